@@ -9,9 +9,11 @@
 #include "flux_kernels.h"
 #include "flux_safetensors.h"
 #include "flux_qwen3.h"
+#include "flux_transformer.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <time.h>
 #include <sys/stat.h>
 
@@ -19,6 +21,9 @@
 #include "flux_metal.h"
 #endif
 
+#define FLUX_MEM_DEFAULT FLUX_MEM_WORK
+#include "flux_mem.h"
+
 /* ========================================================================
  * Forward Declarations for Internal Types
  * ======================================================================== */
@@ -36,16 +41,29 @@ extern int *flux_tokenize(flux_tokenizer *tok, const char *text,
 extern flux_vae_t *flux_vae_load(FILE *f);
 extern flux_vae_t *flux_vae_load_safetensors(safetensors_file_t *sf);
 extern void flux_vae_free(flux_vae_t *vae);
+extern flux_vae_t *flux_vae_fork(const flux_vae_t *vae);
+extern void flux_vae_release_workspace(flux_vae_t *vae);
+extern size_t flux_vae_work_bytes(int width, int height);
 extern float *flux_vae_encode(flux_vae_t *vae, const float *img,
                               int batch, int H, int W, int *out_h, int *out_w);
 extern flux_image *flux_vae_decode(flux_vae_t *vae, const float *latent,
                                    int batch, int latent_h, int latent_w);
+extern float *flux_vae_resize_latent(flux_vae_t *vae, const float *latent,
+                                     int latent_h, int latent_w, int out_h, int out_w);
 extern float *flux_image_to_tensor(const flux_image *img);
+extern float *flux_image_to_tensor_resized(const flux_image *img, int out_w, int out_h);
 
 extern flux_transformer_t *flux_transformer_load(FILE *f);
 extern flux_transformer_t *flux_transformer_load_safetensors(const char *model_dir);
 extern flux_transformer_t *flux_transformer_load_safetensors_mmap(const char *model_dir);
 extern void flux_transformer_free(flux_transformer_t *tf);
+extern flux_transformer_t *flux_transformer_fork(flux_transformer_t *tf);
+extern void flux_transformer_release_workspace(flux_transformer_t *tf);
+extern void flux_transformer_release_work(flux_transformer_t *tf);
+extern void flux_transformer_estimate_memory(const char *model_dir, int use_mmap,
+                                             int total_seq, size_t *weights,
+                                             size_t *mapped, size_t *work,
+                                             size_t *scores);
 extern float *flux_transformer_forward(flux_transformer_t *tf,
                                         const float *img_latent, int img_h, int img_w,
                                         const float *txt_emb, int txt_seq,
@@ -79,35 +97,65 @@ extern float *flux_sample_euler_with_multi_refs(void *transformer, void *text_en
                                                 void (*progress_callback)(int step, int total));
 
 /* CFG sampling (for base model) */
-extern float *flux_sample_euler_cfg(void *transformer, void *text_encoder,
-                                     float *z, int batch, int channels, int h, int w,
-                                     const float *text_emb_cond, int text_seq_cond,
-                                     const float *text_emb_uncond, int text_seq_uncond,
-                                     float guidance_scale,
-                                     const float *schedule, int num_steps,
-                                     void (*progress_callback)(int step, int total));
-extern float *flux_sample_euler_cfg_with_refs(void *transformer, void *text_encoder,
-                                               float *z, int batch, int channels, int h, int w,
-                                               const float *ref_latent, int ref_h, int ref_w,
-                                               int t_offset,
-                                               const float *text_emb_cond, int text_seq_cond,
-                                               const float *text_emb_uncond, int text_seq_uncond,
-                                               float guidance_scale,
-                                               const float *schedule, int num_steps,
-                                               void (*progress_callback)(int step, int total));
-extern float *flux_sample_euler_cfg_with_multi_refs(void *transformer, void *text_encoder,
-                                                     float *z, int batch, int channels, int h, int w,
-                                                     const flux_ref_t *refs, int num_refs,
-                                                     const float *text_emb_cond, int text_seq_cond,
-                                                     const float *text_emb_uncond, int text_seq_uncond,
-                                                     float guidance_scale,
-                                                     const float *schedule, int num_steps,
-                                                     void (*progress_callback)(int step, int total));
+extern float *flux_sample_euler_cfg(void *transformer,
+                                    float *z, int batch, int channels, int h, int w,
+                                    const flux_ref_t *refs, int num_refs,
+                                    const float *text_emb_cond, int text_seq_cond,
+                                    const float *text_emb_uncond, int text_seq_uncond,
+                                    float guidance_scale,
+                                    float cfg_t_min, float cfg_t_max, int cfg_reuse,
+                                    const float *schedule, int num_steps,
+                                    int *out_nfe,
+                                    void (*progress_callback)(int step, int total));
+
+extern float *flux_sample_multistep(void *transformer,
+                                    float *z, int batch, int channels, int h, int w,
+                                    const flux_ref_t *refs, int num_refs,
+                                    const float *text_emb_cond, int text_seq_cond,
+                                    const float *text_emb_uncond, int text_seq_uncond,
+                                    float guidance_scale,
+                                    float cfg_t_min, float cfg_t_max, int cfg_reuse,
+                                    int sampler,
+                                    const float *schedule, int num_steps,
+                                    int *out_nfe,
+                                    void (*progress_callback)(int step, int total));
+
+extern float *flux_sample_adaptive(void *transformer,
+                                   float *z, int batch, int channels, int h, int w,
+                                   const flux_ref_t *refs, int num_refs,
+                                   const float *text_emb_cond, int text_seq_cond,
+                                   const float *text_emb_uncond, int text_seq_uncond,
+                                   float guidance_scale,
+                                   float cfg_t_min, float cfg_t_max, int cfg_reuse,
+                                   float tolerance,
+                                   const float *schedule, int num_steps,
+                                   int *out_steps, int *out_nfe,
+                                   void (*progress_callback)(int step, int total));
+
+extern float *flux_sample_progressive(void *transformer, void *vae,
+                                      int channels, int h, int w, int64_t seed,
+                                      const flux_ref_t *refs, int num_refs,
+                                      const float *text_emb_cond, int text_seq_cond,
+                                      const float *text_emb_uncond, int text_seq_uncond,
+                                      float guidance_scale,
+                                      float cfg_t_min, float cfg_t_max, int cfg_reuse,
+                                      int levels, float t_end, int noise_gen,
+                                      const float *schedule, int num_steps,
+                                      int *out_nfe,
+                                      void (*progress_callback)(int step, int total));
 
 extern float *flux_linear_schedule(int num_steps);
 extern float *flux_power_schedule(int num_steps, float alpha);
 extern float *flux_official_schedule(int num_steps, int image_seq_len);
 extern float *flux_init_noise(int batch, int channels, int h, int w, int64_t seed);
+extern float *flux_init_noise_philox(int batch, int channels, int h, int w, int64_t seed);
+
+/* Initial latent noise from the generator selected by p */
+static float *init_noise(const flux_params *p, int latent_h, int latent_w, int64_t seed) {
+    if (p->noise == FLUX_NOISE_PHILOX)
+        return flux_init_noise_philox(1, FLUX_LATENT_CHANNELS, latent_h, latent_w, seed);
+    return flux_init_noise(1, FLUX_LATENT_CHANNELS, latent_h, latent_w, seed);
+}
 
 /* Return schedule based on params: linear, power, or official shifted sigmoid. */
 static float *flux_selected_schedule(const flux_params *p, int image_seq_len) {
@@ -134,6 +182,7 @@ struct flux_ctx {
     qwen3_encoder_t *qwen3_encoder;
     flux_vae_t *vae;
     flux_transformer_t *transformer;
+    flux_weights *weights;      /* Shared weights the components fork, or NULL */
 
     /* Configuration */
     int max_width;
@@ -144,18 +193,45 @@ struct flux_ctx {
     int text_dim;      /* Text embedding dimension (7680 for 4B, varies for 9B) */
     int is_non_commercial; /* 1 if model has non-commercial license (9B) */
     int num_heads;     /* Transformer attention heads (24 for 4B, 32 for 9B) */
+    size_t vae_weight_bytes;  /* VAE weights as loaded (f32) */
 
     /* Model info */
     char model_name[64];
     char model_version[32];
     char model_dir[512];  /* For reloading text encoder if released */
+    char model_info[256]; /* flux_model_info() result */
 
     /* Memory mode */
     int use_mmap;  /* Use mmap for text encoder (lower memory, slower) */
+    int keep_text_encoder;  /* Keep Qwen3 resident between generations */
+
+    /* Statistics of the last generation */
+    int last_steps;    /* Denoising steps taken */
+    int last_evals;    /* Transformer evaluations (both CFG branches) */
+
+    /* Sampling checkpoints (flux_set_checkpoint_interval) */
+    int ckpt_every;
+    flux_checkpoint **ckpts;
+    int num_ckpts;
+    int ckpt_h, ckpt_w;            /* State of the run being recorded */
+    int ckpt_num_steps;
+    const float *ckpt_schedule;
+    int64_t ckpt_seed;
+    uint64_t ckpt_hash;
 };
 
-/* Global error message */
-static char g_error_msg[256] = {0};
+/* Shared weight store (flux_weights_load, flux_get_weights). The components
+ * here are never run: contexts fork them for private work buffers. */
+struct flux_weights {
+    int refs;
+    qwen3_encoder_t *qwen3_encoder;
+    flux_vae_t *vae;
+    flux_transformer_t *transformer;
+    flux_ctx defaults;          /* Settings for flux_new(); components unset */
+};
+
+/* Error message of the last failed call on this thread */
+static FLUX_THREAD_LOCAL char g_error_msg[256] = {0};
 
 const char *flux_get_error(void) {
     return g_error_msg;
@@ -171,6 +247,15 @@ static void set_error(const char *msg) {
     g_error_msg[sizeof(g_error_msg) - 1] = '\0';
 }
 
+/* A stage returned NULL: abandoned through flux_abort_callback, or failed */
+static void set_stage_error(const char *msg) {
+    set_error(flux_aborted() ? "Cancelled" : msg);
+}
+
+static void set_sampling_error(void) {
+    set_stage_error("Sampling failed");
+}
+
 /* ========================================================================
  * Model Loading from HuggingFace-style directory with safetensors files
  * ======================================================================== */
@@ -263,11 +348,15 @@ flux_ctx *flux_load_dir(const char *model_dir) {
      * to support systems with limited RAM (e.g., 16GB). */
     snprintf(path, sizeof(path), "%s/vae/diffusion_pytorch_model.safetensors", model_dir);
     if (file_exists(path)) {
+        int prev_mem = flux_mem_enter(FLUX_MEM_VAE);
         safetensors_file_t *sf = safetensors_open(path);
         if (sf) {
             ctx->vae = flux_vae_load_safetensors(sf);
+            for (int i = 0; i < sf->num_tensors; i++)
+                ctx->vae_weight_bytes += (size_t)safetensor_numel(&sf->tensors[i]) * sizeof(float);
             safetensors_close(sf);
         }
+        flux_mem_leave(prev_mem);
     }
 
     /* Verify VAE is loaded */
@@ -303,6 +392,11 @@ void flux_free(flux_ctx *ctx) {
     qwen3_encoder_free(ctx->qwen3_encoder);
     flux_vae_free(ctx->vae);
     flux_transformer_free(ctx->transformer);
+    flux_weights_release(ctx->weights);
+
+    for (int i = 0; i < ctx->num_ckpts; i++)
+        flux_checkpoint_free(ctx->ckpts[i]);
+    free(ctx->ckpts);
 
     free(ctx);
 }
@@ -333,22 +427,50 @@ void flux_release_text_encoder(flux_ctx *ctx) {
 
 #ifdef USE_METAL
     /* Reset all GPU state to ensure clean slate for transformer.
-     * This clears weight caches, activation pools, and pending commands. */
-    flux_metal_reset();
+     * This clears weight caches, activation pools, and pending commands.
+     * On shared weights only work buffers were dropped: the weights stay in use. */
+    if (!ctx->weights) flux_metal_reset();
 #endif
 }
 
+void flux_set_keep_text_encoder(flux_ctx *ctx, int keep) {
+    if (ctx) ctx->keep_text_encoder = keep;
+}
+
+/* Whether a kept text encoder still fits next to the transformer within
+ * the memory limit (a container's, say) */
+static int text_encoder_fits(flux_ctx *ctx) {
+    size_t limit = flux_get_host_resources()->memory_limit;
+    flux_memory_estimate est;
+    if (limit == 0 || ctx->weights ||
+        flux_estimate_memory(ctx, NULL, NULL, 0, &est) != 0 ||
+        est.denoise_peak <= limit)
+        return 1;
+    if (flux_verbose)
+        fprintf(stderr, "Releasing text encoder: keeping it needs ~%.1f GB, "
+                "over the %.1f GB memory limit\n", est.denoise_peak / 1e9, limit / 1e9);
+    return 0;
+}
+
+/* Generation paths call this once their prompts are encoded */
+static void text_encoding_done(flux_ctx *ctx) {
+    if (!ctx->keep_text_encoder || !text_encoder_fits(ctx))
+        flux_release_text_encoder(ctx);
+}
+
 /* Load transformer on-demand if not already loaded */
 static int flux_load_transformer_if_needed(flux_ctx *ctx) {
     if (ctx->transformer) return 1;  /* Already loaded */
 
-    if (flux_phase_callback) flux_phase_callback("Loading FLUX.2 transformer", 0);
+    flux_phase_begin("Loading FLUX.2 transformer");
+    int prev_mem = flux_mem_enter(FLUX_MEM_TRANSFORMER_WEIGHTS);
     if (ctx->use_mmap) {
         ctx->transformer = flux_transformer_load_safetensors_mmap(ctx->model_dir);
     } else {
         ctx->transformer = flux_transformer_load_safetensors(ctx->model_dir);
     }
-    if (flux_phase_callback) flux_phase_callback("Loading FLUX.2 transformer", 1);
+    flux_mem_leave(prev_mem);
+    flux_phase_end("Loading FLUX.2 transformer");
 
     if (!ctx->transformer) {
         set_error("Failed to load transformer");
@@ -366,22 +488,33 @@ void *flux_get_transformer(flux_ctx *ctx) {
  * Text Encoding
  * ======================================================================== */
 
+/* Load encoder if not already loaded; contexts on shared weights fork it */
+static void load_text_encoder_if_needed(flux_ctx *ctx) {
+    if (ctx->qwen3_encoder) return;
+    if (ctx->weights) {
+        if (ctx->weights->qwen3_encoder)
+            ctx->qwen3_encoder = qwen3_encoder_fork(ctx->weights->qwen3_encoder);
+        return;
+    }
+    if (!ctx->model_dir[0]) return;
+
+    flux_phase_begin("Loading Qwen3 encoder");
+    int prev_mem = flux_mem_enter(FLUX_MEM_QWEN3);
+    ctx->qwen3_encoder = qwen3_encoder_load(ctx->model_dir, ctx->use_mmap);
+    flux_mem_leave(prev_mem);
+    flux_phase_end("Loading Qwen3 encoder");
+    if (!ctx->qwen3_encoder) {
+        fprintf(stderr, "Warning: Failed to load Qwen3 text encoder\n");
+    }
+}
+
 float *flux_encode_text(flux_ctx *ctx, const char *prompt, int *out_seq_len) {
     if (!ctx || !prompt) {
         *out_seq_len = 0;
         return NULL;
     }
 
-    /* Load encoder if not already loaded */
-    if (!ctx->qwen3_encoder && ctx->model_dir[0]) {
-        if (flux_phase_callback) flux_phase_callback("Loading Qwen3 encoder", 0);
-        ctx->qwen3_encoder = qwen3_encoder_load(ctx->model_dir, ctx->use_mmap);
-        if (flux_phase_callback) flux_phase_callback("Loading Qwen3 encoder", 1);
-        if (!ctx->qwen3_encoder) {
-            fprintf(stderr, "Warning: Failed to load Qwen3 text encoder\n");
-        }
-    }
-
+    load_text_encoder_if_needed(ctx);
     if (!ctx->qwen3_encoder) {
         /* Return zero embeddings if encoder not available */
         *out_seq_len = QWEN3_MAX_SEQ_LEN;
@@ -389,18 +522,414 @@ float *flux_encode_text(flux_ctx *ctx, const char *prompt, int *out_seq_len) {
     }
 
     /* Encode text using Qwen3 */
-    if (flux_phase_callback) flux_phase_callback("encoding text", 0);
+    flux_phase_begin("encoding text");
+    int prev_mem = flux_mem_enter(FLUX_MEM_QWEN3);
     float *embeddings = qwen3_encode_text(ctx->qwen3_encoder, prompt);
-    if (flux_phase_callback) flux_phase_callback("encoding text", 1);
+    flux_mem_leave(prev_mem);
+    flux_phase_end("encoding text");
+
+    /* Abandoned or failed: leave the encoder as a finished encode would */
+    if (!embeddings) text_encoding_done(ctx);
 
     *out_seq_len = QWEN3_MAX_SEQ_LEN;  /* Always 512 */
     return embeddings;
 }
 
+/* ========================================================================
+ * Shared Weights and Context Forks
+ * ======================================================================== */
+
+flux_weights *flux_weights_retain(flux_weights *w) {
+    if (w) __atomic_add_fetch(&w->refs, 1, __ATOMIC_RELAXED);
+    return w;
+}
+
+void flux_weights_release(flux_weights *w) {
+    if (!w || __atomic_sub_fetch(&w->refs, 1, __ATOMIC_ACQ_REL) > 0) return;
+    qwen3_encoder_free(w->qwen3_encoder);
+    flux_vae_free(w->vae);
+    flux_transformer_free(w->transformer);
+    free(w);
+}
+
+/* Clear what a copied context must not share with its source */
+static void clear_private_state(flux_ctx *ctx) {
+    ctx->tokenizer = NULL;
+    ctx->qwen3_encoder = NULL;
+    ctx->vae = NULL;
+    ctx->transformer = NULL;
+    ctx->weights = NULL;
+    ctx->last_steps = ctx->last_evals = 0;
+    ctx->ckpt_every = 0;
+    ctx->ckpts = NULL;
+    ctx->num_ckpts = 0;
+    ctx->ckpt_schedule = NULL;
+}
+
+/* Point ctx at w with private forks of its components; ctx takes a reference */
+static int attach_weights(flux_ctx *ctx, flux_weights *w) {
+    ctx->weights = flux_weights_retain(w);
+    ctx->qwen3_encoder = w->qwen3_encoder ? qwen3_encoder_fork(w->qwen3_encoder) : NULL;
+    ctx->vae = w->vae ? flux_vae_fork(w->vae) : NULL;
+    ctx->transformer = flux_transformer_fork(w->transformer);
+    if ((w->qwen3_encoder && !ctx->qwen3_encoder) || (w->vae && !ctx->vae) ||
+        !ctx->transformer) {
+        set_error("Out of memory");
+        return 0;
+    }
+    return 1;
+}
+
+flux_weights *flux_get_weights(flux_ctx *ctx) {
+    if (!ctx) return NULL;
+    if (ctx->weights) return flux_weights_retain(ctx->weights);
+
+    /* The store never loads anything later: load everything up front */
+    load_text_encoder_if_needed(ctx);
+    if (!flux_load_transformer_if_needed(ctx)) return NULL;
+
+    flux_weights *w = (flux_weights *)calloc(1, sizeof(flux_weights));
+    if (!w) {
+        set_error("Out of memory");
+        return NULL;
+    }
+    w->refs = 1;
+    w->qwen3_encoder = ctx->qwen3_encoder;
+    w->vae = ctx->vae;
+    w->transformer = ctx->transformer;
+    qwen3_encoder_release_workspace(w->qwen3_encoder);
+    flux_vae_release_workspace(w->vae);
+    flux_transformer_release_workspace(w->transformer);
+
+    w->defaults = *ctx;
+    clear_private_state(&w->defaults);
+
+    /* ctx itself now runs on forks of the moved components */
+    ctx->qwen3_encoder = NULL;
+    ctx->vae = NULL;
+    ctx->transformer = NULL;
+    if (!attach_weights(ctx, w)) {
+        flux_weights_release(w);
+        return NULL;
+    }
+    return w;
+}
+
+flux_weights *flux_weights_load(const char *model_dir, int use_mmap) {
+    flux_ctx *ctx = flux_load_dir(model_dir);
+    if (!ctx) return NULL;
+    ctx->use_mmap = use_mmap;
+    flux_weights *w = flux_get_weights(ctx);
+    flux_free(ctx);
+    return w;
+}
+
+flux_ctx *flux_new(flux_weights *w) {
+    if (!w) return NULL;
+    flux_ctx *ctx = (flux_ctx *)malloc(sizeof(flux_ctx));
+    if (!ctx) {
+        set_error("Out of memory");
+        return NULL;
+    }
+    *ctx = w->defaults;
+    if (!attach_weights(ctx, w)) {
+        flux_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+
+flux_ctx *flux_fork(flux_ctx *ctx) {
+    if (!ctx) return NULL;
+    flux_weights *w = flux_get_weights(ctx);
+    if (!w) return NULL;
+
+    flux_ctx *fork = (flux_ctx *)malloc(sizeof(flux_ctx));
+    if (!fork) {
+        flux_weights_release(w);
+        set_error("Out of memory");
+        return NULL;
+    }
+    *fork = *ctx;
+    clear_private_state(fork);
+    int ok = attach_weights(fork, w);
+    flux_weights_release(w);
+    if (!ok) {
+        flux_free(fork);
+        return NULL;
+    }
+    return fork;
+}
+
+/* ========================================================================
+ * Sampling Checkpoints
+ * ======================================================================== */
+
+#define CHECKPOINT_MAGIC    "FLXCKPT2"
+
+/* Context recording checkpoints: the step latent callback has no user data */
+static FLUX_THREAD_LOCAL flux_ctx *g_ckpt_ctx = NULL;
+
+/* FNV-1a over the model name and the prompt text. The prompt, not its
+ * embedding: the encoder's output can differ in the last bits between
+ * backends and thread counts, which must not stop a resume. */
+static uint64_t cond_hash(const flux_ctx *ctx, const char *prompt) {
+    const char *parts[2] = {ctx->model_name, prompt};
+    uint64_t h = 1469598103934665603ULL;
+    for (int p = 0; p < 2; p++) {
+        const unsigned char *b = (const unsigned char *)parts[p];
+        do {    /* Including the terminator, as a separator */
+            h ^= *b;
+            h *= 1099511628211ULL;
+        } while (*b++);
+    }
+    return h;
+}
+
+static void checkpoint_record(int step, int total, float t,
+                              const float *latent, int h, int w) {
+    flux_ctx *ctx = g_ckpt_ctx;
+    if (!ctx) return;
+    /* Progressive sampling: only full-size latents can be resumed */
+    if (h != ctx->ckpt_h || w != ctx->ckpt_w) return;
+    if (step % ctx->ckpt_every != 0 && step < total) return;
+
+    flux_checkpoint *ck = (flux_checkpoint *)calloc(1, sizeof(flux_checkpoint));
+    size_t latent_size = (size_t)FLUX_LATENT_CHANNELS * h * w;
+    ck->latent_h = h;
+    ck->latent_w = w;
+    ck->step = step;
+    ck->num_steps = ctx->ckpt_num_steps;
+    ck->t = t;
+    ck->seed = ctx->ckpt_seed;
+    ck->cond_hash = ctx->ckpt_hash;
+    ck->schedule = (float *)malloc((ck->num_steps + 1) * sizeof(float));
+    memcpy(ck->schedule, ctx->ckpt_schedule, (ck->num_steps + 1) * sizeof(float));
+    ck->latent = (float *)malloc(latent_size * sizeof(float));
+    memcpy(ck->latent, latent, latent_size * sizeof(float));
+
+    ctx->ckpts = (flux_checkpoint **)realloc(ctx->ckpts,
+                                             (ctx->num_ckpts + 1) * sizeof(flux_checkpoint *));
+    ctx->ckpts[ctx->num_ckpts++] = ck;
+}
+
+/* Drop the previous run's checkpoints and start recording a new run */
+static void checkpoint_begin(flux_ctx *ctx, int latent_h, int latent_w,
+                             const float *schedule, int num_steps, int64_t seed,
+                             const char *prompt) {
+    for (int i = 0; i < ctx->num_ckpts; i++)
+        flux_checkpoint_free(ctx->ckpts[i]);
+    free(ctx->ckpts);
+    ctx->ckpts = NULL;
+    ctx->num_ckpts = 0;
+    if (ctx->ckpt_every <= 0) return;
+
+    ctx->ckpt_h = latent_h;
+    ctx->ckpt_w = latent_w;
+    ctx->ckpt_schedule = schedule;
+    ctx->ckpt_num_steps = num_steps;
+    ctx->ckpt_seed = seed;
+    ctx->ckpt_hash = cond_hash(ctx, prompt);
+    g_ckpt_ctx = ctx;
+    flux_step_latent_callback = checkpoint_record;
+}
+
+static void checkpoint_end(void) {
+    g_ckpt_ctx = NULL;
+    flux_step_latent_callback = NULL;
+}
+
+void flux_set_checkpoint_interval(flux_ctx *ctx, int every) {
+    if (ctx) ctx->ckpt_every = every > 0 ? every : 0;
+}
+
+int flux_checkpoint_count(flux_ctx *ctx) {
+    return ctx ? ctx->num_ckpts : 0;
+}
+
+const flux_checkpoint *flux_get_checkpoint(flux_ctx *ctx, int index) {
+    if (!ctx || ctx->num_ckpts == 0) return NULL;
+    if (index < 0) index = ctx->num_ckpts - 1;
+    if (index >= ctx->num_ckpts) return NULL;
+    return ctx->ckpts[index];
+}
+
+void flux_checkpoint_free(flux_checkpoint *ck) {
+    if (!ck) return;
+    free(ck->schedule);
+    free(ck->latent);
+    free(ck);
+}
+
+/*
+ * File layout (native byte order):
+ *   char[8] magic, int32 latent_h, latent_w, step, num_steps,
+ *   float32 t, int64 seed, uint64 cond_hash,
+ *   float32 schedule[num_steps + 1], float32 latent[128 * latent_h * latent_w]
+ */
+int flux_checkpoint_save(const flux_checkpoint *ck, const char *path) {
+    if (!ck || !path) return -1;
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+
+    int32_t dims[4] = { ck->latent_h, ck->latent_w, ck->step, ck->num_steps };
+    size_t latent_size = (size_t)FLUX_LATENT_CHANNELS * ck->latent_h * ck->latent_w;
+    int ok = fwrite(CHECKPOINT_MAGIC, 1, 8, f) == 8 &&
+             fwrite(dims, sizeof(dims), 1, f) == 1 &&
+             fwrite(&ck->t, sizeof(float), 1, f) == 1 &&
+             fwrite(&ck->seed, sizeof(int64_t), 1, f) == 1 &&
+             fwrite(&ck->cond_hash, sizeof(uint64_t), 1, f) == 1 &&
+             fwrite(ck->schedule, sizeof(float), ck->num_steps + 1, f) ==
+                 (size_t)ck->num_steps + 1 &&
+             fwrite(ck->latent, sizeof(float), latent_size, f) == latent_size;
+    if (fclose(f) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+flux_checkpoint *flux_checkpoint_load(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        set_error("Cannot open checkpoint file");
+        return NULL;
+    }
+
+    char magic[8];
+    int32_t dims[4];
+    flux_checkpoint *ck = (flux_checkpoint *)calloc(1, sizeof(flux_checkpoint));
+    if (fread(magic, 1, 8, f) != 8 || memcmp(magic, CHECKPOINT_MAGIC, 8) != 0 ||
+        fread(dims, sizeof(dims), 1, f) != 1 ||
+        fread(&ck->t, sizeof(float), 1, f) != 1 ||
+        fread(&ck->seed, sizeof(int64_t), 1, f) != 1 ||
+        fread(&ck->cond_hash, sizeof(uint64_t), 1, f) != 1 ||
+        dims[0] <= 0 || dims[1] <= 0 ||
+        dims[0] > FLUX_VAE_MAX_DIM / 16 || dims[1] > FLUX_VAE_MAX_DIM / 16 ||
+        dims[3] < 0 || dims[3] > FLUX_MAX_STEPS || dims[2] < 0 || dims[2] > dims[3]) {
+        fclose(f);
+        free(ck);
+        set_error("Invalid checkpoint file");
+        return NULL;
+    }
+    ck->latent_h = dims[0];
+    ck->latent_w = dims[1];
+    ck->step = dims[2];
+    ck->num_steps = dims[3];
+
+    size_t latent_size = (size_t)FLUX_LATENT_CHANNELS * ck->latent_h * ck->latent_w;
+    ck->schedule = (float *)malloc((ck->num_steps + 1) * sizeof(float));
+    ck->latent = (float *)malloc(latent_size * sizeof(float));
+    if (fread(ck->schedule, sizeof(float), ck->num_steps + 1, f) != (size_t)ck->num_steps + 1 ||
+        fread(ck->latent, sizeof(float), latent_size, f) != latent_size) {
+        fclose(f);
+        flux_checkpoint_free(ck);
+        set_error("Truncated checkpoint file");
+        return NULL;
+    }
+    fclose(f);
+    return ck;
+}
+
 /* ========================================================================
  * Image Generation
  * ======================================================================== */
 
+/* Decode a final latent; NULL with the error set if abandoned or failed */
+static flux_image *decode_image(flux_ctx *ctx, const float *latent,
+                                int latent_h, int latent_w) {
+    flux_phase_begin("decoding image");
+    flux_image *img = flux_vae_decode(ctx->vae, latent, 1, latent_h, latent_w);
+    flux_phase_end("decoding image");
+    if (!img) set_stage_error("Failed to decode image");
+    return img;
+}
+
+/*
+ * Run the sampler selected by p from initial noise z, with optional
+ * reference latents and CFG (text_emb_uncond != NULL). Records the number
+ * of steps and transformer evaluations in ctx.
+ */
+static float *run_sampler(flux_ctx *ctx, const flux_params *p, float *z,
+                          int latent_h, int latent_w,
+                          const flux_ref_t *refs, int num_refs,
+                          const float *text_emb, int text_seq,
+                          const float *text_emb_uncond, int text_seq_uncond,
+                          float guidance, const float *schedule) {
+    float *latent;
+    int steps = p->num_steps;
+    int evals = p->num_steps;
+
+    if (p->sampler == FLUX_SAMPLER_ADAPTIVE) {
+        float tol = (p->tolerance > 0) ? p->tolerance : FLUX_DEFAULT_TOLERANCE;
+        latent = flux_sample_adaptive(
+            ctx->transformer,
+            z, 1, FLUX_LATENT_CHANNELS, latent_h, latent_w,
+            refs, num_refs,
+            text_emb, text_seq,
+            text_emb_uncond, text_seq_uncond,
+            guidance, p->cfg_t_min, p->cfg_t_max, p->cfg_reuse,
+            tol,
+            schedule, p->num_steps,
+            &steps, &evals,
+            NULL
+        );
+    } else if (p->sampler != FLUX_SAMPLER_EULER) {
+        latent = flux_sample_multistep(
+            ctx->transformer,
+            z, 1, FLUX_LATENT_CHANNELS, latent_h, latent_w,
+            refs, num_refs,
+            text_emb, text_seq,
+            text_emb_uncond, text_seq_uncond,
+            guidance, p->cfg_t_min, p->cfg_t_max, p->cfg_reuse,
+            p->sampler,
+            schedule, p->num_steps,
+            &evals,
+            NULL
+        );
+    } else if (text_emb_uncond) {
+        latent = flux_sample_euler_cfg(
+            ctx->transformer,
+            z, 1, FLUX_LATENT_CHANNELS, latent_h, latent_w,
+            refs, num_refs,
+            text_emb, text_seq,
+            text_emb_uncond, text_seq_uncond,
+            guidance, p->cfg_t_min, p->cfg_t_max, p->cfg_reuse,
+            schedule, p->num_steps,
+            &evals,
+            NULL
+        );
+    } else if (num_refs == 0) {
+        latent = flux_sample_euler(
+            ctx->transformer, ctx->qwen3_encoder,
+            z, 1, FLUX_LATENT_CHANNELS, latent_h, latent_w,
+            text_emb, text_seq,
+            schedule, p->num_steps,
+            NULL
+        );
+    } else if (num_refs == 1) {
+        latent = flux_sample_euler_with_refs(
+            ctx->transformer, ctx->qwen3_encoder,
+            z, 1, FLUX_LATENT_CHANNELS, latent_h, latent_w,
+            refs[0].latent, refs[0].h, refs[0].w,
+            refs[0].t_offset,
+            text_emb, text_seq,
+            schedule, p->num_steps,
+            NULL
+        );
+    } else {
+        latent = flux_sample_euler_with_multi_refs(
+            ctx->transformer, ctx->qwen3_encoder,
+            z, 1, FLUX_LATENT_CHANNELS, latent_h, latent_w,
+            refs, num_refs,
+            text_emb, text_seq,
+            schedule, p->num_steps,
+            NULL
+        );
+    }
+
+    ctx->last_steps = steps;
+    ctx->last_evals = evals;
+    return latent;
+}
+
 flux_image *flux_generate(flux_ctx *ctx, const char *prompt,
                           const flux_params *params) {
     if (!ctx || !prompt) {
@@ -431,12 +960,16 @@ flux_image *flux_generate(flux_ctx *ctx, const char *prompt,
         set_error("Image dimensions exceed maximum (1792x1792)");
         return NULL;
     }
+    if (p.prog_levels > 0 && p.sampler != FLUX_SAMPLER_EULER) {
+        set_error("Progressive resolution requires the Euler sampler");
+        return NULL;
+    }
 
     /* Encode text (and unconditioned text for CFG in base model) */
     int text_seq;
     float *text_emb = flux_encode_text(ctx, prompt, &text_seq);
     if (!text_emb) {
-        set_error("Failed to encode prompt");
+        set_stage_error("Failed to encode prompt");
         return NULL;
     }
 
@@ -446,13 +979,13 @@ flux_image *flux_generate(flux_ctx *ctx, const char *prompt,
         text_emb_uncond = flux_encode_text(ctx, "", &text_seq_uncond);
         if (!text_emb_uncond) {
             free(text_emb);
-            set_error("Failed to encode empty prompt for CFG");
+            set_stage_error("Failed to encode empty prompt for CFG");
             return NULL;
         }
     }
 
     /* Release text encoder to free ~8GB before loading transformer */
-    flux_release_text_encoder(ctx);
+    text_encoding_done(ctx);
 
     /* Load transformer now (after text encoder is freed to reduce peak memory) */
     if (!flux_load_transformer_if_needed(ctx)) {
@@ -466,55 +999,563 @@ flux_image *flux_generate(flux_ctx *ctx, const char *prompt,
     int latent_w = p.width / 16;
     int image_seq_len = latent_h * latent_w;
 
-    /* Initialize noise */
     int64_t seed = (p.seed < 0) ? (int64_t)time(NULL) : p.seed;
-    float *z = flux_init_noise(1, FLUX_LATENT_CHANNELS, latent_h, latent_w, seed);
 
     /* Get schedule */
     float *schedule = flux_selected_schedule(&p, image_seq_len);
 
     /* Sample */
     float *latent;
-    if (ctx->is_distilled) {
-        latent = flux_sample_euler(
-            ctx->transformer, ctx->qwen3_encoder,
-            z, 1, FLUX_LATENT_CHANNELS, latent_h, latent_w,
-            text_emb, text_seq,
-            schedule, p.num_steps,
-            NULL
-        );
-    } else {
-        latent = flux_sample_euler_cfg(
-            ctx->transformer, ctx->qwen3_encoder,
-            z, 1, FLUX_LATENT_CHANNELS, latent_h, latent_w,
+    checkpoint_begin(ctx, latent_h, latent_w, schedule, p.num_steps, seed, prompt);
+    if (p.prog_levels > 0) {
+        /* Progressive resolution draws its own noise at each level */
+        float t_end = (p.prog_t_end > 0) ? p.prog_t_end : FLUX_DEFAULT_PROG_T_END;
+        int evals = p.num_steps;
+        latent = flux_sample_progressive(
+            ctx->transformer, ctx->vae,
+            FLUX_LATENT_CHANNELS, latent_h, latent_w, seed,
+            NULL, 0,
             text_emb, text_seq,
             text_emb_uncond, text_seq_uncond,
-            guidance,
+            guidance, p.cfg_t_min, p.cfg_t_max, p.cfg_reuse,
+            p.prog_levels, t_end, p.noise,
             schedule, p.num_steps,
+            &evals,
             NULL
         );
+        ctx->last_steps = p.num_steps;
+        ctx->last_evals = evals;
+    } else {
+        float *z = init_noise(&p, latent_h, latent_w, seed);
+        latent = run_sampler(ctx, &p, z, latent_h, latent_w, NULL, 0,
+                             text_emb, text_seq,
+                             text_emb_uncond, text_seq_uncond,
+                             guidance, schedule);
+        free(z);
+    }
+    checkpoint_end();
+
+    free(schedule);
+    free(text_emb);
+    free(text_emb_uncond);
+
+    if (!latent) {
+        set_sampling_error();
+        return NULL;
+    }
+
+    /* Decode latent to image */
+    flux_image *img = NULL;
+    if (ctx->vae) {
+        img = decode_image(ctx, latent, latent_h, latent_w);
+    }
+
+    free(latent);
+
+    return img;
+}
+
+/* ========================================================================
+ * Two-Pass Hi-Res Generation
+ * ======================================================================== */
+
+#define HIRES_DEFAULT_SCALE     0.5f
+#define HIRES_DEFAULT_DENOISE   0.6f
+
+flux_image *flux_generate_hires(flux_ctx *ctx, const char *prompt,
+                                const flux_params *params,
+                                float base_scale, float denoise, int hires_steps) {
+    if (!ctx || !prompt) {
+        set_error("Invalid context or prompt");
+        return NULL;
+    }
+
+    flux_params p;
+    if (params) {
+        p = *params;
+    } else {
+        p = (flux_params)FLUX_PARAMS_DEFAULT;
     }
 
-    free(z);
-    free(schedule);
-    free(text_emb);
-    free(text_emb_uncond);
+    /* Validate dimensions */
+    if (p.width <= 0) p.width = FLUX_DEFAULT_WIDTH;
+    if (p.height <= 0) p.height = FLUX_DEFAULT_HEIGHT;
+    if (p.num_steps <= 0) p.num_steps = ctx->default_steps;
+    float guidance = (p.guidance > 0) ? p.guidance : ctx->default_guidance;
+
+    p.width = (p.width / 16) * 16;
+    p.height = (p.height / 16) * 16;
+    if (p.width < 64) p.width = 64;
+    if (p.height < 64) p.height = 64;
+    if (p.width > FLUX_VAE_MAX_DIM || p.height > FLUX_VAE_MAX_DIM) {
+        set_error("Image dimensions exceed maximum (1792x1792)");
+        return NULL;
+    }
+
+    if (base_scale <= 0 || base_scale > 1) base_scale = HIRES_DEFAULT_SCALE;
+    if (denoise <= 0 || denoise > 1) denoise = HIRES_DEFAULT_DENOISE;
+    if (hires_steps <= 0) hires_steps = (int)(p.num_steps * denoise + 0.5f);
+    if (hires_steps < 1) hires_steps = 1;
+
+    /* First pass size, rounded to the 16px latent grid */
+    int base_w = (int)(p.width * base_scale / 16 + 0.5f) * 16;
+    int base_h = (int)(p.height * base_scale / 16 + 0.5f) * 16;
+    if (base_w < 64) base_w = 64;
+    if (base_h < 64) base_h = 64;
+    if (base_w > p.width) base_w = p.width;
+    if (base_h > p.height) base_h = p.height;
+
+    /* Encode text (and unconditioned text for CFG in base model) */
+    int text_seq;
+    float *text_emb = flux_encode_text(ctx, prompt, &text_seq);
+    if (!text_emb) {
+        set_stage_error("Failed to encode prompt");
+        return NULL;
+    }
+
+    float *text_emb_uncond = NULL;
+    int text_seq_uncond = 0;
+    if (!ctx->is_distilled) {
+        text_emb_uncond = flux_encode_text(ctx, "", &text_seq_uncond);
+        if (!text_emb_uncond) {
+            free(text_emb);
+            set_stage_error("Failed to encode empty prompt for CFG");
+            return NULL;
+        }
+    }
+
+    text_encoding_done(ctx);
+
+    if (!flux_load_transformer_if_needed(ctx)) {
+        free(text_emb);
+        free(text_emb_uncond);
+        return NULL;
+    }
+
+    int64_t seed = (p.seed < 0) ? (int64_t)time(NULL) : p.seed;
+
+    /* Pass 1: full schedule at the base size */
+    int base_lat_h = base_h / 16;
+    int base_lat_w = base_w / 16;
+    float *z = init_noise(&p, base_lat_h, base_lat_w, seed);
+    float *schedule = flux_selected_schedule(&p, base_lat_h * base_lat_w);
+    float *base_latent = run_sampler(ctx, &p, z, base_lat_h, base_lat_w, NULL, 0,
+                                     text_emb, text_seq,
+                                     text_emb_uncond, text_seq_uncond,
+                                     guidance, schedule);
+    int base_steps = ctx->last_steps, base_evals = ctx->last_evals;
+    free(z);
+    free(schedule);
+
+    if (!base_latent) {
+        free(text_emb);
+        free(text_emb_uncond);
+        set_sampling_error();
+        return NULL;
+    }
+
+    /* Upsample the latent to the target size */
+    int latent_h = p.height / 16;
+    int latent_w = p.width / 16;
+    flux_phase_begin("upscaling latent");
+    float *up = flux_vae_resize_latent(ctx->vae, base_latent,
+                                       base_lat_h, base_lat_w, latent_h, latent_w);
+    flux_phase_end("upscaling latent");
+    free(base_latent);
+    if (!up) {
+        free(text_emb);
+        free(text_emb_uncond);
+        set_error("Failed to upscale latent");
+        return NULL;
+    }
+
+    /*
+     * Pass 2: the tail at or below `denoise` of a full-size schedule. The
+     * shifted schedules spend fewer than denoise * num_steps steps there,
+     * so num_steps grows until the tail has hires_steps steps (or hits
+     * FLUX_MAX_STEPS). The latent is re-noised to exactly the tail's first
+     * timestep with init_noise() and the pass 1 seed. Both generators
+     * subsample one 112x112 master grid below 1792x1792, so this noise is
+     * aligned with pass 1's; at 1792x1792 it is drawn directly and is not.
+     */
+    flux_params p2 = p;
+    float *full = NULL;
+    int first = 0;
+    p2.num_steps = (int)ceilf(hires_steps / denoise);
+    if (p2.num_steps > FLUX_MAX_STEPS) p2.num_steps = FLUX_MAX_STEPS;
+    for (;;) {
+        full = flux_selected_schedule(&p2, latent_h * latent_w);
+        first = 0;
+        while (first < p2.num_steps - 1 && full[first] > denoise) first++;
+        if (p2.num_steps - first >= hires_steps || p2.num_steps >= FLUX_MAX_STEPS) break;
+        free(full);
+        p2.num_steps++;
+    }
+    p2.num_steps -= first;
+    float t_start = full[first];
+
+    float *noise = init_noise(&p, latent_h, latent_w, seed);
+    int latent_size = FLUX_LATENT_CHANNELS * latent_h * latent_w;
+    for (int i = 0; i < latent_size; i++)
+        up[i] = (1.0f - t_start) * up[i] + t_start * noise[i];
+    free(noise);
+
+    float *latent = run_sampler(ctx, &p2, up, latent_h, latent_w, NULL, 0,
+                                text_emb, text_seq,
+                                text_emb_uncond, text_seq_uncond,
+                                guidance, full + first);
+    ctx->last_steps += base_steps;
+    ctx->last_evals += base_evals;
+
+    free(up);
+    free(full);
+    free(text_emb);
+    free(text_emb_uncond);
+
+    if (!latent) {
+        set_sampling_error();
+        return NULL;
+    }
+
+    if (flux_verbose) {
+        fprintf(stderr, "Hi-res: %dx%d base pass, %d steps at %dx%d from t=%.3f\n",
+                base_w, base_h, p2.num_steps, p.width, p.height, t_start);
+    }
+
+    flux_image *img = NULL;
+    if (ctx->vae) {
+        img = decode_image(ctx, latent, latent_h, latent_w);
+    }
+
+    free(latent);
+    return img;
+}
+
+/* ========================================================================
+ * Variation Fan-out
+ * ======================================================================== */
+
+#define VARIATION_DEFAULT_STRENGTH  0.5f
+
+/*
+ * The first shared_steps steps run once; each branch then swaps part of
+ * the noise component of the shared latent for fresh noise and finishes
+ * the schedule on its own. On a rectified-flow trajectory
+ *   z_t = (1 - t) * x0 + t * eps
+ * and the initial latent is eps, so with strength s the branch latent is
+ *   z_t + t * (sqrt(1 - s^2) - 1) * eps + t * s * n_i
+ * which keeps the noise level at t while decorrelating the branches
+ * (exact for straight trajectories, close otherwise). Branch noise n_i
+ * comes from the initial noise generator with seed + 1 + i.
+ */
+int flux_generate_variations(flux_ctx *ctx, const char *prompt,
+                             const flux_params *params,
+                             int count, int shared_steps, float strength,
+                             flux_image **out_images, int *out_saved_evals) {
+    if (out_saved_evals) *out_saved_evals = 0;
+    if (!ctx || !prompt || !out_images || count < 1) {
+        set_error("Invalid context, prompt or variation count");
+        return -1;
+    }
+
+    flux_params p;
+    if (params) {
+        p = *params;
+    } else {
+        p = (flux_params)FLUX_PARAMS_DEFAULT;
+    }
+
+    /* Validate dimensions */
+    if (p.width <= 0) p.width = FLUX_DEFAULT_WIDTH;
+    if (p.height <= 0) p.height = FLUX_DEFAULT_HEIGHT;
+    if (p.num_steps <= 0) p.num_steps = ctx->default_steps;
+    float guidance = (p.guidance > 0) ? p.guidance : ctx->default_guidance;
+
+    p.width = (p.width / 16) * 16;
+    p.height = (p.height / 16) * 16;
+    if (p.width < 64) p.width = 64;
+    if (p.height < 64) p.height = 64;
+    if (p.width > FLUX_VAE_MAX_DIM || p.height > FLUX_VAE_MAX_DIM) {
+        set_error("Image dimensions exceed maximum (1792x1792)");
+        return -1;
+    }
+
+    /* The branches share one full-size latent, there is no level to resume at */
+    if (p.prog_levels > 0) {
+        set_error("Variations do not support progressive resolution");
+        return -1;
+    }
+
+    /* The adaptive sampler always integrates to t=0, it cannot stop early */
+    if (p.sampler == FLUX_SAMPLER_ADAPTIVE) p.sampler = FLUX_SAMPLER_EULER;
+    if (shared_steps <= 0) shared_steps = p.num_steps / 4;
+    if (shared_steps < 1) shared_steps = 1;
+    if (shared_steps > p.num_steps - 1) shared_steps = p.num_steps - 1;
+    if (strength <= 0 || strength > 1) strength = VARIATION_DEFAULT_STRENGTH;
+
+    /* Encode text (and unconditioned text for CFG in base model) */
+    int text_seq;
+    float *text_emb = flux_encode_text(ctx, prompt, &text_seq);
+    if (!text_emb) {
+        set_stage_error("Failed to encode prompt");
+        return -1;
+    }
+
+    float *text_emb_uncond = NULL;
+    int text_seq_uncond = 0;
+    if (!ctx->is_distilled) {
+        text_emb_uncond = flux_encode_text(ctx, "", &text_seq_uncond);
+        if (!text_emb_uncond) {
+            free(text_emb);
+            set_stage_error("Failed to encode empty prompt for CFG");
+            return -1;
+        }
+    }
+
+    text_encoding_done(ctx);
+
+    if (!flux_load_transformer_if_needed(ctx)) {
+        free(text_emb);
+        free(text_emb_uncond);
+        return -1;
+    }
+
+    int latent_h = p.height / 16;
+    int latent_w = p.width / 16;
+    int latent_size = FLUX_LATENT_CHANNELS * latent_h * latent_w;
+    int64_t seed = (p.seed < 0) ? (int64_t)time(NULL) : p.seed;
+    float *z = init_noise(&p, latent_h, latent_w, seed);
+    float *schedule = flux_selected_schedule(&p, latent_h * latent_w);
+    float *branch = (float *)malloc(latent_size * sizeof(float));
+    if (!z || !schedule || !branch) {
+        free(z);
+        free(schedule);
+        free(branch);
+        free(text_emb);
+        free(text_emb_uncond);
+        set_error("Out of memory");
+        return -1;
+    }
+
+    /* Shared prefix (skipped when there is nothing to share) */
+    float *shared = NULL;
+    int prefix_steps = 0, prefix_evals = 0;
+    if (p.num_steps > 1 && count > 1) {
+        flux_params pre = p;
+        pre.num_steps = shared_steps;
+        shared = run_sampler(ctx, &pre, z, latent_h, latent_w, NULL, 0,
+                             text_emb, text_seq,
+                             text_emb_uncond, text_seq_uncond,
+                             guidance, schedule);
+        if (!shared) {
+            free(z);
+            free(schedule);
+            free(branch);
+            free(text_emb);
+            free(text_emb_uncond);
+            set_sampling_error();
+            return -1;
+        }
+        prefix_steps = ctx->last_steps;
+        prefix_evals = ctx->last_evals;
+    }
+
+    flux_params tail = p;
+    float t_branch = 1.0f;
+    if (shared) {
+        tail.num_steps = p.num_steps - shared_steps;
+        t_branch = schedule[shared_steps];
+    }
+    float keep = sqrtf(1.0f - strength * strength) - 1.0f;
+
+    int total_steps = prefix_steps, total_evals = prefix_evals;
+    int n_done = 0;
+    for (int i = 0; i < count; i++) {
+        const float *z_start = z;
+        if (shared) {
+            float *noise = init_noise(&p, latent_h, latent_w, seed + 1 + i);
+            if (!noise) break;
+            for (int j = 0; j < latent_size; j++)
+                branch[j] = shared[j] + t_branch * (keep * z[j] + strength * noise[j]);
+            free(noise);
+            z_start = branch;
+        } else if (i > 0) {
+            /* Nothing shared: independent runs with consecutive seeds */
+            float *noise = init_noise(&p, latent_h, latent_w, seed + i);
+            if (!noise) break;
+            flux_copy(branch, noise, latent_size);
+            free(noise);
+            z_start = branch;
+        }
+
+        float *latent = run_sampler(ctx, &tail, (float *)z_start, latent_h, latent_w,
+                                    NULL, 0,
+                                    text_emb, text_seq,
+                                    text_emb_uncond, text_seq_uncond,
+                                    guidance, shared ? schedule + shared_steps : schedule);
+        if (!latent) break;
+        total_steps += ctx->last_steps;
+        total_evals += ctx->last_evals;
+
+        out_images[i] = NULL;
+        if (ctx->vae) {
+            out_images[i] = decode_image(ctx, latent, latent_h, latent_w);
+        }
+        free(latent);
+        if (!out_images[i]) break;
+        n_done++;
+    }
+
+    free(branch);
+    free(shared);
+    free(z);
+    free(schedule);
+    free(text_emb);
+    free(text_emb_uncond);
+
+    ctx->last_steps = total_steps;
+    ctx->last_evals = total_evals;
+    if (out_saved_evals && n_done > 1) *out_saved_evals = prefix_evals * (n_done - 1);
+
+    if (n_done == 0) {
+        set_sampling_error();
+        return -1;
+    }
+    return n_done;
+}
+
+/* ========================================================================
+ * Resume from Checkpoint
+ * ======================================================================== */
+
+flux_image *flux_generate_resume(flux_ctx *ctx, const char *prompt,
+                                 const flux_checkpoint *ck,
+                                 const flux_params *params) {
+    if (!ctx || !ck || !ck->latent) {
+        set_error("Invalid context or checkpoint");
+        return NULL;
+    }
+
+    int latent_h = ck->latent_h;
+    int latent_w = ck->latent_w;
+    float *latent = NULL;
+
+    if (ck->t > 0.0f) {
+        if (!prompt) {
+            set_error("Resuming an unfinished checkpoint needs its prompt");
+            return NULL;
+        }
+        if (cond_hash(ctx, prompt) != ck->cond_hash) {
+            set_error("Prompt or model does not match the checkpoint");
+            return NULL;
+        }
+
+        flux_params p;
+        if (params) {
+            p = *params;
+        } else {
+            p = (flux_params)FLUX_PARAMS_DEFAULT;
+        }
+        float guidance = (p.guidance > 0) ? p.guidance : ctx->default_guidance;
+
+        /* Checkpoints hold only the latent, not the previous model outputs
+         * a multistep solver extrapolates from */
+        if (ck->step > 0 && (p.sampler == FLUX_SAMPLER_DPMPP_2M ||
+                             p.sampler == FLUX_SAMPLER_UNIPC)) {
+            set_error("Multistep samplers cannot resume a checkpoint; use euler or adaptive");
+            return NULL;
+        }
+
+        /*
+         * Remaining schedule: the checkpoint's own tail when the step count
+         * is unchanged, otherwise the part of a fresh schedule below t.
+         */
+        float *schedule;
+        int tail_steps;
+        if ((p.num_steps <= 0 || p.num_steps == ck->num_steps) &&
+            ck->schedule[ck->step] == ck->t) {
+            tail_steps = ck->num_steps - ck->step;
+            schedule = (float *)malloc((tail_steps + 1) * sizeof(float));
+            memcpy(schedule, ck->schedule + ck->step, (tail_steps + 1) * sizeof(float));
+        } else {
+            if (p.num_steps <= 0) p.num_steps = ck->num_steps;
+            float *full = flux_selected_schedule(&p, latent_h * latent_w);
+            int first = 0;
+            while (first < p.num_steps && full[first] >= ck->t) first++;
+            tail_steps = p.num_steps - first + 1;
+            schedule = (float *)malloc((tail_steps + 1) * sizeof(float));
+            schedule[0] = ck->t;
+            memcpy(schedule + 1, full + first, tail_steps * sizeof(float));
+            free(full);
+        }
+        p.num_steps = tail_steps;
+
+        int text_seq;
+        float *text_emb = flux_encode_text(ctx, prompt, &text_seq);
+        if (!text_emb) {
+            free(schedule);
+            set_stage_error("Failed to encode prompt");
+            return NULL;
+        }
+
+        float *text_emb_uncond = NULL;
+        int text_seq_uncond = 0;
+        if (!ctx->is_distilled) {
+            text_emb_uncond = flux_encode_text(ctx, "", &text_seq_uncond);
+            if (!text_emb_uncond) {
+                free(schedule);
+                free(text_emb);
+                set_stage_error("Failed to encode empty prompt for CFG");
+                return NULL;
+            }
+        }
 
-    if (!latent) {
-        set_error("Sampling failed");
-        return NULL;
+        text_encoding_done(ctx);
+
+        if (!flux_load_transformer_if_needed(ctx)) {
+            free(schedule);
+            free(text_emb);
+            free(text_emb_uncond);
+            return NULL;
+        }
+
+        /* ck may be one of ctx's own checkpoints, which checkpoint_begin()
+         * drops: start from a copy */
+        size_t latent_size = (size_t)FLUX_LATENT_CHANNELS * latent_h * latent_w;
+        float *z = (float *)malloc(latent_size * sizeof(float));
+        memcpy(z, ck->latent, latent_size * sizeof(float));
+        checkpoint_begin(ctx, latent_h, latent_w, schedule, p.num_steps, ck->seed,
+                         prompt);
+        latent = run_sampler(ctx, &p, z, latent_h, latent_w, NULL, 0,
+                             text_emb, text_seq,
+                             text_emb_uncond, text_seq_uncond,
+                             guidance, schedule);
+        checkpoint_end();
+        free(z);
+
+        free(schedule);
+        free(text_emb);
+        free(text_emb_uncond);
+
+        if (!latent) {
+            set_sampling_error();
+            return NULL;
+        }
+    } else {
+        /* Fully denoised: decode only */
+        size_t latent_size = (size_t)FLUX_LATENT_CHANNELS * latent_h * latent_w;
+        latent = (float *)malloc(latent_size * sizeof(float));
+        memcpy(latent, ck->latent, latent_size * sizeof(float));
+        ctx->last_steps = 0;
+        ctx->last_evals = 0;
     }
 
-    /* Decode latent to image */
     flux_image *img = NULL;
     if (ctx->vae) {
-        if (flux_phase_callback) flux_phase_callback("decoding image", 0);
-        img = flux_vae_decode(ctx->vae, latent, 1, latent_h, latent_w);
-        if (flux_phase_callback) flux_phase_callback("decoding image", 1);
+        img = decode_image(ctx, latent, latent_h, latent_w);
     }
 
     free(latent);
-
     return img;
 }
 
@@ -571,35 +1612,29 @@ flux_image *flux_generate_with_embeddings(flux_ctx *ctx,
 
     /* Initialize noise */
     int64_t seed = (p.seed < 0) ? (int64_t)time(NULL) : p.seed;
-    float *z = flux_init_noise(1, FLUX_LATENT_CHANNELS, latent_h, latent_w, seed);
+    float *z = init_noise(&p, latent_h, latent_w, seed);
 
     /* Get schedule */
     float *schedule = flux_selected_schedule(&p, image_seq_len);
 
     /* Sample - note: pre-computed embeddings only support distilled path.
      * CFG requires two embeddings which the caller doesn't provide. */
-    float *latent = flux_sample_euler(
-        ctx->transformer, ctx->qwen3_encoder,
-        z, 1, FLUX_LATENT_CHANNELS, latent_h, latent_w,
-        text_emb, text_seq,
-        schedule, p.num_steps,
-        NULL  /* progress_callback */
-    );
+    float *latent = run_sampler(ctx, &p, z, latent_h, latent_w, NULL, 0,
+                                text_emb, text_seq, NULL, 0,
+                                0.0f, schedule);
 
     free(z);
     free(schedule);
 
     if (!latent) {
-        set_error("Sampling failed");
+        set_sampling_error();
         return NULL;
     }
 
     /* Decode latent to image */
     flux_image *img = NULL;
     if (ctx->vae) {
-        if (flux_phase_callback) flux_phase_callback("decoding image", 0);
-        img = flux_vae_decode(ctx->vae, latent, 1, latent_h, latent_w);
-        if (flux_phase_callback) flux_phase_callback("decoding image", 1);
+        img = decode_image(ctx, latent, latent_h, latent_w);
     } else {
         set_error("No VAE loaded");
         free(latent);
@@ -668,28 +1703,22 @@ flux_image *flux_generate_with_embeddings_and_noise(flux_ctx *ctx,
     float *schedule = flux_selected_schedule(&p, image_seq_len);
 
     /* Sample */
-    float *latent = flux_sample_euler(
-        ctx->transformer, ctx->qwen3_encoder,
-        z, 1, FLUX_LATENT_CHANNELS, latent_h, latent_w,
-        text_emb, text_seq,
-        schedule, p.num_steps,
-        NULL  /* progress_callback */
-    );
+    float *latent = run_sampler(ctx, &p, z, latent_h, latent_w, NULL, 0,
+                                text_emb, text_seq, NULL, 0,
+                                0.0f, schedule);
 
     free(z);
     free(schedule);
 
     if (!latent) {
-        set_error("Sampling failed");
+        set_sampling_error();
         return NULL;
     }
 
     /* Decode latent to image */
     flux_image *img = NULL;
     if (ctx->vae) {
-        if (flux_phase_callback) flux_phase_callback("decoding image", 0);
-        img = flux_vae_decode(ctx->vae, latent, 1, latent_h, latent_w);
-        if (flux_phase_callback) flux_phase_callback("decoding image", 1);
+        img = decode_image(ctx, latent, latent_h, latent_w);
     } else {
         set_error("No VAE loaded");
         free(latent);
@@ -700,6 +1729,73 @@ flux_image *flux_generate_with_embeddings_and_noise(flux_ctx *ctx,
     return img;
 }
 
+/* Text-to-image sampling only: the caller encodes and decodes */
+float *flux_generate_latent_with_embeddings(flux_ctx *ctx,
+                                            const float *text_emb, int text_seq,
+                                            const float *uncond_emb, int uncond_seq,
+                                            const flux_params *params,
+                                            int *out_h, int *out_w) {
+    *out_h = *out_w = 0;
+    if (!ctx || !text_emb) {
+        set_error("Invalid context or embeddings");
+        return NULL;
+    }
+    if (!ctx->is_distilled && !uncond_emb) {
+        set_error("Base model needs the unconditioned embedding for CFG");
+        return NULL;
+    }
+
+    /* Load transformer if not already loaded */
+    if (!flux_load_transformer_if_needed(ctx)) {
+        return NULL;
+    }
+
+    flux_params p;
+    if (params) {
+        p = *params;
+    } else {
+        p = (flux_params)FLUX_PARAMS_DEFAULT;
+    }
+
+    /* Validate dimensions */
+    if (p.width <= 0) p.width = FLUX_DEFAULT_WIDTH;
+    if (p.height <= 0) p.height = FLUX_DEFAULT_HEIGHT;
+    if (p.num_steps <= 0) p.num_steps = ctx->default_steps;
+    float guidance = (p.guidance > 0) ? p.guidance : ctx->default_guidance;
+
+    p.width = (p.width / 16) * 16;
+    p.height = (p.height / 16) * 16;
+    if (p.width < 64) p.width = 64;
+    if (p.height < 64) p.height = 64;
+    if (p.width > FLUX_VAE_MAX_DIM || p.height > FLUX_VAE_MAX_DIM) {
+        set_error("Image dimensions exceed maximum (1792x1792)");
+        return NULL;
+    }
+
+    int latent_h = p.height / 16;
+    int latent_w = p.width / 16;
+
+    int64_t seed = (p.seed < 0) ? (int64_t)time(NULL) : p.seed;
+    float *z = init_noise(&p, latent_h, latent_w, seed);
+    float *schedule = flux_selected_schedule(&p, latent_h * latent_w);
+
+    float *latent = run_sampler(ctx, &p, z, latent_h, latent_w, NULL, 0,
+                                text_emb, text_seq,
+                                ctx->is_distilled ? NULL : uncond_emb,
+                                ctx->is_distilled ? 0 : uncond_seq,
+                                guidance, schedule);
+    free(z);
+    free(schedule);
+
+    if (!latent) {
+        set_sampling_error();
+        return NULL;
+    }
+    *out_h = latent_h;
+    *out_w = latent_w;
+    return latent;
+}
+
 /* ========================================================================
  * Attention Memory Budget
  * ======================================================================== */
@@ -766,6 +1862,116 @@ static int fit_refs_for_attention(int num_heads,
     return shrunk;
 }
 
+/* Pixel dimensions reference images are encoded at, before any
+ * fit_refs_for_attention(): multiples of 16 within the VAE limit.
+ * ref_dims is [h0, w0, h1, w1, ...]. */
+static void set_ref_pixel_dims(const flux_image **refs, int num_refs, int *ref_dims) {
+    for (int i = 0; i < num_refs; i++) {
+        int rh = (refs[i]->height / 16) * 16;
+        int rw = (refs[i]->width / 16) * 16;
+        if (rh > FLUX_VAE_MAX_DIM) rh = FLUX_VAE_MAX_DIM;
+        if (rw > FLUX_VAE_MAX_DIM) rw = FLUX_VAE_MAX_DIM;
+        if (rh < 16) rh = 16;
+        if (rw < 16) rw = 16;
+        ref_dims[i*2]   = rh;
+        ref_dims[i*2+1] = rw;
+    }
+}
+
+/* ========================================================================
+ * Memory Estimation
+ * ======================================================================== */
+
+int flux_estimate_memory(flux_ctx *ctx, const flux_params *params,
+                         const flux_image **refs, int num_refs,
+                         flux_memory_estimate *out) {
+    if (!ctx || !out || num_refs < 0 || (num_refs > 0 && !refs)) {
+        set_error("Invalid arguments");
+        return -1;
+    }
+    memset(out, 0, sizeof(*out));
+
+    flux_params p;
+    if (params) {
+        p = *params;
+    } else {
+        flux_params defaults = FLUX_PARAMS_DEFAULT;
+        p = defaults;
+    }
+    if (p.width <= 0) p.width = FLUX_DEFAULT_WIDTH;
+    if (p.height <= 0) p.height = FLUX_DEFAULT_HEIGHT;
+    p.width = (p.width / 16) * 16;
+    p.height = (p.height / 16) * 16;
+    if (p.width < 64) p.width = 64;
+    if (p.height < 64) p.height = 64;
+    if (p.width > FLUX_VAE_MAX_DIM || p.height > FLUX_VAE_MAX_DIM) {
+        set_error("Image dimensions exceed maximum (1792x1792)");
+        return -1;
+    }
+
+    /* References at the sizes flux_multiref() would encode them */
+    int *ref_dims = NULL;
+    if (num_refs > 0) {
+        ref_dims = (int *)malloc(num_refs * 2 * sizeof(int));
+        if (!ref_dims) {
+            set_error("Out of memory");
+            return -1;
+        }
+        set_ref_pixel_dims(refs, num_refs, ref_dims);
+        fit_refs_for_attention(ctx->num_heads, p.height, p.width,
+                               ref_dims, num_refs, FLUX_MAX_SEQ_LEN);
+    }
+
+    size_t img_seq = (size_t)(p.height / 16) * (p.width / 16);
+    size_t ref_seq = 0, max_ref_vae = 0, ref_tensors = 0;
+    for (int i = 0; i < num_refs; i++) {
+        int rh = ref_dims[i*2], rw = ref_dims[i*2+1];
+        ref_seq += (size_t)(rh / 16) * (rw / 16);
+        ref_tensors += (size_t)3 * rh * rw * sizeof(float);
+        size_t vae = flux_vae_work_bytes(rw, rh);
+        if (vae > max_ref_vae) max_ref_vae = vae;
+    }
+    free(ref_dims);
+    int total_seq = (int)(img_seq + ref_seq) + FLUX_MAX_SEQ_LEN;
+
+    size_t te_mapped = 0, tf_mapped = 0;
+    qwen3_encoder_estimate_memory(ctx->model_dir, ctx->use_mmap,
+                                  &out->text_encoder, &te_mapped,
+                                  &out->text_encoder_work);
+    flux_transformer_estimate_memory(ctx->model_dir, ctx->use_mmap, total_seq,
+                                     &out->transformer_weights, &tf_mapped,
+                                     &out->transformer_work, &out->attention);
+    out->mapped = te_mapped + tf_mapped;
+    out->vae_weights = ctx->vae_weight_bytes;
+    out->vae_work = flux_vae_work_bytes(p.width, p.height);
+    if (max_ref_vae > out->vae_work) out->vae_work = max_ref_vae;
+
+    /* Prompt embeddings (twice with CFG), noise and sampler latents, the
+     * encoded references and the image the latents decode into */
+    size_t latent = (size_t)FLUX_LATENT_CHANNELS * img_seq * sizeof(float);
+    out->latents = (size_t)FLUX_MAX_SEQ_LEN * ctx->text_dim * sizeof(float) *
+                   (ctx->is_distilled ? 1 : 2) +
+                   4 * latent +
+                   (size_t)FLUX_LATENT_CHANNELS * ref_seq * sizeof(float) +
+                   ref_tensors +
+                   (size_t)3 * p.width * p.height;
+
+    /* The VAE and, once loaded, the transformer stay resident. The text
+     * encoder is released after encoding unless kept, and shared weights
+     * always keep it. */
+    size_t resident = out->transformer_weights + out->vae_weights;
+    size_t te_kept = (ctx->keep_text_encoder || ctx->weights) ? out->text_encoder : 0;
+    out->encode_peak = resident + out->text_encoder + out->text_encoder_work + out->latents;
+    out->denoise_peak = resident + te_kept + out->transformer_work +
+                        out->attention + out->latents;
+    out->vae_peak = resident + te_kept + out->vae_work + out->latents;
+
+    out->peak = out->encode_peak;
+    if (out->denoise_peak > out->peak) out->peak = out->denoise_peak;
+    if (out->vae_peak > out->peak) out->peak = out->vae_peak;
+    return 0;
+}
+
 /* ========================================================================
  * Image-to-Image Generation
  * ======================================================================== */
@@ -814,18 +2020,6 @@ flux_image *flux_img2img(flux_ctx *ctx, const char *prompt,
         }
     }
 
-    /* Resize input if needed */
-    flux_image *resized = NULL;
-    const flux_image *img_to_use = input;
-    if (input->width != ref_w || input->height != ref_h) {
-        resized = flux_image_resize(input, ref_w, ref_h);
-        if (!resized) {
-            set_error("Failed to resize input image");
-            return NULL;
-        }
-        img_to_use = resized;
-    }
-
     /* Resolve steps and guidance */
     if (p.num_steps <= 0) p.num_steps = ctx->default_steps;
     float guidance = (p.guidance > 0) ? p.guidance : ctx->default_guidance;
@@ -834,8 +2028,7 @@ flux_image *flux_img2img(flux_ctx *ctx, const char *prompt,
     int text_seq;
     float *text_emb = flux_encode_text(ctx, prompt, &text_seq);
     if (!text_emb) {
-        if (resized) flux_image_free(resized);
-        set_error("Failed to encode prompt");
+        set_stage_error("Failed to encode prompt");
         return NULL;
     }
 
@@ -845,27 +2038,31 @@ flux_image *flux_img2img(flux_ctx *ctx, const char *prompt,
         text_emb_uncond = flux_encode_text(ctx, "", &text_seq_uncond);
         if (!text_emb_uncond) {
             free(text_emb);
-            if (resized) flux_image_free(resized);
-            set_error("Failed to encode empty prompt for CFG");
+            set_stage_error("Failed to encode empty prompt for CFG");
             return NULL;
         }
     }
 
     /* Release text encoder to free ~8GB before loading transformer */
-    flux_release_text_encoder(ctx);
+    text_encoding_done(ctx);
 
     /* Load transformer now (after text encoder is freed to reduce peak memory) */
     if (!flux_load_transformer_if_needed(ctx)) {
         free(text_emb);
         free(text_emb_uncond);
-        if (resized) flux_image_free(resized);
         return NULL;
     }
 
-    /* Encode image to latent */
-    if (flux_phase_callback) flux_phase_callback("encoding reference image", 0);
-    float *img_tensor = flux_image_to_tensor(img_to_use);
-    if (resized) flux_image_free(resized);
+    /* Encode image to latent (resized straight into the VAE input tensor) */
+    flux_phase_begin("encoding reference image");
+    float *img_tensor = flux_image_to_tensor_resized(input, ref_w, ref_h);
+    if (!img_tensor) {
+        flux_phase_end("encoding reference image");
+        free(text_emb);
+        free(text_emb_uncond);
+        set_error("Failed to resize input image");
+        return NULL;
+    }
 
     int latent_h, latent_w;
     float *img_latent = NULL;
@@ -881,12 +2078,12 @@ flux_image *flux_img2img(flux_ctx *ctx, const char *prompt,
     }
 
     free(img_tensor);
-    if (flux_phase_callback) flux_phase_callback("encoding reference image", 1);
+    flux_phase_end("encoding reference image");
 
     if (!img_latent) {
         free(text_emb);
         free(text_emb_uncond);
-        set_error("Failed to encode image");
+        set_stage_error("Failed to encode image");
         return NULL;
     }
 
@@ -901,7 +2098,6 @@ flux_image *flux_img2img(flux_ctx *ctx, const char *prompt,
      * This is fundamentally different from traditional img2img that adds
      * noise directly to the encoded image.
      */
-    int num_steps = p.num_steps;
     int out_lat_h = p.height / 16;
     int out_lat_w = p.width / 16;
     int image_seq_len = out_lat_h * out_lat_w;  /* For schedule calculation */
@@ -911,36 +2107,17 @@ flux_image *flux_img2img(flux_ctx *ctx, const char *prompt,
 
     /* Initialize target latent with pure noise */
     int64_t seed = (p.seed < 0) ? (int64_t)time(NULL) : p.seed;
-    float *z = flux_init_noise(1, FLUX_LATENT_CHANNELS, out_lat_h, out_lat_w, seed);
+    float *z = init_noise(&p, out_lat_h, out_lat_w, seed);
 
     /* Reference image latent is img_latent, with T offset = 10 */
     int t_offset = 10;
 
     /* Sample using in-context conditioning */
-    float *latent;
-    if (ctx->is_distilled) {
-        latent = flux_sample_euler_with_refs(
-            ctx->transformer, ctx->qwen3_encoder,
-            z, 1, FLUX_LATENT_CHANNELS, out_lat_h, out_lat_w,
-            img_latent, latent_h, latent_w,
-            t_offset,
-            text_emb, text_seq,
-            schedule, num_steps,
-            NULL
-        );
-    } else {
-        latent = flux_sample_euler_cfg_with_refs(
-            ctx->transformer, ctx->qwen3_encoder,
-            z, 1, FLUX_LATENT_CHANNELS, out_lat_h, out_lat_w,
-            img_latent, latent_h, latent_w,
-            t_offset,
-            text_emb, text_seq,
-            text_emb_uncond, text_seq_uncond,
-            guidance,
-            schedule, num_steps,
-            NULL
-        );
-    }
+    flux_ref_t ref = { img_latent, latent_h, latent_w, t_offset };
+    float *latent = run_sampler(ctx, &p, z, out_lat_h, out_lat_w, &ref, 1,
+                                text_emb, text_seq,
+                                text_emb_uncond, text_seq_uncond,
+                                guidance, schedule);
 
     free(z);
     free(img_latent);
@@ -949,16 +2126,14 @@ flux_image *flux_img2img(flux_ctx *ctx, const char *prompt,
     free(text_emb_uncond);
 
     if (!latent) {
-        set_error("Sampling failed");
+        set_sampling_error();
         return NULL;
     }
 
     /* Decode */
     flux_image *result = NULL;
     if (ctx->vae) {
-        if (flux_phase_callback) flux_phase_callback("decoding image", 0);
-        result = flux_vae_decode(ctx->vae, latent, 1, out_lat_h, out_lat_w);
-        if (flux_phase_callback) flux_phase_callback("decoding image", 1);
+        result = decode_image(ctx, latent, out_lat_h, out_lat_w);
     }
 
     free(latent);
@@ -1017,7 +2192,7 @@ flux_image *flux_multiref(flux_ctx *ctx, const char *prompt,
     int text_seq;
     float *text_emb = flux_encode_text(ctx, prompt, &text_seq);
     if (!text_emb) {
-        set_error("Failed to encode prompt");
+        set_stage_error("Failed to encode prompt");
         return NULL;
     }
 
@@ -1027,12 +2202,12 @@ flux_image *flux_multiref(flux_ctx *ctx, const char *prompt,
         text_emb_uncond = flux_encode_text(ctx, "", &text_seq_uncond);
         if (!text_emb_uncond) {
             free(text_emb);
-            set_error("Failed to encode empty prompt for CFG");
+            set_stage_error("Failed to encode empty prompt for CFG");
             return NULL;
         }
     }
 
-    flux_release_text_encoder(ctx);
+    text_encoding_done(ctx);
 
     if (!flux_load_transformer_if_needed(ctx)) {
         free(text_emb);
@@ -1042,16 +2217,7 @@ flux_image *flux_multiref(flux_ctx *ctx, const char *prompt,
 
     /* Build reference pixel dimensions, clamped and rounded to 16. */
     int *ref_pixel_dims = (int *)malloc(num_refs * 2 * sizeof(int));
-    for (int i = 0; i < num_refs; i++) {
-        int rh = (refs[i]->height / 16) * 16;
-        int rw = (refs[i]->width / 16) * 16;
-        if (rh > FLUX_VAE_MAX_DIM) rh = FLUX_VAE_MAX_DIM;
-        if (rw > FLUX_VAE_MAX_DIM) rw = FLUX_VAE_MAX_DIM;
-        if (rh < 16) rh = 16;
-        if (rw < 16) rw = 16;
-        ref_pixel_dims[i*2]   = rh;
-        ref_pixel_dims[i*2+1] = rw;
-    }
+    set_ref_pixel_dims(refs, num_refs, ref_pixel_dims);
 
     /* Shrink references if attention would exceed 4 GB. */
     if (fit_refs_for_attention(ctx->num_heads, p.height, p.width,
@@ -1064,56 +2230,27 @@ flux_image *flux_multiref(flux_ctx *ctx, const char *prompt,
     /* Encode all reference images */
     flux_ref_t *ref_latents = (flux_ref_t *)malloc(num_refs * sizeof(flux_ref_t));
     float **ref_data = (float **)malloc(num_refs * sizeof(float *));
-    flux_image **resized_imgs = (flux_image **)calloc(num_refs, sizeof(flux_image *));
 
     for (int i = 0; i < num_refs; i++) {
-        const flux_image *ref = refs[i];
-        const flux_image *img_to_use = ref;
-
         int ref_h = ref_pixel_dims[i*2];
         int ref_w = ref_pixel_dims[i*2+1];
 
-        /* Resize only if dimensions differ from original */
-        if (ref->width != ref_w || ref->height != ref_h) {
-            resized_imgs[i] = flux_image_resize(ref, ref_w, ref_h);
-            if (!resized_imgs[i]) {
-                for (int j = 0; j < i; j++) {
-                    free(ref_data[j]);
-                    if (resized_imgs[j]) flux_image_free(resized_imgs[j]);
-                }
-                free(ref_latents);
-                free(ref_data);
-                free(resized_imgs);
-                free(ref_pixel_dims);
-                free(text_emb);
-                free(text_emb_uncond);
-                set_error("Failed to resize reference image");
-                return NULL;
-            }
-            img_to_use = resized_imgs[i];
-        }
-
-        /* Encode to latent at reference's own size */
-        float *tensor = flux_image_to_tensor(img_to_use);
+        /* Resize straight into the VAE input tensor and encode at the
+         * reference's own size */
+        float *tensor = flux_image_to_tensor_resized(refs[i], ref_w, ref_h);
         int lat_h, lat_w;
-        ref_data[i] = flux_vae_encode(ctx->vae, tensor, 1,
-                                       img_to_use->height, img_to_use->width,
-                                       &lat_h, &lat_w);
+        ref_data[i] = tensor ? flux_vae_encode(ctx->vae, tensor, 1, ref_h, ref_w,
+                                               &lat_h, &lat_w) : NULL;
         free(tensor);
 
         if (!ref_data[i]) {
-            for (int j = 0; j < i; j++) {
-                free(ref_data[j]);
-                if (resized_imgs[j]) flux_image_free(resized_imgs[j]);
-            }
-            if (resized_imgs[i]) flux_image_free(resized_imgs[i]);
+            for (int j = 0; j < i; j++) free(ref_data[j]);
             free(ref_latents);
             free(ref_data);
-            free(resized_imgs);
             free(ref_pixel_dims);
             free(text_emb);
             free(text_emb_uncond);
-            set_error("Failed to encode reference image");
+            set_stage_error("Failed to encode reference image");
             return NULL;
         }
 
@@ -1123,11 +2260,6 @@ flux_image *flux_multiref(flux_ctx *ctx, const char *prompt,
         ref_latents[i].t_offset = 10 * (i + 1);  /* 10, 20, 30, ... */
     }
 
-    /* Free resized images (latents are now encoded) */
-    for (int i = 0; i < num_refs; i++) {
-        if (resized_imgs[i]) flux_image_free(resized_imgs[i]);
-    }
-    free(resized_imgs);
     free(ref_pixel_dims);
 
     int latent_h = p.height / 16;
@@ -1136,31 +2268,14 @@ flux_image *flux_multiref(flux_ctx *ctx, const char *prompt,
 
     float *schedule = flux_selected_schedule(&p, image_seq_len);
     int64_t seed = (p.seed < 0) ? (int64_t)time(NULL) : p.seed;
-    float *z = flux_init_noise(1, FLUX_LATENT_CHANNELS, latent_h, latent_w, seed);
+    float *z = init_noise(&p, latent_h, latent_w, seed);
 
     /* Sample with multi-reference conditioning */
-    float *latent;
-    if (ctx->is_distilled) {
-        latent = flux_sample_euler_with_multi_refs(
-            ctx->transformer, ctx->qwen3_encoder,
-            z, 1, FLUX_LATENT_CHANNELS, latent_h, latent_w,
-            ref_latents, num_refs,
-            text_emb, text_seq,
-            schedule, p.num_steps,
-            NULL
-        );
-    } else {
-        latent = flux_sample_euler_cfg_with_multi_refs(
-            ctx->transformer, ctx->qwen3_encoder,
-            z, 1, FLUX_LATENT_CHANNELS, latent_h, latent_w,
-            ref_latents, num_refs,
-            text_emb, text_seq,
-            text_emb_uncond, text_seq_uncond,
-            guidance,
-            schedule, p.num_steps,
-            NULL
-        );
-    }
+    float *latent = run_sampler(ctx, &p, z, latent_h, latent_w,
+                                ref_latents, num_refs,
+                                text_emb, text_seq,
+                                text_emb_uncond, text_seq_uncond,
+                                guidance, schedule);
 
     /* Cleanup */
     free(z);
@@ -1174,22 +2289,344 @@ flux_image *flux_multiref(flux_ctx *ctx, const char *prompt,
     free(text_emb_uncond);
 
     if (!latent) {
-        set_error("Sampling failed");
+        set_sampling_error();
         return NULL;
     }
 
     /* Decode */
     flux_image *result = NULL;
     if (ctx->vae) {
-        if (flux_phase_callback) flux_phase_callback("decoding image", 0);
-        result = flux_vae_decode(ctx->vae, latent, 1, latent_h, latent_w);
-        if (flux_phase_callback) flux_phase_callback("decoding image", 1);
+        result = decode_image(ctx, latent, latent_h, latent_w);
     }
 
     free(latent);
     return result;
 }
 
+/* ========================================================================
+ * Continuous Batching Engine
+ *
+ * Requests are admitted between steps and every flux_engine_step() runs
+ * one packed transformer forward over all active requests, whatever step
+ * each of them is at: every request contributes its own segment with its
+ * own timestep (plus an unconditioned segment while CFG applies), then
+ * takes its own Euler step. Finished latents are decoded and parked until
+ * flux_engine_poll() hands them out.
+ *
+ * The packed work buffers grow with the batch's total token count, so
+ * admission is bounded by bytes as well as by count: each request carries
+ * the transformer work flux_estimate_memory() gives for it (twice with
+ * CFG), and a request waits while the active ones would exceed the budget.
+ * ======================================================================== */
+
+#define ENGINE_DEFAULT_ACTIVE   8
+#define ENGINE_DEFAULT_WORK     ((size_t)4 << 30)   /* Work bytes per step */
+
+typedef struct engine_req {
+    int id;
+    int latent_h, latent_w;
+    int step, num_steps;
+    float *schedule;            /* [num_steps + 1] */
+    float *z;                   /* Current latent */
+    float *text_emb;
+    int text_seq;
+    float guidance;             /* 0: no CFG (distilled model) */
+    float cfg_t_min, cfg_t_max;
+    int cfg_now;                /* CFG applies at the current step */
+    int failed;                 /* A forward failed: retired without an image */
+    size_t work;                /* Estimated transformer work bytes */
+    flux_image *img;            /* Result, once finished */
+    struct engine_req *next;
+} engine_req;
+
+struct flux_engine {
+    flux_ctx *ctx;
+    int max_active;
+    engine_req *pending;        /* Submitted, waiting for a slot (FIFO) */
+    engine_req *active;         /* Denoising */
+    engine_req *done;           /* Decoded, waiting for flux_engine_poll() */
+    int num_pending, num_active;
+    size_t work_budget;         /* Admission limit on the sum of work */
+    size_t active_work;
+    int packed;                 /* A forward since the last drain was packed */
+    float *uncond_emb;          /* Empty-prompt encoding shared by all CFG requests */
+    int uncond_seq;
+    int next_id;
+};
+
+static void engine_append(engine_req **list, engine_req *r) {
+    r->next = NULL;
+    while (*list) list = &(*list)->next;
+    *list = r;
+}
+
+static void engine_req_free(engine_req *r) {
+    free(r->schedule);
+    free(r->z);
+    free(r->text_emb);
+    flux_image_free(r->img);
+    free(r);
+}
+
+flux_engine *flux_engine_new(flux_ctx *ctx, int max_active) {
+    if (!ctx) return NULL;
+    flux_engine *eng = (flux_engine *)calloc(1, sizeof(flux_engine));
+    if (!eng) return NULL;
+    eng->ctx = ctx;
+    eng->max_active = (max_active > 0) ? max_active : ENGINE_DEFAULT_ACTIVE;
+    eng->next_id = 1;
+
+    /* Work budget: the default, or what the memory limit leaves next to
+     * the weights and everything else a single generation holds */
+    eng->work_budget = ENGINE_DEFAULT_WORK;
+    size_t limit = flux_get_host_resources()->memory_limit;
+    flux_memory_estimate est;
+    if (limit > 0 && flux_estimate_memory(ctx, NULL, NULL, 0, &est) == 0) {
+        size_t fixed = est.denoise_peak - est.transformer_work;
+        size_t room = (limit > fixed) ? limit - fixed : 0;
+        if (room < eng->work_budget) eng->work_budget = room;
+    }
+    return eng;
+}
+
+void flux_engine_free(flux_engine *eng) {
+    if (!eng) return;
+    engine_req *lists[3] = {eng->pending, eng->active, eng->done};
+    for (int i = 0; i < 3; i++) {
+        while (lists[i]) {
+            engine_req *next = lists[i]->next;
+            engine_req_free(lists[i]);
+            lists[i] = next;
+        }
+    }
+    free(eng->uncond_emb);
+    free(eng);
+}
+
+/* The engine steps every request with Euler at its own resolution */
+static int engine_params_ok(const flux_params *p) {
+    if (p->sampler != FLUX_SAMPLER_EULER || p->cfg_reuse > 0 || p->prog_levels > 0) {
+        set_error("Engine requests must use the Euler sampler, without "
+                  "cfg_reuse or progressive resolution");
+        return 0;
+    }
+    return 1;
+}
+
+int flux_engine_submit_embeddings(flux_engine *eng, const float *text_emb, int text_seq,
+                                  const flux_params *params) {
+    if (!eng || !text_emb) {
+        set_error("Invalid engine or embeddings");
+        return -1;
+    }
+    flux_ctx *ctx = eng->ctx;
+
+    flux_params p;
+    if (params) {
+        p = *params;
+    } else {
+        p = (flux_params)FLUX_PARAMS_DEFAULT;
+    }
+    if (!engine_params_ok(&p)) return -1;
+
+    if (p.width <= 0) p.width = FLUX_DEFAULT_WIDTH;
+    if (p.height <= 0) p.height = FLUX_DEFAULT_HEIGHT;
+    if (p.num_steps <= 0) p.num_steps = ctx->default_steps;
+    float guidance = (p.guidance > 0) ? p.guidance : ctx->default_guidance;
+
+    p.width = (p.width / 16) * 16;
+    p.height = (p.height / 16) * 16;
+    if (p.width < 64) p.width = 64;
+    if (p.height < 64) p.height = 64;
+    if (p.width > FLUX_VAE_MAX_DIM || p.height > FLUX_VAE_MAX_DIM) {
+        set_error("Image dimensions exceed maximum (1792x1792)");
+        return -1;
+    }
+
+    /* The unconditioned embedding is the same for every request */
+    if (!ctx->is_distilled && !eng->uncond_emb) {
+        eng->uncond_emb = flux_encode_text(ctx, "", &eng->uncond_seq);
+        if (!eng->uncond_emb) {
+            set_stage_error("Failed to encode empty prompt for CFG");
+            return -1;
+        }
+        text_encoding_done(ctx);
+    }
+
+    engine_req *r = (engine_req *)calloc(1, sizeof(engine_req));
+    r->id = eng->next_id++;
+    r->latent_h = p.height / 16;
+    r->latent_w = p.width / 16;
+    r->num_steps = p.num_steps;
+    r->schedule = flux_selected_schedule(&p, r->latent_h * r->latent_w);
+    int64_t seed = (p.seed < 0) ? (int64_t)time(NULL) : p.seed;
+    r->z = init_noise(&p, r->latent_h, r->latent_w, seed);
+    size_t emb_size = (size_t)text_seq * ctx->text_dim * sizeof(float);
+    r->text_emb = (float *)malloc(emb_size);
+    memcpy(r->text_emb, text_emb, emb_size);
+    r->text_seq = text_seq;
+    r->guidance = ctx->is_distilled ? 0.0f : guidance;
+    r->cfg_t_min = p.cfg_t_min;
+    r->cfg_t_max = (p.cfg_t_max > 0) ? p.cfg_t_max : 1.0f;
+    flux_memory_estimate est;
+    if (flux_estimate_memory(ctx, &p, NULL, 0, &est) == 0)
+        r->work = est.transformer_work * (r->guidance > 0 ? 2 : 1);
+
+    engine_append(&eng->pending, r);
+    eng->num_pending++;
+    return r->id;
+}
+
+int flux_engine_submit(flux_engine *eng, const char *prompt, const flux_params *params) {
+    if (!eng || !prompt) {
+        set_error("Invalid engine or prompt");
+        return -1;
+    }
+    if (params && !engine_params_ok(params)) return -1;
+    int text_seq;
+    float *text_emb = flux_encode_text(eng->ctx, prompt, &text_seq);
+    if (!text_emb) {
+        set_stage_error("Failed to encode prompt");
+        return -1;
+    }
+    int id = flux_engine_submit_embeddings(eng, text_emb, text_seq, params);
+    text_encoding_done(eng->ctx);
+    free(text_emb);
+    return id;
+}
+
+int flux_engine_step(flux_engine *eng) {
+    if (!eng) return -1;
+    flux_ctx *ctx = eng->ctx;
+
+    /* Admit waiting requests into free slots, in order, while their work
+     * fits the budget. One request is always admitted into an idle engine,
+     * whatever its size: it runs unpacked. */
+    while (eng->pending && eng->num_active < eng->max_active &&
+           (!eng->active || eng->active_work + eng->pending->work <= eng->work_budget)) {
+        engine_req *r = eng->pending;
+        eng->pending = r->next;
+        eng->num_pending--;
+        engine_append(&eng->active, r);
+        eng->num_active++;
+        eng->active_work += r->work;
+    }
+    if (!eng->active) return eng->num_pending;
+
+    if (!flux_load_transformer_if_needed(ctx)) return -1;
+
+    /* One segment per request, two while CFG applies */
+    flux_packed_seg_t *segs = (flux_packed_seg_t *)malloc(eng->num_active * 2 *
+                                                          sizeof(flux_packed_seg_t));
+    float **v = (float **)calloc(eng->num_active * 2, sizeof(float *));
+    int n = 0;
+    for (engine_req *r = eng->active; r; r = r->next) {
+        float t = r->schedule[r->step];
+        r->cfg_now = (r->guidance > 0 && t >= r->cfg_t_min && t <= r->cfg_t_max);
+        segs[n++] = (flux_packed_seg_t){r->z, r->latent_h, r->latent_w,
+                                        r->text_emb, r->text_seq, t};
+        if (r->cfg_now)
+            segs[n++] = (flux_packed_seg_t){r->z, r->latent_h, r->latent_w,
+                                            eng->uncond_emb, eng->uncond_seq, t};
+    }
+
+    if (n > 1) eng->packed = 1;
+    if (flux_transformer_forward_packed(ctx->transformer, segs, n, v) < 0 && n > 1) {
+        /* The stack failed (its buffers did not fit, say): run the segments
+         * one by one, so that only a request whose own forward fails is lost */
+        for (int i = 0; i < n; i++)
+            v[i] = flux_transformer_forward(ctx->transformer, segs[i].img_latent,
+                                            segs[i].img_h, segs[i].img_w,
+                                            segs[i].txt_emb, segs[i].txt_seq,
+                                            segs[i].timestep);
+    }
+    free(segs);
+
+    /* Per-request Euler step */
+    int s = 0;
+    for (engine_req *r = eng->active; r; r = r->next) {
+        int size = FLUX_LATENT_CHANNELS * r->latent_h * r->latent_w;
+        float dt = r->schedule[r->step + 1] - r->schedule[r->step];
+        float *v_cond = v[s++];
+        float *v_uncond = r->cfg_now ? v[s++] : NULL;
+        if (!v_cond || (r->cfg_now && !v_uncond)) {
+            free(v_cond);
+            free(v_uncond);
+            set_stage_error("Transformer forward failed");
+            r->failed = 1;
+            continue;
+        }
+        if (v_uncond) {
+            for (int i = 0; i < size; i++)
+                v_cond[i] = v_uncond[i] + r->guidance * (v_cond[i] - v_uncond[i]);
+            free(v_uncond);
+        }
+        flux_axpy(r->z, dt, v_cond, size);
+        free(v_cond);
+        r->step++;
+    }
+    free(v);
+
+    /* Retire finished requests to the VAE */
+    engine_req **link = &eng->active;
+    while (*link) {
+        engine_req *r = *link;
+        if (r->step < r->num_steps && !r->failed) {
+            link = &r->next;
+            continue;
+        }
+        *link = r->next;
+        eng->num_active--;
+        eng->active_work -= r->work;
+        if (r->failed) {
+            /* Polled with a NULL image */
+        } else if (ctx->vae) {
+            r->img = decode_image(ctx, r->z, r->latent_h, r->latent_w);
+        } else {
+            set_error("No VAE loaded");
+        }
+        free(r->z);
+        free(r->text_emb);
+        free(r->schedule);
+        r->z = r->text_emb = r->schedule = NULL;
+        engine_append(&eng->done, r);
+    }
+
+    /* Drained: give back the buffers the packed batches grew */
+    if (!eng->active && eng->packed) {
+        flux_transformer_release_work(ctx->transformer);
+        eng->packed = 0;
+    }
+
+    return eng->num_active + eng->num_pending;
+}
+
+int flux_engine_progress(flux_engine *eng, int id, int *step, int *total) {
+    if (!eng) return -1;
+    engine_req *lists[3] = {eng->pending, eng->active, eng->done};
+    for (int i = 0; i < 3; i++) {
+        for (engine_req *r = lists[i]; r; r = r->next) {
+            if (r->id != id) continue;
+            if (step) *step = r->step;
+            if (total) *total = r->num_steps;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+flux_image *flux_engine_poll(flux_engine *eng, int *out_id) {
+    *out_id = 0;
+    if (!eng || !eng->done) return NULL;
+    engine_req *r = eng->done;
+    eng->done = r->next;
+    flux_image *img = r->img;
+    *out_id = r->id;
+    r->img = NULL;
+    engine_req_free(r);
+    return img;
+}
+
 /* ========================================================================
  * Utility Functions
  * ======================================================================== */
@@ -1198,16 +2635,29 @@ void flux_set_seed(int64_t seed) {
     flux_rng_seed((uint64_t)seed);
 }
 
+int flux_sampler_from_name(const char *name) {
+    if (!name) return -1;
+    if (strcmp(name, "euler") == 0) return FLUX_SAMPLER_EULER;
+    if (strcmp(name, "dpm++2m") == 0) return FLUX_SAMPLER_DPMPP_2M;
+    if (strcmp(name, "unipc") == 0) return FLUX_SAMPLER_UNIPC;
+    if (strcmp(name, "adaptive") == 0) return FLUX_SAMPLER_ADAPTIVE;
+    return -1;
+}
+
+void flux_last_step_count(flux_ctx *ctx, int *steps, int *evals) {
+    if (steps) *steps = ctx ? ctx->last_steps : 0;
+    if (evals) *evals = ctx ? ctx->last_evals : 0;
+}
+
 const char *flux_model_info(flux_ctx *ctx) {
-    static char info[256];
     if (!ctx) {
         return "No model loaded";
     }
-    snprintf(info, sizeof(info), "%s v%s (%s, %d steps, guidance %.1f)",
+    snprintf(ctx->model_info, sizeof(ctx->model_info), "%s v%s (%s, %d steps, guidance %.1f)",
              ctx->model_name, ctx->model_version,
              ctx->is_distilled ? "distilled" : "base",
              ctx->default_steps, ctx->default_guidance);
-    return info;
+    return ctx->model_info;
 }
 
 int flux_text_dim(flux_ctx *ctx) {
@@ -1218,6 +2668,10 @@ int flux_is_non_commercial(flux_ctx *ctx) {
     return ctx ? ctx->is_non_commercial : 0;
 }
 
+void flux_free_buffer(void *p) {
+    flux_mem_free(p);
+}
+
 /* ========================================================================
  * Low-level API
  * ======================================================================== */
@@ -1241,9 +2695,7 @@ float *flux_encode_image(flux_ctx *ctx, const flux_image *img,
 flux_image *flux_decode_latent(flux_ctx *ctx, const float *latent,
                                int latent_h, int latent_w) {
     if (!ctx || !latent || !ctx->vae) return NULL;
-    if (flux_phase_callback) flux_phase_callback("decoding image", 0);
-    flux_image *img = flux_vae_decode(ctx->vae, latent, 1, latent_h, latent_w);
-    if (flux_phase_callback) flux_phase_callback("decoding image", 1);
+    flux_image *img = decode_image(ctx, latent, latent_h, latent_w);
     return img;
 }
 
@@ -1356,16 +2808,14 @@ flux_image *flux_img2img_debug_py(flux_ctx *ctx, const flux_params *params) {
     free(text_emb);
 
     if (!latent) {
-        set_error("Sampling failed");
+        set_sampling_error();
         return NULL;
     }
 
     /* Decode */
     flux_image *result = NULL;
     if (ctx->vae) {
-        if (flux_phase_callback) flux_phase_callback("decoding image", 0);
-        result = flux_vae_decode(ctx->vae, latent, 1, latent_h, latent_w);
-        if (flux_phase_callback) flux_phase_callback("decoding image", 1);
+        result = decode_image(ctx, latent, latent_h, latent_w);
     }
 
     free(latent);
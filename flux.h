@@ -55,6 +55,7 @@ extern "C" {
  * ======================================================================== */
 
 typedef struct flux_ctx flux_ctx;
+typedef struct flux_weights flux_weights;
 typedef struct flux_image flux_image;
 typedef struct flux_tokenizer flux_tokenizer;
 
@@ -82,12 +83,35 @@ typedef struct {
     int linear_schedule;    /* Use linear timestep schedule instead of shifted sigmoid */
     int power_schedule;     /* Use power curve timestep schedule */
     float power_alpha;      /* Exponent for power schedule (default: 2.0) */
+    int sampler;            /* FLUX_SAMPLER_* ODE solver (default: Euler) */
+    float tolerance;        /* Local error tolerance for FLUX_SAMPLER_ADAPTIVE (0 = default) */
+    float cfg_t_min;        /* CFG only for timesteps t >= cfg_t_min (default: 0) */
+    float cfg_t_max;        /* CFG only for timesteps t <= cfg_t_max (0 = 1.0) */
+    int cfg_reuse;          /* Reuse the uncond prediction for N more CFG evals (default: 0) */
+    int prog_levels;        /* Progressive resolution: start at 1/2^N size (0 = off, Euler only) */
+    float prog_t_end;       /* Timestep of the last resolution switch (0 = default) */
+    int noise;              /* FLUX_NOISE_* initial noise generator (default: xoshiro) */
 } flux_params;
 
+/* Samplers for flux_params.sampler */
+#define FLUX_SAMPLER_EULER      0   /* First-order Euler */
+#define FLUX_SAMPLER_DPMPP_2M   1   /* DPM-Solver++(2M) multistep */
+#define FLUX_SAMPLER_UNIPC      2   /* UniPC (bh2) predictor-corrector */
+#define FLUX_SAMPLER_ADAPTIVE   3   /* Heun-Euler pair, step size from tolerance */
+
+/* Initial noise generators for flux_params.noise */
+#define FLUX_NOISE_XOSHIRO      0   /* Sequential global xoshiro256** (reproduces older seeds) */
+#define FLUX_NOISE_PHILOX       1   /* Counter-based Philox, stateless and parallel */
+
+#define FLUX_DEFAULT_TOLERANCE  0.05f
+#define FLUX_DEFAULT_PROG_T_END 0.6f
+
 /* Default parameters */
 #define FLUX_DEFAULT_WIDTH  256
 #define FLUX_DEFAULT_HEIGHT 256
-#define FLUX_PARAMS_DEFAULT { FLUX_DEFAULT_WIDTH, FLUX_DEFAULT_HEIGHT, 0, -1, 0.0f, 0, 0, 2.0f }
+#define FLUX_PARAMS_DEFAULT { FLUX_DEFAULT_WIDTH, FLUX_DEFAULT_HEIGHT, 0, -1, 0.0f, 0, 0, 2.0f, \
+                              FLUX_SAMPLER_EULER, 0.0f, 0.0f, 0.0f, 0, 0, 0.0f, \
+                              FLUX_NOISE_XOSHIRO }
 
 /* ========================================================================
  * Core API
@@ -105,6 +129,49 @@ flux_ctx *flux_load_dir(const char *model_dir);
  */
 void flux_free(flux_ctx *ctx);
 
+/*
+ * Create a context that shares ctx's model weights but has its own work
+ * buffers, caches and statistics, so generations on different forks can
+ * run concurrently on separate threads (callbacks and flux_get_error() are
+ * per thread). The first fork moves all of ctx's models, loading any not
+ * loaded yet, into a shared flux_weights store (see below); contexts may
+ * then be freed in any order. Metal builds share one GPU backend, so run
+ * one generation at a time there.
+ */
+flux_ctx *flux_fork(flux_ctx *ctx);
+
+/*
+ * Shared weight store: the fully loaded text encoder, transformer and VAE
+ * of one model directory, immutable once loaded and reference counted.
+ * Every context created from it holds a reference and owns only its work
+ * buffers and caches, so N concurrent contexts cost one copy of the model.
+ *
+ *   flux_weights *w = flux_weights_load("path/to/model", 0);
+ *   flux_ctx *a = flux_new(w), *b = flux_new(w);
+ *   flux_weights_release(w);          (a and b keep the weights alive)
+ *   ... generate on a and b from different threads ...
+ *   flux_free(a); flux_free(b);       (the last one frees the weights)
+ */
+flux_weights *flux_weights_load(const char *model_dir, int use_mmap);
+
+/*
+ * Weights shared by ctx, moving its models into a new store on first use
+ * as flux_fork() does. The caller gets a new reference. Returns NULL on error.
+ */
+flux_weights *flux_get_weights(flux_ctx *ctx);
+
+/* Add a reference to w and return it. */
+flux_weights *flux_weights_retain(flux_weights *w);
+
+/* Drop a reference; the weights are freed with the last one. */
+void flux_weights_release(flux_weights *w);
+
+/*
+ * New context on shared weights, with the model's default settings and its
+ * own work buffers. Returns NULL on error.
+ */
+flux_ctx *flux_new(flux_weights *w);
+
 /*
  * Release the text encoder to free ~8GB of memory.
  * Call this after encoding if you don't need to encode more prompts.
@@ -112,6 +179,14 @@ void flux_free(flux_ctx *ctx);
  */
 void flux_release_text_encoder(flux_ctx *ctx);
 
+/*
+ * Keep the text encoder loaded after encoding instead of releasing it
+ * (default: released). For long-running processes that encode many
+ * prompts and can afford the memory; flux_release_text_encoder() still
+ * frees it on demand.
+ */
+void flux_set_keep_text_encoder(flux_ctx *ctx, int keep);
+
 /*
  * Enable mmap mode for text encoder (--mmap).
  * Uses memory-mapped bf16 weights directly instead of converting to f32.
@@ -120,6 +195,89 @@ void flux_release_text_encoder(flux_ctx *ctx);
  */
 void flux_set_mmap(flux_ctx *ctx, int enable);
 
+/*
+ * Memory estimate for one generation on a context (flux_estimate_memory).
+ * Sizes are bytes of anonymous memory (heap, converted weights), the part
+ * that counts against RAM and cgroup limits. Weights mmap'ed from the
+ * safetensors files are reported apart in mapped: the kernel can drop and
+ * re-read those pages. Contexts on one flux_weights store share the weight
+ * sizes; count them once per store.
+ */
+typedef struct {
+    size_t text_encoder;          /* Qwen3 weights while loaded */
+    size_t text_encoder_work;     /* Qwen3 work buffers during encoding */
+    size_t transformer_weights;   /* Resident transformer weights */
+    size_t transformer_work;      /* Transformer activations and work buffers */
+    size_t attention;             /* Attention scores (0 with flash attention) */
+    size_t vae_weights;
+    size_t vae_work;              /* Largest VAE encode/decode workspace */
+    size_t latents;               /* Embeddings, latents, references, output */
+    size_t mapped;                /* File-backed mmap weight pages */
+    size_t encode_peak;           /* Phase totals: text encoding, */
+    size_t denoise_peak;          /* denoising, */
+    size_t vae_peak;              /* reference encoding and decoding */
+    size_t peak;                  /* Largest phase total */
+} flux_memory_estimate;
+
+/*
+ * Estimate peak memory per phase of generating params (NULL = defaults)
+ * with num_refs reference images on ctx, for its backend, mmap and text
+ * encoder residency settings, without loading anything. For admission
+ * control: a job fits when peak plus what is already in use stays under
+ * the memory limit. Returns 0 on success, -1 on invalid arguments.
+ */
+int flux_estimate_memory(flux_ctx *ctx, const flux_params *params,
+                         const flux_image **refs, int num_refs,
+                         flux_memory_estimate *out);
+
+/*
+ * CPUs and memory this process may use, detected once: the affinity mask
+ * (cpuset) capped by a cgroup v1/v2 CPU quota, and physical RAM capped by a
+ * cgroup memory limit. Thread pools and BLAS are sized from cpus, memory
+ * policies (text encoder residency, convolution tiling) from memory_limit.
+ */
+typedef struct {
+    int cpus;                   /* Usable CPUs */
+    int online_cpus;            /* Online CPUs of the host */
+    int affinity_cpus;          /* CPUs in the affinity mask */
+    double cpu_quota;           /* cgroup CPU quota in CPUs (0 = none) */
+    int cgroup_version;         /* 1 or 2, 0 if not found */
+    size_t physical_memory;     /* Host RAM */
+    size_t cgroup_memory_limit; /* 0 = none */
+    size_t memory_limit;        /* Usable memory */
+    int numa_nodes;             /* NUMA nodes with usable CPUs (1 = not NUMA) */
+} flux_host_resources;
+
+const flux_host_resources *flux_get_host_resources(void);
+
+/* Memory available now: free RAM, capped by what the cgroup limit leaves. */
+size_t flux_available_memory(void);
+
+/*
+ * NUMA placement of weights on hosts with several nodes. Interleave spreads
+ * weight pages over all nodes, so every thread sees the average bandwidth
+ * instead of one socket serving all. Partition puts each row slice of a
+ * weight matrix on one node and binds the threads computing those output
+ * rows to it, so GEMMs read node-local weights; it suits the built-in GEMM
+ * threads (generic build) and OpenBLAS with one thread per node slice.
+ * Auto (default) interleaves on NUMA hosts. Set before loading weights;
+ * worker threads are bound to nodes whenever the policy is not off.
+ *
+ * Only weights loaded without mmap (flux_set_mmap(ctx, 0)) are placed.
+ * mmap'd weights, the default, stay in the page cache, which the kernel
+ * fills by the process's own memory policy and not by mbind() on the
+ * mapping; run the process under numactl --interleave=all to spread them.
+ */
+#define FLUX_NUMA_AUTO          0
+#define FLUX_NUMA_OFF           1
+#define FLUX_NUMA_INTERLEAVE    2
+#define FLUX_NUMA_PARTITION     3
+
+void flux_set_numa_policy(int policy);
+
+/* Policy in effect: never auto, and off on single-node hosts. */
+int flux_numa_policy(void);
+
 /*
  * Check if model is distilled (4-step) or base (50-step with CFG).
  * Returns 1 for distilled, 0 for base.
@@ -140,6 +298,35 @@ void flux_set_base_mode(flux_ctx *ctx);
 flux_image *flux_generate(flux_ctx *ctx, const char *prompt,
                           const flux_params *params);
 
+/*
+ * Two-pass hi-res text-to-image generation.
+ * Generates at base_scale times the requested size, upsamples the latent
+ * to the full size, re-noises it to timestep `denoise` and finishes with
+ * hires_steps steps at full size. Pass 0 for base_scale (0.5), denoise
+ * (0.6) or hires_steps (num_steps * denoise) to use the defaults. Speed
+ * and image quality against a single full-size pass have not been
+ * measured with real weights.
+ */
+flux_image *flux_generate_hires(flux_ctx *ctx, const char *prompt,
+                                const flux_params *params,
+                                float base_scale, float denoise, int hires_steps);
+
+/*
+ * Generate `count` variations of one prompt that share their first
+ * shared_steps denoising steps, then branch by replacing a `strength`
+ * fraction (0..1) of the noise with per-variation noise and finish each
+ * trajectory separately. Pass 0 for shared_steps (num_steps / 4) or
+ * strength (0.5) to use the defaults. Images are stored in
+ * out_images[0..count-1]; returns the number generated or -1 on error.
+ * out_saved_evals (may be NULL) receives the transformer evaluations
+ * saved compared to independent runs. Progressive resolution
+ * (prog_levels > 0) is not supported and fails with an error.
+ */
+int flux_generate_variations(flux_ctx *ctx, const char *prompt,
+                             const flux_params *params,
+                             int count, int shared_steps, float strength,
+                             flux_image **out_images, int *out_saved_evals);
+
 /*
  * Image-to-image generation.
  * Takes an input image and modifies it according to the prompt.
@@ -182,6 +369,187 @@ flux_image *flux_generate_with_embeddings_and_noise(flux_ctx *ctx,
                                                      const float *noise, int noise_size,
                                                      const flux_params *params);
 
+/*
+ * Text-to-image sampling without decoding, for callers that run the text
+ * encoder and VAE themselves (e.g. on other threads). Base models need
+ * uncond_emb, the empty-prompt encoding, for CFG; distilled models ignore
+ * it. Returns the latent [128, out_h, out_w] (free with flux_free_buffer();
+ * decode with flux_decode_latent), or NULL on error.
+ */
+float *flux_generate_latent_with_embeddings(flux_ctx *ctx,
+                                            const float *text_emb, int text_seq,
+                                            const float *uncond_emb, int uncond_seq,
+                                            const flux_params *params,
+                                            int *out_h, int *out_w);
+
+/* ========================================================================
+ * Sampling Checkpoints
+ * ======================================================================== */
+
+/*
+ * Latent state of a text-to-image run after `step` denoising steps.
+ * Enough to continue the same trajectory (with the original or a longer
+ * schedule tail) or to re-decode the final latent without re-sampling.
+ */
+typedef struct {
+    int latent_h, latent_w;     /* Latent grid (image size / 16) */
+    int step;                   /* Steps completed */
+    int num_steps;              /* Steps in schedule */
+    float t;                    /* Timestep of the latent (0 = fully denoised) */
+    int64_t seed;               /* Seed of the initial noise */
+    uint64_t cond_hash;         /* Hash of the model name and prompt */
+    float *schedule;            /* [num_steps + 1] */
+    float *latent;              /* [FLUX_LATENT_CHANNELS, latent_h, latent_w] */
+} flux_checkpoint;
+
+/*
+ * Record a checkpoint every `every` steps, and after the final step,
+ * during flux_generate() and flux_generate_resume(). 0 disables (default).
+ * Checkpoints of the previous run are dropped when a new run starts.
+ */
+void flux_set_checkpoint_interval(flux_ctx *ctx, int every);
+
+/*
+ * Checkpoints recorded by the last run on ctx, oldest first. Index -1
+ * returns the latest. The checkpoint is owned by ctx.
+ */
+int flux_checkpoint_count(flux_ctx *ctx);
+const flux_checkpoint *flux_get_checkpoint(flux_ctx *ctx, int index);
+
+/*
+ * Save / load a checkpoint as a small binary file (header, schedule and
+ * float32 latent). Save returns 0 on success, -1 on error; load returns
+ * NULL on error. Free loaded checkpoints with flux_checkpoint_free().
+ */
+int flux_checkpoint_save(const flux_checkpoint *ck, const char *path);
+flux_checkpoint *flux_checkpoint_load(const char *path);
+void flux_checkpoint_free(flux_checkpoint *ck);
+
+/*
+ * Continue a text-to-image run from a checkpoint. The prompt must encode
+ * to the same embedding as the original (checked by hash). If
+ * params->num_steps is 0 or equal to the checkpoint's, the original
+ * schedule tail is used; otherwise the tail below the checkpoint's
+ * timestep is taken from a fresh num_steps schedule. A fully denoised
+ * checkpoint is only decoded, and prompt may be NULL. Checkpoints do not
+ * store solver history, so an unfinished checkpoint cannot be resumed with
+ * the multistep samplers (DPM++2M, UniPC).
+ */
+flux_image *flux_generate_resume(flux_ctx *ctx, const char *prompt,
+                                 const flux_checkpoint *ck,
+                                 const flux_params *params);
+
+/* ========================================================================
+ * Continuous Batching Engine
+ * ======================================================================== */
+
+/*
+ * Serves many text-to-image requests at once. New requests are admitted
+ * between steps, and each flux_engine_step() runs one transformer forward
+ * over every active request (at most max_active), whatever step each one
+ * is at, with per-request timestep modulation and Euler update. Finished
+ * latents are decoded by the VAE in the same call. Euler only: requests
+ * with another sampler, cfg_reuse or progressive levels are rejected, and
+ * checkpoint intervals do not apply. Base models get CFG (guidance window
+ * included) as an extra packed evaluation per request. Besides max_active,
+ * admission is limited by the estimated work memory of the active
+ * requests (4 GB, less under a tighter memory limit); the packed work
+ * buffers are released whenever the engine drains.
+ */
+typedef struct flux_engine flux_engine;
+
+/* max_active <= 0 selects the default (8). Returns NULL on error. */
+flux_engine *flux_engine_new(flux_ctx *ctx, int max_active);
+void flux_engine_free(flux_engine *eng);
+
+/*
+ * Queue a request. Returns its id (> 0), or -1 on error. The prompt is
+ * encoded immediately; the embeddings variant copies text_emb.
+ */
+int flux_engine_submit(flux_engine *eng, const char *prompt, const flux_params *params);
+int flux_engine_submit_embeddings(flux_engine *eng, const float *text_emb, int text_seq,
+                                  const flux_params *params);
+
+/*
+ * Admit waiting requests, run one denoising step for all active ones and
+ * decode those that finished. If the packed forward fails, each request
+ * is retried on its own and only those that fail again are retired
+ * (polled with a NULL image). Returns the number of requests still
+ * pending or active (0 when idle), or -1 on error.
+ */
+int flux_engine_step(flux_engine *eng);
+
+/*
+ * Steps completed and total steps of request id. Returns 0, or -1 if the
+ * engine does not know the id (never submitted, or already polled).
+ */
+int flux_engine_progress(flux_engine *eng, int id, int *step, int *total);
+
+/*
+ * Take the next finished request, in completion order. Returns its image
+ * (caller frees; NULL if its denoising or decoding failed) and sets
+ * *out_id, or returns
+ * NULL with *out_id = 0 when nothing has finished.
+ */
+flux_image *flux_engine_poll(flux_engine *eng, int *out_id);
+
+/* ========================================================================
+ * Asynchronous Generation
+ * ======================================================================== */
+
+/*
+ * A generation running on its own thread. Cancellation and deadlines are
+ * cooperative: the transformer checks them between blocks, so a request
+ * stops within one block of being abandoned. Text encoding and VAE
+ * decoding run to completion once started.
+ */
+typedef struct flux_request flux_request;
+
+typedef enum {
+    FLUX_REQUEST_RUNNING = 0,
+    FLUX_REQUEST_DONE,          /* Image ready (flux_request_take_image) */
+    FLUX_REQUEST_FAILED,        /* See flux_request_error() */
+    FLUX_REQUEST_CANCELLED,     /* flux_request_cancel() */
+    FLUX_REQUEST_EXPIRED        /* Deadline passed */
+} flux_request_status;
+
+/* Completion callback, on the request's thread once its status is final.
+ * It may poll and take the image but must not free the request. */
+typedef void (*flux_request_cb_t)(flux_request *req, void *user);
+
+/*
+ * Start generating prompt (with num_refs reference images, which must stay
+ * valid until completion; 0 for text-to-image) on a new thread. params may
+ * be NULL for defaults. timeout is in seconds from now (0 = no deadline).
+ * ctx is in use until the request completes: run concurrent requests on
+ * separate contexts (flux_fork, flux_new). Returns NULL on error.
+ */
+flux_request *flux_submit(flux_ctx *ctx, const char *prompt,
+                          const flux_image **refs, int num_refs,
+                          const flux_params *params, double timeout,
+                          flux_request_cb_t on_done, void *user);
+
+/* Ask the request to stop; returns immediately. */
+void flux_request_cancel(flux_request *req);
+
+/* Current status, without blocking. */
+flux_request_status flux_request_poll(flux_request *req);
+
+/* Block until the request completes; returns its final status. */
+flux_request_status flux_request_wait(flux_request *req);
+
+/* Denoising steps completed and total steps (0 before sampling starts). */
+void flux_request_progress(flux_request *req, int *step, int *total);
+
+/* Take ownership of the finished image (NULL unless done, or if taken). */
+flux_image *flux_request_take_image(flux_request *req);
+
+/* Why a completed request has no image ("" while running or when done). */
+const char *flux_request_error(flux_request *req);
+
+/* Cancel if still running, wait for the thread, and free everything. */
+void flux_request_free(flux_request *req);
+
 /* ========================================================================
  * Image I/O
  * ======================================================================== */
@@ -206,6 +574,13 @@ int flux_image_save(const flux_image *img, const char *path);
  */
 int flux_image_save_with_seed(const flux_image *img, const char *path, int64_t seed);
 
+/*
+ * Encode image as PNG in memory, with the seed metadata of
+ * flux_image_save_with_seed(). Returns a buffer to free with
+ * flux_free_buffer() and its size in out_len, or NULL on error.
+ */
+uint8_t *flux_image_encode_png(const flux_image *img, int64_t seed, size_t *out_len);
+
 /*
  * Create a new image with given dimensions.
  */
@@ -230,6 +605,19 @@ flux_image *flux_image_resize(const flux_image *img, int new_width, int new_heig
  */
 void flux_set_seed(int64_t seed);
 
+/*
+ * Parse a sampler name ("euler", "dpm++2m", "unipc", "adaptive") into
+ * FLUX_SAMPLER_*. Returns -1 for unknown names.
+ */
+int flux_sampler_from_name(const char *name);
+
+/*
+ * Steps taken and transformer evaluations (both CFG branches counted) by
+ * the last generation on ctx. With FLUX_SAMPLER_ADAPTIVE these depend on
+ * the prompt and tolerance rather than on num_steps.
+ */
+void flux_last_step_count(flux_ctx *ctx, int *steps, int *evals);
+
 /*
  * Get model info string.
  */
@@ -246,7 +634,7 @@ int flux_text_dim(flux_ctx *ctx);
 int flux_is_non_commercial(flux_ctx *ctx);
 
 /*
- * Get last error message.
+ * Get the last error message of the calling thread.
  */
 const char *flux_get_error(void);
 
@@ -265,7 +653,7 @@ void flux_set_step_image_callback(flux_ctx *ctx, flux_step_image_cb_t callback);
 /*
  * Encode image to latent space using VAE encoder.
  * Returns latent tensor [1, 128, H/16, W/16].
- * Caller must free() the returned pointer.
+ * Caller must free the returned pointer with flux_free_buffer().
  */
 float *flux_encode_image(flux_ctx *ctx, const flux_image *img,
                          int *out_h, int *out_w);
@@ -279,7 +667,7 @@ flux_image *flux_decode_latent(flux_ctx *ctx, const float *latent,
 /*
  * Encode text prompt to embeddings.
  * Returns embedding tensor [1, seq_len, 7680].
- * Caller must free() the returned pointer.
+ * Caller must free the returned pointer with flux_free_buffer().
  */
 float *flux_encode_text(flux_ctx *ctx, const char *prompt, int *out_seq_len);
 
@@ -294,6 +682,13 @@ float *flux_denoise_step(flux_ctx *ctx, const float *z, float t,
                          const float *text_emb, int text_len,
                          int latent_h, int latent_w);
 
+/*
+ * Free a buffer the library returned (embeddings, latents, velocities,
+ * encoded PNGs). Plain free() also works but leaves the buffer counted
+ * by the memory accounting behind -v. Any malloc'd pointer is accepted.
+ */
+void flux_free_buffer(void *p);
+
 #ifdef __cplusplus
 }
 #endif
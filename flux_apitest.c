@@ -0,0 +1,326 @@
+/*
+ * FLUX API Checks
+ *
+ * Exact-output checks of the library API on a model directory, meant for
+ * the random-weight model from make_tiny_model.py (images are noise, but
+ * every path runs):
+ *
+ *   - forks: two forks generating concurrently on their own threads give
+ *     images bit-identical to the parent's
+ *   - abort: a generation abandoned from the abort callback at several
+ *     points, from the first text encoder layer to the last VAE level,
+ *     returns NULL, reports "Cancelled" and leaves the library's
+ *     heap (flux_mem) as it found it; the next run matches the first
+ *   - Philox noise: every size is a subsample of the same master grid,
+ *     whatever the global RNG did in between
+ *   - checkpoints: resuming a mid-run checkpoint, one of the context's
+ *     own or one saved to a file, gives the uninterrupted run's image, and
+ *     another prompt is refused
+ *   - packed engine: requests of different sizes denoised together in one
+ *     packed forward per step give the images flux_generate() gives alone
+ *
+ * Usage:
+ *   make apitest                      (builds the tiny model if needed)
+ *   ./flux_apitest /tmp/flux-tiny
+ */
+
+#include "flux.h"
+#include "flux_kernels.h"
+#include "flux_mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+
+#define TEST_SIZE   64
+#define TEST_STEPS  4
+#define TEST_SEED   42
+#define TEST_PROMPT "a small red boat"
+
+extern float *flux_init_noise(int batch, int channels, int h, int w, int64_t seed);
+extern float *flux_init_noise_philox(int batch, int channels, int h, int w, int64_t seed);
+
+static int g_failed = 0;
+
+static void check(int ok, const char *what) {
+    printf("  %-58s %s\n", what, ok ? "ok" : "FAIL");
+    if (!ok) g_failed++;
+}
+
+static flux_params test_params(void) {
+    flux_params p = FLUX_PARAMS_DEFAULT;
+    p.width = TEST_SIZE;
+    p.height = TEST_SIZE;
+    p.num_steps = TEST_STEPS;
+    p.seed = TEST_SEED;
+    return p;
+}
+
+static int same_image(const flux_image *a, const flux_image *b) {
+    return a && b && a->width == b->width && a->height == b->height &&
+           a->channels == b->channels &&
+           memcmp(a->data, b->data, (size_t)a->width * a->height * a->channels) == 0;
+}
+
+static size_t heap_bytes(void) {
+    flux_mem_stats total;
+    flux_mem_get_stats(NULL, &total);
+    return total.current;
+}
+
+/* ========================================================================
+ * Philox Noise
+ * ======================================================================== */
+
+static void test_philox(void) {
+    printf("Philox noise:\n");
+    int c = FLUX_LATENT_CHANNELS, m = 112;
+    float *master = flux_init_noise_philox(1, c, m, m, TEST_SEED);
+    int sizes[3][2] = {{4, 4}, {8, 12}, {40, 24}};
+    int ok = master != NULL;
+    for (int s = 0; s < 3 && ok; s++) {
+        int h = sizes[s][0], w = sizes[s][1];
+        float *n = flux_init_noise_philox(1, c, h, w, TEST_SEED);
+        for (int ch = 0; n && ch < c; ch++)
+            for (int y = 0; y < h; y++)
+                for (int x = 0; x < w; x++)
+                    if (n[((size_t)ch * h + y) * w + x] !=
+                        master[((size_t)ch * m + y * m / h) * m + x * m / w]) ok = 0;
+        if (!n) ok = 0;
+        free(n);
+    }
+    check(ok, "every size subsamples the 112x112 master grid");
+
+    /* Draws from the global generator must not shift Philox */
+    float *before = flux_init_noise_philox(1, c, 8, 8, TEST_SEED);
+    free(flux_init_noise(1, c, 8, 8, TEST_SEED + 1));
+    float *after = flux_init_noise_philox(1, c, 8, 8, TEST_SEED);
+    check(before && after && memcmp(before, after, (size_t)c * 64 * sizeof(float)) == 0,
+          "independent of the global RNG state");
+    free(before);
+    free(after);
+    free(master);
+}
+
+/* ========================================================================
+ * Checkpoints
+ * ======================================================================== */
+
+static void test_checkpoints(flux_ctx *ctx, const flux_image *ref) {
+    printf("Checkpoint resume:\n");
+    flux_params p = test_params();
+    flux_set_checkpoint_interval(ctx, TEST_STEPS / 2);
+    flux_image *img = flux_generate(ctx, TEST_PROMPT, &p);
+    flux_set_checkpoint_interval(ctx, 0);
+    check(same_image(img, ref), "recording checkpoints leaves the image unchanged");
+    flux_image_free(img);
+
+    const flux_checkpoint *ck = flux_checkpoint_count(ctx) > 0 ?
+                                flux_get_checkpoint(ctx, 0) : NULL;
+    check(ck && ck->step == TEST_STEPS / 2, "checkpoint recorded mid-run");
+    if (!ck) return;
+
+    const char *path = "/tmp/flux_apitest.ckpt";
+    flux_checkpoint *loaded = flux_checkpoint_save(ck, path) == 0 ?
+                              flux_checkpoint_load(path) : NULL;
+    check(loaded && loaded->step == ck->step &&
+          memcmp(loaded->latent, ck->latent, (size_t)FLUX_LATENT_CHANNELS *
+                 ck->latent_h * ck->latent_w * sizeof(float)) == 0,
+          "checkpoint file round trip");
+    if (!loaded) return;
+
+    p.num_steps = 0;    /* Keep the checkpoint's schedule */
+    img = flux_generate_resume(ctx, TEST_PROMPT, ck, &p);    /* Drops ck */
+    check(same_image(img, ref), "resume is bit-identical to the full run");
+    flux_image_free(img);
+    img = flux_generate_resume(ctx, TEST_PROMPT, loaded, &p);
+    check(same_image(img, ref), "resume from the file is bit-identical");
+    flux_image_free(img);
+    img = flux_generate_resume(ctx, "another prompt", loaded, &p);
+    check(img == NULL, "resume with another prompt is refused");
+    flux_image_free(img);
+    flux_checkpoint_free(loaded);
+    remove(path);
+}
+
+/* ========================================================================
+ * Abort
+ * ======================================================================== */
+
+static FLUX_THREAD_LOCAL int g_polls, g_abort_at;
+
+static int abort_after(void) {
+    return ++g_polls >= g_abort_at;
+}
+
+static void test_abort(flux_ctx *ctx, const flux_image *ref) {
+    printf("Abort:\n");
+    flux_params p = test_params();
+
+    /* Count the polls of a full run: text encoder layers come first, then
+     * sampler steps with their transformer blocks, then the VAE levels */
+    g_polls = 0;
+    g_abort_at = INT_MAX;
+    flux_abort_callback = abort_after;
+    flux_image_free(flux_generate(ctx, TEST_PROMPT, &p));
+    flux_abort_callback = NULL;
+    int total = g_polls;
+
+    int points[5] = {1, total / 4, total / 2, total - 2, total};
+    int all_null = 1, all_cancelled = 1, no_leak = 1;
+    for (int i = 0; i < 5; i++) {
+        size_t heap = heap_bytes();
+        g_polls = 0;
+        g_abort_at = points[i];
+        flux_abort_callback = abort_after;
+        flux_image *img = flux_generate(ctx, TEST_PROMPT, &p);
+        flux_abort_callback = NULL;
+        if (img) all_null = 0;
+        if (strcmp(flux_get_error(), "Cancelled") != 0) all_cancelled = 0;
+        if (heap_bytes() != heap) {
+            no_leak = 0;
+            printf("    abort at poll %d: heap %zu -> %zu bytes\n",
+                   points[i], heap, heap_bytes());
+        }
+        flux_image_free(img);
+    }
+    check(all_null, "aborted generations return NULL");
+    check(all_cancelled, "and report \"Cancelled\"");
+    check(no_leak, "and free everything they allocated");
+
+    flux_image *img = flux_generate(ctx, TEST_PROMPT, &p);
+    check(same_image(img, ref), "the next run is bit-identical to the first");
+    flux_image_free(img);
+}
+
+/* ========================================================================
+ * Packed Engine
+ * ======================================================================== */
+
+static void test_engine(flux_ctx *ctx) {
+    printf("Packed engine:\n");
+    int sizes[3][2] = {{64, 64}, {96, 64}, {64, 128}};
+    flux_params p[3];
+    int ids[3];
+    flux_image *packed[3] = {NULL, NULL, NULL};
+
+    flux_engine *eng = flux_engine_new(ctx, 0);
+    int ok = eng != NULL;
+    for (int i = 0; i < 3 && ok; i++) {
+        p[i] = test_params();
+        p[i].width = sizes[i][0];
+        p[i].height = sizes[i][1];
+        p[i].seed = TEST_SEED + i;
+        ids[i] = flux_engine_submit(eng, TEST_PROMPT, &p[i]);
+        if (ids[i] <= 0) ok = 0;
+    }
+    check(ok, "three requests of different sizes submitted");
+
+    /* All three are admitted at once, so every step is one packed forward */
+    int running = ok, finished = 0;
+    while (running > 0) {
+        running = flux_engine_step(eng);
+        int id;
+        flux_image *img;
+        while ((img = flux_engine_poll(eng, &id)) != NULL || id != 0) {
+            for (int i = 0; i < 3; i++)
+                if (ids[i] == id) packed[i] = img;
+            finished++;
+        }
+    }
+    check(finished == 3, "all three finish");
+
+    int same = finished == 3;
+    for (int i = 0; i < 3; i++) {
+        flux_image *img = flux_generate(ctx, TEST_PROMPT, &p[i]);
+        if (!same_image(img, packed[i])) same = 0;
+        flux_image_free(img);
+        flux_image_free(packed[i]);
+    }
+    check(same, "packed images are bit-identical to sequential ones");
+    flux_engine_free(eng);
+}
+
+/* ========================================================================
+ * Forks
+ * ======================================================================== */
+
+typedef struct {
+    flux_ctx *ctx;
+    flux_image *img;
+} fork_job;
+
+static void *fork_thread(void *arg) {
+    fork_job *job = (fork_job *)arg;
+    flux_params p = test_params();
+    job->img = flux_generate(job->ctx, TEST_PROMPT, &p);
+    return NULL;
+}
+
+static void test_forks(flux_ctx *ctx, const flux_image *ref) {
+    printf("Forks:\n");
+    fork_job jobs[2] = {{flux_fork(ctx), NULL}, {flux_fork(ctx), NULL}};
+    check(jobs[0].ctx && jobs[1].ctx, "forks created");
+    if (!jobs[0].ctx || !jobs[1].ctx) {
+        flux_free(jobs[0].ctx);
+        flux_free(jobs[1].ctx);
+        return;
+    }
+
+    pthread_t threads[2];
+    int started[2];
+    for (int i = 0; i < 2; i++)
+        started[i] = pthread_create(&threads[i], NULL, fork_thread, &jobs[i]) == 0;
+    for (int i = 0; i < 2; i++)
+        if (started[i]) pthread_join(threads[i], NULL);
+    check(started[0] && started[1], "threads started");
+    check(same_image(jobs[0].img, ref) && same_image(jobs[1].img, ref),
+          "concurrent forks are bit-identical to the parent");
+
+    /* And the parent still is, after sharing its weights */
+    flux_params p = test_params();
+    flux_image *img = flux_generate(ctx, TEST_PROMPT, &p);
+    check(same_image(img, ref), "the parent is unchanged after forking");
+    flux_image_free(img);
+
+    for (int i = 0; i < 2; i++) {
+        flux_image_free(jobs[i].img);
+        flux_free(jobs[i].ctx);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s MODEL_DIR\n", argv[0]);
+        return 2;
+    }
+
+    test_philox();
+
+    flux_mem_enable(1);     /* For the abort leak check */
+    flux_ctx *ctx = flux_load_dir(argv[1]);
+    if (!ctx) {
+        fprintf(stderr, "Error: cannot load %s: %s\n", argv[1], flux_get_error());
+        return 1;
+    }
+    flux_params p = test_params();
+    flux_image *ref = flux_generate(ctx, TEST_PROMPT, &p);
+    if (!ref) {
+        fprintf(stderr, "Error: reference generation failed: %s\n", flux_get_error());
+        flux_free(ctx);
+        return 1;
+    }
+
+    test_checkpoints(ctx, ref);
+    test_abort(ctx, ref);
+    test_engine(ctx);
+    test_forks(ctx, ref);   /* Last: forking moves ctx's weights into a store */
+
+    flux_image_free(ref);
+    flux_free(ctx);
+
+    printf("%s\n", g_failed ? "API CHECKS FAILED" : "API CHECKS PASSED");
+    return g_failed ? 1 : 0;
+}
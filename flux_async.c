@@ -0,0 +1,199 @@
+/*
+ * FLUX Asynchronous Generation
+ *
+ * flux_submit() runs one generation on a thread of its own and returns a
+ * handle to poll, wait on, or cancel. Cancellation and deadlines are
+ * cooperative: the request thread installs flux_abort_callback, which the
+ * text encoder polls per layer, the sampler per step, the transformer per
+ * block and the VAE decoder per level, so an abandoned request stops
+ * within one block (milliseconds) in whichever stage it is.
+ */
+
+#include "flux.h"
+#include "flux_kernels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+struct flux_request {
+    flux_ctx *ctx;
+    char *prompt;
+    const flux_image **refs;
+    int num_refs;
+    flux_params params;
+    flux_request_cb_t on_done;
+    void *user;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    int cancel;                 /* Set by flux_request_cancel() (atomic) */
+    double deadline;            /* Monotonic seconds, 0 = none */
+    int step, total;            /* Progress (atomic) */
+
+    flux_request_status status; /* Under lock */
+    flux_image *image;
+    char error[256];
+};
+
+/* Request run by this thread, for the callbacks (which take no user data) */
+static FLUX_THREAD_LOCAL flux_request *g_request = NULL;
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int request_expired(const flux_request *r) {
+    return r->deadline > 0 && monotonic_seconds() >= r->deadline;
+}
+
+static int request_abort_callback(void) {
+    flux_request *r = g_request;
+    return __atomic_load_n(&r->cancel, __ATOMIC_RELAXED) || request_expired(r);
+}
+
+static void request_step_callback(int step, int total) {
+    flux_request *r = g_request;
+    __atomic_store_n(&r->total, total, __ATOMIC_RELAXED);
+    __atomic_store_n(&r->step, step > 0 ? step - 1 : 0, __ATOMIC_RELAXED);
+}
+
+static void *request_thread(void *arg) {
+    flux_request *r = (flux_request *)arg;
+    flux_image *img = NULL;
+
+    g_request = r;
+    flux_abort_callback = request_abort_callback;
+    flux_step_callback = request_step_callback;
+
+    if (!request_abort_callback()) {
+        if (r->num_refs > 0)
+            img = flux_multiref(r->ctx, r->prompt, r->refs, r->num_refs, &r->params);
+        else
+            img = flux_generate(r->ctx, r->prompt, &r->params);
+    }
+
+    /* A request that finished just as it was cancelled still counts as done */
+    flux_request_status status = FLUX_REQUEST_DONE;
+    const char *error = "";
+    if (!img) {
+        if (__atomic_load_n(&r->cancel, __ATOMIC_RELAXED)) {
+            status = FLUX_REQUEST_CANCELLED;
+            error = "Cancelled";
+        } else if (request_expired(r)) {
+            status = FLUX_REQUEST_EXPIRED;
+            error = "Deadline exceeded";
+        } else {
+            status = FLUX_REQUEST_FAILED;
+            error = flux_get_error();
+        }
+    } else {
+        __atomic_store_n(&r->step, __atomic_load_n(&r->total, __ATOMIC_RELAXED),
+                         __ATOMIC_RELAXED);
+    }
+
+    flux_abort_callback = NULL;
+    flux_step_callback = NULL;
+    g_request = NULL;
+
+    pthread_mutex_lock(&r->lock);
+    r->image = img;
+    snprintf(r->error, sizeof(r->error), "%s", error);
+    r->status = status;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+
+    if (r->on_done) r->on_done(r, r->user);
+    return NULL;
+}
+
+flux_request *flux_submit(flux_ctx *ctx, const char *prompt,
+                          const flux_image **refs, int num_refs,
+                          const flux_params *params, double timeout,
+                          flux_request_cb_t on_done, void *user) {
+    if (!ctx || !prompt || num_refs < 0 || (num_refs > 0 && !refs)) return NULL;
+
+    flux_request *r = (flux_request *)calloc(1, sizeof(flux_request));
+    if (!r) return NULL;
+    r->ctx = ctx;
+    r->prompt = strdup(prompt);
+    r->refs = refs;
+    r->num_refs = num_refs;
+    if (params) {
+        r->params = *params;
+    } else {
+        flux_params defaults = FLUX_PARAMS_DEFAULT;
+        r->params = defaults;
+    }
+    r->on_done = on_done;
+    r->user = user;
+    r->deadline = timeout > 0 ? monotonic_seconds() + timeout : 0;
+    r->status = FLUX_REQUEST_RUNNING;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+
+    if (!r->prompt || pthread_create(&r->thread, NULL, request_thread, r) != 0) {
+        pthread_mutex_destroy(&r->lock);
+        pthread_cond_destroy(&r->cond);
+        free(r->prompt);
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+void flux_request_cancel(flux_request *req) {
+    if (req) __atomic_store_n(&req->cancel, 1, __ATOMIC_RELAXED);
+}
+
+flux_request_status flux_request_poll(flux_request *req) {
+    if (!req) return FLUX_REQUEST_FAILED;
+    pthread_mutex_lock(&req->lock);
+    flux_request_status status = req->status;
+    pthread_mutex_unlock(&req->lock);
+    return status;
+}
+
+flux_request_status flux_request_wait(flux_request *req) {
+    if (!req) return FLUX_REQUEST_FAILED;
+    pthread_mutex_lock(&req->lock);
+    while (req->status == FLUX_REQUEST_RUNNING)
+        pthread_cond_wait(&req->cond, &req->lock);
+    flux_request_status status = req->status;
+    pthread_mutex_unlock(&req->lock);
+    return status;
+}
+
+void flux_request_progress(flux_request *req, int *step, int *total) {
+    *step = req ? __atomic_load_n(&req->step, __ATOMIC_RELAXED) : 0;
+    *total = req ? __atomic_load_n(&req->total, __ATOMIC_RELAXED) : 0;
+}
+
+flux_image *flux_request_take_image(flux_request *req) {
+    if (!req) return NULL;
+    pthread_mutex_lock(&req->lock);
+    flux_image *img = req->image;
+    req->image = NULL;
+    pthread_mutex_unlock(&req->lock);
+    return img;
+}
+
+const char *flux_request_error(flux_request *req) {
+    return req ? req->error : "Invalid request";
+}
+
+void flux_request_free(flux_request *req) {
+    if (!req) return;
+    flux_request_cancel(req);
+    pthread_join(req->thread, NULL);
+    flux_image_free(req->image);
+    pthread_mutex_destroy(&req->lock);
+    pthread_cond_destroy(&req->cond);
+    free(req->prompt);
+    free(req);
+}
@@ -0,0 +1,710 @@
+/*
+ * FLUX Kernel Benchmarks
+ *
+ * Times the hot kernels at the shapes the models run (1024x1024 output:
+ * 4096 image + 512 text tokens, Qwen3 at 512 tokens, VAE at full
+ * resolution) on synthetic data, so kernel changes can be measured
+ * without the model weights or a full generation.
+ *
+ * Each case runs once to warm up, then repeatedly for --min-time seconds;
+ * the median run is reported with GFLOP/s and GB/s. The GB/s figure is
+ * the minimum traffic (inputs, weights and outputs once each), so it is
+ * a lower bound on what the kernel actually moves.
+ *
+ * --json writes the results; --baseline compares against an earlier
+ * --json file and exits non-zero when a case got slower than --tolerance.
+ *
+ * Usage:
+ *   make bench BENCH_ARGS="--json base.json"
+ *   make bench BENCH_ARGS="--baseline base.json"
+ *   ./flux_bench --quick --filter linear
+ */
+
+#include "flux.h"
+#include "flux_kernels.h"
+#include "flux_safetensors.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <unistd.h>
+
+#ifdef USE_METAL
+#include "flux_metal.h"
+#endif
+
+#if defined(USE_BLAS) && !defined(__APPLE__)
+extern void openblas_set_num_threads(int num_threads);
+#endif
+
+#define BENCH_MAX_CASES     64
+#define BENCH_MAX_RUNS      100
+
+typedef struct {
+    char name[80];
+    double ms;              /* Median run */
+    double best_ms;
+    double gflops;          /* 0 for memory-bound kernels */
+    double gbs;
+    int runs;
+    double base_ms;         /* From --baseline, 0 = no match */
+} bench_result;
+
+static bench_result g_results[BENCH_MAX_CASES];
+static int g_num_results = 0;
+static const char *g_filter = NULL;
+static double g_min_time = 1.0;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Deterministic fill in [-scale, scale] */
+static uint64_t g_rng = 0x9e3779b97f4a7c15ULL;
+
+static void fill(float *p, size_t n, float scale) {
+    for (size_t i = 0; i < n; i++) {
+        g_rng ^= g_rng << 13;
+        g_rng ^= g_rng >> 7;
+        g_rng ^= g_rng << 17;
+        p[i] = ((float)(g_rng >> 40) / (float)(1 << 24) * 2.0f - 1.0f) * scale;
+    }
+}
+
+static float *alloc_filled(size_t n, float scale) {
+    float *p = (float *)malloc(n * sizeof(float));
+    if (!p) {
+        fprintf(stderr, "flux_bench: out of memory (%.1f MB)\n", n * 4 / 1e6);
+        exit(1);
+    }
+    fill(p, n, scale);
+    return p;
+}
+
+/* Check the filter before allocating, so skipped cases cost nothing */
+static int wanted(const char *name) {
+    return !g_filter || strstr(name, g_filter) != NULL;
+}
+
+/*
+ * Time run(arg). A warm-up run that already takes min_time is kept as the
+ * only sample: the large generic-build cases would otherwise take minutes.
+ */
+static void measure(const char *name, double flops, double bytes,
+                    void (*run)(void *), void *arg) {
+    double samples[BENCH_MAX_RUNS];
+    int n = 0;
+
+    double t0 = now_seconds();
+    run(arg);
+    double first = now_seconds() - t0;
+
+    if (first >= g_min_time) {
+        samples[n++] = first;
+    } else {
+        double spent = 0;
+        while (n < BENCH_MAX_RUNS && (n == 0 || spent < g_min_time)) {
+            t0 = now_seconds();
+            run(arg);
+            samples[n] = now_seconds() - t0;
+            spent += samples[n++];
+        }
+    }
+    qsort(samples, n, sizeof(double), cmp_double);
+
+    if (g_num_results >= BENCH_MAX_CASES) return;
+    bench_result *r = &g_results[g_num_results++];
+    memset(r, 0, sizeof(*r));
+    snprintf(r->name, sizeof(r->name), "%s", name);
+    double median = samples[n / 2];
+    r->ms = median * 1e3;
+    r->best_ms = samples[0] * 1e3;
+    r->gflops = flops / median / 1e9;
+    r->gbs = bytes / median / 1e9;
+    r->runs = n;
+
+    char gflops[16] = "-";
+    if (flops > 0) snprintf(gflops, sizeof(gflops), "%.1f", r->gflops);
+    printf("%-44s %10.3f ms %9s GFLOP/s %8.1f GB/s  (%d runs)\n",
+           r->name, r->ms, gflops, r->gbs, r->runs);
+    fflush(stdout);
+}
+
+/* ========================================================================
+ * Linear layers
+ * ======================================================================== */
+
+typedef struct {
+    float *y, *x, *W;
+    uint16_t *W_bf16;
+    int seq, in, out;
+} linear_case;
+
+static void run_linear(void *arg) {
+    linear_case *c = (linear_case *)arg;
+    flux_linear_nobias(c->y, c->x, c->W, c->seq, c->in, c->out);
+}
+
+static void run_linear_bf16(void *arg) {
+    linear_case *c = (linear_case *)arg;
+    flux_linear_nobias_bf16(c->y, c->x, c->W_bf16, c->seq, c->in, c->out);
+}
+
+static void bench_linear(const char *label, int seq, int in, int out, int bf16) {
+    char name[80];
+    snprintf(name, sizeof(name), "linear%s.%s[%dx%dx%d]",
+             bf16 ? "_bf16" : "", label, seq, in, out);
+    if (!wanted(name)) return;
+
+    linear_case c = {.seq = seq, .in = in, .out = out};
+    size_t wn = (size_t)out * in;
+    c.x = alloc_filled((size_t)seq * in, 1.0f);
+    c.y = alloc_filled((size_t)seq * out, 0.0f);
+    if (bf16) {
+        float *W = alloc_filled(wn, 0.02f);
+        c.W_bf16 = (uint16_t *)malloc(wn * sizeof(uint16_t));
+        for (size_t i = 0; i < wn; i++) {
+            uint32_t bits;
+            memcpy(&bits, &W[i], 4);
+            c.W_bf16[i] = (uint16_t)(bits >> 16);
+        }
+        free(W);
+        flux_numa_place(c.W_bf16, out, (size_t)in * sizeof(uint16_t));
+    } else {
+        c.W = alloc_filled(wn, 0.02f);
+        flux_numa_place(c.W, out, (size_t)in * sizeof(float));
+    }
+
+    double flops = 2.0 * seq * in * out;
+    double bytes = ((double)seq * in + (double)seq * out) * 4 + wn * (bf16 ? 2 : 4);
+    measure(name, flops, bytes, bf16 ? run_linear_bf16 : run_linear, &c);
+
+    free(c.x); free(c.y); free(c.W); free(c.W_bf16);
+}
+
+/* ========================================================================
+ * Attention
+ * ======================================================================== */
+
+typedef struct {
+    float *q, *k, *v, *out, *scores;
+    int seq, heads, head_dim;
+} attn_case;
+
+static void run_flash_attention(void *arg) {
+    attn_case *c = (attn_case *)arg;
+    flux_flash_attention(c->out, c->q, c->k, c->v, c->seq, c->seq,
+                         c->heads, c->head_dim, 1.0f / sqrtf((float)c->head_dim));
+}
+
+/* Scores path used by the BLAS and Metal builds: per head
+ * softmax(Q K^T) V with the [seq, seq] matrix materialized */
+static void run_sdpa(void *arg) {
+    attn_case *c = (attn_case *)arg;
+    float scale = 1.0f / sqrtf((float)c->head_dim);
+    size_t head = (size_t)c->seq * c->head_dim;
+    int n = c->seq * c->seq;
+    for (int h = 0; h < c->heads; h++) {
+        flux_matmul_t(c->scores, c->q + h * head, c->k + h * head,
+                      c->seq, c->head_dim, c->seq);
+        for (int i = 0; i < n; i++) c->scores[i] *= scale;
+        flux_softmax(c->scores, c->seq, c->seq);
+        flux_matmul(c->out + h * head, c->scores, c->v + h * head,
+                    c->seq, c->seq, c->head_dim);
+    }
+}
+
+static void bench_attention(int seq, int heads, int head_dim) {
+    char flash[80], sdpa[80];
+    snprintf(flash, sizeof(flash), "attention.flash[%dx%dx%d]", seq, heads, head_dim);
+    snprintf(sdpa, sizeof(sdpa), "attention.sdpa[%dx%dx%d]", seq, heads, head_dim);
+    if (!wanted(flash) && !wanted(sdpa)) return;
+
+    attn_case c = {.seq = seq, .heads = heads, .head_dim = head_dim};
+    size_t n = (size_t)seq * heads * head_dim;
+    c.q = alloc_filled(n, 1.0f);
+    c.k = alloc_filled(n, 1.0f);
+    c.v = alloc_filled(n, 1.0f);
+    c.out = alloc_filled(n, 0.0f);
+
+    double flops = 4.0 * heads * (double)seq * seq * head_dim;
+    double bytes = 4.0 * n * 4;
+    if (wanted(flash)) measure(flash, flops, bytes, run_flash_attention, &c);
+    if (wanted(sdpa)) {
+        c.scores = alloc_filled((size_t)seq * seq, 0.0f);
+        /* Scores are written and read back twice per head */
+        measure(sdpa, flops, bytes + 4.0 * heads * (double)seq * seq * 4,
+                run_sdpa, &c);
+        free(c.scores);
+    }
+
+    free(c.q); free(c.k); free(c.v); free(c.out);
+}
+
+/* ========================================================================
+ * Convolution
+ * ======================================================================== */
+
+typedef struct {
+    float *out, *in, *w, *b;
+    int in_ch, out_ch, H, W, k;
+} conv_case;
+
+static void run_conv(void *arg) {
+    conv_case *c = (conv_case *)arg;
+    flux_conv2d(c->out, c->in, c->w, c->b, 1, c->in_ch, c->out_ch,
+                c->H, c->W, c->k, c->k, 1, c->k / 2);
+}
+
+static void bench_conv(const char *label, int in_ch, int out_ch, int side, int k) {
+    char name[80];
+    snprintf(name, sizeof(name), "conv2d.%s[%dx%d@%d k%d]",
+             label, in_ch, out_ch, side, k);
+    if (!wanted(name)) return;
+
+    conv_case c = {.in_ch = in_ch, .out_ch = out_ch, .H = side, .W = side, .k = k};
+    size_t hw = (size_t)side * side;
+    size_t wn = (size_t)out_ch * in_ch * k * k;
+    c.in = alloc_filled(in_ch * hw, 1.0f);
+    c.out = alloc_filled(out_ch * hw, 0.0f);
+    c.w = alloc_filled(wn, 0.02f);
+    c.b = alloc_filled(out_ch, 0.1f);
+
+    double flops = 2.0 * wn * hw;
+    double bytes = ((double)in_ch * hw + (double)out_ch * hw + wn) * 4;
+    measure(name, flops, bytes, run_conv, &c);
+
+    free(c.in); free(c.out); free(c.w); free(c.b);
+}
+
+/* ========================================================================
+ * Element-wise kernels: norms, RoPE, softmax, activations
+ * ======================================================================== */
+
+typedef struct {
+    float *out, *x, *w, *b;
+    int rows, cols, channels, side;
+} elem_case;
+
+static void run_rms_norm(void *arg) {
+    elem_case *c = (elem_case *)arg;
+    flux_rms_norm(c->out, c->x, c->w, c->rows, c->cols, 1e-6f);
+}
+
+static void run_group_norm(void *arg) {
+    elem_case *c = (elem_case *)arg;
+    flux_group_norm(c->out, c->x, c->w, c->b, 1, c->channels, c->side, c->side, 32, 1e-6f);
+}
+
+static void run_softmax(void *arg) {
+    elem_case *c = (elem_case *)arg;
+    flux_softmax(c->x, c->rows, c->cols);
+}
+
+static void run_rope(void *arg) {
+    elem_case *c = (elem_case *)arg;
+    flux_apply_rope(c->x, c->w, 1, c->rows, c->channels, c->cols);
+}
+
+static void run_silu_mul(void *arg) {
+    elem_case *c = (elem_case *)arg;
+    flux_silu_mul(c->x, c->w, c->rows * c->cols);
+}
+
+static void bench_rms_norm(int rows, int cols) {
+    char name[80];
+    snprintf(name, sizeof(name), "rms_norm[%dx%d]", rows, cols);
+    if (!wanted(name)) return;
+    size_t n = (size_t)rows * cols;
+    elem_case c = {.rows = rows, .cols = cols};
+    c.x = alloc_filled(n, 1.0f);
+    c.out = alloc_filled(n, 0.0f);
+    c.w = alloc_filled(cols, 1.0f);
+    measure(name, 4.0 * n, 8.0 * n, run_rms_norm, &c);
+    free(c.x); free(c.out); free(c.w);
+}
+
+static void bench_group_norm(int channels, int side) {
+    char name[80];
+    snprintf(name, sizeof(name), "group_norm[%d@%d]", channels, side);
+    if (!wanted(name)) return;
+    size_t n = (size_t)channels * side * side;
+    elem_case c = {.channels = channels, .side = side};
+    c.x = alloc_filled(n, 1.0f);
+    c.out = alloc_filled(n, 0.0f);
+    c.w = alloc_filled(channels, 1.0f);
+    c.b = alloc_filled(channels, 0.1f);
+    measure(name, 7.0 * n, 8.0 * n, run_group_norm, &c);
+    free(c.x); free(c.out); free(c.w); free(c.b);
+}
+
+static void bench_softmax(int rows, int cols) {
+    char name[80];
+    snprintf(name, sizeof(name), "softmax[%dx%d]", rows, cols);
+    if (!wanted(name)) return;
+    size_t n = (size_t)rows * cols;
+    elem_case c = {.rows = rows, .cols = cols};
+    /* Softmax is shift-invariant and normalized in place, so repeated
+     * runs on the same buffer stay finite */
+    c.x = alloc_filled(n, 4.0f);
+    measure(name, 4.0 * n, 8.0 * n, run_softmax, &c);
+    free(c.x);
+}
+
+static void bench_rope(int seq, int heads, int head_dim) {
+    char name[80];
+    snprintf(name, sizeof(name), "rope[%dx%dx%d]", seq, heads, head_dim);
+    if (!wanted(name)) return;
+    size_t n = (size_t)seq * heads * head_dim;
+    elem_case c = {.rows = seq, .channels = heads, .cols = head_dim};
+    c.x = alloc_filled(n, 1.0f);
+    /* Unit-length (cos, sin) pairs keep repeated rotations bounded */
+    c.w = (float *)malloc((size_t)seq * head_dim * sizeof(float));
+    for (size_t i = 0; i < (size_t)seq * head_dim / 2; i++) {
+        c.w[2 * i] = cosf(i * 0.01f);
+        c.w[2 * i + 1] = sinf(i * 0.01f);
+    }
+    measure(name, 3.0 * n, 8.0 * n + (double)seq * head_dim * 4, run_rope, &c);
+    free(c.x); free(c.w);
+}
+
+static void bench_silu_mul(int rows, int cols) {
+    char name[80];
+    snprintf(name, sizeof(name), "silu_mul[%dx%d]", rows, cols);
+    if (!wanted(name)) return;
+    size_t n = (size_t)rows * cols;
+    elem_case c = {.rows = rows, .cols = cols};
+    c.x = alloc_filled(n, 1.0f);
+    c.w = alloc_filled(n, 1.0f);
+    /* In place: |silu(g) * u| <= |g| for |u| <= 1, so repeated runs stay bounded */
+    measure(name, 5.0 * n, 12.0 * n, run_silu_mul, &c);
+    free(c.x); free(c.w);
+}
+
+/* ========================================================================
+ * Weight conversion and image I/O
+ * ======================================================================== */
+
+typedef struct {
+    safetensors_file_t *sf;
+    safetensor_t *t;
+} bf16_case;
+
+static void run_bf16_to_f32(void *arg) {
+    bf16_case *c = (bf16_case *)arg;
+    flux_free_buffer(safetensors_get_f32(c->sf, c->t));
+}
+
+/* The loader's bf16 -> f32 conversion (non-mmap loads, mmap block loads),
+ * including the allocation it makes, on an in-memory tensor */
+static void bench_bf16(int rows, int cols) {
+    char name[80];
+    snprintf(name, sizeof(name), "bf16_to_f32[%dx%d]", rows, cols);
+    if (!wanted(name)) return;
+    size_t n = (size_t)rows * cols;
+
+    safetensors_file_t *sf = (safetensors_file_t *)calloc(1, sizeof(safetensors_file_t));
+    safetensor_t *t = &sf->tensors[0];
+    sf->num_tensors = 1;
+    sf->data = malloc(8 + n * sizeof(uint16_t));
+    uint16_t *src = (uint16_t *)((char *)sf->data + 8);
+    for (size_t i = 0; i < n; i++) src[i] = 0x3c00 + (uint16_t)(i & 0xff);
+    t->dtype = DTYPE_BF16;
+    t->ndim = 2;
+    t->shape[0] = rows;
+    t->shape[1] = cols;
+    t->data_size = n * sizeof(uint16_t);
+
+    bf16_case c = {.sf = sf, .t = t};
+    measure(name, 0, 6.0 * n, run_bf16_to_f32, &c);
+    free(sf->data);
+    free(sf);
+}
+
+typedef struct {
+    flux_image *img;
+    char path[64];
+} png_case;
+
+static void run_png_encode(void *arg) {
+    png_case *c = (png_case *)arg;
+    size_t len;
+    flux_free_buffer(flux_image_encode_png(c->img, 42, &len));
+}
+
+static void run_png_decode(void *arg) {
+    png_case *c = (png_case *)arg;
+    flux_image_free(flux_image_load(c->path));
+}
+
+static void bench_png(int side) {
+    char enc[80], dec[80];
+    snprintf(enc, sizeof(enc), "png.encode[%dx%d]", side, side);
+    snprintf(dec, sizeof(dec), "png.decode[%dx%d]", side, side);
+    if (!wanted(enc) && !wanted(dec)) return;
+
+    /* Smooth gradients with noise in the low bits, like a generated image */
+    png_case c;
+    c.img = flux_image_create(side, side, 3);
+    for (int y = 0; y < side; y++) {
+        for (int x = 0; x < side; x++) {
+            uint8_t *p = c.img->data + ((size_t)y * side + x) * 3;
+            g_rng ^= g_rng << 13; g_rng ^= g_rng >> 7; g_rng ^= g_rng << 17;
+            p[0] = (uint8_t)((x * 255 / side) ^ (g_rng & 7));
+            p[1] = (uint8_t)((y * 255 / side) ^ ((g_rng >> 3) & 7));
+            p[2] = (uint8_t)(((x + y) * 127 / side) ^ ((g_rng >> 6) & 7));
+        }
+    }
+    double bytes = (double)side * side * 3;
+
+    if (wanted(enc)) measure(enc, 0, bytes, run_png_encode, &c);
+    if (wanted(dec)) {
+        snprintf(c.path, sizeof(c.path), "/tmp/flux_bench_%d.png", (int)getpid());
+        if (flux_image_save(c.img, c.path) == 0) {
+            measure(dec, 0, bytes, run_png_decode, &c);
+            unlink(c.path);
+        } else {
+            fprintf(stderr, "flux_bench: cannot write %s, skipping decode\n", c.path);
+        }
+    }
+    flux_image_free(c.img);
+}
+
+/* ========================================================================
+ * JSON output and baseline comparison
+ * ======================================================================== */
+
+static const char *backend_name(void) {
+#if defined(USE_METAL)
+    return "mps";
+#elif defined(USE_BLAS)
+    return "blas";
+#else
+    return "generic";
+#endif
+}
+
+static const char *numa_name(int policy) {
+    static const char *names[] = {"auto", "off", "interleave", "partition"};
+    return names[policy];
+}
+
+static int write_json(const char *path, int quick) {
+    FILE *f = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "flux_bench: cannot write %s\n", path);
+        return -1;
+    }
+    const flux_host_resources *host = flux_get_host_resources();
+    fprintf(f, "{\n  \"backend\": \"%s\",\n  \"quick\": %s,\n  \"threads\": %d,\n"
+               "  \"numa_nodes\": %d,\n  \"numa\": \"%s\",\n  \"results\": [\n",
+            backend_name(), quick ? "true" : "false", flux_num_threads(),
+            host->numa_nodes, numa_name(flux_numa_policy()));
+    for (int i = 0; i < g_num_results; i++) {
+        const bench_result *r = &g_results[i];
+        fprintf(f, "    {\"name\": \"%s\", \"ms\": %.4f, \"best_ms\": %.4f, "
+                   "\"gflops\": %.2f, \"gbs\": %.2f, \"runs\": %d}%s\n",
+                r->name, r->ms, r->best_ms, r->gflops, r->gbs, r->runs,
+                i + 1 < g_num_results ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    if (f != stdout) fclose(f);
+    return 0;
+}
+
+static char *read_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *buf = (char *)malloc(len + 1);
+    if (buf && fread(buf, 1, len, f) != (size_t)len) {
+        free(buf);
+        buf = NULL;
+    }
+    if (buf) buf[len] = '\0';
+    fclose(f);
+    return buf;
+}
+
+/* Look each result up by name in a file written by write_json() and flag
+ * those slower than tolerance percent. Returns the number of regressions. */
+static int compare_baseline(const char *path, double tolerance) {
+    char *json = read_file(path);
+    if (!json) {
+        fprintf(stderr, "flux_bench: cannot read baseline %s\n", path);
+        return -1;
+    }
+
+    int regressions = 0, matched = 0;
+    printf("\nCompared with %s (tolerance %.0f%%):\n", path, tolerance);
+    char backend[64];
+    snprintf(backend, sizeof(backend), "\"backend\": \"%s\"", backend_name());
+    if (!strstr(json, backend))
+        printf("  note: baseline was measured with a different backend\n");
+    for (int i = 0; i < g_num_results; i++) {
+        bench_result *r = &g_results[i];
+        char key[sizeof(r->name) + 16];
+        snprintf(key, sizeof(key), "\"name\": \"%.80s\"", r->name);
+        const char *p = strstr(json, key);
+        const char *ms = p ? strstr(p, "\"ms\":") : NULL;
+        if (!ms) continue;
+        r->base_ms = atof(ms + 5);
+        if (r->base_ms <= 0) continue;
+        matched++;
+
+        double change = (r->ms / r->base_ms - 1.0) * 100.0;
+        const char *flag = "";
+        if (change > tolerance) {
+            flag = "  REGRESSION";
+            regressions++;
+        } else if (change < -tolerance) {
+            flag = "  faster";
+        }
+        printf("%-44s %10.3f ms  was %10.3f ms  %+6.1f%%%s\n",
+               r->name, r->ms, r->base_ms, change, flag);
+    }
+    if (matched == 0)
+        printf("  no matching cases (different --quick or --filter?)\n");
+    else
+        printf("%d of %d cases slower than baseline\n", regressions, matched);
+
+    free(json);
+    return regressions;
+}
+
+/* ========================================================================
+ * Main
+ * ======================================================================== */
+
+static void print_usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options]\n\n", prog);
+    fprintf(stderr, "Times the FLUX kernels at model shapes on synthetic data.\n\n");
+    fprintf(stderr, "  -f, --filter STR      Only run cases whose name contains STR\n");
+    fprintf(stderr, "  -q, --quick           Smaller shapes (256x256 image, 128 text tokens)\n");
+    fprintf(stderr, "  -t, --min-time S      Seconds of timed runs per case (default: 1)\n");
+    fprintf(stderr, "  -j, --json FILE       Write results as JSON (- for stdout)\n");
+    fprintf(stderr, "  -b, --baseline FILE   Compare with an earlier --json file\n");
+    fprintf(stderr, "      --tolerance PCT   Slowdown reported as regression (default: 10)\n");
+    fprintf(stderr, "      --numa POLICY     Weight placement: auto, off, interleave, partition\n");
+    fprintf(stderr, "  -h, --help            Show this help\n");
+}
+
+int main(int argc, char **argv) {
+    static struct option long_options[] = {
+        {"filter",    required_argument, 0, 'f'},
+        {"quick",     no_argument,       0, 'q'},
+        {"min-time",  required_argument, 0, 't'},
+        {"json",      required_argument, 0, 'j'},
+        {"baseline",  required_argument, 0, 'b'},
+        {"tolerance", required_argument, 0, 256},
+        {"numa",      required_argument, 0, 257},
+        {"help",      no_argument,       0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int quick = 0;
+    const char *json_path = NULL, *baseline_path = NULL;
+    double tolerance = 10.0;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "f:qt:j:b:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'f': g_filter = optarg; break;
+            case 'q': quick = 1; break;
+            case 't': g_min_time = atof(optarg); break;
+            case 'j': json_path = optarg; break;
+            case 'b': baseline_path = optarg; break;
+            case 256: tolerance = atof(optarg); break;
+            case 257: {
+                int policy = -1;
+                for (int p = FLUX_NUMA_AUTO; p <= FLUX_NUMA_PARTITION; p++)
+                    if (strcmp(optarg, numa_name(p)) == 0) policy = p;
+                if (policy < 0) {
+                    fprintf(stderr, "Error: Unknown NUMA policy '%s'\n", optarg);
+                    return 1;
+                }
+                flux_set_numa_policy(policy);
+                break;
+            }
+            case 'h': print_usage(argv[0]); return 0;
+            default: print_usage(argv[0]); return 1;
+        }
+    }
+
+#ifdef USE_METAL
+    flux_metal_init();
+#endif
+#if defined(USE_BLAS) && !defined(__APPLE__)
+    if (flux_numa_policy() == FLUX_NUMA_PARTITION && !getenv("OPENBLAS_NUM_THREADS"))
+        openblas_set_num_threads(1);
+#endif
+
+    const flux_host_resources *host = flux_get_host_resources();
+    printf("Backend: %s | %d threads | %d NUMA node%s (%s)%s\n\n",
+           backend_name(), flux_num_threads(), host->numa_nodes,
+           host->numa_nodes == 1 ? "" : "s", numa_name(flux_numa_policy()),
+           quick ? " | quick" : "");
+
+    /* Shapes: FLUX.2 klein 4B at 1024x1024 (4096 image + 512 text tokens),
+     * Qwen3 4B at 512 tokens; --quick uses 256x256 and 128 tokens */
+    int side = quick ? 256 : 1024;
+    int txt = quick ? 128 : 512;
+    int img = (side / 16) * (side / 16);
+    int seq = img + txt;
+    int hidden = 3072, mlp = 9216, heads = 24, head_dim = 128;
+
+    bench_linear("dit.attn", img, hidden, hidden, 0);
+    bench_linear("dit.ff_in", img, hidden, 2 * mlp, 0);
+    bench_linear("dit.ff_out", img, mlp, hidden, 0);
+    bench_linear("dit.single_in", seq, hidden, 3 * hidden + 2 * mlp, 0);
+    bench_linear("dit.single_out", seq, hidden + mlp, hidden, 0);
+    bench_linear("dit.single_in", seq, hidden, 3 * hidden + 2 * mlp, 1);
+    bench_linear("qwen3.q", txt, 2560, 4096, 0);
+    bench_linear("qwen3.kv", txt, 2560, 1024, 0);
+    bench_linear("qwen3.o", txt, 4096, 2560, 0);
+    bench_linear("qwen3.gate_up", txt, 2560, 9728, 0);
+    bench_linear("qwen3.down", txt, 9728, 2560, 0);
+
+    /* 256x256, 512x512 and 1024x1024 with 512 text tokens */
+    bench_attention(768, heads, head_dim);
+    if (!quick) {
+        bench_attention(1536, heads, head_dim);
+        bench_attention(4608, heads, head_dim);
+    }
+
+    /* VAE decoder: latent at side/8, upsampled to full resolution */
+    bench_conv("vae.mid", 512, 512, side / 8, 3);
+    bench_conv("vae.up1", 512, 512, side / 4, 3);
+    bench_conv("vae.up2", 256, 256, side / 2, 3);
+    bench_conv("vae.up3", 128, 128, side, 3);
+    bench_conv("vae.out", 128, 3, side, 3);
+
+    bench_rms_norm(seq, hidden);
+    bench_group_norm(512, side / 4);
+    bench_softmax(heads * seq, seq);
+    bench_rope(seq, heads, head_dim);
+    bench_silu_mul(seq, mlp);
+
+    bench_bf16(quick ? 3 * hidden : 3 * hidden + 2 * mlp, hidden);
+    bench_png(side);
+
+    int status = 0;
+    if (json_path && write_json(json_path, quick) != 0) status = 1;
+    if (baseline_path) {
+        int regressions = compare_baseline(baseline_path, tolerance);
+        if (regressions != 0) status = 1;
+    }
+    return status;
+}
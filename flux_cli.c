@@ -61,6 +61,7 @@ typedef struct {
     int linear_schedule;
     int power_schedule;
     float power_alpha;
+    int sampler;
     int image_count;
     int show_enabled;
     int show_steps_enabled;
@@ -327,6 +328,7 @@ static int generate_image(const char *prompt, const char *ref_image,
     params.linear_schedule = state.linear_schedule;
     params.power_schedule = state.power_schedule;
     params.power_alpha = state.power_alpha;
+    params.sampler = state.sampler;
 
     /* Determine seed */
     int64_t actual_seed;
@@ -399,7 +401,7 @@ static int generate_image(const char *prompt, const char *ref_image,
                     flux_release_text_encoder(state.ctx);
                     img = flux_generate_with_embeddings(state.ctx, embeddings,
                                                          seq_len, &params);
-                    free(embeddings);
+                    flux_free_buffer(embeddings);
                 } else {
                     img = NULL;
                 }
@@ -444,6 +446,7 @@ static int generate_multiref(const char *prompt, const char **ref_paths, int num
     params.linear_schedule = state.linear_schedule;
     params.power_schedule = state.power_schedule;
     params.power_alpha = state.power_alpha;
+    params.sampler = state.sampler;
 
     /* Determine seed */
     int64_t actual_seed;
@@ -541,6 +544,7 @@ static void cmd_help(void) {
     printf("  !guidance <n>         Set CFG guidance scale (0 = auto)\n");
     printf("  !linear               Toggle linear timestep schedule\n");
     printf("  !power [alpha]        Toggle power schedule (default alpha: 2.0)\n");
+    printf("  !sampler <name>       Set sampler: euler, dpm++2m, unipc, adaptive\n");
     printf("  !explore <n> <prompt> Generate n thumbnail variations\n");
     printf("  !show                 Toggle terminal display\n");
     printf("  !show-steps           Toggle showing each denoising step\n");
@@ -766,6 +770,7 @@ static void cmd_explore(char *arg) {
     params.linear_schedule = state.linear_schedule;
     params.power_schedule = state.power_schedule;
     params.power_alpha = state.power_alpha;
+    params.sampler = state.sampler;
 
     if (!flux_is_distilled(state.ctx)) {
         /* Base model: use flux_generate() for CFG support */
@@ -821,7 +826,7 @@ static void cmd_explore(char *arg) {
             }
         }
 
-        free(embeddings);
+        flux_free_buffer(embeddings);
     }
 
     free(prompt_to_free);
@@ -902,6 +907,15 @@ static int process_command(char *line) {
                "power" : "shifted sigmoid");
         if (state.power_schedule)
             printf("Power alpha: %.1f\n", state.power_alpha);
+    } else if (starts_with_ci(cmd, "sampler")) {
+        char *arg = skip_spaces(cmd + 7);
+        int sampler = flux_sampler_from_name(arg);
+        if (sampler < 0) {
+            fprintf(stderr, "Unknown sampler. Use euler, dpm++2m, unipc or adaptive.\n");
+        } else {
+            state.sampler = sampler;
+            printf("Sampler: %s\n", arg);
+        }
     } else if (starts_with_ci(cmd, "explore")) {
         cmd_explore(cmd + 7);
     } else if (starts_with_ci(cmd, "show-steps") ||
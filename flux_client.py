@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""
+Test client for the flux generation server (flux -d model/ --serve SOCKET).
+Usage: python3 flux_client.py [--socket PATH] -p "prompt" [-o out.png] [options]
+
+Without -o the server returns the PNG bytes, which are written to
+--save (default: out.png). Progress events are printed as they arrive.
+"""
+
+import argparse
+import json
+import socket
+import sys
+
+
+def read_line(sock, buf):
+    while b"\n" not in buf:
+        chunk = sock.recv(65536)
+        if not chunk:
+            return None, buf
+        buf += chunk
+    line, _, rest = buf.partition(b"\n")
+    return json.loads(line), rest
+
+
+def read_bytes(sock, buf, n):
+    while len(buf) < n:
+        chunk = sock.recv(max(65536, n - len(buf)))
+        if not chunk:
+            raise RuntimeError("connection closed during image data")
+        buf += chunk
+    return buf[:n], buf[n:]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="flux --serve test client")
+    parser.add_argument("--socket", default="/tmp/flux.sock", help="Server socket path")
+    parser.add_argument("-p", "--prompt", help="Text prompt")
+    parser.add_argument("-o", "--output", help="Output path written by the server")
+    parser.add_argument("--save", default="out.png",
+                        help="Where to write returned PNG bytes when -o is not given")
+    parser.add_argument("-W", "--width", type=int)
+    parser.add_argument("-H", "--height", type=int)
+    parser.add_argument("-s", "--steps", type=int)
+    parser.add_argument("-S", "--seed", type=int)
+    parser.add_argument("-g", "--guidance", type=float)
+    parser.add_argument("--sampler")
+    parser.add_argument("--resume", help="Checkpoint file to continue from (server-side path)")
+    parser.add_argument("-i", "--input", action="append", default=[],
+                        help="Reference image (repeatable)")
+    parser.add_argument("--shutdown", action="store_true", help="Ask the server to exit")
+    args = parser.parse_args()
+
+    if args.shutdown:
+        request = {"shutdown": True}
+    else:
+        if not args.prompt:
+            parser.error("-p/--prompt is required")
+        request = {"prompt": args.prompt}
+        for key in ("output", "width", "height", "steps", "seed", "guidance", "sampler",
+                    "resume"):
+            value = getattr(args, key)
+            if value is not None:
+                request[key] = value
+        if args.input:
+            request["refs"] = args.input
+
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(args.socket)
+    sock.sendall(json.dumps(request).encode() + b"\n")
+
+    buf = b""
+    status = 1
+    while True:
+        event, buf = read_line(sock, buf)
+        if event is None:
+            break
+        kind = event.get("event")
+        if kind == "progress":
+            print(f"step {event['step']}/{event['total']}", file=sys.stderr)
+        elif kind == "phase":
+            if not event["done"]:
+                print(f"{event['phase']}...", file=sys.stderr)
+        elif kind == "done":
+            if "png_bytes" in event:
+                data, buf = read_bytes(sock, buf, event["png_bytes"])
+                with open(args.save, "wb") as f:
+                    f.write(data)
+                event["path"] = args.save
+            print(f"{event['path']} {event['width']}x{event['height']} "
+                  f"seed {event['seed']} ({event['seconds']:.2f}s)")
+            status = 0
+        elif kind == "error":
+            print(f"error: {event['message']}", file=sys.stderr)
+        else:
+            print(json.dumps(event), file=sys.stderr)
+            if kind == "shutdown":
+                status = 0
+    sock.close()
+    return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
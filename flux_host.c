@@ -0,0 +1,344 @@
+/*
+ * FLUX Host Resources
+ *
+ * CPUs and memory this process may actually use. Inside a container the
+ * host's core count and RAM are misleading: a cgroup CPU quota or cpuset
+ * and a cgroup memory limit apply instead. Both cgroup v1 and v2 are read,
+ * at the process's own cgroup and every ancestor up to the mount root,
+ * since a limit anywhere on the path applies.
+ *
+ * On multi-socket Linux hosts the NUMA layout is read from sysfs too, to
+ * place weights across nodes and bind worker threads to them.
+ */
+
+#define _GNU_SOURCE
+#include "flux.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+#define CGROUP_ROOT "/sys/fs/cgroup"
+#define NODE_ROOT "/sys/devices/system/node"
+#define MAX_NUMA_NODES 16
+
+/* mbind(2) modes and flags, as in <numaif.h> (libnuma is not required) */
+#define NUMA_MPOL_BIND          2
+#define NUMA_MPOL_INTERLEAVE    3
+#define NUMA_MPOL_MF_MOVE       (1 << 1)
+
+static flux_host_resources g_host;
+static char g_usage_path[1024];     /* Memory usage of our cgroup */
+static pthread_once_t g_host_once = PTHREAD_ONCE_INIT;
+
+/* NUMA nodes holding usable CPUs, in node id order */
+static int g_node_id[MAX_NUMA_NODES];
+#ifdef __linux__
+static cpu_set_t g_node_cpus[MAX_NUMA_NODES];   /* Within the affinity mask */
+#endif
+static int g_numa_policy = FLUX_NUMA_AUTO;
+
+/* Read the first line of path into buf. Returns 0 on success. */
+static int read_line(const char *path, char *buf, size_t size) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    int ok = fgets(buf, (int)size, f) != NULL;
+    fclose(f);
+    if (!ok) return -1;
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+/* Cgroup path of this process for a v1 controller, or for v2 when
+ * controller is NULL, from /proc/self/cgroup. Returns 0 if found. */
+static int cgroup_path(const char *controller, char *out, size_t size) {
+    FILE *f = fopen("/proc/self/cgroup", "r");
+    if (!f) return -1;
+    char line[1024];
+    int found = -1;
+    while (found != 0 && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        /* hierarchy-id:controller-list:path */
+        char *list = strchr(line, ':');
+        char *path = list ? strchr(list + 1, ':') : NULL;
+        if (!path) continue;
+        *path++ = '\0';
+        list++;
+        if (!controller) {
+            if (*list) continue;
+        } else {
+            int match = 0;
+            char *save = NULL;
+            for (char *tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save))
+                if (strcmp(tok, controller) == 0) match = 1;
+            if (!match) continue;
+        }
+        snprintf(out, size, "%s", path);
+        found = 0;
+    }
+    fclose(f);
+    return found;
+}
+
+/* Call fn on file in dir at the cgroup path and each of its ancestors up to
+ * the mount root (in a cgroup namespace the path is "/" and the root is our
+ * own cgroup). fn returns a limit or 0 for none; the smallest limit wins. */
+static double cgroup_min(const char *dir, const char *cgpath, const char *file,
+                         double (*fn)(const char *path)) {
+    char path[1024], rel[512];
+    double best = 0;
+    snprintf(rel, sizeof(rel), "%s", cgpath);
+    for (;;) {
+        size_t len = strlen(rel);
+        while (len > 0 && rel[len - 1] == '/') rel[--len] = '\0';
+        snprintf(path, sizeof(path), "%s%s/%s", dir, rel, file);
+        double v = fn(path);
+        if (v > 0 && (best == 0 || v < best)) best = v;
+        if (len == 0) break;
+        char *slash = strrchr(rel, '/');
+        if (!slash) break;
+        *slash = '\0';
+    }
+    return best;
+}
+
+/* cgroup v2 cpu.max: "quota period" or "max period" */
+static double read_cpu_max(const char *path) {
+    char buf[128];
+    if (read_line(path, buf, sizeof(buf)) != 0) return 0;
+    if (strncmp(buf, "max", 3) == 0) return 0;
+    double quota = 0, period = 0;
+    if (sscanf(buf, "%lf %lf", &quota, &period) != 2 || quota <= 0 || period <= 0)
+        return 0;
+    return quota / period;
+}
+
+/* cgroup v1 cpu.cfs_quota_us next to cpu.cfs_period_us; -1 = unlimited */
+static double read_cfs_quota(const char *path) {
+    char buf[64], period_path[1024];
+    if (read_line(path, buf, sizeof(buf)) != 0) return 0;
+    double quota = atof(buf);
+    if (quota <= 0) return 0;
+    snprintf(period_path, sizeof(period_path), "%.*s/cpu.cfs_period_us",
+             (int)(strrchr(path, '/') - path), path);
+    if (read_line(period_path, buf, sizeof(buf)) != 0) return 0;
+    double period = atof(buf);
+    return period > 0 ? quota / period : 0;
+}
+
+/* Memory limit in bytes; "max" and v1's huge "unlimited" value are none */
+static double read_memory_limit(const char *path) {
+    char buf[64];
+    if (read_line(path, buf, sizeof(buf)) != 0) return 0;
+    if (strncmp(buf, "max", 3) == 0) return 0;
+    double v = atof(buf);
+    return v > 0 && v < (double)(1ULL << 60) ? v : 0;
+}
+
+/* Set g_usage_path to file of our own cgroup, below the mount root or at it */
+static void find_usage_file(const char *dir, const char *cgpath, const char *file) {
+    snprintf(g_usage_path, sizeof(g_usage_path), "%s%s/%s",
+             dir, strcmp(cgpath, "/") == 0 ? "" : cgpath, file);
+    if (access(g_usage_path, R_OK) == 0) return;
+    snprintf(g_usage_path, sizeof(g_usage_path), "%s/%s", dir, file);
+    if (access(g_usage_path, R_OK) != 0) g_usage_path[0] = '\0';
+}
+
+/* Memory usage in bytes (memory.current, memory.usage_in_bytes) */
+static size_t read_memory_usage(const char *path) {
+    char buf[64];
+    if (read_line(path, buf, sizeof(buf)) != 0) return 0;
+    return (size_t)strtoull(buf, NULL, 10);
+}
+
+#ifdef __linux__
+/* Parse a sysfs CPU list ("0-23,48-71") into set */
+static void parse_cpulist(const char *list, cpu_set_t *set) {
+    CPU_ZERO(set);
+    const char *p = list;
+    while (*p) {
+        char *end;
+        long a = strtol(p, &end, 10), b = a;
+        if (end == p) break;
+        if (*end == '-') b = strtol(end + 1, &end, 10);
+        for (long c = a; c <= b && c < CPU_SETSIZE; c++) CPU_SET((int)c, set);
+        p = *end == ',' ? end + 1 : end;
+        if (*end != ',') break;
+    }
+}
+
+/* Nodes with CPUs this process may run on; 1 when not NUMA */
+static int detect_numa_nodes(void) {
+    cpu_set_t allowed, online;
+    char list[4096];
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 ||
+        read_line(NODE_ROOT "/online", list, sizeof(list)) != 0)
+        return 1;
+    parse_cpulist(list, &online);   /* Node ids, in the same list format */
+    int n = 0;
+    for (int id = 0; id < CPU_SETSIZE && n < MAX_NUMA_NODES; id++) {
+        if (!CPU_ISSET(id, &online)) continue;
+        char path[128];
+        snprintf(path, sizeof(path), NODE_ROOT "/node%d/cpulist", id);
+        if (read_line(path, list, sizeof(list)) != 0) continue;
+        cpu_set_t cpus;
+        parse_cpulist(list, &cpus);
+        CPU_AND(&cpus, &cpus, &allowed);
+        if (CPU_COUNT(&cpus) == 0) continue;   /* Memory-only or outside our cpuset */
+        g_node_id[n] = id;
+        g_node_cpus[n] = cpus;
+        n++;
+    }
+    return n > 0 ? n : 1;
+}
+#endif
+
+static void detect_host(void) {
+    flux_host_resources *h = &g_host;
+    char cg[512];
+
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    h->online_cpus = online > 0 ? (int)online : 1;
+    h->affinity_cpus = h->online_cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        int n = CPU_COUNT(&set);
+        if (n > 0 && n < h->affinity_cpus) h->affinity_cpus = n;
+    }
+#endif
+
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && page_size > 0)
+        h->physical_memory = (size_t)pages * (size_t)page_size;
+
+    double quota = 0, mem_limit = 0;
+    if (cgroup_path(NULL, cg, sizeof(cg)) == 0 &&
+        access(CGROUP_ROOT "/cgroup.controllers", F_OK) == 0) {
+        h->cgroup_version = 2;
+        quota = cgroup_min(CGROUP_ROOT, cg, "cpu.max", read_cpu_max);
+        mem_limit = cgroup_min(CGROUP_ROOT, cg, "memory.max", read_memory_limit);
+        find_usage_file(CGROUP_ROOT, cg, "memory.current");
+    } else {
+        if (cgroup_path("cpu", cg, sizeof(cg)) == 0) {
+            h->cgroup_version = 1;
+            quota = cgroup_min(CGROUP_ROOT "/cpu", cg, "cpu.cfs_quota_us", read_cfs_quota);
+        }
+        if (cgroup_path("memory", cg, sizeof(cg)) == 0) {
+            h->cgroup_version = 1;
+            mem_limit = cgroup_min(CGROUP_ROOT "/memory", cg, "memory.limit_in_bytes",
+                                   read_memory_limit);
+            find_usage_file(CGROUP_ROOT "/memory", cg, "memory.usage_in_bytes");
+        }
+    }
+
+    h->cpu_quota = quota;
+    h->cpus = h->affinity_cpus;
+    if (quota > 0) {
+        int q = (int)(quota + 0.999);  /* A 2.5 CPU quota keeps 3 threads busy */
+        if (q < 1) q = 1;
+        if (q < h->cpus) h->cpus = q;
+    }
+
+    h->numa_nodes = 1;
+#ifdef __linux__
+    h->numa_nodes = detect_numa_nodes();
+#endif
+
+    h->cgroup_memory_limit = (size_t)mem_limit;
+    h->memory_limit = h->physical_memory;
+    if (h->cgroup_memory_limit > 0 &&
+        (h->memory_limit == 0 || h->cgroup_memory_limit < h->memory_limit))
+        h->memory_limit = h->cgroup_memory_limit;
+}
+
+const flux_host_resources *flux_get_host_resources(void) {
+    pthread_once(&g_host_once, detect_host);
+    return &g_host;
+}
+
+size_t flux_available_memory(void) {
+    const flux_host_resources *h = flux_get_host_resources();
+    size_t avail = 0;
+#ifdef _SC_AVPHYS_PAGES
+    long pages = sysconf(_SC_AVPHYS_PAGES);
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && page_size > 0) avail = (size_t)pages * (size_t)page_size;
+#endif
+    if (h->cgroup_memory_limit > 0 && g_usage_path[0]) {
+        size_t used = read_memory_usage(g_usage_path);
+        size_t left = used < h->cgroup_memory_limit ? h->cgroup_memory_limit - used : 0;
+        if (avail == 0 || left < avail) avail = left;
+    }
+    return avail;
+}
+
+/* ========================================================================
+ * NUMA Placement
+ * ======================================================================== */
+
+void flux_set_numa_policy(int policy) {
+    g_numa_policy = policy;
+}
+
+int flux_numa_policy(void) {
+    if (flux_get_host_resources()->numa_nodes < 2) return FLUX_NUMA_OFF;
+    return g_numa_policy == FLUX_NUMA_AUTO ? FLUX_NUMA_INTERLEAVE : g_numa_policy;
+}
+
+#ifdef __linux__
+/* mbind() the whole pages inside [p, p + bytes) to mode over nodes
+ * [first, first + count), moving pages already touched */
+static void mbind_range(const void *p, size_t bytes, int mode, int first, int count) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)p + page - 1) & ~(uintptr_t)(page - 1);
+    uintptr_t end = ((uintptr_t)p + bytes) & ~(uintptr_t)(page - 1);
+    if (end <= start) return;
+    unsigned long mask[1024 / (8 * sizeof(unsigned long))] = {0};
+    for (int i = first; i < first + count; i++) {
+        int id = g_node_id[i];
+        mask[id / (8 * sizeof(unsigned long))] |= 1UL << (id % (8 * sizeof(unsigned long)));
+    }
+    /* Best effort: the kernel may lack NUMA support or refuse the move */
+    (void)syscall(SYS_mbind, (void *)start, (unsigned long)(end - start), mode,
+                  mask, (unsigned long)(sizeof(mask) * 8), NUMA_MPOL_MF_MOVE);
+}
+#endif
+
+void flux_numa_place(const void *p, size_t rows, size_t row_bytes) {
+#ifdef __linux__
+    int policy = flux_numa_policy();
+    if (!p || policy == FLUX_NUMA_OFF) return;
+    int nodes = flux_get_host_resources()->numa_nodes;
+    if (policy == FLUX_NUMA_INTERLEAVE || rows < (size_t)nodes) {
+        mbind_range(p, rows * row_bytes, NUMA_MPOL_INTERLEAVE, 0, nodes);
+        return;
+    }
+    /* Partition: node k holds the rows flux_parallel_for() hands its threads */
+    for (int k = 0; k < nodes; k++) {
+        size_t r0 = rows * k / nodes, r1 = rows * (k + 1) / nodes;
+        mbind_range((const char *)p + r0 * row_bytes, (r1 - r0) * row_bytes,
+                    NUMA_MPOL_BIND, k, 1);
+    }
+#else
+    (void)p; (void)rows; (void)row_bytes;
+#endif
+}
+
+int flux_numa_thread_attr(pthread_attr_t *attr, int t, int nthreads) {
+#ifdef __linux__
+    if (flux_numa_policy() == FLUX_NUMA_OFF || nthreads < 2) return 0;
+    int nodes = flux_get_host_resources()->numa_nodes;
+    int k = (int)((long long)t * nodes / nthreads);
+    return pthread_attr_setaffinity_np(attr, sizeof(cpu_set_t), &g_node_cpus[k]) == 0;
+#else
+    (void)attr; (void)t; (void)nthreads;
+    return 0;
+#endif
+}
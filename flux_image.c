@@ -9,11 +9,16 @@
  */
 
 #include "flux.h"
+#include "flux_kernels.h"
 #include "jpeg.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
+
+#define FLUX_MEM_DEFAULT FLUX_MEM_IMAGE
+#include "flux_mem.h"
 
 /* ========================================================================
  * Image Creation and Management
@@ -126,7 +131,7 @@ static int save_ppm(const flux_image *img, FILE *f) {
 
 /* CRC32 table for PNG */
 static uint32_t crc_table[256];
-static int crc_table_computed = 0;
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
 
 static void make_crc_table(void) {
     for (int n = 0; n < 256; n++) {
@@ -139,11 +144,10 @@ static void make_crc_table(void) {
         }
         crc_table[n] = c;
     }
-    crc_table_computed = 1;
 }
 
 static uint32_t update_crc(uint32_t crc, const uint8_t *buf, size_t len) {
-    if (!crc_table_computed) make_crc_table();
+    pthread_once(&crc_table_once, make_crc_table);
 
     uint32_t c = crc;
     for (size_t n = 0; n < len; n++) {
@@ -859,6 +863,7 @@ flux_image *flux_image_load(const char *path) {
 
     flux_image *img = NULL;
     const char *ext = get_extension(path);
+    FLUX_TRACE_BEGIN("image_load", "io");
 
     if (strcasecmp(ext, "png") == 0) {
         img = load_png(f);
@@ -882,6 +887,7 @@ flux_image *flux_image_load(const char *path) {
     }
 
     fclose(f);
+    FLUX_TRACE_END();
     return img;
 }
 
@@ -893,6 +899,7 @@ int flux_image_save(const flux_image *img, const char *path) {
 
     int result;
     const char *ext = get_extension(path);
+    FLUX_TRACE_BEGIN("image_save", "io");
 
     if (strcasecmp(ext, "png") == 0) {
         result = save_png(img, f);
@@ -904,6 +911,7 @@ int flux_image_save(const flux_image *img, const char *path) {
     }
 
     fclose(f);
+    FLUX_TRACE_END();
     return result;
 }
 
@@ -915,6 +923,7 @@ int flux_image_save_with_seed(const flux_image *img, const char *path, int64_t s
 
     int result;
     const char *ext = get_extension(path);
+    FLUX_TRACE_BEGIN("image_save", "io");
 
     if (strcasecmp(ext, "png") == 0) {
         result = save_png_with_metadata(img, f, seed, 1);
@@ -927,9 +936,30 @@ int flux_image_save_with_seed(const flux_image *img, const char *path, int64_t s
     }
 
     fclose(f);
+    FLUX_TRACE_END();
     return result;
 }
 
+uint8_t *flux_image_encode_png(const flux_image *img, int64_t seed, size_t *out_len) {
+    if (!img || !out_len) return NULL;
+
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *f = open_memstream(&buf, &len);
+    if (!f) return NULL;
+
+    FLUX_TRACE_BEGIN("png_encode", "io");
+    int result = save_png_with_metadata(img, f, seed, 1);
+    fclose(f);
+    FLUX_TRACE_END();
+    if (result != 0) {
+        free(buf);
+        return NULL;
+    }
+    *out_len = len;
+    return (uint8_t *)buf;
+}
+
 /* ========================================================================
  * Image Manipulation
  * ======================================================================== */
@@ -980,6 +1010,196 @@ flux_image *flux_image_resize(const flux_image *img, int new_width, int new_heig
     return resized;
 }
 
+/* ========================================================================
+ * Fused Resize + Normalize (VAE input)
+ *
+ * Resamples straight into the planar [3, H, W] float tensor the VAE encoder
+ * expects, skipping the intermediate uint8 image. The filter is separable:
+ * bilinear when upscaling, Lanczos3 widened by the scale factor when
+ * downscaling so that every source pixel contributes (no aliasing).
+ * ======================================================================== */
+
+typedef struct {
+    int *start;         /* First source index per output sample */
+    int *count;         /* Number of taps per output sample */
+    float *weights;     /* [out_size, max_taps], each row sums to 1 */
+    int max_taps;
+} resample_filter_t;
+
+static float lanczos3(float x) {
+    x = fabsf(x);
+    if (x < 1e-6f) return 1.0f;
+    if (x >= 3.0f) return 0.0f;
+    float px = 3.14159265f * x;
+    return 3.0f * sinf(px) * sinf(px / 3.0f) / (px * px);
+}
+
+static void resample_filter_free(resample_filter_t *f) {
+    free(f->start);
+    free(f->count);
+    free(f->weights);
+}
+
+static int resample_filter_init(resample_filter_t *f, int in_size, int out_size) {
+    float scale = (float)in_size / out_size;
+    int down = scale > 1.0f;
+    float support = down ? 3.0f * scale : 1.0f;
+
+    f->max_taps = 2 * (int)ceilf(support) + 1;
+    f->start = (int *)malloc(out_size * sizeof(int));
+    f->count = (int *)malloc(out_size * sizeof(int));
+    f->weights = (float *)malloc((size_t)out_size * f->max_taps * sizeof(float));
+    if (!f->start || !f->count || !f->weights) {
+        resample_filter_free(f);
+        return 0;
+    }
+
+    for (int o = 0; o < out_size; o++) {
+        float center = (o + 0.5f) * scale - 0.5f;
+        int lo = (int)ceilf(center - support);
+        int hi = (int)floorf(center + support);
+        if (lo < 0) lo = 0;
+        if (hi > in_size - 1) hi = in_size - 1;
+        if (hi - lo + 1 > f->max_taps) hi = lo + f->max_taps - 1;
+
+        float *w = f->weights + (size_t)o * f->max_taps;
+        float sum = 0.0f;
+        for (int i = lo; i <= hi; i++) {
+            float d = i - center;
+            float v = down ? lanczos3(d / scale) : 1.0f - fabsf(d);
+            if (v < 0.0f && !down) v = 0.0f;
+            w[i - lo] = v;
+            sum += v;
+        }
+
+        if (hi < lo || sum == 0.0f) {
+            /* Degenerate window: fall back to the nearest source sample */
+            int n = (int)floorf(center + 0.5f);
+            lo = n < 0 ? 0 : (n >= in_size ? in_size - 1 : n);
+            hi = lo;
+            w[0] = 1.0f;
+            sum = 1.0f;
+        }
+
+        f->start[o] = lo;
+        f->count[o] = hi - lo + 1;
+        for (int i = 0; i < f->count[o]; i++) w[i] /= sum;
+    }
+    return 1;
+}
+
+typedef struct {
+    const flux_image *img;
+    const resample_filter_t *fx, *fy;
+    float *tmp;         /* Horizontal pass output [3, in_h, out_w] */
+    float *out;         /* Final tensor [3, out_h, out_w] */
+    int out_w, out_h;
+} resize_job_t;
+
+/* Horizontal pass over source rows [start, end): uint8 interleaved -> planar */
+static void resize_rows_h(void *arg, int start, int end) {
+    resize_job_t *job = (resize_job_t *)arg;
+    const flux_image *img = job->img;
+    const resample_filter_t *fx = job->fx;
+    int W = img->width, H = img->height, C = img->channels;
+    int out_w = job->out_w;
+
+    for (int y = start; y < end; y++) {
+        const uint8_t *row = img->data + (size_t)y * W * C;
+        for (int c = 0; c < 3; c++) {
+            int sc = (C < 3) ? 0 : c;   /* Grayscale replicated to RGB */
+            float *dst = job->tmp + ((size_t)c * H + y) * out_w;
+            for (int x = 0; x < out_w; x++) {
+                const float *w = fx->weights + (size_t)x * fx->max_taps;
+                const uint8_t *src = row + (size_t)fx->start[x] * C + sc;
+                float sum = 0.0f;
+                for (int k = 0; k < fx->count[x]; k++)
+                    sum += w[k] * src[k * C];
+                dst[x] = sum;
+            }
+        }
+    }
+}
+
+/* Vertical pass over output rows [start, end), normalizing to [-1, 1] */
+static void resize_rows_v(void *arg, int start, int end) {
+    resize_job_t *job = (resize_job_t *)arg;
+    const resample_filter_t *fy = job->fy;
+    int H = job->img->height;
+    int out_w = job->out_w, out_h = job->out_h;
+
+    for (int y = start; y < end; y++) {
+        const float *w = fy->weights + (size_t)y * fy->max_taps;
+        for (int c = 0; c < 3; c++) {
+            float *dst = job->out + ((size_t)c * out_h + y) * out_w;
+            const float *src = job->tmp + ((size_t)c * H + fy->start[y]) * out_w;
+            for (int x = 0; x < out_w; x++) dst[x] = 0.0f;
+            for (int k = 0; k < fy->count[y]; k++) {
+                const float *row = src + (size_t)k * out_w;
+                float wk = w[k];
+                for (int x = 0; x < out_w; x++) dst[x] += wk * row[x];
+            }
+            for (int x = 0; x < out_w; x++) {
+                float v = dst[x] * (2.0f / 255.0f) - 1.0f;
+                dst[x] = v < -1.0f ? -1.0f : (v > 1.0f ? 1.0f : v);
+            }
+        }
+    }
+}
+
+/*
+ * Resize img to out_w x out_h and return the VAE input tensor [3, H, W]
+ * normalized to [-1, 1]. Equivalent to flux_image_resize() followed by
+ * flux_image_to_tensor(), without the intermediate image and with proper
+ * filtering when downscaling. Caller frees the result.
+ */
+float *flux_image_to_tensor_resized(const flux_image *img, int out_w, int out_h) {
+    if (!img || out_w <= 0 || out_h <= 0) return NULL;
+
+    int W = img->width, H = img->height, C = img->channels;
+    size_t plane = (size_t)out_w * out_h;
+    float *out = (float *)malloc(3 * plane * sizeof(float));
+    if (!out) return NULL;
+
+    if (W == out_w && H == out_h) {
+        for (size_t i = 0; i < plane; i++) {
+            const uint8_t *px = img->data + i * C;
+            for (int c = 0; c < 3; c++) {
+                float v = px[(C < 3) ? 0 : c];
+                out[c * plane + i] = v * (2.0f / 255.0f) - 1.0f;
+            }
+        }
+        return out;
+    }
+
+    resample_filter_t fx, fy;
+    if (!resample_filter_init(&fx, W, out_w)) {
+        free(out);
+        return NULL;
+    }
+    if (!resample_filter_init(&fy, H, out_h)) {
+        resample_filter_free(&fx);
+        free(out);
+        return NULL;
+    }
+    float *tmp = (float *)malloc(3 * (size_t)H * out_w * sizeof(float));
+    if (!tmp) {
+        resample_filter_free(&fx);
+        resample_filter_free(&fy);
+        free(out);
+        return NULL;
+    }
+
+    resize_job_t job = { img, &fx, &fy, tmp, out, out_w, out_h };
+    flux_parallel_for(H, resize_rows_h, &job);
+    flux_parallel_for(out_h, resize_rows_v, &job);
+
+    free(tmp);
+    resample_filter_free(&fx);
+    resample_filter_free(&fy);
+    return out;
+}
+
 /* Convert image to specific number of channels */
 flux_image *flux_image_convert(const flux_image *img, int new_channels) {
     if (!img || new_channels < 1 || new_channels > 4) return NULL;
@@ -5,11 +5,15 @@
  * Uses Metal/MPS on Apple Silicon, BLAS otherwise.
  */
 
+#include "flux.h"
 #include "flux_kernels.h"
+#include "flux_roofline.h"
 #include <math.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
 
 /* Use Metal for GPU acceleration on Apple Silicon */
 #ifdef USE_METAL
@@ -25,26 +29,43 @@
 #endif
 #endif
 
+#define FLUX_MEM_DEFAULT FLUX_MEM_WORK
+#include "flux_mem.h"
+
 /* Minimum matrix size to use GPU (smaller matrices are faster on CPU) */
 #define MIN_GPU_ELEMENTS (512 * 512)
 
 /* fast_expf is defined in flux_kernels.h */
 
-/* Progress callbacks - set by caller before inference */
-flux_substep_callback_t flux_substep_callback = NULL;
-flux_step_callback_t flux_step_callback = NULL;
-flux_phase_callback_t flux_phase_callback = NULL;
-flux_step_image_callback_t flux_step_image_callback = NULL;
-void *flux_step_image_vae = NULL;
-flux_text_progress_callback_t flux_text_progress_callback = NULL;
-flux_vae_progress_callback_t flux_vae_progress_callback = NULL;
+/* Progress callbacks - set by caller before inference, per thread */
+FLUX_THREAD_LOCAL flux_substep_callback_t flux_substep_callback = NULL;
+FLUX_THREAD_LOCAL flux_step_callback_t flux_step_callback = NULL;
+FLUX_THREAD_LOCAL flux_phase_callback_t flux_phase_callback = NULL;
+FLUX_THREAD_LOCAL flux_step_image_callback_t flux_step_image_callback = NULL;
+FLUX_THREAD_LOCAL void *flux_step_image_vae = NULL;
+FLUX_THREAD_LOCAL flux_step_latent_callback_t flux_step_latent_callback = NULL;
+FLUX_THREAD_LOCAL flux_text_progress_callback_t flux_text_progress_callback = NULL;
+FLUX_THREAD_LOCAL flux_vae_progress_callback_t flux_vae_progress_callback = NULL;
+FLUX_THREAD_LOCAL flux_abort_callback_t flux_abort_callback = NULL;
+
+void flux_phase_begin(const char *phase) {
+    FLUX_TRACE_BEGIN(phase, "phase");
+    flux_mem_phase_begin(phase);
+    if (flux_phase_callback) flux_phase_callback(phase, 0);
+}
+
+void flux_phase_end(const char *phase) {
+    if (flux_phase_callback) flux_phase_callback(phase, 1);
+    flux_mem_phase_end(phase);
+    FLUX_TRACE_END();
+}
 int flux_verbose = 0;
 
 /* ========================================================================
  * Random Number Generator (xoshiro256**)
  * ======================================================================== */
 
-static uint64_t rng_state[4] = {
+static FLUX_THREAD_LOCAL uint64_t rng_state[4] = {
     0x853c49e6748fea9bULL,
     0xda3e39cb94b95bdbULL,
     0x647c4677a2884327ULL,
@@ -103,6 +124,55 @@ void flux_rand(float *out, int n) {
     }
 }
 
+/* Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3") */
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+static inline void philox4x32_10(uint32_t c[4], uint64_t key) {
+    uint32_t k0 = (uint32_t)key, k1 = (uint32_t)(key >> 32);
+    for (int r = 0; r < 10; r++) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * c[0];
+        uint64_t p1 = (uint64_t)PHILOX_M1 * c[2];
+        uint32_t c1 = c[1], c3 = c[3];
+        c[0] = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        c[1] = (uint32_t)p1;
+        c[2] = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c[3] = (uint32_t)p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+}
+
+#define PHILOX_CHUNK 256
+
+void flux_philox_randn(float *out, const uint64_t *index, int n, uint64_t key) {
+    float u1[PHILOX_CHUNK], u2[PHILOX_CHUNK], z[PHILOX_CHUNK];
+
+    for (int base = 0; base < n; base += PHILOX_CHUNK) {
+        int len = n - base < PHILOX_CHUNK ? n - base : PHILOX_CHUNK;
+
+        /* Two 24-bit uniforms in (0, 1) per position */
+        for (int i = 0; i < len; i++) {
+            uint64_t idx = index[base + i];
+            uint32_t c[4] = { (uint32_t)idx, (uint32_t)(idx >> 32), 0, 0 };
+            philox4x32_10(c, key);
+            u1[i] = ((c[0] >> 8) + 0.5f) * (1.0f / 16777216.0f);
+            u2[i] = ((c[1] >> 8) + 0.5f) * (1.0f / 16777216.0f);
+        }
+        for (int i = len; i < PHILOX_CHUNK; i++) u1[i] = u2[i] = 0.5f;
+
+        /* Box-Muller on the whole chunk (branch-free, vectorizes). Always
+         * the full chunk: with a scalar tail the vector and scalar logf/cosf
+         * would round differently, and a position's value would depend on
+         * the row length, breaking size-independent noise. */
+        for (int i = 0; i < PHILOX_CHUNK; i++)
+            z[i] = sqrtf(-2.0f * logf(u1[i])) * cosf(2.0f * 3.14159265358979323846f * u2[i]);
+        memcpy(out + base, z, len * sizeof(float));
+    }
+}
+
 /* ========================================================================
  * Basic Element-wise Operations
  * ======================================================================== */
@@ -138,6 +208,9 @@ void flux_axpy(float *a, float scale, const float *b, int n) {
 void flux_matmul(float *C, const float *A, const float *B,
                  int M, int K, int N) {
     /* C[M,N] = A[M,K] @ B[K,N] */
+    FLUX_TRACE_BEGIN_ARGS("matmul", "gemm", "m,k,n", M, K, N);
+    FLUX_OP_BEGIN(op, FLUX_OP_LINEAR, 2.0 * M * K * N,
+                  4.0 * ((double)M * K + (double)K * N + (double)M * N));
 
 #ifdef USE_METAL
     size_t matrix_elements = (size_t)M * N;
@@ -149,6 +222,8 @@ void flux_matmul(float *C, const float *A, const float *B,
                          B, N,
                          0.0f,
                          C, N);
+        FLUX_OP_END(op);
+        FLUX_TRACE_END();
         return;
     }
 #endif
@@ -170,11 +245,16 @@ void flux_matmul(float *C, const float *A, const float *B,
         }
     }
 #endif
+    FLUX_OP_END(op);
+    FLUX_TRACE_END();
 }
 
 void flux_matmul_t(float *C, const float *A, const float *B,
                    int M, int K, int N) {
     /* C[M,N] = A[M,K] @ B[N,K]^T */
+    FLUX_TRACE_BEGIN_ARGS("matmul_t", "gemm", "m,k,n", M, K, N);
+    FLUX_OP_BEGIN(op, FLUX_OP_LINEAR, 2.0 * M * K * N,
+                  4.0 * ((double)M * K + (double)K * N + (double)M * N));
 
 #ifdef USE_METAL
     size_t matrix_elements = (size_t)M * N;
@@ -186,6 +266,8 @@ void flux_matmul_t(float *C, const float *A, const float *B,
                          B, K,
                          0.0f,
                          C, N);
+        FLUX_OP_END(op);
+        FLUX_TRACE_END();
         return;
     }
 #endif
@@ -206,12 +288,62 @@ void flux_matmul_t(float *C, const float *A, const float *B,
             C[m * N + n] = sum;
         }
     }
+#endif
+    FLUX_OP_END(op);
+    FLUX_TRACE_END();
+}
+
+/* Below this many multiply-adds a linear layer is not worth threads */
+#define LINEAR_PARALLEL_MIN (1 << 20)
+
+typedef struct {
+    float *y;
+    const float *x, *W, *b;
+    int seq_len, in_dim, out_dim;
+} linear_job_t;
+
+/* Output features [start, end) of a linear layer. Each worker reads only
+ * its row slice of W, which the NUMA partition policy puts on the node the
+ * worker is bound to. */
+static void linear_rows(void *arg, int start, int end) {
+    const linear_job_t *j = (const linear_job_t *)arg;
+    int in_dim = j->in_dim, out_dim = j->out_dim;
+#ifdef USE_BLAS
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                j->seq_len, end - start, in_dim,
+                1.0f, j->x, in_dim, j->W + (size_t)start * in_dim, in_dim,
+                0.0f, j->y + start, out_dim);
+    if (j->b != NULL) {
+        for (int s = 0; s < j->seq_len; s++) {
+            for (int o = start; o < end; o++) {
+                j->y[(size_t)s * out_dim + o] += j->b[o];
+            }
+        }
+    }
+#else
+    for (int s = 0; s < j->seq_len; s++) {
+        const float *x_row = j->x + (size_t)s * in_dim;
+        float *y_row = j->y + (size_t)s * out_dim;
+        for (int o = start; o < end; o++) {
+            const float *w_row = j->W + (size_t)o * in_dim;
+            float sum = (j->b != NULL) ? j->b[o] : 0.0f;
+            for (int i = 0; i < in_dim; i++) {
+                sum += x_row[i] * w_row[i];
+            }
+            y_row[o] = sum;
+        }
+    }
 #endif
 }
 
 void flux_linear(float *y, const float *x, const float *W, const float *b,
                  int seq_len, int in_dim, int out_dim) {
     /* y[seq, out] = x[seq, in] @ W[out, in]^T + b[out] */
+    linear_job_t job = { y, x, W, b, seq_len, in_dim, out_dim };
+    FLUX_TRACE_BEGIN_ARGS("linear", "gemm", "m,k,n", seq_len, in_dim, out_dim);
+    FLUX_OP_BEGIN(op, FLUX_OP_LINEAR, 2.0 * seq_len * in_dim * out_dim,
+                  4.0 * ((double)seq_len * in_dim + (double)out_dim * in_dim +
+                         (double)seq_len * out_dim + (b ? out_dim : 0)));
 
 #ifdef USE_METAL
     /* Use Metal GPU for large matrices */
@@ -238,11 +370,22 @@ void flux_linear(float *y, const float *x, const float *W, const float *b,
                 }
             }
         }
+        FLUX_OP_END(op);
+        FLUX_TRACE_END();
         return;
     }
 #endif
 
 #ifdef USE_BLAS
+    /* NUMA partition: single-threaded BLAS per node-bound worker slice */
+    if (flux_numa_policy() == FLUX_NUMA_PARTITION &&
+        (size_t)seq_len * out_dim * in_dim >= LINEAR_PARALLEL_MIN) {
+        flux_parallel_for(out_dim, linear_rows, &job);
+        FLUX_OP_END(op);
+        FLUX_TRACE_END();
+        return;
+    }
+
     /* Use BLAS sgemm: C = alpha * A @ B^T + beta * C
      * A[M, K] = x[seq_len, in_dim]
      * B[N, K] = W[out_dim, in_dim]
@@ -262,20 +405,16 @@ void flux_linear(float *y, const float *x, const float *W, const float *b,
         }
     }
 #else
-    /* Fallback: naive implementation */
-    for (int s = 0; s < seq_len; s++) {
-        const float *x_row = x + s * in_dim;
-        float *y_row = y + s * out_dim;
-        for (int o = 0; o < out_dim; o++) {
-            const float *w_row = W + o * in_dim;
-            float sum = (b != NULL) ? b[o] : 0.0f;
-            for (int i = 0; i < in_dim; i++) {
-                sum += x_row[i] * w_row[i];
-            }
-            y_row[o] = sum;
-        }
-    }
+    /* Fallback: naive implementation; NUMA partition splits it over
+     * node-bound threads like the BLAS path above */
+    if (flux_numa_policy() == FLUX_NUMA_PARTITION &&
+        (size_t)seq_len * out_dim * in_dim >= LINEAR_PARALLEL_MIN)
+        flux_parallel_for(out_dim, linear_rows, &job);
+    else
+        linear_rows(&job, 0, out_dim);
 #endif
+    FLUX_OP_END(op);
+    FLUX_TRACE_END();
 }
 
 void flux_linear_nobias(float *y, const float *x, const float *W,
@@ -286,6 +425,10 @@ void flux_linear_nobias(float *y, const float *x, const float *W,
 void flux_linear_nobias_bf16(float *y, const float *x, const uint16_t *W_bf16,
                              int seq_len, int in_dim, int out_dim) {
     /* y[seq, out] = x[seq, in] @ W[out, in]^T */
+    FLUX_TRACE_BEGIN_ARGS("linear_bf16", "gemm", "m,k,n", seq_len, in_dim, out_dim);
+    FLUX_OP_BEGIN(op, FLUX_OP_LINEAR, 2.0 * seq_len * in_dim * out_dim,
+                  2.0 * out_dim * in_dim +
+                  4.0 * ((double)seq_len * in_dim + (double)seq_len * out_dim));
 
 #ifdef USE_METAL
     /* Use Metal GPU for bf16 matmul - provides 2x memory bandwidth */
@@ -303,13 +446,19 @@ void flux_linear_nobias_bf16(float *y, const float *x, const uint16_t *W_bf16,
                               W_bf16, in_dim,
                               0.0f,
                               y, out_dim);
+        FLUX_OP_END(op);
+        FLUX_TRACE_END();
         return;
     }
 #endif
 
     /* Fallback: convert bf16 to f32 and use regular linear */
     float *W_f32 = (float *)malloc((size_t)out_dim * in_dim * sizeof(float));
-    if (!W_f32) return;
+    if (!W_f32) {
+        FLUX_OP_END(op);
+        FLUX_TRACE_END();
+        return;
+    }
 
     /* Convert bf16 to f32 */
     for (int i = 0; i < out_dim * in_dim; i++) {
@@ -319,6 +468,8 @@ void flux_linear_nobias_bf16(float *y, const float *x, const uint16_t *W_bf16,
 
     flux_linear_nobias(y, x, W_f32, seq_len, in_dim, out_dim);
     free(W_f32);
+    FLUX_OP_END(op);
+    FLUX_TRACE_END();
 }
 
 /* ========================================================================
@@ -346,11 +497,17 @@ void flux_conv2d(float *out, const float *in, const float *weight, const float *
                  int kH, int kW, int stride, int padding) {
     int outH = (H + 2 * padding - kH) / stride + 1;
     int outW = (W + 2 * padding - kW) / stride + 1;
+    FLUX_TRACE_BEGIN_ARGS("conv2d", "conv", "in_ch,out_ch,pixels", in_ch, out_ch, H * W);
+    FLUX_OP_BEGIN(op, FLUX_OP_CONV, 2.0 * batch * out_ch * outH * outW * in_ch * kH * kW,
+                  4.0 * ((double)batch * in_ch * H * W + (double)out_ch * in_ch * kH * kW +
+                          (double)batch * out_ch * outH * outW));
 
 #ifdef USE_BLAS
     /* im2col + BLAS optimization with tiling for large convolutions */
     size_t col_size = (size_t)in_ch * kH * kW * outH * outW;
     size_t max_col_size = (size_t)256 * 1024 * 1024;  /* 1GB limit */
+    size_t mem_cap = flux_get_host_resources()->memory_limit / 16 / sizeof(float);
+    if (mem_cap > 0 && mem_cap < max_col_size) max_col_size = mem_cap;  /* Small containers */
 
     /* For large convolutions, process in row tiles */
     int tile_rows = outH;
@@ -428,6 +585,8 @@ void flux_conv2d(float *out, const float *in, const float *weight, const float *
     }
 
     free(col);
+    FLUX_OP_END(op);
+    FLUX_TRACE_END();
     return;
 
 naive_fallback:
@@ -460,6 +619,8 @@ naive_fallback:
             }
         }
     }
+    FLUX_OP_END(op);
+    FLUX_TRACE_END();
 }
 
 /* ========================================================================
@@ -468,12 +629,15 @@ naive_fallback:
 
 void flux_rms_norm(float *out, const float *x, const float *weight,
                    int seq_len, int hidden, float eps) {
+    FLUX_OP_BEGIN(op, FLUX_OP_NORM, 4.0 * seq_len * hidden,
+                  4.0 * (2.0 * seq_len * hidden + hidden));
 #ifdef USE_METAL
     /* Use GPU for RMSNorm only for very large tensors
      * The CPU-GPU sync overhead usually outweighs benefits for smaller ops */
     size_t elements = (size_t)seq_len * hidden;
     if (flux_metal_shaders_available() && elements >= 1024 * 1024) {
         flux_metal_rms_norm(out, x, weight, seq_len, hidden, eps);
+        FLUX_OP_END(op);
         return;
     }
 #endif
@@ -495,12 +659,15 @@ void flux_rms_norm(float *out, const float *x, const float *weight,
             out_row[i] = x_row[i] * rms_inv * weight[i];
         }
     }
+    FLUX_OP_END(op);
 }
 
 void flux_group_norm(float *out, const float *x, const float *gamma, const float *beta,
                      int batch, int channels, int H, int W, int num_groups, float eps) {
     int channels_per_group = channels / num_groups;
     int spatial = H * W;
+    FLUX_OP_BEGIN(op, FLUX_OP_NORM, 7.0 * batch * channels * spatial,
+                  4.0 * (2.0 * batch * channels * spatial + 2.0 * channels));
 
     for (int b = 0; b < batch; b++) {
         for (int g = 0; g < num_groups; g++) {
@@ -539,6 +706,7 @@ void flux_group_norm(float *out, const float *x, const float *gamma, const float
             }
         }
     }
+    FLUX_OP_END(op);
 }
 
 void flux_batch_norm(float *out, const float *x,
@@ -642,6 +810,10 @@ void flux_softmax(float *x, int rows, int cols) {
 void flux_attention(float *out, const float *Q, const float *K, const float *V,
                     int batch, int heads, int seq_q, int seq_k, int head_dim,
                     float scale) {
+    FLUX_TRACE_BEGIN_ARGS("attention", "attention", "seq_q,seq_k,heads", seq_q, seq_k, heads);
+    FLUX_OP_BEGIN(op, FLUX_OP_ATTENTION, 4.0 * batch * heads * seq_q * seq_k * head_dim,
+                  4.0 * batch * heads * head_dim * (2.0 * seq_q + 2.0 * seq_k));
+    int prev_mem = flux_mem_enter(FLUX_MEM_ATTENTION);
     /* Allocate attention scores */
     float *scores = (float *)malloc(seq_q * seq_k * sizeof(float));
 
@@ -680,6 +852,9 @@ void flux_attention(float *out, const float *Q, const float *K, const float *V,
     }
 
     free(scores);
+    flux_mem_leave(prev_mem);
+    FLUX_OP_END(op);
+    FLUX_TRACE_END();
 }
 
 /* ========================================================================
@@ -884,6 +1059,10 @@ static void flash_attention_head_tiled(float *out,
  */
 void flux_flash_attention(float *out, const float *Q, const float *K, const float *V,
                           int seq_q, int seq_k, int heads, int head_dim, float scale) {
+    FLUX_TRACE_BEGIN_ARGS("flash_attention", "attention", "seq_q,seq_k,heads", seq_q, seq_k, heads);
+    FLUX_OP_BEGIN(op, FLUX_OP_ATTENTION, 4.0 * heads * seq_q * seq_k * head_dim,
+                  4.0 * heads * head_dim * (2.0 * seq_q + 2.0 * seq_k));
+    int prev_mem = flux_mem_enter(FLUX_MEM_ATTENTION);
     /* Tile sizes for cache efficiency */
     int q_tile_size = 32;  /* Process 32 queries at a time */
     int k_tile_size = 64;  /* Process 64 keys at a time */
@@ -974,6 +1153,9 @@ void flux_flash_attention(float *out, const float *Q, const float *K, const floa
     }
 
     free(tile_scores);
+    flux_mem_leave(prev_mem);
+    FLUX_OP_END(op);
+    FLUX_TRACE_END();
 }
 
 void flux_apply_rope(float *x, const float *freqs,
@@ -1108,3 +1290,71 @@ void flux_unpatchify(float *out, const float *in,
 void flux_copy(float *dst, const float *src, int n) {
     memcpy(dst, src, n * sizeof(float));
 }
+
+/* ========================================================================
+ * Threading
+ * ======================================================================== */
+
+#define FLUX_MAX_THREADS 64
+
+static FLUX_THREAD_LOCAL int thread_budget = 0;
+
+int flux_num_threads(void) {
+    static int cached = 0;
+    if (!cached) {
+        int ncpu = flux_get_host_resources()->cpus;
+        if (ncpu < 1) ncpu = 1;
+        if (ncpu > FLUX_MAX_THREADS) ncpu = FLUX_MAX_THREADS;
+        cached = ncpu;
+    }
+    return (thread_budget > 0 && thread_budget < cached) ? thread_budget : cached;
+}
+
+int flux_set_thread_budget(int threads) {
+    int prev = thread_budget;
+    thread_budget = threads > 0 ? threads : 0;
+    return prev;
+}
+
+typedef struct {
+    flux_range_fn_t fn;
+    void *arg;
+    int start, end;
+} range_work_t;
+
+static void *range_worker(void *p) {
+    range_work_t *w = (range_work_t *)p;
+    FLUX_TRACE_BEGIN_ARGS("range", "thread", "start,end", w->start, w->end, 0);
+    w->fn(w->arg, w->start, w->end);
+    FLUX_TRACE_END();
+    return NULL;
+}
+
+void flux_parallel_for(int n, flux_range_fn_t fn, void *arg) {
+    int nthreads = flux_num_threads();
+    if (nthreads > n) nthreads = n;
+    if (nthreads <= 1) {
+        if (n > 0) fn(arg, 0, n);
+        return;
+    }
+
+    pthread_t threads[FLUX_MAX_THREADS];
+    range_work_t work[FLUX_MAX_THREADS];
+    int ok[FLUX_MAX_THREADS];
+    for (int t = 0; t < nthreads; t++) {
+        work[t] = (range_work_t){
+            .fn = fn, .arg = arg,
+            .start = (int)((long long)n * t / nthreads),
+            .end = (int)((long long)n * (t + 1) / nthreads),
+        };
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        flux_numa_thread_attr(&attr, t, nthreads);
+        ok[t] = pthread_create(&threads[t], &attr, range_worker, &work[t]) == 0;
+        pthread_attr_destroy(&attr);
+        if (!ok[t]) range_worker(&work[t]);
+    }
+    for (int t = 0; t < nthreads; t++) {
+        if (ok[t]) pthread_join(threads[t], NULL);
+    }
+}
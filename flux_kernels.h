@@ -11,6 +11,8 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <math.h>
+#include <pthread.h>
+#include "flux_trace.h"
 
 /* Forward declarations */
 struct flux_image;
@@ -239,6 +241,13 @@ void flux_randn(float *out, int n);
 /* Fill tensor with uniform random [0, 1) */
 void flux_rand(float *out, int n);
 
+/*
+ * Counter-based normals (Philox4x32-10 + Box-Muller). out[i] depends only
+ * on (key, index[i]): no shared state, so any subset of a stream can be
+ * generated in any order and from any thread.
+ */
+void flux_philox_randn(float *out, const uint64_t *index, int n, uint64_t key);
+
 /* ========================================================================
  * Utility Functions
  * ======================================================================== */
@@ -246,6 +255,40 @@ void flux_rand(float *out, int n);
 /* Copy tensor */
 void flux_copy(float *dst, const float *src, int n);
 
+/* ========================================================================
+ * Threading
+ * ======================================================================== */
+
+/* Number of worker threads for CPU-parallel loops: the CPUs the process
+ * may use (cpuset, cgroup quota), see flux_get_host_resources(), capped
+ * by the calling thread's budget. */
+int flux_num_threads(void);
+
+/*
+ * Cap the worker threads of loops started from the calling thread
+ * (0: no cap). Returns the previous cap. Lets stages that run models side
+ * by side on their own threads split the CPUs instead of each taking all
+ * of them. BLAS threading is process-wide and not affected.
+ */
+int flux_set_thread_budget(int threads);
+
+/*
+ * Run fn(arg, start, end) over [0, n) split into contiguous chunks, one per
+ * worker thread. Runs inline when n is small or only one core is available.
+ */
+typedef void (*flux_range_fn_t)(void *arg, int start, int end);
+void flux_parallel_for(int n, flux_range_fn_t fn, void *arg);
+
+/*
+ * Place a weight matrix of rows x row_bytes by the NUMA policy: interleaved
+ * over all nodes, or row slice k on node k, matching the chunks worker k
+ * of flux_parallel_for() computes. No-op off NUMA hosts.
+ */
+void flux_numa_place(const void *p, size_t rows, size_t row_bytes);
+
+/* Bind worker t of nthreads to its NUMA node in attr. Returns 1 if bound. */
+int flux_numa_thread_attr(pthread_attr_t *attr, int t, int nthreads);
+
 /* ========================================================================
  * Progress Callbacks
  * ======================================================================== */
@@ -272,9 +315,15 @@ typedef void (*flux_substep_callback_t)(flux_substep_type_t type, int index, int
  */
 typedef void (*flux_step_callback_t)(int step, int total);
 
-/* Global callback pointers - set by caller before inference */
-extern flux_substep_callback_t flux_substep_callback;
-extern flux_step_callback_t flux_step_callback;
+/*
+ * Callbacks, the RNG, the error message and timing counters are
+ * thread-local: each thread sets its own before inference, and
+ * generations on separate threads (see flux_fork()) don't interfere.
+ */
+#define FLUX_THREAD_LOCAL __thread
+
+extern FLUX_THREAD_LOCAL flux_substep_callback_t flux_substep_callback;
+extern FLUX_THREAD_LOCAL flux_step_callback_t flux_step_callback;
 
 /*
  * Phase callback - called at major phase boundaries.
@@ -282,7 +331,12 @@ extern flux_step_callback_t flux_step_callback;
  * done: 0 when starting, 1 when finished
  */
 typedef void (*flux_phase_callback_t)(const char *phase, int done);
-extern flux_phase_callback_t flux_phase_callback;
+extern FLUX_THREAD_LOCAL flux_phase_callback_t flux_phase_callback;
+
+/* Report a phase boundary to flux_phase_callback and the timeline trace.
+ * phase must be a string literal. */
+void flux_phase_begin(const char *phase);
+void flux_phase_end(const char *phase);
 
 /*
  * Step image callback - called after each denoising step with decoded image.
@@ -294,8 +348,19 @@ extern flux_phase_callback_t flux_phase_callback;
  * calling the sampling function. The callback is only invoked when both are set.
  */
 typedef void (*flux_step_image_callback_t)(int step, int total, const struct flux_image *img);
-extern flux_step_image_callback_t flux_step_image_callback;
-extern void *flux_step_image_vae;  /* Set to flux_vae_t* for step image decoding */
+extern FLUX_THREAD_LOCAL flux_step_image_callback_t flux_step_image_callback;
+extern FLUX_THREAD_LOCAL void *flux_step_image_vae;  /* Set to flux_vae_t* for step image decoding */
+
+/*
+ * Step latent callback - called after each denoising step with the raw
+ * latent, e.g. to record resumable checkpoints.
+ * step: completed steps (1-based), total: total number of steps
+ * t: timestep the latent is at (0 when sampling is finished)
+ * latent: [channels, h, w] (caller must NOT free or keep)
+ */
+typedef void (*flux_step_latent_callback_t)(int step, int total, float t,
+                                            const float *latent, int h, int w);
+extern FLUX_THREAD_LOCAL flux_step_latent_callback_t flux_step_latent_callback;
 
 /*
  * Text encoder progress callback - called once per Qwen3 layer.
@@ -303,7 +368,7 @@ extern void *flux_step_image_vae;  /* Set to flux_vae_t* for step image decoding
  * total: total number of layers (36)
  */
 typedef void (*flux_text_progress_callback_t)(int layer, int total);
-extern flux_text_progress_callback_t flux_text_progress_callback;
+extern FLUX_THREAD_LOCAL flux_text_progress_callback_t flux_text_progress_callback;
 
 /*
  * VAE progress callback - called once per resblock/attention block.
@@ -311,9 +376,24 @@ extern flux_text_progress_callback_t flux_text_progress_callback;
  * total: total number of blocks (11 for encoder, 15 for decoder)
  */
 typedef void (*flux_vae_progress_callback_t)(int block, int total);
-extern flux_vae_progress_callback_t flux_vae_progress_callback;
+extern FLUX_THREAD_LOCAL flux_vae_progress_callback_t flux_vae_progress_callback;
+
+/*
+ * Abort callback - polled between transformer blocks, Qwen3 layers, VAE
+ * decoder levels and sampler steps. Returning non-zero abandons the
+ * generation: the stage returns NULL, the sampler frees its state and the
+ * generate call fails ("Cancelled"). Keep it cheap; it runs ~25 times per
+ * transformer evaluation.
+ */
+typedef int (*flux_abort_callback_t)(void);
+extern FLUX_THREAD_LOCAL flux_abort_callback_t flux_abort_callback;
+
+static inline int flux_aborted(void) {
+    return flux_abort_callback && flux_abort_callback();
+}
 
-/* Global verbose flag - when 0, library code suppresses diagnostic output */
+/* Global verbose flag - when 0, library code suppresses diagnostic output.
+ * Process-wide configuration: set it once, before starting any threads. */
 extern int flux_verbose;
 
 #endif /* FLUX_KERNELS_H */
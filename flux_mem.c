@@ -0,0 +1,409 @@
+/*
+ * FLUX Memory Accounting
+ *
+ * Off until flux_mem_enable(): the routed calls test one flag and go
+ * straight to the C library. When on, live blocks are kept in
+ * open-addressing tables keyed by address, so free() knows the size and
+ * subsystem of what it releases without a header in front of the block:
+ * buffers stay where malloc put them and can still be released by code
+ * that does not route through here. The tables are split into shards by
+ * address, each with its own lock, and the counters are atomics, so
+ * threads allocating at once rarely wait on each other.
+ */
+
+#include "flux_mem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#define MEM_SHARDS      64          /* Power of two */
+#define MEM_TABLE_MIN   64
+#define MEM_MAX_PHASES  32
+#define MEM_PHASE_DEPTH 8
+
+typedef struct {
+    const void *p;          /* NULL: empty slot */
+    size_t size;
+    uint8_t subsystem;
+    uint8_t mapped;
+} mem_block;
+
+typedef struct {
+    pthread_mutex_t lock;
+    mem_block *table;
+    size_t capacity;        /* Power of two */
+    size_t count;
+} mem_shard;
+
+volatile int flux_mem_on = 0;
+FLUX_THREAD_LOCAL int flux_mem_scope = -1;
+
+static pthread_once_t g_once = PTHREAD_ONCE_INIT;
+static mem_shard g_shards[MEM_SHARDS];
+
+/* Updated with __atomic builtins */
+static flux_mem_stats g_stats[FLUX_MEM_SUBSYSTEMS];
+static size_t g_heap = 0, g_heap_peak = 0;
+
+/* Phase table: entries are written under g_phase_lock and published by
+ * g_num_phases; peaks and g_running[] are atomics */
+static pthread_mutex_t g_phase_lock = PTHREAD_MUTEX_INITIALIZER;
+static flux_mem_phase g_phases[MEM_MAX_PHASES];
+static int g_running[MEM_MAX_PHASES];   /* Threads inside each phase */
+static int g_num_phases = 0;
+static int g_phases_open = 0;           /* Sum of g_running[] */
+static int g_generation = 0;            /* Bumped by flux_mem_reset_peaks() */
+
+/* The phases open on this thread, innermost last: indices into g_phases,
+ * or -1 for one that did not fit the table. Valid for t_generation. */
+static FLUX_THREAD_LOCAL int t_open[MEM_PHASE_DEPTH];
+static FLUX_THREAD_LOCAL int t_depth = 0;
+static FLUX_THREAD_LOCAL int t_generation = 0;
+
+static const char *subsystem_names[FLUX_MEM_SUBSYSTEMS] = {
+    "other", "transformer weights", "work buffers", "attention",
+    "qwen3", "vae", "images"
+};
+
+const char *flux_mem_subsystem_name(int subsystem) {
+    if (subsystem < 0 || subsystem >= FLUX_MEM_SUBSYSTEMS) return "?";
+    return subsystem_names[subsystem];
+}
+
+static void init_shards(void) {
+    for (int i = 0; i < MEM_SHARDS; i++)
+        pthread_mutex_init(&g_shards[i].lock, NULL);
+}
+
+void flux_mem_enable(int enable) {
+    if (enable) pthread_once(&g_once, init_shards);
+    flux_mem_on = enable;
+}
+
+/* ========================================================================
+ * Counters
+ * ======================================================================== */
+
+static void atomic_max(size_t *p, size_t v) {
+    size_t cur = __atomic_load_n(p, __ATOMIC_RELAXED);
+    while (v > cur && !__atomic_compare_exchange_n(p, &cur, v, 1, __ATOMIC_RELAXED,
+                                                   __ATOMIC_RELAXED)) {}
+}
+
+static void count_block(int subsystem, size_t size, int mapped) {
+    flux_mem_stats *st = &g_stats[subsystem];
+    if (mapped) {
+        __atomic_add_fetch(&st->mapped, size, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_add_fetch(&st->allocs, 1, __ATOMIC_RELAXED);
+    atomic_max(&st->peak, __atomic_add_fetch(&st->current, size, __ATOMIC_RELAXED));
+    size_t heap = __atomic_add_fetch(&g_heap, size, __ATOMIC_RELAXED);
+    atomic_max(&g_heap_peak, heap);
+    if (!__atomic_load_n(&g_phases_open, __ATOMIC_RELAXED)) return;
+    int n = __atomic_load_n(&g_num_phases, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < n; i++) {
+        if (__atomic_load_n(&g_running[i], __ATOMIC_RELAXED))
+            atomic_max(&g_phases[i].peak, heap);
+    }
+}
+
+static void uncount(const mem_block *b) {
+    flux_mem_stats *st = &g_stats[b->subsystem];
+    if (b->mapped) {
+        __atomic_sub_fetch(&st->mapped, b->size, __ATOMIC_RELAXED);
+    } else {
+        __atomic_sub_fetch(&st->current, b->size, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&g_heap, b->size, __ATOMIC_RELAXED);
+    }
+}
+
+/* ========================================================================
+ * Block Tables (caller holds the shard's lock)
+ * ======================================================================== */
+
+static uint64_t hash_of(const void *p) {
+    return (uint64_t)(uintptr_t)p * 0x9E3779B97F4A7C15ull;
+}
+
+/* Top bits pick the shard, the bits below them the slot */
+static mem_shard *shard_of(const void *p) {
+    return &g_shards[hash_of(p) >> 58];
+}
+
+static size_t slot_of(const mem_shard *sh, const void *p) {
+    return (size_t)(hash_of(p) >> 20) & (sh->capacity - 1);
+}
+
+static int grow_table(mem_shard *sh) {
+    size_t cap = sh->capacity ? sh->capacity * 2 : MEM_TABLE_MIN;
+    mem_block *table = (mem_block *)calloc(cap, sizeof(mem_block));
+    if (!table) return -1;
+    mem_block *old = sh->table;
+    size_t old_cap = sh->capacity;
+    sh->table = table;
+    sh->capacity = cap;
+    for (size_t i = 0; i < old_cap; i++) {
+        if (!old[i].p) continue;
+        size_t s = slot_of(sh, old[i].p);
+        while (sh->table[s].p) s = (s + 1) & (sh->capacity - 1);
+        sh->table[s] = old[i];
+    }
+    free(old);
+    return 0;
+}
+
+static mem_block *find_block(mem_shard *sh, const void *p) {
+    if (!sh->capacity) return NULL;
+    for (size_t s = slot_of(sh, p); sh->table[s].p; s = (s + 1) & (sh->capacity - 1))
+        if (sh->table[s].p == p) return &sh->table[s];
+    return NULL;
+}
+
+/* Linear probing: shift later entries of the run back over the hole */
+static void remove_block(mem_shard *sh, mem_block *b) {
+    size_t hole = (size_t)(b - sh->table);
+    size_t s = hole;
+    sh->table[hole].p = NULL;
+    for (;;) {
+        s = (s + 1) & (sh->capacity - 1);
+        if (!sh->table[s].p) break;
+        size_t home = slot_of(sh, sh->table[s].p);
+        /* Move it if its home is not in (hole, s] */
+        if ((s > hole) ? (home <= hole || home > s) : (home <= hole && home > s)) {
+            sh->table[hole] = sh->table[s];
+            sh->table[s].p = NULL;
+            hole = s;
+        }
+    }
+    sh->count--;
+}
+
+/* Record a block. An address still in the table was released behind our
+ * back (plain free() of a returned buffer), so its old entry goes first. */
+static void add_block(void *p, size_t size, int subsystem, int mapped) {
+    mem_shard *sh = shard_of(p);
+    pthread_mutex_lock(&sh->lock);
+    mem_block *old = find_block(sh, p);
+    if (old) {
+        uncount(old);
+        remove_block(sh, old);
+    }
+    if ((sh->count + 1) * 2 > sh->capacity && grow_table(sh) != 0) {
+        pthread_mutex_unlock(&sh->lock);
+        return;
+    }
+    size_t s = slot_of(sh, p);
+    while (sh->table[s].p) s = (s + 1) & (sh->capacity - 1);
+    sh->table[s] = (mem_block){ p, size, (uint8_t)subsystem, (uint8_t)mapped };
+    sh->count++;
+    count_block(subsystem, size, mapped);
+    pthread_mutex_unlock(&sh->lock);
+}
+
+/* Forget p. Returns 1 and its entry in *out if it was counted. */
+static int drop_block(const void *p, mem_block *out) {
+    mem_shard *sh = shard_of(p);
+    pthread_mutex_lock(&sh->lock);
+    mem_block *b = find_block(sh, p);
+    if (b) {
+        if (out) *out = *b;
+        uncount(b);
+        remove_block(sh, b);
+    }
+    pthread_mutex_unlock(&sh->lock);
+    return b != NULL;
+}
+
+static int resolve(int subsystem) {
+    int s = flux_mem_scope >= 0 ? flux_mem_scope : subsystem;
+    return (s >= 0 && s < FLUX_MEM_SUBSYSTEMS) ? s : FLUX_MEM_OTHER;
+}
+
+/* ========================================================================
+ * Allocation
+ * ======================================================================== */
+
+void *flux_mem_malloc(size_t size, int subsystem) {
+    void *p = malloc(size);
+    if (p && flux_mem_on) add_block(p, size, resolve(subsystem), 0);
+    return p;
+}
+
+void *flux_mem_calloc(size_t n, size_t size, int subsystem) {
+    void *p = calloc(n, size);
+    if (p && flux_mem_on) add_block(p, n * size, resolve(subsystem), 0);
+    return p;
+}
+
+void *flux_mem_realloc(void *p, size_t size, int subsystem) {
+    if (!flux_mem_on) return realloc(p, size);
+
+    /* Drop first: realloc may hand the same address to another thread */
+    int sub = resolve(subsystem);
+    mem_block old;
+    int tracked = p && drop_block(p, &old);
+    if (tracked && flux_mem_scope < 0) sub = old.subsystem;
+    void *q = realloc(p, size);
+    if (q) add_block(q, size, sub, 0);
+    else if (tracked && size) add_block(p, old.size, sub, 0);   /* p is still live */
+    return q;
+}
+
+void flux_mem_free(void *p) {
+    if (!p) return;
+    if (flux_mem_on) drop_block(p, NULL);
+    free(p);
+}
+
+void flux_mem_map(const void *p, size_t size, int subsystem) {
+    if (p && flux_mem_on) add_block((void *)p, size, resolve(subsystem), 1);
+}
+
+void flux_mem_unmap(const void *p) {
+    if (p && flux_mem_on) drop_block(p, NULL);
+}
+
+/* ========================================================================
+ * Phases
+ * ======================================================================== */
+
+void flux_mem_phase_begin(const char *name) {
+    if (!flux_mem_on) return;
+    pthread_mutex_lock(&g_phase_lock);
+    if (t_generation != g_generation) {
+        t_generation = g_generation;
+        t_depth = 0;
+    }
+    int i;
+    for (i = 0; i < g_num_phases; i++)
+        if (strcmp(g_phases[i].name, name) == 0) break;
+    if (i == g_num_phases && g_num_phases < MEM_MAX_PHASES) {
+        g_phases[g_num_phases] = (flux_mem_phase){ name, 0, 0, 0, 0 };
+        g_running[g_num_phases] = 0;
+        __atomic_store_n(&g_num_phases, g_num_phases + 1, __ATOMIC_RELEASE);
+    }
+    if (i == g_num_phases) i = -1;
+    if (i >= 0) {
+        flux_mem_phase *ph = &g_phases[i];
+        size_t heap = __atomic_load_n(&g_heap, __ATOMIC_RELAXED);
+        ph->count++;
+        ph->start = heap;
+        atomic_max(&ph->peak, heap);
+        __atomic_add_fetch(&g_running[i], 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&g_phases_open, 1, __ATOMIC_RELAXED);
+    }
+    if (t_depth < MEM_PHASE_DEPTH) t_open[t_depth] = i;
+    t_depth++;
+    pthread_mutex_unlock(&g_phase_lock);
+}
+
+void flux_mem_phase_end(const char *name) {
+    if (!flux_mem_on) return;
+    pthread_mutex_lock(&g_phase_lock);
+    if (t_generation == g_generation && t_depth > 0) {
+        t_depth--;
+        int i = (t_depth < MEM_PHASE_DEPTH) ? t_open[t_depth] : -1;
+        if (i >= 0) {
+            __atomic_sub_fetch(&g_running[i], 1, __ATOMIC_RELAXED);
+            __atomic_sub_fetch(&g_phases_open, 1, __ATOMIC_RELAXED);
+            if (strcmp(g_phases[i].name, name) == 0)
+                g_phases[i].end = __atomic_load_n(&g_heap, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&g_phase_lock);
+}
+
+/* ========================================================================
+ * Queries
+ * ======================================================================== */
+
+void flux_mem_get_stats(flux_mem_stats stats[FLUX_MEM_SUBSYSTEMS], flux_mem_stats *total) {
+    flux_mem_stats snap[FLUX_MEM_SUBSYSTEMS];
+    for (int i = 0; i < FLUX_MEM_SUBSYSTEMS; i++) {
+        const flux_mem_stats *s = &g_stats[i];
+        snap[i].current = __atomic_load_n(&s->current, __ATOMIC_RELAXED);
+        snap[i].peak = __atomic_load_n(&s->peak, __ATOMIC_RELAXED);
+        snap[i].mapped = __atomic_load_n(&s->mapped, __ATOMIC_RELAXED);
+        snap[i].allocs = __atomic_load_n(&s->allocs, __ATOMIC_RELAXED);
+    }
+    if (stats) memcpy(stats, snap, sizeof(snap));
+    if (total) {
+        memset(total, 0, sizeof(*total));
+        for (int i = 0; i < FLUX_MEM_SUBSYSTEMS; i++) {
+            total->current += snap[i].current;
+            total->mapped += snap[i].mapped;
+            total->allocs += snap[i].allocs;
+        }
+        total->peak = __atomic_load_n(&g_heap_peak, __ATOMIC_RELAXED);
+    }
+}
+
+int flux_mem_get_phases(flux_mem_phase *phases, int max) {
+    pthread_mutex_lock(&g_phase_lock);
+    int n = g_num_phases < max ? g_num_phases : max;
+    for (int i = 0; i < n; i++) {
+        phases[i] = g_phases[i];
+        phases[i].peak = __atomic_load_n(&g_phases[i].peak, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&g_phase_lock);
+    return n;
+}
+
+void flux_mem_reset_peaks(void) {
+    pthread_mutex_lock(&g_phase_lock);
+    for (int i = 0; i < FLUX_MEM_SUBSYSTEMS; i++)
+        __atomic_store_n(&g_stats[i].peak,
+                         __atomic_load_n(&g_stats[i].current, __ATOMIC_RELAXED),
+                         __ATOMIC_RELAXED);
+    __atomic_store_n(&g_heap_peak, __atomic_load_n(&g_heap, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&g_num_phases, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&g_phases_open, 0, __ATOMIC_RELAXED);
+    g_generation++;
+    pthread_mutex_unlock(&g_phase_lock);
+}
+
+void flux_mem_print(void) {
+    flux_mem_stats stats[FLUX_MEM_SUBSYSTEMS], total;
+    flux_mem_phase phases[MEM_MAX_PHASES];
+    flux_mem_get_stats(stats, &total);
+    int num_phases = flux_mem_get_phases(phases, MEM_MAX_PHASES);
+
+    fprintf(stderr, "\nMemory (MB):               current      peak    mapped    allocs\n");
+    for (int i = 0; i < FLUX_MEM_SUBSYSTEMS; i++) {
+        const flux_mem_stats *s = &stats[i];
+        if (!s->peak && !s->mapped) continue;
+        fprintf(stderr, "  %-22s %9.1f %9.1f %9.1f %9llu\n", subsystem_names[i],
+                s->current / 1e6, s->peak / 1e6, s->mapped / 1e6,
+                (unsigned long long)s->allocs);
+    }
+    fprintf(stderr, "  %-22s %9.1f %9.1f %9.1f %9llu\n", "total",
+            total.current / 1e6, total.peak / 1e6, total.mapped / 1e6,
+            (unsigned long long)total.allocs);
+
+    /* Requested bytes overstate what is resident when big buffers are
+     * only partly touched; the kernel's high-water mark shows how much */
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+#ifdef __APPLE__
+        double rss = (double)ru.ru_maxrss;          /* Bytes */
+#else
+        double rss = (double)ru.ru_maxrss * 1024;   /* Kilobytes */
+#endif
+        fprintf(stderr, "  %-22s %19.1f\n", "process peak RSS", rss / 1e6);
+    }
+
+    if (num_phases > 0) {
+        fprintf(stderr, "  %-30s %9s %9s %9s\n", "phase (heap)", "start", "peak", "end");
+        for (int i = 0; i < num_phases; i++) {
+            const flux_mem_phase *ph = &phases[i];
+            fprintf(stderr, "  %-30s %9.1f %9.1f %9.1f", ph->name,
+                    ph->start / 1e6, ph->peak / 1e6, ph->end / 1e6);
+            if (ph->count > 1) fprintf(stderr, "  (x%d)", ph->count);
+            fprintf(stderr, "\n");
+        }
+    }
+}
@@ -0,0 +1,119 @@
+/*
+ * FLUX Memory Accounting - Header
+ *
+ * Heap allocations made by the library, and the weight files it maps,
+ * are attributed to a subsystem and counted: live bytes, peak bytes and
+ * mapped bytes per subsystem, and the heap's start, peak and end for each
+ * phase (loading, text encoding, denoising, decoding). flux_mem_print()
+ * shows the result; -v prints it after generation.
+ *
+ * Library sources route malloc/calloc/realloc/free here by defining
+ * FLUX_MEM_DEFAULT (their subsystem) and including this header after the
+ * system headers. A subsystem entered with flux_mem_enter() on the
+ * allocating thread overrides the file's default. Accounting is off by
+ * default, and the routed calls then cost one branch; main.c turns it on
+ * for -v before loading the model.
+ *
+ * Only memory allocated through the routed calls is counted: Metal
+ * buffers and allocations in the tokenizers are not. Buffers the library
+ * hands to callers (embeddings, latents, encoded PNGs) are released with
+ * flux_free_buffer(); plain free() works but leaves them counted.
+ */
+
+#ifndef FLUX_MEM_H
+#define FLUX_MEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "flux_kernels.h"
+
+typedef enum {
+    FLUX_MEM_OTHER = 0,
+    FLUX_MEM_TRANSFORMER_WEIGHTS,   /* Loaded, converted or mapped weights */
+    FLUX_MEM_WORK,                  /* Activations, latents, kernel scratch */
+    FLUX_MEM_ATTENTION,             /* Q/K/V staging, scores, attention scratch */
+    FLUX_MEM_QWEN3,                 /* Text encoder weights and buffers */
+    FLUX_MEM_VAE,                   /* VAE weights and buffers */
+    FLUX_MEM_IMAGE,                 /* Decoded and loaded images */
+    FLUX_MEM_SUBSYSTEMS
+} flux_mem_subsystem;
+
+typedef struct {
+    size_t current;         /* Live heap bytes */
+    size_t peak;            /* Highest current so far */
+    size_t mapped;          /* File mappings (mmap'd safetensors) */
+    uint64_t allocs;        /* Allocations so far */
+} flux_mem_stats;
+
+typedef struct {
+    const char *name;       /* The name given to flux_phase_begin() */
+    int count;              /* Times the phase ran */
+    size_t start;           /* Heap bytes when it last began */
+    size_t peak;            /* Highest heap bytes during any run */
+    size_t end;             /* Heap bytes when it last ended */
+} flux_mem_phase;
+
+/* Start or stop counting. Enable before anything is loaded: blocks
+ * allocated while off are never counted, and blocks freed while off stay
+ * counted until their address is reused. */
+void flux_mem_enable(int enable);
+
+/*
+ * Per-subsystem counters. total (may be NULL) gets the sums, with peak
+ * the highest total heap seen, not the sum of the subsystem peaks.
+ */
+void flux_mem_get_stats(flux_mem_stats stats[FLUX_MEM_SUBSYSTEMS], flux_mem_stats *total);
+
+/* Phases in the order they first ran. Returns how many were written. */
+int flux_mem_get_phases(flux_mem_phase *phases, int max);
+
+/* Restart peaks (subsystems, total, phases) from the current usage */
+void flux_mem_reset_peaks(void);
+
+const char *flux_mem_subsystem_name(int subsystem);
+
+/* Subsystem and phase tables, in MB, to stderr */
+void flux_mem_print(void);
+
+/* Phase boundaries; flux_phase_begin()/flux_phase_end() call these.
+ * name must be a string literal. Phases nest per thread; a phase open on
+ * any thread sees the peak of the whole heap. */
+void flux_mem_phase_begin(const char *name);
+void flux_mem_phase_end(const char *name);
+
+/* Count a file mapping, until flux_mem_unmap() of the same address */
+void flux_mem_map(const void *p, size_t size, int subsystem);
+void flux_mem_unmap(const void *p);
+
+/* ========================================================================
+ * Attribution
+ * ======================================================================== */
+
+extern volatile int flux_mem_on;
+extern FLUX_THREAD_LOCAL int flux_mem_scope;
+
+/* Attribute this thread's allocations to subsystem until the returned
+ * value is passed to flux_mem_leave() */
+static inline int flux_mem_enter(int subsystem) {
+    int prev = flux_mem_scope;
+    flux_mem_scope = subsystem;
+    return prev;
+}
+
+static inline void flux_mem_leave(int prev) {
+    flux_mem_scope = prev;
+}
+
+void *flux_mem_malloc(size_t size, int subsystem);
+void *flux_mem_calloc(size_t n, size_t size, int subsystem);
+void *flux_mem_realloc(void *p, size_t size, int subsystem);
+void flux_mem_free(void *p);
+
+#ifdef FLUX_MEM_DEFAULT
+#define malloc(size)        flux_mem_malloc((size), FLUX_MEM_DEFAULT)
+#define calloc(n, size)     flux_mem_calloc((n), (size), FLUX_MEM_DEFAULT)
+#define realloc(p, size)    flux_mem_realloc((p), (size), FLUX_MEM_DEFAULT)
+#define free(p)             flux_mem_free(p)
+#endif
+
+#endif /* FLUX_MEM_H */
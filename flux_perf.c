@@ -0,0 +1,613 @@
+/*
+ * FLUX End-to-End Benchmark
+ *
+ * Runs a matrix of configurations (sizes x steps x reference images x
+ * batch sizes, warm and/or cold) through the real generation API and
+ * reports where the time goes. Phases come from the library's progress
+ * callbacks: "Loading ..." phases and flux_load_dir() count as load,
+ * "encoding text" as encode, "encoding reference image" as refs,
+ * "decoding image" as VAE, and the time between step callbacks as the
+ * individual steps. Tokenization is timed on its own (it is also part of
+ * encode), and save is PNG encoding into memory, so the disk is not timed.
+ *
+ * warm: one context for the whole mode, text encoder kept loaded, an
+ *       untimed run before each configuration.
+ * cold: every run loads a fresh context and frees it afterwards; its
+ *       latency includes loading.
+ *
+ * Batches above 1 submit that many prompts to a flux_engine and step it
+ * until all are done; latency is per image, from submission to PNG.
+ *
+ * Usage: flux -d model/ --bench --bench-sizes 256,512 --bench-batch 1,4
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "flux.h"
+#include "flux_kernels.h"
+#include "flux_qwen3.h"
+#include "flux_perf.h"
+
+#define PERF_MAX_LIST           16
+#define PERF_DEFAULT_ITERS      3
+#define PERF_DEFAULT_PROMPT     "a photo of a cat sitting on a windowsill"
+
+/* ======================================================================
+ * Phase Recording
+ * ====================================================================== */
+
+/* Milliseconds spent per phase, summed over an iteration */
+typedef struct {
+    double load, tokenize, encode, refs, denoise, vae, save;
+    double step[FLUX_MAX_STEPS];
+    int num_steps;
+} perf_phases;
+
+/* Callbacks carry no user data; only the main thread records */
+static perf_phases *g_rec = NULL;
+static double g_phase_start = 0;
+static double g_step_start = 0;     /* 0 = no step open */
+static int g_step_index = 0;
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static void add_step(perf_phases *p, int index, double ms) {
+    if (index < 0 || index >= FLUX_MAX_STEPS) return;
+    p->step[index] += ms;
+    p->denoise += ms;
+    if (index + 1 > p->num_steps) p->num_steps = index + 1;
+}
+
+static void close_step(double now) {
+    if (g_step_start <= 0) return;
+    add_step(g_rec, g_step_index, now - g_step_start);
+    g_step_start = 0;
+}
+
+static void perf_step_callback(int step, int total) {
+    (void)total;
+    double now = now_ms();
+    close_step(now);
+    g_step_start = now;
+    g_step_index = step - 1;
+}
+
+static void perf_phase_callback(const char *phase, int done) {
+    double now = now_ms();
+    if (!done) {
+        close_step(now);
+        g_phase_start = now;
+        return;
+    }
+    double ms = now - g_phase_start;
+    if (strncmp(phase, "Loading", 7) == 0) g_rec->load += ms;
+    else if (strcmp(phase, "encoding text") == 0) g_rec->encode += ms;
+    else if (strcmp(phase, "encoding reference image") == 0) g_rec->refs += ms;
+    else if (strcmp(phase, "decoding image") == 0) g_rec->vae += ms;
+}
+
+static void record_begin(perf_phases *p) {
+    memset(p, 0, sizeof(*p));
+    g_rec = p;
+    g_step_start = 0;
+    flux_phase_callback = perf_phase_callback;
+    flux_step_callback = perf_step_callback;
+}
+
+static void record_end(void) {
+    close_step(now_ms());
+    flux_phase_callback = NULL;
+    flux_step_callback = NULL;
+}
+
+/* ======================================================================
+ * Peak RSS
+ * ====================================================================== */
+
+/* Reset the kernel's peak RSS counter (Linux 4.0+). Returns 0 on success. */
+static int reset_peak_rss(void) {
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+    if (!f) return -1;
+    int ok = fputs("5", f) >= 0;
+    return (fclose(f) == 0 && ok) ? 0 : -1;
+}
+
+static double peak_rss_mb(void) {
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f) {
+        char line[256];
+        long kb = -1;
+        while (fgets(line, sizeof(line), f))
+            if (sscanf(line, "VmHWM: %ld kB", &kb) == 1) break;
+        fclose(f);
+        if (kb >= 0) return kb / 1024.0;
+    }
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#ifdef __APPLE__
+    return ru.ru_maxrss / (1024.0 * 1024.0);    /* bytes */
+#else
+    return ru.ru_maxrss / 1024.0;               /* kilobytes */
+#endif
+}
+
+/* ======================================================================
+ * Configurations
+ * ====================================================================== */
+
+typedef struct {
+    int cold;
+    int width, height, steps, refs, batch;
+
+    /* Results */
+    int iterations, images, failures;
+    double *latency;            /* Per image, ms */
+    double wall_ms;             /* Timed iterations, end to end */
+    double peak_rss_mb;
+    int rss_reset;              /* peak_rss_mb covers this config only */
+    perf_phases sum;            /* Summed over timed iterations */
+} perf_config;
+
+/* Parse "a,b,c" into ints; "WxH" pairs go to out2 (a lone N is NxN) */
+static int parse_list(const char *s, int *out, int *out2, int max) {
+    int n = 0;
+    while (s && *s && n < max) {
+        char *end;
+        long v = strtol(s, &end, 10);
+        if (end == s) return -1;
+        out[n] = (int)v;
+        if (out2) {
+            out2[n] = (int)v;
+            if (*end == 'x' || *end == 'X') {
+                s = end + 1;
+                out2[n] = (int)strtol(s, &end, 10);
+                if (end == s) return -1;
+            }
+        }
+        n++;
+        if (*end == ',') end++;
+        else if (*end) return -1;
+        s = end;
+    }
+    return n;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of sorted[0..n) */
+static double percentile(const double *sorted, int n, double p) {
+    if (n <= 0) return 0;
+    int rank = (int)ceil(p / 100.0 * n);
+    if (rank < 1) rank = 1;
+    if (rank > n) rank = n;
+    return sorted[rank - 1];
+}
+
+/* Synthetic reference image: smooth gradients, like a photo at low detail */
+static flux_image *make_ref_image(int width, int height, int index) {
+    flux_image *img = flux_image_create(width, height, 3);
+    if (!img) return NULL;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint8_t *p = img->data + ((size_t)y * width + x) * 3;
+            p[0] = (uint8_t)(x * 255 / width);
+            p[1] = (uint8_t)(y * 255 / height);
+            p[2] = (uint8_t)((x + y + 64 * index) & 255);
+        }
+    }
+    return img;
+}
+
+typedef struct {
+    const char *model_dir;
+    const char *prompt;
+    const flux_params *defaults;
+    const flux_perf_opts *opts;
+    qwen3_tokenizer_t *tokenizer;
+    flux_ctx *warm_ctx;
+} perf_run;
+
+static flux_ctx *load_ctx(const perf_run *run) {
+    flux_ctx *ctx = flux_load_dir(run->model_dir);
+    if (!ctx) return NULL;
+    if (run->opts->use_mmap) flux_set_mmap(ctx, 1);
+    if (run->opts->force_base) flux_set_base_mode(ctx);
+    return ctx;
+}
+
+/* Parameters for one run of cfg, with the model's automatic values resolved */
+static flux_params config_params(const perf_run *run, flux_ctx *ctx,
+                                 const perf_config *cfg) {
+    flux_params p = *run->defaults;
+    p.width = cfg->width;
+    p.height = cfg->height;
+    p.num_steps = cfg->steps > 0 ? cfg->steps : (flux_is_distilled(ctx) ? 4 : 50);
+    if (p.guidance <= 0) p.guidance = flux_is_distilled(ctx) ? 1.0f : 4.0f;
+    if (p.seed < 0) p.seed = 42;
+    return p;
+}
+
+static double time_tokenize(const perf_run *run) {
+    if (!run->tokenizer) return 0;
+    double t0 = now_ms();
+    int n;
+    free(qwen3_tokenize_chat(run->tokenizer, run->prompt, &n, QWEN3_MAX_SEQ_LEN));
+    return now_ms() - t0;
+}
+
+/* PNG-encode img into memory; returns 0 on success */
+static int save_image(flux_image *img, int64_t seed, perf_phases *rec) {
+    double t0 = now_ms();
+    size_t len;
+    uint8_t *png = flux_image_encode_png(img, seed, &len);
+    rec->save += now_ms() - t0;
+    flux_free_buffer(png);
+    return png ? 0 : -1;
+}
+
+/*
+ * One iteration of cfg: batch images, each latency stored in latency[].
+ * Returns the number of failed images.
+ */
+static int run_iteration(const perf_run *run, perf_config *cfg,
+                         flux_image **refs, perf_phases *rec, double *latency) {
+    double t0 = now_ms();
+    int failed = 0;
+
+    record_begin(rec);
+    flux_ctx *ctx = run->warm_ctx;
+    if (!ctx) {
+        double l0 = now_ms();
+        ctx = load_ctx(run);
+        rec->load += now_ms() - l0;
+        if (!ctx) {
+            record_end();
+            for (int i = 0; i < cfg->batch; i++) latency[i] = now_ms() - t0;
+            return cfg->batch;
+        }
+    }
+    flux_params params = config_params(run, ctx, cfg);
+
+    if (cfg->batch <= 1) {
+        rec->tokenize += time_tokenize(run);
+        flux_image *img = cfg->refs > 0
+            ? flux_multiref(ctx, run->prompt, (const flux_image **)refs, cfg->refs, &params)
+            : flux_generate(ctx, run->prompt, &params);
+        close_step(now_ms());
+        if (!img || save_image(img, params.seed, rec) != 0) failed++;
+        flux_image_free(img);
+        latency[0] = now_ms() - t0;
+    } else {
+        /* Engine steps run every request at once; time them from outside */
+        flux_phase_callback = perf_phase_callback;
+        flux_step_callback = NULL;
+        flux_engine *eng = flux_engine_new(ctx, cfg->batch);
+        int ids[PERF_MAX_LIST * 16];
+        int n = cfg->batch < (int)(sizeof(ids) / sizeof(ids[0]))
+                ? cfg->batch : (int)(sizeof(ids) / sizeof(ids[0]));
+        for (int i = 0; i < n; i++) {
+            rec->tokenize += time_tokenize(run);
+            flux_params p = params;
+            p.seed = params.seed + i;
+            ids[i] = eng ? flux_engine_submit(eng, run->prompt, &p) : -1;
+            latency[i] = -1;
+        }
+        int step = 0, pending = eng ? 1 : 0;
+        while (pending > 0) {
+            double s0 = now_ms(), vae0 = rec->vae, load0 = rec->load;
+            pending = flux_engine_step(eng);
+            add_step(rec, step++, (now_ms() - s0) - (rec->vae - vae0) - (rec->load - load0));
+
+            int id;
+            flux_image *img;
+            while ((img = flux_engine_poll(eng, &id)) != NULL || id > 0) {
+                int slot = -1;
+                for (int i = 0; i < n; i++) if (ids[i] == id) slot = i;
+                if (!img || save_image(img, params.seed + slot, rec) != 0) failed++;
+                flux_image_free(img);
+                if (slot >= 0) latency[slot] = now_ms() - t0;
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            if (latency[i] < 0) {
+                failed++;
+                latency[i] = now_ms() - t0;
+            }
+        }
+        flux_engine_free(eng);
+    }
+    record_end();
+
+    if (!run->warm_ctx) flux_free(ctx);
+    return failed;
+}
+
+static int run_config(const perf_run *run, perf_config *cfg) {
+    int iters = run->opts->iterations > 0 ? run->opts->iterations : PERF_DEFAULT_ITERS;
+    int quiet = run->opts->quiet;
+
+    flux_image *refs[PERF_MAX_LIST] = {0};
+    for (int i = 0; i < cfg->refs; i++) {
+        refs[i] = make_ref_image(cfg->width, cfg->height, i);
+        if (!refs[i]) return -1;
+    }
+
+    cfg->latency = (double *)malloc((size_t)iters * cfg->batch * sizeof(double));
+    if (!cfg->latency) return -1;
+
+    perf_phases rec;
+    if (!cfg->cold) {
+        if (!quiet) fprintf(stderr, "  warm-up...");
+        cfg->failures += run_iteration(run, cfg, refs, &rec, cfg->latency);
+        if (!quiet) fprintf(stderr, " done\n");
+    }
+
+    cfg->rss_reset = reset_peak_rss() == 0;
+    double t0 = now_ms();
+    for (int it = 0; it < iters; it++) {
+        if (!quiet) {
+            fprintf(stderr, "\r  iteration %d/%d", it + 1, iters);
+            fflush(stderr);
+        }
+        cfg->failures += run_iteration(run, cfg, refs, &rec,
+                                       cfg->latency + (size_t)it * cfg->batch);
+        perf_phases *s = &cfg->sum;
+        s->load += rec.load;
+        s->tokenize += rec.tokenize;
+        s->encode += rec.encode;
+        s->refs += rec.refs;
+        s->denoise += rec.denoise;
+        s->vae += rec.vae;
+        s->save += rec.save;
+        for (int i = 0; i < rec.num_steps; i++) s->step[i] += rec.step[i];
+        if (rec.num_steps > s->num_steps) s->num_steps = rec.num_steps;
+    }
+    cfg->wall_ms = now_ms() - t0;
+    if (!quiet) fprintf(stderr, "\n");
+    cfg->peak_rss_mb = peak_rss_mb();
+    cfg->iterations = iters;
+    cfg->images = iters * cfg->batch;
+    qsort(cfg->latency, cfg->images, sizeof(double), cmp_double);
+
+    for (int i = 0; i < cfg->refs; i++) flux_image_free(refs[i]);
+    return 0;
+}
+
+/* ======================================================================
+ * Reporting
+ * ====================================================================== */
+
+static void config_label(const perf_config *c, char *buf, size_t size) {
+    snprintf(buf, size, "%s %dx%d s%d r%d b%d", c->cold ? "cold" : "warm",
+             c->width, c->height, c->steps, c->refs, c->batch);
+}
+
+static void print_tables(const perf_config *cfgs, int n) {
+    char label[64];
+
+    printf("\n%-26s %5s %9s %9s %9s %8s %9s\n",
+           "config", "imgs", "p50 s", "p95 s", "p99 s", "img/s", "peak MB");
+    for (int i = 0; i < n; i++) {
+        const perf_config *c = &cfgs[i];
+        config_label(c, label, sizeof(label));
+        printf("%-26s %5d %9.3f %9.3f %9.3f %8.3f %8.0f%s",
+               label, c->images,
+               percentile(c->latency, c->images, 50) / 1000.0,
+               percentile(c->latency, c->images, 95) / 1000.0,
+               percentile(c->latency, c->images, 99) / 1000.0,
+               c->wall_ms > 0 ? c->images / (c->wall_ms / 1000.0) : 0,
+               c->peak_rss_mb, c->rss_reset ? "" : "*");
+        if (c->failures) printf("  (%d failed)", c->failures);
+        printf("\n");
+    }
+
+    printf("\nPer-iteration phase means (ms):\n");
+    printf("%-26s %8s %8s %8s %8s %8s %8s %8s %8s\n", "config",
+           "load", "tokenize", "encode", "refs", "step", "denoise", "vae", "save");
+    for (int i = 0; i < n; i++) {
+        const perf_config *c = &cfgs[i];
+        double k = c->iterations > 0 ? 1.0 / c->iterations : 0;
+        const perf_phases *s = &c->sum;
+        config_label(c, label, sizeof(label));
+        printf("%-26s %8.1f %8.2f %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f\n", label,
+               s->load * k, s->tokenize * k, s->encode * k, s->refs * k,
+               s->num_steps > 0 ? s->denoise * k / s->num_steps : 0,
+               s->denoise * k, s->vae * k, s->save * k);
+    }
+    int any_unreset = 0;
+    for (int i = 0; i < n; i++) any_unreset |= !cfgs[i].rss_reset;
+    if (any_unreset)
+        printf("\n* peak RSS since process start (could not reset the counter)\n");
+}
+
+static int write_json(const char *path, const perf_run *run,
+                      const perf_config *cfgs, int n) {
+    FILE *f = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Error: cannot write %s\n", path);
+        return -1;
+    }
+    fprintf(f, "{\n  \"model_dir\": \"%s\",\n  \"threads\": %d,\n  \"results\": [\n",
+            run->model_dir, flux_num_threads());
+    for (int i = 0; i < n; i++) {
+        const perf_config *c = &cfgs[i];
+        const perf_phases *s = &c->sum;
+        double k = c->iterations > 0 ? 1.0 / c->iterations : 0;
+        double mean = 0;
+        for (int j = 0; j < c->images; j++) mean += c->latency[j];
+        if (c->images > 0) mean /= c->images;
+
+        fprintf(f, "    {\"mode\": \"%s\", \"width\": %d, \"height\": %d, \"steps\": %d, "
+                   "\"refs\": %d, \"batch\": %d,\n",
+                c->cold ? "cold" : "warm", c->width, c->height, c->steps, c->refs, c->batch);
+        fprintf(f, "     \"iterations\": %d, \"images\": %d, \"failures\": %d,\n",
+                c->iterations, c->images, c->failures);
+        fprintf(f, "     \"latency_ms\": {\"p50\": %.2f, \"p95\": %.2f, \"p99\": %.2f, "
+                   "\"mean\": %.2f},\n",
+                percentile(c->latency, c->images, 50), percentile(c->latency, c->images, 95),
+                percentile(c->latency, c->images, 99), mean);
+        fprintf(f, "     \"images_per_s\": %.4f, \"peak_rss_mb\": %.1f, "
+                   "\"peak_rss_since_start\": %s,\n",
+                c->wall_ms > 0 ? c->images / (c->wall_ms / 1000.0) : 0,
+                c->peak_rss_mb, c->rss_reset ? "false" : "true");
+        fprintf(f, "     \"phases_ms\": {\"load\": %.2f, \"tokenize\": %.3f, \"encode\": %.2f, "
+                   "\"refs\": %.2f, \"denoise\": %.2f, \"vae\": %.2f, \"save\": %.2f},\n",
+                s->load * k, s->tokenize * k, s->encode * k, s->refs * k,
+                s->denoise * k, s->vae * k, s->save * k);
+        fprintf(f, "     \"step_ms\": [");
+        for (int j = 0; j < s->num_steps; j++)
+            fprintf(f, "%s%.2f", j ? ", " : "", s->step[j] * k);
+        fprintf(f, "]}%s\n", i + 1 < n ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    if (f != stdout) fclose(f);
+    return 0;
+}
+
+/* ======================================================================
+ * Entry Point
+ * ====================================================================== */
+
+int flux_perf_run(const char *model_dir, const char *prompt,
+                  const flux_params *defaults, const flux_perf_opts *opts) {
+    int widths[PERF_MAX_LIST], heights[PERF_MAX_LIST];
+    int steps[PERF_MAX_LIST], refs[PERF_MAX_LIST], batches[PERF_MAX_LIST];
+    int nsizes = 1, nsteps = 1, nrefs = 1, nbatches = 1;
+
+    widths[0] = defaults->width;
+    heights[0] = defaults->height;
+    steps[0] = defaults->num_steps;
+    refs[0] = 0;
+    batches[0] = 1;
+    if (opts->sizes) nsizes = parse_list(opts->sizes, widths, heights, PERF_MAX_LIST);
+    if (opts->steps) nsteps = parse_list(opts->steps, steps, NULL, PERF_MAX_LIST);
+    if (opts->refs) nrefs = parse_list(opts->refs, refs, NULL, PERF_MAX_LIST);
+    if (opts->batches) nbatches = parse_list(opts->batches, batches, NULL, PERF_MAX_LIST);
+    if (nsizes <= 0 || nsteps <= 0 || nrefs <= 0 || nbatches <= 0) {
+        fprintf(stderr, "Error: --bench lists are comma-separated numbers (sizes: N or WxH)\n");
+        return 1;
+    }
+    for (int i = 0; i < nsizes; i++) {
+        if (widths[i] < 64 || widths[i] > 4096 || heights[i] < 64 || heights[i] > 4096) {
+            fprintf(stderr, "Error: --bench-sizes entries must be between 64 and 4096\n");
+            return 1;
+        }
+    }
+    for (int i = 0; i < nsteps; i++) {
+        if (steps[i] > FLUX_MAX_STEPS) {
+            fprintf(stderr, "Error: Steps must be between 1 and %d\n", FLUX_MAX_STEPS);
+            return 1;
+        }
+    }
+    for (int i = 0; i < nrefs; i++) {
+        if (refs[i] < 0 || refs[i] > PERF_MAX_LIST) {
+            fprintf(stderr, "Error: --bench-refs entries must be between 0 and %d\n", PERF_MAX_LIST);
+            return 1;
+        }
+    }
+    for (int i = 0; i < nbatches; i++) {
+        if (batches[i] < 1 || batches[i] > PERF_MAX_LIST * 16) {
+            fprintf(stderr, "Error: --bench-batch entries must be between 1 and %d\n",
+                    PERF_MAX_LIST * 16);
+            return 1;
+        }
+    }
+
+    int modes[2], nmodes = 0;
+    if (opts->warm || !opts->cold) modes[nmodes++] = 0;
+    if (opts->cold) modes[nmodes++] = 1;
+
+    perf_run run = {
+        .model_dir = model_dir,
+        .prompt = prompt ? prompt : PERF_DEFAULT_PROMPT,
+        .defaults = defaults,
+        .opts = opts,
+    };
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/tokenizer/tokenizer.json", model_dir);
+    int verbose = flux_verbose;
+    flux_verbose = 0;
+    run.tokenizer = qwen3_tokenizer_load(path);
+    flux_verbose = verbose;
+
+    int max_cfgs = nmodes * nsizes * nsteps * nrefs * nbatches;
+    perf_config *cfgs = (perf_config *)calloc(max_cfgs, sizeof(perf_config));
+    int ncfgs = 0, rc = 0;
+
+    for (int m = 0; m < nmodes && rc == 0; m++) {
+        if (!modes[m]) {
+            double t0 = now_ms();
+            run.warm_ctx = load_ctx(&run);
+            if (!run.warm_ctx) {
+                fprintf(stderr, "Error: Failed to load model: %s\n", flux_get_error());
+                rc = 1;
+                break;
+            }
+            flux_set_keep_text_encoder(run.warm_ctx, 1);
+            if (!opts->quiet)
+                fprintf(stderr, "warm: context loaded in %.1f ms\n", now_ms() - t0);
+        }
+
+        for (int a = 0; a < nsizes; a++)
+        for (int b = 0; b < nsteps; b++)
+        for (int c = 0; c < nrefs; c++)
+        for (int d = 0; d < nbatches; d++) {
+            if (batches[d] > 1 && refs[c] > 0) {
+                if (!opts->quiet)
+                    fprintf(stderr, "skipping refs=%d batch=%d: batches are text-to-image only\n",
+                            refs[c], batches[d]);
+                continue;
+            }
+            perf_config *cfg = &cfgs[ncfgs];
+            cfg->cold = modes[m];
+            cfg->width = widths[a];
+            cfg->height = heights[a];
+            cfg->refs = refs[c];
+            cfg->batch = batches[d];
+            cfg->steps = steps[b];
+            if (cfg->steps <= 0)
+                cfg->steps = (!run.warm_ctx || flux_is_distilled(run.warm_ctx)) ? 4 : 50;
+
+            char label[64];
+            config_label(cfg, label, sizeof(label));
+            if (!opts->quiet) fprintf(stderr, "%s\n", label);
+            if (run_config(&run, cfg) != 0) {
+                fprintf(stderr, "Error: Out of memory\n");
+                rc = 1;
+                break;
+            }
+            ncfgs++;
+            if (cfg->failures) {
+                fprintf(stderr, "Warning: %d of %d runs of %s failed: %s\n",
+                        cfg->failures, cfg->images, label, flux_get_error());
+                rc = 1;
+            }
+        }
+
+        if (run.warm_ctx) {
+            flux_free(run.warm_ctx);
+            run.warm_ctx = NULL;
+        }
+    }
+
+    print_tables(cfgs, ncfgs);
+    if (opts->json_path && write_json(opts->json_path, &run, cfgs, ncfgs) != 0) rc = 1;
+
+    for (int i = 0; i < ncfgs; i++) free(cfgs[i].latency);
+    free(cfgs);
+    qwen3_tokenizer_free(run.tokenizer);
+    return rc;
+}
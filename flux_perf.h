@@ -0,0 +1,38 @@
+/*
+ * FLUX End-to-End Benchmark (--bench)
+ */
+
+#ifndef FLUX_PERF_H
+#define FLUX_PERF_H
+
+#include "flux.h"
+
+typedef struct {
+    const char *sizes;          /* "256,512x768" (NULL: defaults' size) */
+    const char *steps;          /* "4,8" (NULL: defaults, or the model's) */
+    const char *refs;           /* Reference images per run, "0,1" (NULL: 0) */
+    const char *batches;        /* Concurrent requests, "1,4" (NULL: 1) */
+    int warm;                   /* Reuse one context across runs */
+    int cold;                   /* Load a fresh context for every run */
+    int iterations;             /* Timed runs per configuration (0: 3) */
+    int use_mmap;               /* flux_set_mmap() on every context */
+    int force_base;             /* flux_set_base_mode() on every context */
+    const char *json_path;      /* Also write results here (NULL: none) */
+    int quiet;                  /* No progress on stderr */
+} flux_perf_opts;
+
+/*
+ * Run every combination of sizes, steps, refs and batches in the selected
+ * modes (warm only if neither is set), each for opts->iterations timed
+ * runs. Warm configurations start with an untimed run. Batches above 1
+ * go through flux_engine and are text-to-image only.
+ *
+ * Reports per-phase times (load, tokenize, encode, reference encoding,
+ * each step, VAE, PNG encode), p50/p95/p99 latency, images/s and peak RSS
+ * as a table on stdout, and as JSON when json_path is set.
+ * Returns 0 if every run succeeded, non-zero otherwise.
+ */
+int flux_perf_run(const char *model_dir, const char *prompt,
+                  const flux_params *defaults, const flux_perf_opts *opts);
+
+#endif /* FLUX_PERF_H */
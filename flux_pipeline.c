@@ -0,0 +1,533 @@
+/*
+ * FLUX Batch Pipeline
+ *
+ * Runs a file of prompts through four stages connected by bounded queues:
+ *
+ *   encode thread    Qwen3 text encoding
+ *   calling thread   transformer sampling
+ *   decode thread    VAE decode
+ *   writer threads   PNG compression and file write
+ *
+ * While job N denoises, job N+1 is being encoded and job N-1 decoded and
+ * written, so the transformer stays busy instead of waiting on the other
+ * models. The encoder, transformer and VAE each own their work buffers,
+ * so every model stage is a single thread; only writing scales out.
+ *
+ * The model stages split the compute threads (flux_set_thread_budget()):
+ * most go to denoising, the bottleneck, and the rest to encoding and
+ * decoding. When the three models and their work buffers would not fit in
+ * memory together (flux_estimate_memory()), the model stages take turns
+ * instead, each with every thread, and the text encoder is released after
+ * each prompt if it does not fit next to the transformer either.
+ *
+ * Back-pressure: a stage blocks when the next queue holds queue_depth jobs,
+ * or when its buffered embeddings, latents and images exceed the byte cap
+ * (by default a quarter of the memory available at that moment). A queue
+ * always accepts one job, so the pipeline never stalls.
+ *
+ * Usage: flux -d model/ --batch prompts.txt -o out.png
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "flux.h"
+#include "flux_kernels.h"
+#include "flux_pipeline.h"
+
+#if defined(USE_BLAS) && !defined(USE_METAL) && !defined(__APPLE__)
+extern int openblas_get_num_threads(void);
+extern void openblas_set_num_threads(int num_threads);
+#endif
+
+/* ======================================================================
+ * Constants
+ * ====================================================================== */
+
+#define PIPE_DEFAULT_DEPTH      2
+#define PIPE_DEFAULT_WRITERS    2
+#define PIPE_MAX_WRITERS        16
+
+enum { STAGE_ENCODE, STAGE_DENOISE, STAGE_DECODE, STAGE_WRITE, NUM_STAGES };
+
+static const char *stage_names[NUM_STAGES] = { "encode", "denoise", "decode", "write" };
+
+#define PIPE_SIDE_SHARE         8       /* Encode and decode threads: 1/8 each */
+
+/* ======================================================================
+ * Jobs and Queues
+ * ====================================================================== */
+
+typedef struct pipe_job {
+    int index;                  /* 1-based position in the batch */
+    char *prompt;
+    char *output;
+    int64_t seed;
+    float *emb;                 /* Encode -> denoise */
+    int emb_seq;
+    float *latent;              /* Denoise -> decode */
+    int latent_h, latent_w;
+    flux_image *img;            /* Decode -> write */
+    size_t bytes;               /* Size of the buffer in flight */
+    double seconds[NUM_STAGES];
+    struct pipe_job *next;
+} pipe_job;
+
+typedef struct {
+    pipe_job *head, *tail;
+    int count, capacity;
+    size_t bytes, max_bytes;    /* max_bytes 0: follow available memory */
+    int closed;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty, not_full;
+} pipe_queue;
+
+typedef struct {
+    flux_ctx *ctx;
+    const flux_params *defaults;
+    pipe_job *jobs;             /* Parsed batch, consumed by the encoder */
+    int num_jobs;
+    float *uncond_emb;          /* Empty-prompt encoding (base models) */
+    int uncond_seq;
+    pipe_queue to_denoise, to_decode, to_write;
+    int threads[NUM_STAGES];    /* Compute threads of the model stages */
+    int serial;                 /* Model stages take turns on model_mutex */
+    int low_memory;             /* Because they do not fit in memory together */
+    int release_encoder;        /* Release the text encoder after each prompt */
+    pthread_mutex_t model_mutex;
+    pthread_mutex_t stats_mutex;
+    double busy[NUM_STAGES];
+    int done, failed;
+    int quiet;
+} pipeline;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void queue_init(pipe_queue *q, int capacity, size_t max_bytes) {
+    memset(q, 0, sizeof(*q));
+    q->capacity = capacity;
+    q->max_bytes = max_bytes;
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+}
+
+static void queue_destroy(pipe_queue *q) {
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+}
+
+static int queue_has_room(const pipe_queue *q, size_t bytes) {
+    if (q->count == 0) return 1;
+    if (q->count >= q->capacity) return 0;
+    size_t cap = q->max_bytes ? q->max_bytes : flux_available_memory() / 4;
+    return cap == 0 || q->bytes + bytes <= cap;
+}
+
+static void queue_push(pipe_queue *q, pipe_job *job) {
+    pthread_mutex_lock(&q->mutex);
+    while (!queue_has_room(q, job->bytes))
+        pthread_cond_wait(&q->not_full, &q->mutex);
+    job->next = NULL;
+    if (q->tail) q->tail->next = job;
+    else q->head = job;
+    q->tail = job;
+    q->count++;
+    q->bytes += job->bytes;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+/* Next job, or NULL once the queue is closed and drained */
+static pipe_job *queue_pop(pipe_queue *q) {
+    pthread_mutex_lock(&q->mutex);
+    while (!q->head && !q->closed)
+        pthread_cond_wait(&q->not_empty, &q->mutex);
+    pipe_job *job = q->head;
+    if (job) {
+        q->head = job->next;
+        if (!q->head) q->tail = NULL;
+        q->count--;
+        q->bytes -= job->bytes;
+        pthread_cond_broadcast(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return job;
+}
+
+static void queue_close(pipe_queue *q) {
+    pthread_mutex_lock(&q->mutex);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_mutex_unlock(&q->mutex);
+}
+
+static void job_free(pipe_job *job) {
+    free(job->prompt);
+    free(job->output);
+    flux_free_buffer(job->emb);
+    flux_free_buffer(job->latent);
+    flux_image_free(job->img);
+    free(job);
+}
+
+static void job_fail(pipeline *pl, pipe_job *job, const char *msg) {
+    pthread_mutex_lock(&pl->stats_mutex);
+    pl->failed++;
+    fprintf(stderr, "Error: batch job %d (%s): %s\n", job->index, job->output, msg);
+    pthread_mutex_unlock(&pl->stats_mutex);
+    job_free(job);
+}
+
+static void stage_time(pipeline *pl, pipe_job *job, int stage, double start) {
+    double elapsed = now_seconds() - start;
+    if (job) job->seconds[stage] = elapsed;
+    pthread_mutex_lock(&pl->stats_mutex);
+    pl->busy[stage] += elapsed;
+    pthread_mutex_unlock(&pl->stats_mutex);
+}
+
+static void model_lock(pipeline *pl) {
+    if (pl->serial) pthread_mutex_lock(&pl->model_mutex);
+}
+
+static void model_unlock(pipeline *pl) {
+    if (pl->serial) pthread_mutex_unlock(&pl->model_mutex);
+}
+
+/* ======================================================================
+ * Memory and Threads
+ * ====================================================================== */
+
+/* Overlapping the stages holds all three models with the work buffers of
+ * each. Without room for that the stages take turns, keeping the text
+ * encoder only if it fits next to the transformer (or VAE). The Metal
+ * backend keeps global command batching state, so there the model stages
+ * always take turns on the GPU; PNG writing still overlaps. */
+static void plan_memory(pipeline *pl) {
+#ifdef USE_METAL
+    pl->serial = 1;
+#endif
+    size_t limit = flux_get_host_resources()->memory_limit;
+    flux_memory_estimate est;
+    flux_set_keep_text_encoder(pl->ctx, 1);
+    if (limit == 0 || flux_estimate_memory(pl->ctx, pl->defaults, NULL, 0, &est) != 0)
+        return;
+    if (est.denoise_peak + est.text_encoder_work + est.vae_work <= limit) return;
+    pl->serial = pl->low_memory = 1;
+    if (est.peak > limit) {
+        flux_set_keep_text_encoder(pl->ctx, 0);
+        pl->release_encoder = 1;
+    }
+}
+
+/* Turns get every thread; overlapping stages split them, giving encode
+ * and decode an eighth each and denoising the rest */
+static void plan_threads(pipeline *pl, const flux_pipeline_opts *o) {
+    int n = flux_num_threads();
+    int side = pl->serial ? n : (n / PIPE_SIDE_SHARE > 0 ? n / PIPE_SIDE_SHARE : 1);
+    int denoise = pl->serial ? n : n - 2 * side;
+    if (denoise < 1) denoise = 1;
+    pl->threads[STAGE_ENCODE] = o->encode_threads > 0 ? o->encode_threads : side;
+    pl->threads[STAGE_DENOISE] = o->denoise_threads > 0 ? o->denoise_threads : denoise;
+    pl->threads[STAGE_DECODE] = o->decode_threads > 0 ? o->decode_threads : side;
+}
+
+/* ======================================================================
+ * Batch File
+ * ====================================================================== */
+
+/* out.png -> out-<n>.png */
+static char *numbered_path(const char *output, int n) {
+    char path[1024];
+    const char *dot = strrchr(output, '.');
+    const char *slash = strrchr(output, '/');
+    if (!dot || (slash && dot < slash)) dot = output + strlen(output);
+    snprintf(path, sizeof(path), "%.*s-%d%s", (int)(dot - output), output, n, dot);
+    return strdup(path);
+}
+
+static int load_batch(pipeline *pl, const char *batch_file, const char *output) {
+    FILE *f = fopen(batch_file, "r");
+    if (!f) {
+        fprintf(stderr, "Error: cannot open batch file %s\n", batch_file);
+        return -1;
+    }
+
+    int64_t base_seed = (pl->defaults->seed >= 0) ?
+                        pl->defaults->seed : (int64_t)time(NULL);
+    pipe_job **tail = &pl->jobs;
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+
+    while ((len = getline(&line, &cap, f)) != -1) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0 || line[0] == '#') continue;
+
+        pipe_job *job = (pipe_job *)calloc(1, sizeof(pipe_job));
+        job->index = pl->num_jobs + 1;
+        job->seed = base_seed + pl->num_jobs;
+        char *tab = strchr(line, '\t');
+        if (tab) {
+            *tab = '\0';
+            job->output = strdup(line);
+            job->prompt = strdup(tab + 1);
+        } else {
+            job->output = numbered_path(output, job->index);
+            job->prompt = strdup(line);
+        }
+        *tail = job;
+        tail = &job->next;
+        pl->num_jobs++;
+    }
+    free(line);
+    fclose(f);
+
+    if (pl->num_jobs == 0) {
+        fprintf(stderr, "Error: no prompts in batch file %s\n", batch_file);
+        return -1;
+    }
+    return 0;
+}
+
+/* ======================================================================
+ * Stages
+ * ====================================================================== */
+
+static void *encode_stage(void *arg) {
+    pipeline *pl = (pipeline *)arg;
+    flux_set_thread_budget(pl->threads[STAGE_ENCODE]);
+
+    /* Base models share one unconditioned encoding across all jobs */
+    if (!flux_is_distilled(pl->ctx)) {
+        model_lock(pl);
+        double start = now_seconds();
+        pl->uncond_emb = flux_encode_text(pl->ctx, "", &pl->uncond_seq);
+        model_unlock(pl);
+        stage_time(pl, NULL, STAGE_ENCODE, start);
+    }
+
+    while (pl->jobs) {
+        pipe_job *job = pl->jobs;
+        pl->jobs = job->next;
+
+        model_lock(pl);
+        double start = now_seconds();
+        job->emb = flux_encode_text(pl->ctx, job->prompt, &job->emb_seq);
+        if (pl->release_encoder) flux_release_text_encoder(pl->ctx);
+        model_unlock(pl);
+        stage_time(pl, job, STAGE_ENCODE, start);
+
+        if (!job->emb || (!flux_is_distilled(pl->ctx) && !pl->uncond_emb)) {
+            job_fail(pl, job, "failed to encode prompt");
+            continue;
+        }
+        job->bytes = (size_t)job->emb_seq * flux_text_dim(pl->ctx) * sizeof(float);
+        queue_push(&pl->to_denoise, job);
+    }
+    queue_close(&pl->to_denoise);
+    return NULL;
+}
+
+static void denoise_stage(pipeline *pl) {
+    int prev_budget = flux_set_thread_budget(pl->threads[STAGE_DENOISE]);
+    pipe_job *job;
+    while ((job = queue_pop(&pl->to_denoise)) != NULL) {
+        flux_params params = *pl->defaults;
+        params.seed = job->seed;
+
+        model_lock(pl);
+        double start = now_seconds();
+        job->latent = flux_generate_latent_with_embeddings(
+            pl->ctx, job->emb, job->emb_seq, pl->uncond_emb, pl->uncond_seq,
+            &params, &job->latent_h, &job->latent_w);
+        model_unlock(pl);
+        stage_time(pl, job, STAGE_DENOISE, start);
+
+        flux_free_buffer(job->emb);
+        job->emb = NULL;
+        if (!job->latent) {
+            job_fail(pl, job, flux_get_error());
+            continue;
+        }
+        job->bytes = (size_t)FLUX_LATENT_CHANNELS * job->latent_h * job->latent_w *
+                     sizeof(float);
+        queue_push(&pl->to_decode, job);
+    }
+    queue_close(&pl->to_decode);
+    flux_set_thread_budget(prev_budget);
+}
+
+static void *decode_stage(void *arg) {
+    pipeline *pl = (pipeline *)arg;
+    flux_set_thread_budget(pl->threads[STAGE_DECODE]);
+    pipe_job *job;
+    while ((job = queue_pop(&pl->to_decode)) != NULL) {
+        model_lock(pl);
+        double start = now_seconds();
+        job->img = flux_decode_latent(pl->ctx, job->latent, job->latent_h, job->latent_w);
+        model_unlock(pl);
+        stage_time(pl, job, STAGE_DECODE, start);
+
+        flux_free_buffer(job->latent);
+        job->latent = NULL;
+        if (!job->img) {
+            job_fail(pl, job, "VAE decode failed");
+            continue;
+        }
+        job->bytes = (size_t)job->img->width * job->img->height * job->img->channels;
+        queue_push(&pl->to_write, job);
+    }
+    queue_close(&pl->to_write);
+    return NULL;
+}
+
+static void *write_stage(void *arg) {
+    pipeline *pl = (pipeline *)arg;
+    pipe_job *job;
+    while ((job = queue_pop(&pl->to_write)) != NULL) {
+        double start = now_seconds();
+        int rc = flux_image_save_with_seed(job->img, job->output, job->seed);
+        stage_time(pl, job, STAGE_WRITE, start);
+
+        if (rc != 0) {
+            job_fail(pl, job, "failed to save image");
+            continue;
+        }
+        pthread_mutex_lock(&pl->stats_mutex);
+        pl->done++;
+        if (!pl->quiet) {
+            fprintf(stderr, "[batch] %d/%d %s %dx%d seed %lld "
+                    "(encode %.1fs, denoise %.1fs, decode %.1fs, write %.1fs)\n",
+                    job->index, pl->num_jobs, job->output,
+                    job->img->width, job->img->height, (long long)job->seed,
+                    job->seconds[STAGE_ENCODE], job->seconds[STAGE_DENOISE],
+                    job->seconds[STAGE_DECODE], job->seconds[STAGE_WRITE]);
+        }
+        pthread_mutex_unlock(&pl->stats_mutex);
+        job_free(job);
+    }
+    return NULL;
+}
+
+/* ======================================================================
+ * Public API
+ * ====================================================================== */
+
+int flux_pipeline_run(flux_ctx *ctx, const char *batch_file, const char *output,
+                      const flux_params *defaults, const flux_pipeline_opts *opts) {
+    flux_pipeline_opts o = {0};
+    if (opts) o = *opts;
+    if (o.queue_depth <= 0) o.queue_depth = PIPE_DEFAULT_DEPTH;
+    if (o.writers <= 0) o.writers = PIPE_DEFAULT_WRITERS;
+    if (o.writers > PIPE_MAX_WRITERS) o.writers = PIPE_MAX_WRITERS;
+
+    pipeline pl;
+    memset(&pl, 0, sizeof(pl));
+    pl.ctx = ctx;
+    pl.defaults = defaults;
+    pl.quiet = o.quiet;
+    if (load_batch(&pl, batch_file, output ? output : "out.png") != 0) {
+        while (pl.jobs) {
+            pipe_job *job = pl.jobs;
+            pl.jobs = job->next;
+            job_free(job);
+        }
+        return 1;
+    }
+
+    queue_init(&pl.to_denoise, o.queue_depth, o.max_queued_bytes);
+    queue_init(&pl.to_decode, o.queue_depth, o.max_queued_bytes);
+    queue_init(&pl.to_write, o.queue_depth, o.max_queued_bytes);
+    pthread_mutex_init(&pl.model_mutex, NULL);
+    pthread_mutex_init(&pl.stats_mutex, NULL);
+
+    plan_memory(&pl);
+    plan_threads(&pl, &o);
+#if defined(USE_BLAS) && !defined(USE_METAL) && !defined(__APPLE__)
+    /* OpenBLAS has one process-wide pool: size it for the denoise stage,
+     * which runs most of the GEMMs */
+    int prev_blas_threads = openblas_get_num_threads();
+    if (!pl.serial) openblas_set_num_threads(pl.threads[STAGE_DENOISE]);
+#endif
+
+    if (!o.quiet) {
+        fprintf(stderr, "Batch: %d prompts, queue depth %d, %d writer%s, "
+                "threads encode %d / denoise %d / decode %d\n",
+                pl.num_jobs, o.queue_depth, o.writers, o.writers == 1 ? "" : "s",
+                pl.threads[STAGE_ENCODE], pl.threads[STAGE_DENOISE],
+                pl.threads[STAGE_DECODE]);
+        if (pl.low_memory)
+            fprintf(stderr, "  The models do not fit in memory together: stages take turns%s\n",
+                    pl.release_encoder ? ", text encoder released after each prompt" : "");
+    }
+
+    /* Threads start from the end of the pipeline: if one cannot be created,
+     * closing the queues in front of those already running stops them */
+    double start = now_seconds();
+    pthread_t encoder, decoder, writers[PIPE_MAX_WRITERS];
+    int num_writers = 0, decoder_started = 0, started = 0;
+    while (num_writers < o.writers &&
+           pthread_create(&writers[num_writers], NULL, write_stage, &pl) == 0)
+        num_writers++;
+    if (num_writers == o.writers)
+        decoder_started = pthread_create(&decoder, NULL, decode_stage, &pl) == 0;
+    if (decoder_started)
+        started = pthread_create(&encoder, NULL, encode_stage, &pl) == 0;
+
+    if (started) {
+        denoise_stage(&pl);
+        pthread_join(encoder, NULL);
+    } else {
+        fprintf(stderr, "Error: cannot start batch pipeline threads\n");
+        queue_close(&pl.to_decode);
+        queue_close(&pl.to_write);
+        while (pl.jobs) {
+            pipe_job *job = pl.jobs;
+            pl.jobs = job->next;
+            job_free(job);
+        }
+    }
+    if (decoder_started) pthread_join(decoder, NULL);
+    for (int i = 0; i < num_writers; i++)
+        pthread_join(writers[i], NULL);
+    double elapsed = now_seconds() - start;
+
+    if (started && !o.quiet) {
+        double sequential = 0;
+        for (int s = 0; s < NUM_STAGES; s++) sequential += pl.busy[s];
+        fprintf(stderr, "Batch: %d/%d images in %.1fs", pl.done, pl.num_jobs, elapsed);
+        if (pl.done > 0) fprintf(stderr, ", %.2fs/image", elapsed / pl.done);
+        fprintf(stderr, "\n  Stage busy:");
+        for (int s = 0; s < NUM_STAGES; s++)
+            fprintf(stderr, " %s %.1fs", stage_names[s], pl.busy[s]);
+        fprintf(stderr, "\n  Overlap: %.2fx over running the stages back to back (%.1fs)\n",
+                elapsed > 0 ? sequential / elapsed : 1.0, sequential);
+    }
+
+#if defined(USE_BLAS) && !defined(USE_METAL) && !defined(__APPLE__)
+    openblas_set_num_threads(prev_blas_threads);
+#endif
+    flux_set_keep_text_encoder(ctx, 0);
+    flux_release_text_encoder(ctx);
+
+    flux_free_buffer(pl.uncond_emb);
+    queue_destroy(&pl.to_denoise);
+    queue_destroy(&pl.to_decode);
+    queue_destroy(&pl.to_write);
+    pthread_mutex_destroy(&pl.model_mutex);
+    pthread_mutex_destroy(&pl.stats_mutex);
+    return (!started || pl.failed > 0) ? 1 : 0;
+}
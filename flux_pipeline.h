@@ -0,0 +1,38 @@
+/*
+ * FLUX Batch Pipeline
+ */
+
+#ifndef FLUX_PIPELINE_H
+#define FLUX_PIPELINE_H
+
+#include <stddef.h>
+#include "flux.h"
+
+typedef struct {
+    int queue_depth;            /* Jobs buffered between stages (0: 2) */
+    int writers;                /* PNG writer threads (0: 2) */
+    int encode_threads;         /* Compute threads per model stage (0: */
+    int denoise_threads;        /*   denoise gets 3/4 of the CPUs while */
+    int decode_threads;         /*   the stages overlap, all when serial) */
+    size_t max_queued_bytes;    /* Buffered embeddings/latents/images cap
+                                 * (0: a quarter of available memory) */
+    int quiet;                  /* No per-job or summary output */
+} flux_pipeline_opts;
+
+/*
+ * Generate every prompt in batch_file, one per line ("PROMPT" or
+ * "OUTPUT<TAB>PROMPT"; blank lines and lines starting with '#' are
+ * skipped). Unnamed outputs are numbered after output: out.png becomes
+ * out-1.png, out-2.png, ... Job i uses seed defaults->seed + i (or the
+ * current time when the seed is negative).
+ *
+ * Text encoding, denoising, VAE decoding and PNG writing run on separate
+ * threads connected by bounded queues, so consecutive jobs overlap. The
+ * model stages split the compute threads, or take turns when the models
+ * would not fit in memory together.
+ * Returns 0 if every job succeeded, non-zero otherwise.
+ */
+int flux_pipeline_run(flux_ctx *ctx, const char *batch_file, const char *output,
+                      const flux_params *defaults, const flux_pipeline_opts *opts);
+
+#endif /* FLUX_PIPELINE_H */
@@ -12,6 +12,7 @@
 #include "flux_qwen3.h"
 #include "flux_safetensors.h"
 #include "flux_kernels.h"
+#include "flux_roofline.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,6 +32,9 @@
 #include "flux_metal.h"
 #endif
 
+#define FLUX_MEM_DEFAULT FLUX_MEM_QWEN3
+#include "flux_mem.h"
+
 /* Minimum matrix size for GPU acceleration.
  * Using 10M threshold keeps text encoder on CPU (Accelerate BLAS), which is
  * faster and avoids GPU memory pressure on 16GB systems. Text encoder weights
@@ -134,6 +138,8 @@ struct qwen3_model {
 
     /* BF16 GPU acceleration */
     int use_bf16;
+
+    int is_fork;              /* Weights belong to the model it was forked from */
 };
 
 /* Forward declarations for mmap streaming mode */
@@ -169,6 +175,9 @@ static void qwen3_linear(float *y, const float *x, const float *W,
     }
 #endif
 
+    FLUX_OP_BEGIN(op, FLUX_OP_LINEAR, 2.0 * seq_len * in_dim * out_dim,
+                  4.0 * ((double)seq_len * in_dim + (double)out_dim * in_dim +
+                         (double)seq_len * out_dim));
 #ifdef USE_BLAS
     cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
                 seq_len, out_dim, in_dim,
@@ -185,10 +194,13 @@ static void qwen3_linear(float *y, const float *x, const float *W,
         }
     }
 #endif
+    FLUX_OP_END(op);
 }
 
 static void qwen3_rms_norm(float *out, const float *x, const float *weight,
                            int seq_len, int hidden, float eps) {
+    FLUX_OP_BEGIN(op, FLUX_OP_NORM, 4.0 * seq_len * hidden,
+                  4.0 * (2.0 * seq_len * hidden + hidden));
     for (int s = 0; s < seq_len; s++) {
         const float *x_row = x + s * hidden;
         float *out_row = out + s * hidden;
@@ -206,11 +218,14 @@ static void qwen3_rms_norm(float *out, const float *x, const float *weight,
             out_row[i] = x_row[i] * rms_inv * weight[i];
         }
     }
+    FLUX_OP_END(op);
 }
 
 /* Per-head RMS norm for Q/K normalization */
 static void qwen3_head_rms_norm(float *out, const float *x, const float *weight,
                                 int seq_len, int num_heads, int head_dim, float eps) {
+    FLUX_OP_BEGIN(op, FLUX_OP_NORM, 4.0 * seq_len * num_heads * head_dim,
+                  4.0 * (2.0 * seq_len * num_heads * head_dim + head_dim));
     for (int s = 0; s < seq_len; s++) {
         for (int h = 0; h < num_heads; h++) {
             const float *x_head = x + s * num_heads * head_dim + h * head_dim;
@@ -230,6 +245,7 @@ static void qwen3_head_rms_norm(float *out, const float *x, const float *weight,
             }
         }
     }
+    FLUX_OP_END(op);
 }
 
 static void qwen3_softmax(float *x, int len) {
@@ -345,6 +361,8 @@ static void qwen3_attention_forward(qwen3_model_t *model, qwen3_layer_t *layer,
     apply_rope(model->q_buf, model->k_buf, model->rope_cos, model->rope_sin,
                seq_len, num_heads, num_kv_heads, head_dim);
 
+    FLUX_OP_BEGIN(attn_op, FLUX_OP_ATTENTION, 4.0 * num_heads * seq_len * seq_len * head_dim,
+                  4.0 * seq_len * head_dim * (2.0 * num_heads + 2.0 * num_kv_heads));
 #ifdef USE_METAL
     /* Try GPU-accelerated causal attention for all heads in parallel.
      * The GPU kernel uses both causal masking and attention mask.
@@ -444,6 +462,8 @@ static void qwen3_attention_forward(qwen3_model_t *model, qwen3_layer_t *layer,
 #ifdef USE_METAL
 output_proj:
 #endif
+    FLUX_OP_END(attn_op);
+
     /* Output projection */
     qwen3_linear(model->hidden_state, model->attn_out, layer->attn.o_proj_weight,
                  seq_len, q_dim, hidden);
@@ -921,6 +941,9 @@ static int qwen3_forward_gpu(qwen3_model_t *model, int seq_len, const int *atten
     for (int layer_idx = 0; layer_idx <= QWEN3_OUTPUT_LAYER_3; layer_idx++) {
         qwen3_layer_t *layer = &model->layers[layer_idx];
 
+        /* Abandoned: the CPU path below sees the flag too and returns NULL */
+        if (flux_aborted()) { ok = 0; break; }
+
         /* Load weights on demand (mmap mode) */
         if (model->use_mmap) {
             if (load_layer_weights_small_f32(layer, model->sf_files, model->num_sf_files, layer_idx) != 0) {
@@ -1067,6 +1090,14 @@ float *qwen3_forward(qwen3_model_t *model, const int *input_ids,
 #endif
 
     for (int layer_idx = 0; layer_idx < model->num_layers; layer_idx++) {
+        /* Abandoned through flux_abort_callback */
+        if (flux_aborted()) {
+#ifdef USE_METAL
+            if (batch_mode) flux_gpu_batch_end();
+#endif
+            return NULL;
+        }
+
         /* In mmap mode, load layer weights on-demand */
         if (model->use_mmap) {
 #ifdef USE_METAL
@@ -1090,6 +1121,8 @@ float *qwen3_forward(qwen3_model_t *model, const int *input_ids,
             }
         }
 
+        FLUX_TRACE_BEGIN_ARGS("qwen3_layer", "block", "index,seq", layer_idx, seq_len, 0);
+        int prev_block = flux_op_enter_block(FLUX_BLOCK_QWEN3);
 #ifdef USE_METAL
         if (model->use_bf16 && flux_metal_available()) {
             qwen3_layer_forward_bf16(model, &model->layers[layer_idx], seq_len, attention_mask);
@@ -1098,6 +1131,8 @@ float *qwen3_forward(qwen3_model_t *model, const int *input_ids,
         {
             qwen3_layer_forward(model, &model->layers[layer_idx], seq_len, attention_mask);
         }
+        flux_op_leave_block(prev_block);
+        FLUX_TRACE_END();
 
         /* In mmap mode, free layer weights after use */
         if (model->use_mmap) {
@@ -1508,6 +1543,58 @@ static void qwen3_alloc_work_buffers(qwen3_model_t *model) {
     }
 }
 
+void qwen3_encoder_estimate_memory(const char *model_dir, int use_mmap,
+                                   size_t *weights, size_t *mapped, size_t *work) {
+    qwen3_model_t model;
+    char path[1024];
+    memset(&model, 0, sizeof(model));
+    snprintf(path, sizeof(path), "%s/text_encoder", model_dir);
+    if (parse_qwen3_config(path, &model) != 0) qwen3_set_defaults(&model);
+
+    size_t hidden = model.hidden_size, hd = model.head_dim;
+    size_t q_dim = (size_t)model.num_heads * hd, kv_dim = (size_t)model.num_kv_heads * hd;
+    size_t layer = hidden * (2 * q_dim + 2 * kv_dim) +          /* q, k, v, o */
+                   3 * hidden * model.intermediate_size +       /* gate, up, down */
+                   2 * hidden + 2 * hd;                         /* norms */
+    size_t embed = (size_t)model.vocab_size * hidden;
+    size_t params = embed + layer * model.num_layers + hidden;
+
+    int bf16 = 0;
+#ifdef USE_METAL
+    bf16 = flux_metal_available() && !getenv("FLUX_QWEN3_NO_BF16");
+#endif
+    if (use_mmap) {
+        /* Embeddings are converted up front, layers one at a time */
+        *weights = (embed + (bf16 ? 0 : layer)) * sizeof(float);
+        *mapped = params * sizeof(uint16_t);
+    } else {
+        *weights = params * sizeof(float);
+        *mapped = 0;
+    }
+
+    /* qwen3_alloc_work_buffers(), RoPE tables and the returned embeddings */
+    size_t seq = QWEN3_MAX_SEQ_LEN;
+    *work = (7 * seq * hidden + 2 * seq * q_dim + 2 * seq * kv_dim +
+             (size_t)model.num_heads * seq * seq +
+             2 * seq * model.intermediate_size + 3 * seq * hd +
+             seq * hd + seq * model.text_dim) * sizeof(float);
+}
+
+/* Spread a layer's projections over NUMA nodes (flux_numa_place) */
+static void place_layer_numa(const qwen3_model_t *model, qwen3_layer_t *layer) {
+    size_t hidden = model->hidden_size, inter = model->intermediate_size;
+    size_t q_dim = (size_t)model->num_heads * model->head_dim;
+    size_t kv_dim = (size_t)model->num_kv_heads * model->head_dim;
+    size_t row = hidden * sizeof(float);
+    flux_numa_place(layer->attn.q_proj_weight, q_dim, row);
+    flux_numa_place(layer->attn.k_proj_weight, kv_dim, row);
+    flux_numa_place(layer->attn.v_proj_weight, kv_dim, row);
+    flux_numa_place(layer->attn.o_proj_weight, hidden, q_dim * sizeof(float));
+    flux_numa_place(layer->mlp.gate_proj_weight, inter, row);
+    flux_numa_place(layer->mlp.up_proj_weight, inter, row);
+    flux_numa_place(layer->mlp.down_proj_weight, hidden, inter * sizeof(float));
+}
+
 qwen3_model_t *qwen3_model_load(const char *model_dir) {
     qwen3_model_t *model = calloc(1, sizeof(qwen3_model_t));
     if (!model) return NULL;
@@ -1546,6 +1633,7 @@ qwen3_model_t *qwen3_model_load(const char *model_dir) {
             fprintf(stderr, "qwen3_model_load: failed to load layer %d\n", i);
             goto error;
         }
+        place_layer_numa(model, &model->layers[i]);
     }
 
     /* Load final norm */
@@ -1649,9 +1737,58 @@ error:
     return NULL;
 }
 
+static void qwen3_free_work_buffers(qwen3_model_t *model) {
+    free(model->hidden_state);
+    free(model->residual);
+    free(model->q_buf);
+    free(model->k_buf);
+    free(model->v_buf);
+    free(model->attn_scores);
+    free(model->attn_out);
+    free(model->mlp_gate);
+    free(model->mlp_up);
+    free(model->mlp_out);
+    free(model->norm_buf);
+
+    /* Free attention work buffers */
+    free(model->attn_q_head);
+    free(model->attn_v_head);
+    free(model->attn_out_head);
+
+    for (int i = 0; i < 3; i++) {
+        free(model->layer_outputs[i]);
+    }
+}
+
+/* Share the weights of model with private work buffers. In mmap mode the
+ * layer structs are copied too, since layers are loaded into them on use. */
+static qwen3_model_t *qwen3_model_fork(const qwen3_model_t *model) {
+    qwen3_model_t *fork = malloc(sizeof(qwen3_model_t));
+    if (!fork) return NULL;
+    *fork = *model;
+    fork->is_fork = 1;
+    if (model->use_mmap) {
+        fork->layers = malloc(model->num_layers * sizeof(qwen3_layer_t));
+        if (!fork->layers) {
+            free(fork);
+            return NULL;
+        }
+        memcpy(fork->layers, model->layers, model->num_layers * sizeof(qwen3_layer_t));
+    }
+    qwen3_alloc_work_buffers(fork);
+    return fork;
+}
+
 void qwen3_model_free(qwen3_model_t *model) {
     if (!model) return;
 
+    if (model->is_fork) {
+        if (model->use_mmap) free(model->layers);
+        qwen3_free_work_buffers(model);
+        free(model);
+        return;
+    }
+
     free(model->embed_tokens);
     free(model->norm_weight);
     free(model->rope_cos);
@@ -1675,26 +1812,7 @@ void qwen3_model_free(qwen3_model_t *model) {
         free(model->layers);
     }
 
-    free(model->hidden_state);
-    free(model->residual);
-    free(model->q_buf);
-    free(model->k_buf);
-    free(model->v_buf);
-    free(model->attn_scores);
-    free(model->attn_out);
-    free(model->mlp_gate);
-    free(model->mlp_up);
-    free(model->mlp_out);
-    free(model->norm_buf);
-
-    /* Free attention work buffers */
-    free(model->attn_q_head);
-    free(model->attn_v_head);
-    free(model->attn_out_head);
-
-    for (int i = 0; i < 3; i++) {
-        free(model->layer_outputs[i]);
-    }
+    qwen3_free_work_buffers(model);
 
     /* Close mmap'd safetensors files if open */
     for (int i = 0; i < model->num_sf_files; i++) {
@@ -1740,9 +1858,36 @@ qwen3_encoder_t *qwen3_encoder_load(const char *model_dir, int use_mmap) {
     return enc;
 }
 
+qwen3_encoder_t *qwen3_encoder_fork(const qwen3_encoder_t *enc) {
+    if (!enc) return NULL;
+    qwen3_encoder_t *fork = calloc(1, sizeof(qwen3_encoder_t));
+    if (!fork) return NULL;
+    fork->tokenizer = enc->tokenizer;
+    fork->model = qwen3_model_fork(enc->model);
+    fork->is_fork = 1;
+    if (!fork->model) {
+        free(fork);
+        return NULL;
+    }
+    return fork;
+}
+
+void qwen3_encoder_release_workspace(qwen3_encoder_t *enc) {
+    if (!enc || !enc->model) return;
+    qwen3_model_t *model = enc->model;
+    qwen3_free_work_buffers(model);
+    model->hidden_state = model->residual = NULL;
+    model->q_buf = model->k_buf = model->v_buf = NULL;
+    model->attn_scores = model->attn_out = NULL;
+    model->mlp_gate = model->mlp_up = model->mlp_out = NULL;
+    model->norm_buf = NULL;
+    model->attn_q_head = model->attn_v_head = model->attn_out_head = NULL;
+    for (int i = 0; i < 3; i++) model->layer_outputs[i] = NULL;
+}
+
 void qwen3_encoder_free(qwen3_encoder_t *enc) {
     if (!enc) return;
-    qwen3_tokenizer_free(enc->tokenizer);
+    if (!enc->is_fork) qwen3_tokenizer_free(enc->tokenizer);
     qwen3_model_free(enc->model);
     free(enc);
 }
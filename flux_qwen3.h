@@ -8,6 +8,7 @@
 #ifndef FLUX_QWEN3_H
 #define FLUX_QWEN3_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -112,6 +113,7 @@ float *qwen3_forward(qwen3_model_t *model,
 typedef struct qwen3_encoder {
     qwen3_tokenizer_t *tokenizer;
     qwen3_model_t *model;
+    int is_fork;                /* Shares tokenizer and weights (qwen3_encoder_fork) */
 } qwen3_encoder_t;
 
 /*
@@ -121,6 +123,26 @@ typedef struct qwen3_encoder {
  */
 qwen3_encoder_t *qwen3_encoder_load(const char *model_dir, int use_mmap);
 
+/*
+ * Encoder sharing enc's tokenizer and weights, with its own work buffers,
+ * so both can encode on different threads. Free it before enc.
+ */
+qwen3_encoder_t *qwen3_encoder_fork(const qwen3_encoder_t *enc);
+
+/*
+ * Free the work buffers of an encoder that from now on only serves as the
+ * weight source of its forks.
+ */
+void qwen3_encoder_release_workspace(qwen3_encoder_t *enc);
+
+/*
+ * Memory qwen3_encoder_load(model_dir, use_mmap) would need, without
+ * loading anything: resident weights (anonymous memory), file-backed
+ * mmap pages, and work buffers for one encode.
+ */
+void qwen3_encoder_estimate_memory(const char *model_dir, int use_mmap,
+                                   size_t *weights, size_t *mapped, size_t *work);
+
 /*
  * Free encoder resources.
  */
@@ -10,6 +10,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdint.h>
+#include <pthread.h>
 #include "flux_kernels.h"
 
 /* ========================================================================
@@ -71,11 +72,9 @@ typedef struct qwen3_tokenizer {
  */
 static int byte_to_unicode[256];
 static int unicode_to_byte[512];
-static int byte_encoder_initialized = 0;
-
-static void init_byte_encoder(void) {
-    if (byte_encoder_initialized) return;
+static pthread_once_t byte_encoder_once = PTHREAD_ONCE_INIT;
 
+static void build_byte_encoder(void) {
     /* Printable ASCII and extended Latin */
     for (int i = 33; i <= 126; i++) {
         byte_to_unicode[i] = i;
@@ -102,8 +101,10 @@ static void init_byte_encoder(void) {
     /* Fix: byte 0 should also be mapped */
     byte_to_unicode[0] = 256;
     unicode_to_byte[256] = 0;
+}
 
-    byte_encoder_initialized = 1;
+static void init_byte_encoder(void) {
+    pthread_once(&byte_encoder_once, build_byte_encoder);
 }
 
 /* Encode a byte to its unicode character (UTF-8) */
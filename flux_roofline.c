@@ -0,0 +1,270 @@
+/*
+ * FLUX Roofline Accounting
+ *
+ * Counters are shared by all threads and updated atomically; kernels are
+ * coarse enough (one GEMM, one attention call) that this costs nothing
+ * measurable. The peak probe runs the library's own f32 and bf16 linear
+ * layers at a transformer projection's shape and a STREAM triad split with
+ * flux_parallel_for(), so the peaks are what this build can reach with
+ * these threads, not datasheet numbers. The report keeps the probed peaks
+ * as they are: a row past 100% is printed as such and flagged, since it
+ * means the probe fell short of what the model's kernels reach.
+ */
+
+#include "flux.h"
+#include "flux_roofline.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+volatile int flux_roofline_on = 0;
+FLUX_THREAD_LOCAL int flux_op_block = FLUX_BLOCK_OTHER;
+
+static FLUX_THREAD_LOCAL int op_depth = 0;
+static flux_op_stats g_stats[FLUX_BLOCK_TYPES][FLUX_OP_TYPES];
+static flux_peak g_peak;
+static int g_peak_valid = 0;
+
+static const char *op_names[FLUX_OP_TYPES] = {
+    "linear", "attention", "conv", "norm"
+};
+static const char *block_names[FLUX_BLOCK_TYPES] = {
+    "other", "double", "single", "qwen3", "vae"
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* ========================================================================
+ * Counting
+ * ======================================================================== */
+
+/* Returns the start time, or 1 for an op nested in one already counted */
+uint64_t flux_op_begin(void) {
+    if (op_depth++ > 0) return 1;
+    return now_ns();
+}
+
+void flux_op_end(const flux_op_scope *op) {
+    op_depth--;
+    if (op->start == 1) return;
+    uint64_t ns = now_ns() - op->start;
+    int block = flux_op_block;
+    if (block < 0 || block >= FLUX_BLOCK_TYPES) block = FLUX_BLOCK_OTHER;
+    flux_op_stats *s = &g_stats[block][op->type];
+    __atomic_fetch_add(&s->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->flops, (uint64_t)op->flops, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->bytes, (uint64_t)op->bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&s->ns, ns, __ATOMIC_RELAXED);
+}
+
+void flux_roofline_enable(int enable) {
+    flux_roofline_on = enable;
+}
+
+void flux_roofline_reset(void) {
+    memset(g_stats, 0, sizeof(g_stats));
+}
+
+void flux_roofline_stats(flux_op_stats stats[FLUX_BLOCK_TYPES][FLUX_OP_TYPES]) {
+    for (int b = 0; b < FLUX_BLOCK_TYPES; b++) {
+        for (int o = 0; o < FLUX_OP_TYPES; o++) {
+            flux_op_stats *s = &g_stats[b][o];
+            stats[b][o].calls = __atomic_load_n(&s->calls, __ATOMIC_RELAXED);
+            stats[b][o].flops = __atomic_load_n(&s->flops, __ATOMIC_RELAXED);
+            stats[b][o].bytes = __atomic_load_n(&s->bytes, __ATOMIC_RELAXED);
+            stats[b][o].ns = __atomic_load_n(&s->ns, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* ========================================================================
+ * Peak Probe
+ * ======================================================================== */
+
+#define PROBE_STREAM_FLOATS  (16 << 20)    /* 64 MB per array */
+#define PROBE_STREAM_CHUNK   (64 << 10)
+#define PROBE_STREAM_REPEATS 5
+#define PROBE_GEMM_TOKENS    4096          /* Rows of the probe projection: 1024x1024 image tokens */
+#define PROBE_GEMM_HIDDEN    3072          /* Its in/out features: 4B hidden size */
+#define PROBE_GEMM_MIN_NS    300000000ull  /* Keep timing GEMMs for 0.3 s */
+
+typedef struct {
+    float *a;
+    const float *b, *c;
+    size_t n;
+} triad_job_t;
+
+static void triad_chunks(void *arg, int start, int end) {
+    const triad_job_t *j = (const triad_job_t *)arg;
+    size_t lo = (size_t)start * PROBE_STREAM_CHUNK;
+    size_t hi = (size_t)end * PROBE_STREAM_CHUNK;
+    if (hi > j->n) hi = j->n;
+    for (size_t i = lo; i < hi; i++) j->a[i] = j->b[i] + 3.0f * j->c[i];
+}
+
+/* a = b + s * c over arrays well past the last-level cache; 3 arrays moved */
+static double probe_stream(void) {
+    size_t n = PROBE_STREAM_FLOATS;
+    size_t limit = flux_get_host_resources()->memory_limit;
+    if (limit > 0 && 3 * n * sizeof(float) > limit / 8)
+        n = limit / 8 / 3 / sizeof(float);
+    float *a = (float *)malloc(n * sizeof(float));
+    float *b = (float *)malloc(n * sizeof(float));
+    float *c = (float *)malloc(n * sizeof(float));
+    if (!a || !b || !c) {
+        free(a); free(b); free(c);
+        return 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        b[i] = 1.0f;
+        c[i] = 2.0f;
+    }
+
+    triad_job_t job = { a, b, c, n };
+    int chunks = (int)((n + PROBE_STREAM_CHUNK - 1) / PROBE_STREAM_CHUNK);
+    double best = 0;
+    for (int r = 0; r < PROBE_STREAM_REPEATS; r++) {
+        uint64_t t0 = now_ns();
+        flux_parallel_for(chunks, triad_chunks, &job);
+        double sec = (now_ns() - t0) / 1e9;
+        double gbps = 3.0 * n * sizeof(float) / sec / 1e9;
+        if (gbps > best) best = gbps;
+    }
+    free(a); free(b); free(c);
+    return best;
+}
+
+/* Best GFLOP/s of one linear path (f32 weights w, or bf16 weights w16) */
+static double time_linear(float *y, const float *x, const float *w, const uint16_t *w16,
+                          int m, int k, int n) {
+    double best = 0;
+    uint64_t start = now_ns();
+    for (int r = 0; r < 2 || now_ns() - start < PROBE_GEMM_MIN_NS; r++) {
+        uint64_t t0 = now_ns();
+        if (w16) flux_linear_nobias_bf16(y, x, w16, m, k, n);
+        else flux_linear_nobias(y, x, w, m, k, n);
+        double gflops = 2.0 * m * k * n / ((now_ns() - t0) / 1e9) / 1e9;
+        if (r > 0 && gflops > best) best = gflops;  /* The first run warms up */
+    }
+    return best;
+}
+
+/* The faster of the f32 and bf16 linear layers, the two paths the
+ * transformer's projections take */
+static double probe_gemm(void) {
+    int m = PROBE_GEMM_TOKENS, k = PROBE_GEMM_HIDDEN, n = PROBE_GEMM_HIDDEN;
+    float *x = (float *)malloc((size_t)m * k * sizeof(float));
+    float *w = (float *)malloc((size_t)n * k * sizeof(float));
+    uint16_t *w16 = (uint16_t *)malloc((size_t)n * k * sizeof(uint16_t));
+    float *y = (float *)malloc((size_t)m * n * sizeof(float));
+    if (!x || !w || !w16 || !y) {
+        free(x); free(w); free(w16); free(y);
+        return 0;
+    }
+    for (size_t i = 0; i < (size_t)m * k; i++) x[i] = (float)(i % 7) * 0.1f;
+    for (size_t i = 0; i < (size_t)n * k; i++) {
+        w[i] = (float)(i % 5) * 0.1f;
+        uint32_t bits;
+        memcpy(&bits, &w[i], sizeof(bits));
+        w16[i] = (uint16_t)(bits >> 16);
+    }
+
+    double f32 = time_linear(y, x, w, NULL, m, k, n);
+    double bf16 = time_linear(y, x, NULL, w16, m, k, n);
+    free(x); free(w); free(w16); free(y);
+    return f32 > bf16 ? f32 : bf16;
+}
+
+int flux_roofline_probe(flux_peak *out) {
+    if (!g_peak_valid) {
+        int was_on = flux_roofline_on;
+        flux_roofline_on = 0;
+        g_peak.gbps = probe_stream();
+        g_peak.gflops = probe_gemm();
+        flux_roofline_on = was_on;
+        if (g_peak.gbps <= 0 || g_peak.gflops <= 0) return -1;
+        g_peak_valid = 1;
+    }
+    if (out) *out = g_peak;
+    return 0;
+}
+
+/* ========================================================================
+ * Report
+ * ======================================================================== */
+
+static double row_gflops(const flux_op_stats *s) {
+    return s->ns > 0 ? (double)s->flops / s->ns : 0;
+}
+
+static double row_gbps(const flux_op_stats *s) {
+    return s->ns > 0 ? (double)s->bytes / s->ns : 0;
+}
+
+/* peak: NULL without a probe. Returns 1 if the row is past the peak. */
+static int print_row(const char *name, const flux_op_stats *s, const flux_peak *peak) {
+    double gflops = row_gflops(s), gbps = row_gbps(s);
+    double intensity = s->bytes > 0 ? (double)s->flops / s->bytes : 0;
+    fprintf(stderr, "  %-10s %7llu %9.1f %8.2f %9.1f %8.1f %7.1f %7.1f",
+            name, (unsigned long long)s->calls, s->flops / 1e9, s->bytes / 1e9,
+            s->ns / 1e6, gflops, gbps, intensity);
+    double pct = 0;
+    if (peak) {
+        double ridge = peak->gflops / peak->gbps;
+        int compute = intensity >= ridge;
+        pct = compute ? 100.0 * gflops / peak->gflops : 100.0 * gbps / peak->gbps;
+        fprintf(stderr, "  %s %5.1f%%%s", compute ? "compute" : "memory ", pct,
+                pct > 100.0 ? " !" : "");
+    }
+    fprintf(stderr, "\n");
+    return pct > 100.0;
+}
+
+static void add_stats(flux_op_stats *sum, const flux_op_stats *s) {
+    sum->calls += s->calls;
+    sum->flops += s->flops;
+    sum->bytes += s->bytes;
+    sum->ns += s->ns;
+}
+
+void flux_roofline_print(void) {
+    flux_op_stats stats[FLUX_BLOCK_TYPES][FLUX_OP_TYPES];
+    flux_roofline_stats(stats);
+
+    flux_op_stats by_op[FLUX_OP_TYPES] = {{0}}, by_block[FLUX_BLOCK_TYPES] = {{0}};
+    flux_op_stats total = {0};
+    for (int b = 0; b < FLUX_BLOCK_TYPES; b++) {
+        for (int o = 0; o < FLUX_OP_TYPES; o++) {
+            add_stats(&by_op[o], &stats[b][o]);
+            add_stats(&by_block[b], &stats[b][o]);
+            add_stats(&total, &stats[b][o]);
+        }
+    }
+    if (total.calls == 0) return;
+
+    const flux_peak *pk = g_peak_valid ? &g_peak : NULL;
+
+    fprintf(stderr, "\nRoofline");
+    if (pk)
+        fprintf(stderr, " (peak %.1f GFLOP/s, %.1f GB/s, ridge %.1f FLOP/byte)",
+                pk->gflops, pk->gbps, pk->gflops / pk->gbps);
+    fprintf(stderr, ":\n");
+    fprintf(stderr, "  %-10s %7s %9s %8s %9s %8s %7s %7s  %s\n",
+            "", "calls", "GFLOP", "GB", "ms", "GFLOP/s", "GB/s", "FLOP/B",
+            pk ? "bound   of peak" : "");
+
+    int over = 0;
+    for (int o = 0; o < FLUX_OP_TYPES; o++)
+        if (by_op[o].calls) over |= print_row(op_names[o], &by_op[o], pk);
+    fprintf(stderr, "  by block:\n");
+    for (int b = 0; b < FLUX_BLOCK_TYPES; b++)
+        if (by_block[b].calls) over |= print_row(block_names[b], &by_block[b], pk);
+    over |= print_row("total", &total, pk);
+    if (over)
+        fprintf(stderr, "  ! past the probed peak: the probe is too weak for this machine\n");
+}
@@ -0,0 +1,109 @@
+/*
+ * FLUX Roofline Accounting - Header
+ *
+ * Kernel entries (linear, attention, convolution, normalization) report
+ * the FLOPs they perform and the bytes they must move, together with the
+ * time they take, aggregated per op type and per block. Compared with the
+ * machine's peak GFLOP/s and GB/s from flux_roofline_probe(), this tells
+ * whether each part of the model is compute- or bandwidth-bound.
+ *
+ * Bytes are compulsory traffic: every input and output once, weights
+ * included. Caches can only do better; an implementation that re-reads
+ * (naive attention writing its score matrix) does worse than counted.
+ */
+
+#ifndef FLUX_ROOFLINE_H
+#define FLUX_ROOFLINE_H
+
+#include <stdint.h>
+#include "flux_kernels.h"
+
+typedef enum {
+    FLUX_OP_LINEAR = 0,     /* Linear layers and matmuls */
+    FLUX_OP_ATTENTION,      /* QK^T, softmax and PV, all heads */
+    FLUX_OP_CONV,           /* 2D convolutions */
+    FLUX_OP_NORM,           /* LayerNorm/AdaLN, RMSNorm, GroupNorm */
+    FLUX_OP_TYPES
+} flux_op_type;
+
+typedef enum {
+    FLUX_BLOCK_OTHER = 0,   /* Embeddings, modulation, final layer */
+    FLUX_BLOCK_DOUBLE,      /* Transformer double-stream blocks */
+    FLUX_BLOCK_SINGLE,      /* Transformer single-stream blocks */
+    FLUX_BLOCK_QWEN3,       /* Text encoder layers */
+    FLUX_BLOCK_VAE,         /* VAE encoder and decoder */
+    FLUX_BLOCK_TYPES
+} flux_block_type;
+
+typedef struct {
+    uint64_t calls;
+    uint64_t flops;
+    uint64_t bytes;
+    uint64_t ns;            /* Wall time inside the kernels */
+} flux_op_stats;
+
+typedef struct {
+    double gflops;          /* Faster of the f32 and bf16 linear layers */
+    double gbps;            /* STREAM triad over buffers beyond the caches */
+} flux_peak;
+
+/* Start or stop accounting (off by default; one branch per kernel when off) */
+void flux_roofline_enable(int enable);
+void flux_roofline_reset(void);
+
+/* Totals since the last reset, [block][op] */
+void flux_roofline_stats(flux_op_stats stats[FLUX_BLOCK_TYPES][FLUX_OP_TYPES]);
+
+/*
+ * Measure peak GEMM throughput and memory bandwidth with the threads the
+ * kernels use. The GEMM is a 3072-wide projection over 4096 tokens, the
+ * shape of a 1024x1024 image's transformer linears. Takes a few seconds
+ * (longer on the generic build); the result is cached. Returns 0, or -1
+ * if the probe buffers could not be allocated.
+ */
+int flux_roofline_probe(flux_peak *out);
+
+/* Per-op and per-block table against the probed peaks, to stderr. Rows
+ * past a peak are flagged: the probe fell short of the real kernels. */
+void flux_roofline_print(void);
+
+/* ========================================================================
+ * Instrumentation
+ * ======================================================================== */
+
+extern volatile int flux_roofline_on;
+extern FLUX_THREAD_LOCAL int flux_op_block;
+
+typedef struct {
+    uint64_t start;         /* 0: not counted, 1: nested in a counted op */
+    flux_op_type type;
+    double flops, bytes;
+} flux_op_scope;
+
+uint64_t flux_op_begin(void);
+void flux_op_end(const flux_op_scope *op);
+
+/*
+ * FLUX_OP_BEGIN(op, type, flops, bytes) ... FLUX_OP_END(op) around a
+ * kernel, with FLUX_OP_END on every return path. Only the outermost op on
+ * a thread is counted, so a kernel that calls another (bf16 linear
+ * converting and calling flux_linear, transformer attention calling flash
+ * attention) is not counted twice.
+ */
+#define FLUX_OP_BEGIN(op, type, flops, bytes) \
+    flux_op_scope op = { flux_roofline_on ? flux_op_begin() : 0, (type), (flops), (bytes) }
+#define FLUX_OP_END(op) \
+    do { if ((op).start) flux_op_end(&(op)); } while (0)
+
+/* Attribute ops on this thread to block until the returned value is restored */
+static inline int flux_op_enter_block(int block) {
+    int prev = flux_op_block;
+    flux_op_block = block;
+    return prev;
+}
+
+static inline void flux_op_leave_block(int prev) {
+    flux_op_block = prev;
+}
+
+#endif /* FLUX_ROOFLINE_H */
@@ -3,6 +3,7 @@
  */
 
 #include "flux_safetensors.h"
+#include "flux_trace.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +12,9 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 
+#define FLUX_MEM_DEFAULT FLUX_MEM_OTHER
+#include "flux_mem.h"
+
 /* Minimal JSON parser for safetensors header */
 
 static void skip_whitespace(const char **p) {
@@ -248,6 +252,7 @@ safetensors_file_t *safetensors_open(const char *path) {
     sf->path = strdup(path);
     sf->data = data;
     sf->file_size = file_size;
+    flux_mem_map(data, file_size, FLUX_MEM_DEFAULT);
     sf->header_size = (size_t)header_size;
 
     /* Copy header JSON for parsing */
@@ -290,7 +295,10 @@ safetensors_file_t *safetensors_open(const char *path) {
 
 void safetensors_close(safetensors_file_t *sf) {
     if (!sf) return;
-    if (sf->data) munmap(sf->data, sf->file_size);
+    if (sf->data) {
+        flux_mem_unmap(sf->data);
+        munmap(sf->data, sf->file_size);
+    }
     free(sf->path);
     free(sf->header_json);
     free(sf);
@@ -364,6 +372,7 @@ float *safetensors_get_f32(const safetensors_file_t *sf, const safetensor_t *t)
     if (!out) return NULL;
 
     const void *data = safetensors_data(sf, t);
+    FLUX_TRACE_BEGIN_ARGS("read_tensor", "io", "elements", (int)n, 0, 0);
 
     switch (t->dtype) {
         case DTYPE_F32:
@@ -389,9 +398,11 @@ float *safetensors_get_f32(const safetensors_file_t *sf, const safetensor_t *t)
         default:
             fprintf(stderr, "safetensors_get_f32: unsupported dtype\n");
             free(out);
+            FLUX_TRACE_END();
             return NULL;
     }
 
+    FLUX_TRACE_END();
     return out;
 }
 
@@ -418,7 +429,9 @@ uint16_t *safetensors_get_bf16(const safetensors_file_t *sf, const safetensor_t
     uint16_t *out = (uint16_t *)malloc(n * sizeof(uint16_t));
     if (!out) return NULL;
 
+    FLUX_TRACE_BEGIN_ARGS("read_tensor", "io", "elements", (int)n, 0, 0);
     memcpy(out, data, n * sizeof(uint16_t));
+    FLUX_TRACE_END();
     return out;
 }
 
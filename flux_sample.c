@@ -2,7 +2,9 @@
  * FLUX Sampling Implementation
  *
  * Rectified Flow sampling for image generation.
- * Uses Euler method for ODE integration.
+ * Uses Euler method for ODE integration, with DPM-Solver++(2M) and UniPC
+ * multistep solvers for fewer-step sampling of the base model, and an
+ * adaptive step-size solver driven by a local error tolerance.
  */
 
 #include "flux.h"
@@ -18,6 +20,9 @@
 #include "flux_metal.h"
 #endif
 
+#define FLUX_MEM_DEFAULT FLUX_MEM_WORK
+#include "flux_mem.h"
+
 /* Timing utilities for performance analysis - use wall-clock time */
 static double get_time_ms(void) {
     struct timeval tv;
@@ -25,11 +30,11 @@ static double get_time_ms(void) {
     return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
 }
 
-/* Cumulative timing for denoising breakdown */
-double flux_timing_transformer_total = 0.0;
-double flux_timing_transformer_double = 0.0;
-double flux_timing_transformer_single = 0.0;
-double flux_timing_transformer_final = 0.0;
+/* Cumulative timing for denoising breakdown (per thread) */
+FLUX_THREAD_LOCAL double flux_timing_transformer_total = 0.0;
+FLUX_THREAD_LOCAL double flux_timing_transformer_double = 0.0;
+FLUX_THREAD_LOCAL double flux_timing_transformer_single = 0.0;
+FLUX_THREAD_LOCAL double flux_timing_transformer_final = 0.0;
 
 void flux_reset_timing(void) {
     flux_timing_transformer_total = 0.0;
@@ -204,6 +209,13 @@ extern flux_image *flux_vae_decode(flux_vae_t *vae, const float *latent,
                                    int batch, int latent_h, int latent_w);
 extern void flux_image_free(flux_image *img);
 
+/* Latent resize through the VAE's unpacked space (progressive sampler) */
+extern float *flux_vae_resize_latent(flux_vae_t *vae, const float *latent,
+                                     int latent_h, int latent_w, int out_h, int out_w);
+
+float *flux_init_noise(int batch, int channels, int h, int w, int64_t seed);
+float *flux_init_noise_philox(int batch, int channels, int h, int w, int64_t seed);
+
 /*
  * Sample using Euler method.
  *
@@ -230,6 +242,7 @@ float *flux_sample_euler(void *transformer, void *text_encoder,
     /* Reset timing counters */
     flux_reset_timing();
     double total_denoising_start = get_time_ms();
+    flux_mem_phase_begin("denoising");
     double step_times[FLUX_MAX_STEPS];
 
     for (int step = 0; step < num_steps; step++) {
@@ -237,6 +250,13 @@ float *flux_sample_euler(void *transformer, void *text_encoder,
         float t_next = schedule[step + 1];
         float dt = t_next - t_curr;  /* Negative for denoising */
 
+        /* Abandoned through flux_abort_callback */
+        if (flux_aborted()) {
+            free(z_curr);
+            z_curr = NULL;
+            break;
+        }
+
         double step_start = get_time_ms();
 
         /* Notify step start */
@@ -246,6 +266,11 @@ float *flux_sample_euler(void *transformer, void *text_encoder,
         /* Predict velocity with conditioning */
         v_cond = flux_transformer_forward(tf, z_curr, h, w,
                                           text_emb, text_seq, t_curr);
+        if (!v_cond) {
+            free(z_curr);
+            z_curr = NULL;
+            break;
+        }
 
         /* Euler step: z_next = z_curr + dt * v */
         flux_axpy(z_curr, dt, v_cond, latent_size);
@@ -254,10 +279,15 @@ float *flux_sample_euler(void *transformer, void *text_encoder,
 
         step_times[step] = get_time_ms() - step_start;
 
+        FLUX_TRACE_SPAN_ARG("step", "step", step_times[step], "step", step + 1);
+
         if (progress_callback) {
             progress_callback(step + 1, num_steps);
         }
 
+        if (flux_step_latent_callback)
+            flux_step_latent_callback(step + 1, num_steps, t_next, z_curr, h, w);
+
         /* Step image callback - decode and display intermediate result */
         if (flux_step_image_callback && flux_step_image_vae && step + 1 < num_steps) {
             flux_image *img = flux_vae_decode((flux_vae_t *)flux_step_image_vae,
@@ -269,8 +299,12 @@ float *flux_sample_euler(void *transformer, void *text_encoder,
         }
     }
 
+    flux_mem_phase_end("denoising");
+    FLUX_TRACE_SPAN("denoising", "phase", get_time_ms() - total_denoising_start);
+
+
     /* Print timing summary */
-    if (flux_verbose) {
+    if (flux_verbose && z_curr) {
         double total_denoising = get_time_ms() - total_denoising_start;
         fprintf(stderr, "\nDenoising timing breakdown:\n");
         for (int step = 0; step < num_steps; step++) {
@@ -325,6 +359,7 @@ float *flux_sample_euler_with_refs(void *transformer, void *text_encoder,
     /* Reset timing counters */
     flux_reset_timing();
     double total_denoising_start = get_time_ms();
+    flux_mem_phase_begin("denoising");
     double step_times[FLUX_MAX_STEPS];
 
     for (int step = 0; step < num_steps; step++) {
@@ -332,6 +367,13 @@ float *flux_sample_euler_with_refs(void *transformer, void *text_encoder,
         float t_next = schedule[step + 1];
         float dt = t_next - t_curr;
 
+        /* Abandoned through flux_abort_callback */
+        if (flux_aborted()) {
+            free(z_curr);
+            z_curr = NULL;
+            break;
+        }
+
         double step_start = get_time_ms();
 
         /* Notify step start */
@@ -345,6 +387,11 @@ float *flux_sample_euler_with_refs(void *transformer, void *text_encoder,
                                                       t_offset,
                                                       text_emb, text_seq,
                                                       t_curr);
+        if (!v) {
+            free(z_curr);
+            z_curr = NULL;
+            break;
+        }
 
         /* Euler step: z_next = z_curr + dt * v */
         flux_axpy(z_curr, dt, v, latent_size);
@@ -353,10 +400,15 @@ float *flux_sample_euler_with_refs(void *transformer, void *text_encoder,
 
         step_times[step] = get_time_ms() - step_start;
 
+        FLUX_TRACE_SPAN_ARG("step", "step", step_times[step], "step", step + 1);
+
         if (progress_callback) {
             progress_callback(step + 1, num_steps);
         }
 
+        if (flux_step_latent_callback)
+            flux_step_latent_callback(step + 1, num_steps, t_next, z_curr, h, w);
+
         /* Step image callback - decode and display intermediate result */
         if (flux_step_image_callback && flux_step_image_vae && step + 1 < num_steps) {
             flux_image *img = flux_vae_decode((flux_vae_t *)flux_step_image_vae,
@@ -368,8 +420,12 @@ float *flux_sample_euler_with_refs(void *transformer, void *text_encoder,
         }
     }
 
+    flux_mem_phase_end("denoising");
+    FLUX_TRACE_SPAN("denoising", "phase", get_time_ms() - total_denoising_start);
+
+
     /* Print timing summary */
-    if (flux_verbose) {
+    if (flux_verbose && z_curr) {
         double total_denoising = get_time_ms() - total_denoising_start;
         fprintf(stderr, "\nDenoising timing breakdown (img2img with refs):\n");
         for (int step = 0; step < num_steps; step++) {
@@ -401,6 +457,7 @@ float *flux_sample_euler_with_multi_refs(void *transformer, void *text_encoder,
 
     flux_reset_timing();
     double total_denoising_start = get_time_ms();
+    flux_mem_phase_begin("denoising");
     double step_times[FLUX_MAX_STEPS];
 
     for (int step = 0; step < num_steps; step++) {
@@ -408,6 +465,13 @@ float *flux_sample_euler_with_multi_refs(void *transformer, void *text_encoder,
         float t_next = schedule[step + 1];
         float dt = t_next - t_curr;
 
+        /* Abandoned through flux_abort_callback */
+        if (flux_aborted()) {
+            free(z_curr);
+            z_curr = NULL;
+            break;
+        }
+
         double step_start = get_time_ms();
 
         if (flux_step_callback)
@@ -419,6 +483,11 @@ float *flux_sample_euler_with_multi_refs(void *transformer, void *text_encoder,
                                                             refs, num_refs,
                                                             text_emb, text_seq,
                                                             t_curr);
+        if (!v) {
+            free(z_curr);
+            z_curr = NULL;
+            break;
+        }
 
         /* Euler step */
         flux_axpy(z_curr, dt, v, latent_size);
@@ -426,9 +495,14 @@ float *flux_sample_euler_with_multi_refs(void *transformer, void *text_encoder,
 
         step_times[step] = get_time_ms() - step_start;
 
+        FLUX_TRACE_SPAN_ARG("step", "step", step_times[step], "step", step + 1);
+
         if (progress_callback)
             progress_callback(step + 1, num_steps);
 
+        if (flux_step_latent_callback)
+            flux_step_latent_callback(step + 1, num_steps, t_next, z_curr, h, w);
+
         if (flux_step_image_callback && flux_step_image_vae && step + 1 < num_steps) {
             flux_image *img = flux_vae_decode((flux_vae_t *)flux_step_image_vae,
                                               z_curr, 1, h, w);
@@ -439,7 +513,10 @@ float *flux_sample_euler_with_multi_refs(void *transformer, void *text_encoder,
         }
     }
 
-    if (flux_verbose) {
+    flux_mem_phase_end("denoising");
+    FLUX_TRACE_SPAN("denoising", "phase", get_time_ms() - total_denoising_start);
+
+    if (flux_verbose && z_curr) {
         double total_denoising = get_time_ms() - total_denoising_start;
         fprintf(stderr, "\nDenoising timing breakdown (multi-ref, %d refs):\n", num_refs);
         for (int step = 0; step < num_steps; step++) {
@@ -453,32 +530,118 @@ float *flux_sample_euler_with_multi_refs(void *transformer, void *text_encoder,
 }
 
 /* ========================================================================
- * CFG (Classifier-Free Guidance) Samplers for Base Model
+ * CFG (Classifier-Free Guidance) for the Base Model
  *
- * These run the transformer twice per step: once with empty text (uncond)
- * and once with the real prompt (cond), then combine:
+ * Guided evaluations run the transformer twice: once with empty text
+ * (uncond) and once with the real prompt (cond), then combine:
  *   v = v_uncond + guidance_scale * (v_cond - v_uncond)
+ *
+ * Two options cut the unconditional passes:
+ * - Guidance interval: CFG only for cfg_t_min <= t <= cfg_t_max (0 = 1.0);
+ *   outside the window the conditional velocity is used alone.
+ * - Uncond reuse: the last v_uncond is reused for the next cfg_reuse
+ *   guided evaluations before being recomputed.
  * ======================================================================== */
 
+typedef struct flux_sampler_model {
+    flux_transformer_t *tf;
+    int h, w;
+    const flux_ref_t *refs;
+    int num_refs;
+    const float *text_emb;
+    int text_seq;
+    const float *text_emb_uncond;   /* NULL: no CFG (distilled model) */
+    int text_seq_uncond;
+    float guidance;
+    float cfg_t_min, cfg_t_max;     /* Guidance interval */
+    int cfg_reuse;                  /* Evaluations to reuse v_uncond for */
+
+    float *v_uncond;                /* Cached unconditional velocity */
+    int uncond_age;                 /* Times the cache has been reused */
+    int nfe;                        /* Transformer evaluations so far */
+} flux_sampler_model;
+
+/* One transformer evaluation with the configured conditioning. */
+static float *sampler_forward(flux_sampler_model *m, const float *z,
+                              const float *text_emb, int text_seq, float t) {
+    m->nfe++;
+    if (m->num_refs == 0)
+        return flux_transformer_forward(m->tf, z, m->h, m->w,
+                                        text_emb, text_seq, t);
+    if (m->num_refs == 1)
+        return flux_transformer_forward_with_refs(m->tf, z, m->h, m->w,
+                                                  m->refs[0].latent,
+                                                  m->refs[0].h, m->refs[0].w,
+                                                  m->refs[0].t_offset,
+                                                  text_emb, text_seq, t);
+    return flux_transformer_forward_with_multi_refs(m->tf, z, m->h, m->w,
+                                                    m->refs, m->num_refs,
+                                                    text_emb, text_seq, t);
+}
+
+/* Predict velocity at (z, t), applying CFG when enabled for this t. */
+static float *sampler_velocity(flux_sampler_model *m, const float *z,
+                               float t, int n) {
+    float *v_cond = sampler_forward(m, z, m->text_emb, m->text_seq, t);
+    if (!v_cond || !m->text_emb_uncond) return v_cond;
+
+    float t_max = (m->cfg_t_max > 0) ? m->cfg_t_max : 1.0f;
+    if (t < m->cfg_t_min || t > t_max) {
+        m->uncond_age = m->cfg_reuse;   /* Cache is stale after the gap */
+        return v_cond;
+    }
+
+    if (!m->v_uncond || m->uncond_age >= m->cfg_reuse) {
+        free(m->v_uncond);
+        m->v_uncond = sampler_forward(m, z, m->text_emb_uncond,
+                                      m->text_seq_uncond, t);
+        m->uncond_age = 0;
+        if (!m->v_uncond) {
+            free(v_cond);
+            return NULL;
+        }
+    } else {
+        m->uncond_age++;
+    }
+
+    const float *v_uncond = m->v_uncond;
+    for (int i = 0; i < n; i++)
+        v_cond[i] = v_uncond[i] + m->guidance * (v_cond[i] - v_uncond[i]);
+    return v_cond;
+}
+
 /*
- * Euler sampler with CFG for text-to-image.
+ * Euler sampler with CFG, optional reference images (num_refs may be 0),
+ * guidance interval and uncond reuse. *out_nfe receives the number of
+ * transformer evaluations.
  */
-float *flux_sample_euler_cfg(void *transformer, void *text_encoder,
-                              float *z, int batch, int channels, int h, int w,
-                              const float *text_emb_cond, int text_seq_cond,
-                              const float *text_emb_uncond, int text_seq_uncond,
-                              float guidance_scale,
-                              const float *schedule, int num_steps,
-                              void (*progress_callback)(int step, int total)) {
-    (void)text_encoder;
+float *flux_sample_euler_cfg(void *transformer,
+                             float *z, int batch, int channels, int h, int w,
+                             const flux_ref_t *refs, int num_refs,
+                             const float *text_emb_cond, int text_seq_cond,
+                             const float *text_emb_uncond, int text_seq_uncond,
+                             float guidance_scale,
+                             float cfg_t_min, float cfg_t_max, int cfg_reuse,
+                             const float *schedule, int num_steps,
+                             int *out_nfe,
+                             void (*progress_callback)(int step, int total)) {
     flux_transformer_t *tf = (flux_transformer_t *)transformer;
     int latent_size = batch * channels * h * w;
 
+    flux_sampler_model model = {
+        tf, h, w, refs, num_refs,
+        text_emb_cond, text_seq_cond,
+        text_emb_uncond, text_seq_uncond, guidance_scale,
+        cfg_t_min, cfg_t_max, cfg_reuse,
+        NULL, 0, 0
+    };
+
     float *z_curr = (float *)malloc(latent_size * sizeof(float));
     flux_copy(z_curr, z, latent_size);
 
     flux_reset_timing();
     double total_denoising_start = get_time_ms();
+    flux_mem_phase_begin("denoising");
     double step_times[FLUX_MAX_STEPS];
 
     for (int step = 0; step < num_steps; step++) {
@@ -486,35 +649,39 @@ float *flux_sample_euler_cfg(void *transformer, void *text_encoder,
         float t_next = schedule[step + 1];
         float dt = t_next - t_curr;
 
+        /* Abandoned through flux_abort_callback */
+        if (flux_aborted()) {
+            free(z_curr);
+            z_curr = NULL;
+            break;
+        }
+
         double step_start = get_time_ms();
 
         if (flux_step_callback)
             flux_step_callback(step + 1, num_steps);
 
-        /* Unconditioned prediction */
-        float *v_uncond = flux_transformer_forward(tf, z_curr, h, w,
-                                                    text_emb_uncond, text_seq_uncond,
-                                                    t_curr);
-
-        /* Conditioned prediction */
-        float *v_cond = flux_transformer_forward(tf, z_curr, h, w,
-                                                  text_emb_cond, text_seq_cond,
-                                                  t_curr);
-
-        /* CFG combine: v = v_uncond + scale * (v_cond - v_uncond) */
-        for (int i = 0; i < latent_size; i++) {
-            float v = v_uncond[i] + guidance_scale * (v_cond[i] - v_uncond[i]);
-            z_curr[i] += dt * v;
+        float *v = sampler_velocity(&model, z_curr, t_curr, latent_size);
+        if (!v) {
+            free(z_curr);
+            z_curr = NULL;
+            break;
         }
 
-        free(v_uncond);
-        free(v_cond);
+        /* Euler step */
+        flux_axpy(z_curr, dt, v, latent_size);
+        free(v);
 
         step_times[step] = get_time_ms() - step_start;
 
+        FLUX_TRACE_SPAN_ARG("step", "step", step_times[step], "step", step + 1);
+
         if (progress_callback)
             progress_callback(step + 1, num_steps);
 
+        if (flux_step_latent_callback)
+            flux_step_latent_callback(step + 1, num_steps, t_next, z_curr, h, w);
+
         if (flux_step_image_callback && flux_step_image_vae && step + 1 < num_steps) {
             flux_image *img = flux_vae_decode((flux_vae_t *)flux_step_image_vae,
                                               z_curr, 1, h, w);
@@ -525,78 +692,230 @@ float *flux_sample_euler_cfg(void *transformer, void *text_encoder,
         }
     }
 
-    if (flux_verbose) {
+    flux_mem_phase_end("denoising");
+    FLUX_TRACE_SPAN("denoising", "phase", get_time_ms() - total_denoising_start);
+
+    if (flux_verbose && z_curr) {
         double total_denoising = get_time_ms() - total_denoising_start;
-        fprintf(stderr, "\nDenoising timing breakdown (CFG, guidance=%.1f):\n", guidance_scale);
+        fprintf(stderr, "\nDenoising timing breakdown (CFG, %d refs, guidance=%.1f):\n",
+                num_refs, guidance_scale);
         for (int step = 0; step < num_steps; step++) {
             fprintf(stderr, "  Step %d: %.1f ms\n", step + 1, step_times[step]);
         }
+        fprintf(stderr, "  Transformer evaluations: %d (%d without CFG savings)\n",
+                model.nfe, 2 * num_steps);
         fprintf(stderr, "  Total denoising: %.1f ms (%.2f s)\n", total_denoising, total_denoising / 1000.0);
     }
 
+    if (out_nfe) *out_nfe = model.nfe;
+    free(model.v_uncond);
     flux_transformer_free_mmap_cache(tf);
     return z_curr;
 }
 
+/* ========================================================================
+ * Multistep Solvers: DPM-Solver++(2M) and UniPC
+ *
+ * Rectified flow z_t = (1 - t) * x0 + t * noise is a diffusion process with
+ * alpha_t = 1 - t and sigma_t = t, so the data-prediction solvers apply
+ * directly to x0 = z_t - t * v. Both reuse the x0 predictions of previous
+ * steps, so they cost one model evaluation per step (two with CFG) exactly
+ * like Euler, which is what they reduce to at first order.
+ *
+ * With lambda = log(alpha / sigma) and h = lambda_next - lambda_curr, the
+ * first-order update is:
+ *   z_next = (sigma_next / sigma_curr) * z + alpha_next * (1 - e^-h) * x0
+ * e^-h is computed as a ratio of alphas and sigmas so that t = 1 (start)
+ * and t = 0 (end) stay finite; higher orders are only used where every
+ * lambda involved is finite.
+ * ======================================================================== */
+
+/* lambda(t) = log(alpha_t / sigma_t), finite for 0 < t < 1 only */
+static double flow_lambda(float t) {
+    return log((1.0 - t) / t);
+}
+
+/* e^-h for a step from t_s to t: (sigma_t * alpha_s) / (alpha_t * sigma_s) */
+static double flow_exp_neg_h(float t_s, float t) {
+    return ((double)t * (1.0 - t_s)) / ((1.0 - t) * t_s);
+}
+
 /*
- * Euler sampler with CFG and single reference image (img2img).
+ * z_out = cz * z + c0 * m0 + c1 * m1 + c2 * m2, elementwise (z_out may
+ * alias z). Unused terms have zero coefficients and NULL pointers.
  */
-float *flux_sample_euler_cfg_with_refs(void *transformer, void *text_encoder,
-                                        float *z, int batch, int channels, int h, int w,
-                                        const float *ref_latent, int ref_h, int ref_w,
-                                        int t_offset,
-                                        const float *text_emb_cond, int text_seq_cond,
-                                        const float *text_emb_uncond, int text_seq_uncond,
-                                        float guidance_scale,
-                                        const float *schedule, int num_steps,
-                                        void (*progress_callback)(int step, int total)) {
-    (void)text_encoder;
+static void multistep_combine(float *z_out, const float *z, int n, double cz,
+                              double c0, const float *m0,
+                              double c1, const float *m1,
+                              double c2, const float *m2) {
+    float fz = (float)cz, f0 = (float)c0, f1 = (float)c1, f2 = (float)c2;
+    for (int i = 0; i < n; i++) {
+        float v = fz * z[i] + f0 * m0[i];
+        if (m1) v += f1 * m1[i];
+        if (m2) v += f2 * m2[i];
+        z_out[i] = v;
+    }
+}
+
+/*
+ * UniPC (bh2 variant) update from t_s to t, shared by predictor and
+ * corrector. m0 is the x0 prediction at t_s; order 2 also uses m_prev at
+ * t_prev. For the corrector, m_t is the x0 prediction at t itself (already
+ * computed for the next step, so correcting is free).
+ */
+static void unipc_update(float *z_out, const float *z_s, int n,
+                         float t_s, float t, const float *m0,
+                         float t_prev, const float *m_prev,
+                         const float *m_t, int order) {
+    double e = flow_exp_neg_h(t_s, t);
+    double alpha_t = 1.0 - t;
+    double cz = t / t_s;
+    double c0 = alpha_t * (1.0 - e);
+    double kB = -alpha_t * (e - 1.0);   /* -alpha_t * B(h), B(h) = e^-h - 1 */
+    double rho_prev = 0.0, rho_t = 0.0, r0 = 1.0;
+
+    if (order >= 2) {
+        double h = flow_lambda(t) - flow_lambda(t_s);
+        r0 = (flow_lambda(t_prev) - flow_lambda(t_s)) / h;
+        if (m_t) {
+            /* Solve [1 1; r0 1] * rho = b for the corrector weights */
+            double hh = -h;
+            double phi = (e - 1.0) / hh - 1.0;
+            double b1 = phi / (e - 1.0);
+            phi = phi / hh - 0.5;
+            double b2 = 2.0 * phi / (e - 1.0);
+            rho_prev = (b1 - b2) / (1.0 - r0);
+            rho_t = b1 - rho_prev;
+        } else {
+            rho_prev = 0.5;
+        }
+    } else if (m_t) {
+        rho_t = 0.5;
+    }
+
+    /* D1 = (m_prev - m0) / r0, D1_t = m_t - m0 */
+    double c_prev = kB * rho_prev / r0;
+    double c_t = kB * rho_t;
+    multistep_combine(z_out, z_s, n, cz, c0 - c_prev - c_t, m0,
+                      c_prev, order >= 2 ? m_prev : NULL,
+                      c_t, m_t);
+}
+
+/*
+ * Multistep sampler (DPM-Solver++(2M) or UniPC) with optional CFG and
+ * reference images. Pass text_emb_uncond = NULL for the distilled model.
+ * *out_nfe receives the number of transformer evaluations.
+ */
+float *flux_sample_multistep(void *transformer,
+                             float *z, int batch, int channels, int h, int w,
+                             const flux_ref_t *refs, int num_refs,
+                             const float *text_emb_cond, int text_seq_cond,
+                             const float *text_emb_uncond, int text_seq_uncond,
+                             float guidance_scale,
+                             float cfg_t_min, float cfg_t_max, int cfg_reuse,
+                             int sampler,
+                             const float *schedule, int num_steps,
+                             int *out_nfe,
+                             void (*progress_callback)(int step, int total)) {
     flux_transformer_t *tf = (flux_transformer_t *)transformer;
     int latent_size = batch * channels * h * w;
+    int unipc = (sampler == FLUX_SAMPLER_UNIPC);
+
+    flux_sampler_model model = {
+        tf, h, w, refs, num_refs,
+        text_emb_cond, text_seq_cond,
+        text_emb_uncond, text_seq_uncond, guidance_scale,
+        cfg_t_min, cfg_t_max, cfg_reuse,
+        NULL, 0, 0
+    };
 
     float *z_curr = (float *)malloc(latent_size * sizeof(float));
+    float *z_last = unipc ? (float *)malloc(latent_size * sizeof(float)) : NULL;
+    float *x0_curr = NULL;  /* x0 prediction at schedule[step - 1] */
+    float *x0_prev = NULL;  /* x0 prediction at schedule[step - 2] */
+    int last_order = 0;
     flux_copy(z_curr, z, latent_size);
 
     flux_reset_timing();
     double total_denoising_start = get_time_ms();
+    flux_mem_phase_begin("denoising");
     double step_times[FLUX_MAX_STEPS];
 
     for (int step = 0; step < num_steps; step++) {
         float t_curr = schedule[step];
         float t_next = schedule[step + 1];
-        float dt = t_next - t_curr;
+
+        /* Abandoned through flux_abort_callback */
+        if (flux_aborted()) {
+            free(z_curr);
+            z_curr = NULL;
+            break;
+        }
 
         double step_start = get_time_ms();
 
         if (flux_step_callback)
             flux_step_callback(step + 1, num_steps);
 
-        /* Unconditioned prediction (with ref) */
-        float *v_uncond = flux_transformer_forward_with_refs(tf,
-                              z_curr, h, w,
-                              ref_latent, ref_h, ref_w, t_offset,
-                              text_emb_uncond, text_seq_uncond, t_curr);
+        /* Velocity -> data prediction x0 = z - t * v (in place) */
+        float *x0 = sampler_velocity(&model, z_curr, t_curr, latent_size);
+        if (!x0) {
+            free(z_curr);
+            z_curr = NULL;
+            break;
+        }
+        for (int i = 0; i < latent_size; i++)
+            x0[i] = z_curr[i] - t_curr * x0[i];
+
+        /* UniPC corrector: refine the previous step's result for free */
+        if (unipc && step > 0) {
+            unipc_update(z_curr, z_last, latent_size,
+                         schedule[step - 1], t_curr, x0_curr,
+                         step > 1 ? schedule[step - 2] : 1.0f, x0_prev,
+                         x0, last_order);
+        }
 
-        /* Conditioned prediction (with ref) */
-        float *v_cond = flux_transformer_forward_with_refs(tf,
-                            z_curr, h, w,
-                            ref_latent, ref_h, ref_w, t_offset,
-                            text_emb_cond, text_seq_cond, t_curr);
+        free(x0_prev);
+        x0_prev = x0_curr;
+        x0_curr = x0;
 
-        /* CFG combine */
-        for (int i = 0; i < latent_size; i++) {
-            float v = v_uncond[i] + guidance_scale * (v_cond[i] - v_uncond[i]);
-            z_curr[i] += dt * v;
-        }
+        /* Second order needs a finite lambda at the previous point and the
+         * target; the step from t=1 and the final step to t=0 are first order. */
+        int order = (step > 0 && schedule[step - 1] < 1.0f && t_next > 0.0f) ? 2 : 1;
 
-        free(v_uncond);
-        free(v_cond);
+        if (unipc) {
+            flux_copy(z_last, z_curr, latent_size);
+            unipc_update(z_curr, z_last, latent_size,
+                         t_curr, t_next, x0_curr,
+                         order >= 2 ? schedule[step - 1] : 1.0f, x0_prev,
+                         NULL, order);
+        } else {
+            double e = flow_exp_neg_h(t_curr, t_next);
+            double c0 = (1.0 - t_next) * (1.0 - e);
+            double c_prev = 0.0;
+            if (order >= 2) {
+                /* D = (1 + 1/(2r)) * x0_curr - 1/(2r) * x0_prev */
+                double h_step = flow_lambda(t_next) - flow_lambda(t_curr);
+                double r = (flow_lambda(t_curr) - flow_lambda(schedule[step - 1])) / h_step;
+                c_prev = -c0 / (2.0 * r);
+            }
+            multistep_combine(z_curr, z_curr, latent_size, t_next / t_curr,
+                              c0 - c_prev, x0_curr,
+                              c_prev, order >= 2 ? x0_prev : NULL,
+                              0.0, NULL);
+        }
+        last_order = order;
 
         step_times[step] = get_time_ms() - step_start;
 
+        FLUX_TRACE_SPAN_ARG("step", "step", step_times[step], "step", step + 1);
+
         if (progress_callback)
             progress_callback(step + 1, num_steps);
 
+        if (flux_step_latent_callback)
+            flux_step_latent_callback(step + 1, num_steps, t_next, z_curr, h, w);
+
         if (flux_step_image_callback && flux_step_image_vae && step + 1 < num_steps) {
             flux_image *img = flux_vae_decode((flux_vae_t *)flux_step_image_vae,
                                               z_curr, 1, h, w);
@@ -607,39 +926,269 @@ float *flux_sample_euler_cfg_with_refs(void *transformer, void *text_encoder,
         }
     }
 
-    if (flux_verbose) {
+    flux_mem_phase_end("denoising");
+    FLUX_TRACE_SPAN("denoising", "phase", get_time_ms() - total_denoising_start);
+
+    if (flux_verbose && z_curr) {
         double total_denoising = get_time_ms() - total_denoising_start;
-        fprintf(stderr, "\nDenoising timing breakdown (CFG img2img, guidance=%.1f):\n", guidance_scale);
+        fprintf(stderr, "\nDenoising timing breakdown (%s%s):\n",
+                unipc ? "UniPC" : "DPM-Solver++(2M)",
+                text_emb_uncond ? ", CFG" : "");
         for (int step = 0; step < num_steps; step++) {
             fprintf(stderr, "  Step %d: %.1f ms\n", step + 1, step_times[step]);
         }
         fprintf(stderr, "  Total denoising: %.1f ms (%.2f s)\n", total_denoising, total_denoising / 1000.0);
     }
 
+    if (out_nfe) *out_nfe = model.nfe;
+    free(model.v_uncond);
+    free(x0_prev);
+    free(x0_curr);
+    free(z_last);
     flux_transformer_free_mmap_cache(tf);
     return z_curr;
 }
 
+/* ========================================================================
+ * Adaptive Sampler (Heun-Euler embedded pair)
+ *
+ * Integrates the flow ODE from t=1 to t=0 with step sizes chosen from a
+ * local error estimate instead of a fixed schedule. Each attempt takes an
+ * Euler step and a Heun step from the same velocity; their difference
+ * estimates the Euler truncation error:
+ *   err = rms((z_heun - z_euler) / (tol * (1 + max(|z|, |z_heun|))))
+ * Steps with err <= 1 are accepted (keeping the Heun result) and the next
+ * step size is scaled by 0.9 / sqrt(err). A rejected attempt reuses the
+ * velocity at the start point, costing one evaluation instead of two.
+ * ======================================================================== */
+
+#define ADAPTIVE_MIN_STEP   1e-3f   /* Smallest step, always accepted */
+#define ADAPTIVE_MAX_GROW   4.0f
+#define ADAPTIVE_MAX_SHRINK 0.2f
+
+/* NaN/inf test on the bits: -ffast-math lets the compiler fold isnan()
+ * and NaN comparisons away */
+static int adaptive_not_finite(float x) {
+    uint32_t u;
+    memcpy(&u, &x, sizeof(u));
+    return (u & 0x7f800000u) == 0x7f800000u;
+}
+
 /*
- * Euler sampler with CFG and multiple reference images.
+ * Adaptive sampler. schedule[0..1] only provides the initial step size.
+ * The number of accepted steps and model evaluations (counting both CFG
+ * branches) are stored in *out_steps and *out_nfe.
  */
-float *flux_sample_euler_cfg_with_multi_refs(void *transformer, void *text_encoder,
-                                              float *z, int batch, int channels, int h, int w,
-                                              const flux_ref_t *refs, int num_refs,
-                                              const float *text_emb_cond, int text_seq_cond,
-                                              const float *text_emb_uncond, int text_seq_uncond,
-                                              float guidance_scale,
-                                              const float *schedule, int num_steps,
-                                              void (*progress_callback)(int step, int total)) {
-    (void)text_encoder;
+float *flux_sample_adaptive(void *transformer,
+                            float *z, int batch, int channels, int h, int w,
+                            const flux_ref_t *refs, int num_refs,
+                            const float *text_emb_cond, int text_seq_cond,
+                            const float *text_emb_uncond, int text_seq_uncond,
+                            float guidance_scale,
+                            float cfg_t_min, float cfg_t_max, int cfg_reuse,
+                            float tolerance,
+                            const float *schedule, int num_steps,
+                            int *out_steps, int *out_nfe,
+                            void (*progress_callback)(int step, int total)) {
     flux_transformer_t *tf = (flux_transformer_t *)transformer;
     int latent_size = batch * channels * h * w;
 
+    flux_sampler_model model = {
+        tf, h, w, refs, num_refs,
+        text_emb_cond, text_seq_cond,
+        text_emb_uncond, text_seq_uncond, guidance_scale,
+        cfg_t_min, cfg_t_max, cfg_reuse,
+        NULL, 0, 0
+    };
+
     float *z_curr = (float *)malloc(latent_size * sizeof(float));
+    float *z_euler = (float *)malloc(latent_size * sizeof(float));
+    float *v1 = NULL;
     flux_copy(z_curr, z, latent_size);
 
+    float t = schedule[0];
+    float dt = (num_steps > 0) ? schedule[0] - schedule[1] : t;
+    int steps = 0, rejected = 0;
+
     flux_reset_timing();
     double total_denoising_start = get_time_ms();
+    flux_mem_phase_begin("denoising");
+    double step_times[FLUX_MAX_STEPS];
+    double step_start = get_time_ms();
+
+    while (t > 0.0f) {
+        /* Abandoned through flux_abort_callback: z_curr is dropped below */
+        if (flux_aborted()) break;
+
+        if (dt > t || steps == FLUX_MAX_STEPS - 1) dt = t;
+        if (dt < ADAPTIVE_MIN_STEP) dt = (t < ADAPTIVE_MIN_STEP) ? t : ADAPTIVE_MIN_STEP;
+        float t_next = t - dt;
+
+        /* Remaining steps estimated at the current step size */
+        if (flux_step_callback)
+            flux_step_callback(steps + 1, steps + (int)ceilf(t / dt));
+
+        if (!v1) {
+            v1 = sampler_velocity(&model, z_curr, t, latent_size);
+        }
+        if (!v1) break;
+
+        /* Euler predictor, then Heun with the velocity at the Euler point */
+        flux_copy(z_euler, z_curr, latent_size);
+        flux_axpy(z_euler, -dt, v1, latent_size);
+        float *v2 = sampler_velocity(&model, z_euler, t_next, latent_size);
+        if (!v2) break;
+
+        double err_sq = 0.0;
+        for (int i = 0; i < latent_size; i++) {
+            float z_heun = z_curr[i] - 0.5f * dt * (v1[i] + v2[i]);
+            float scale = fabsf(z_curr[i]) > fabsf(z_heun) ? fabsf(z_curr[i]) : fabsf(z_heun);
+            float e = (z_heun - z_euler[i]) / (tolerance * (1.0f + scale));
+            err_sq += (double)e * e;
+            v2[i] = z_heun;   /* Keep the candidate in place of v2 */
+        }
+        float err = (float)sqrt(err_sq / latent_size);
+
+        /* Non-finite velocities: no step size will fix that */
+        if (adaptive_not_finite(err)) {
+            if (flux_verbose)
+                fprintf(stderr, "\n  Adaptive: non-finite error estimate at t=%.3f\n", t);
+            free(v2);
+            break;
+        }
+
+        /* The last step allowed by the cap finishes the integration */
+        if (err <= 1.0f || dt <= ADAPTIVE_MIN_STEP || steps == FLUX_MAX_STEPS - 1) {
+            float *tmp = z_curr;
+            z_curr = v2;
+            v2 = tmp;
+            free(v1);
+            v1 = NULL;
+            t = t_next;
+
+            step_times[steps] = get_time_ms() - step_start;
+
+            FLUX_TRACE_SPAN_ARG("step", "step", step_times[steps], "step", steps + 1);
+            step_start = get_time_ms();
+            steps++;
+
+            if (progress_callback)
+                progress_callback(steps, steps + (t > 0.0f));
+
+            if (flux_step_latent_callback)
+                flux_step_latent_callback(steps, steps + (t > 0.0f), t, z_curr, h, w);
+
+            if (flux_step_image_callback && flux_step_image_vae && t > 0.0f) {
+                flux_image *img = flux_vae_decode((flux_vae_t *)flux_step_image_vae,
+                                                  z_curr, 1, h, w);
+                if (img) {
+                    flux_step_image_callback(steps, steps + 1, img);
+                    flux_image_free(img);
+                }
+            }
+        } else if (++rejected > FLUX_MAX_STEPS) {
+            /* Error estimate not converging */
+            free(v2);
+            break;
+        }
+        free(v2);
+
+        float factor = 0.9f / sqrtf(err > 1e-10f ? err : 1e-10f);
+        if (factor > ADAPTIVE_MAX_GROW) factor = ADAPTIVE_MAX_GROW;
+        if (factor < ADAPTIVE_MAX_SHRINK) factor = ADAPTIVE_MAX_SHRINK;
+        dt *= factor;
+    }
+
+    free(v1);
+    free(z_euler);
+    free(model.v_uncond);
+    if (t > 0.0f) {
+        /* Transformer failure or no convergence */
+        free(z_curr);
+        z_curr = NULL;
+    }
+
+    if (out_steps) *out_steps = steps;
+    if (out_nfe) *out_nfe = model.nfe;
+
+    flux_mem_phase_end("denoising");
+    FLUX_TRACE_SPAN("denoising", "phase", get_time_ms() - total_denoising_start);
+
+    if (flux_verbose && z_curr) {
+        double total_denoising = get_time_ms() - total_denoising_start;
+        fprintf(stderr, "\nDenoising timing breakdown (adaptive, tol=%g%s):\n",
+                tolerance, text_emb_uncond ? ", CFG" : "");
+        for (int step = 0; step < steps; step++) {
+            fprintf(stderr, "  Step %d: %.1f ms\n", step + 1, step_times[step]);
+        }
+        fprintf(stderr, "  Accepted steps: %d, rejected: %d, model evaluations: %d\n",
+                steps, rejected, model.nfe);
+        fprintf(stderr, "  Total denoising: %.1f ms (%.2f s)\n", total_denoising, total_denoising / 1000.0);
+    }
+
+    flux_transformer_free_mmap_cache(tf);
+    return z_curr;
+}
+
+/* ========================================================================
+ * Progressive-Resolution Sampler
+ *
+ * Early steps only settle the coarse layout, so they run on a latent
+ * downsampled by 2^levels per side (4^levels fewer image tokens). When t
+ * crosses a switch point the resolution doubles: the latest data
+ * prediction x0 = z - t * v is upsampled and re-noised to the current t
+ *   z = (1 - t) * up(x0) + t * noise
+ * using the initial noise generator with the same seed at the new size. That noise
+ * is subsampled from one fixed grid, so every level sees the same noise
+ * field and the composition carries over between levels.
+ *
+ * Switch points are spread evenly over (t_end, 1): level i (counting
+ * down from `levels`) ends at t = 1 - (1 - t_end) * (levels - i + 1) / levels.
+ * Steps are Euler, with CFG options as in flux_sample_euler_cfg().
+ * ======================================================================== */
+
+/*
+ * Progressive-resolution sampler. The initial noise is drawn internally
+ * from seed at the coarsest size; h, w are the final latent dimensions.
+ * vae supplies the latent normalization for upsampling (may be NULL).
+ */
+float *flux_sample_progressive(void *transformer, void *vae,
+                               int channels, int h, int w, int64_t seed,
+                               const flux_ref_t *refs, int num_refs,
+                               const float *text_emb_cond, int text_seq_cond,
+                               const float *text_emb_uncond, int text_seq_uncond,
+                               float guidance_scale,
+                               float cfg_t_min, float cfg_t_max, int cfg_reuse,
+                               int levels, float t_end, int noise_gen,
+                               const float *schedule, int num_steps,
+                               int *out_nfe,
+                               void (*progress_callback)(int step, int total)) {
+    flux_transformer_t *tf = (flux_transformer_t *)transformer;
+    float *(*init_noise)(int, int, int, int, int64_t) =
+        noise_gen == FLUX_NOISE_PHILOX ? flux_init_noise_philox : flux_init_noise;
+
+    /* Latent size per level; a level never goes below 4x4 tokens */
+    int level = levels;
+    while (level > 0 && ((h >> level) < 4 || (w >> level) < 4)) level--;
+    int cur_h = (h + (1 << level) - 1) >> level;
+    int cur_w = (w + (1 << level) - 1) >> level;
+    int levels_used = level;
+
+    flux_sampler_model model = {
+        tf, cur_h, cur_w, refs, num_refs,
+        text_emb_cond, text_seq_cond,
+        text_emb_uncond, text_seq_uncond, guidance_scale,
+        cfg_t_min, cfg_t_max, cfg_reuse,
+        NULL, 0, 0
+    };
+
+    float *z_curr = init_noise(1, channels, cur_h, cur_w, seed);
+    float *x0 = NULL;   /* Data prediction from the last evaluation */
+    if (!z_curr) return NULL;
+
+    flux_reset_timing();
+    double total_denoising_start = get_time_ms();
+    flux_mem_phase_begin("denoising");
     double step_times[FLUX_MAX_STEPS];
 
     for (int step = 0; step < num_steps; step++) {
@@ -647,40 +1196,89 @@ float *flux_sample_euler_cfg_with_multi_refs(void *transformer, void *text_encod
         float t_next = schedule[step + 1];
         float dt = t_next - t_curr;
 
+        /* Abandoned through flux_abort_callback */
+        if (flux_aborted()) {
+            free(z_curr);
+            z_curr = NULL;
+            break;
+        }
+
         double step_start = get_time_ms();
 
+        /* Move up one level per crossed switch point */
+        while (level > 0 && x0 &&
+               t_curr <= 1.0f - (1.0f - t_end) * (levels_used - level + 1) / levels_used) {
+            level--;
+            int new_h = (h + (1 << level) - 1) >> level;
+            int new_w = (w + (1 << level) - 1) >> level;
+            float *up = flux_vae_resize_latent((flux_vae_t *)vae, x0,
+                                               cur_h, cur_w, new_h, new_w);
+            float *noise = init_noise(1, channels, new_h, new_w, seed);
+            if (!up || !noise) {
+                free(up);
+                free(noise);
+                free(z_curr);
+                z_curr = NULL;
+                break;
+            }
+            int n = channels * new_h * new_w;
+            for (int i = 0; i < n; i++)
+                up[i] = (1.0f - t_curr) * up[i] + t_curr * noise[i];
+            free(noise);
+            free(z_curr);
+            free(x0);
+            x0 = NULL;
+            z_curr = up;
+            cur_h = model.h = new_h;
+            cur_w = model.w = new_w;
+            /* A cached uncond velocity has the old size */
+            free(model.v_uncond);
+            model.v_uncond = NULL;
+            if (flux_verbose)
+                fprintf(stderr, "\n  Progressive: %dx%d latent from t=%.3f\n",
+                        new_w, new_h, t_curr);
+        }
+        if (!z_curr) break;
+
+        int latent_size = channels * cur_h * cur_w;
+
         if (flux_step_callback)
             flux_step_callback(step + 1, num_steps);
 
-        /* Unconditioned prediction (with refs) */
-        float *v_uncond = flux_transformer_forward_with_multi_refs(tf,
-                              z_curr, h, w,
-                              refs, num_refs,
-                              text_emb_uncond, text_seq_uncond, t_curr);
-
-        /* Conditioned prediction (with refs) */
-        float *v_cond = flux_transformer_forward_with_multi_refs(tf,
-                            z_curr, h, w,
-                            refs, num_refs,
-                            text_emb_cond, text_seq_cond, t_curr);
+        float *v = sampler_velocity(&model, z_curr, t_curr, latent_size);
+        if (!v) {
+            free(z_curr);
+            z_curr = NULL;
+            break;
+        }
 
-        /* CFG combine */
-        for (int i = 0; i < latent_size; i++) {
-            float v = v_uncond[i] + guidance_scale * (v_cond[i] - v_uncond[i]);
-            z_curr[i] += dt * v;
+        if (!x0) x0 = (float *)malloc(latent_size * sizeof(float));
+        if (!x0) {
+            free(v);
+            free(z_curr);
+            z_curr = NULL;
+            break;
         }
+        for (int i = 0; i < latent_size; i++)
+            x0[i] = z_curr[i] - t_curr * v[i];
 
-        free(v_uncond);
-        free(v_cond);
+        /* Euler step */
+        flux_axpy(z_curr, dt, v, latent_size);
+        free(v);
 
         step_times[step] = get_time_ms() - step_start;
 
+        FLUX_TRACE_SPAN_ARG("step", "step", step_times[step], "step", step + 1);
+
         if (progress_callback)
             progress_callback(step + 1, num_steps);
 
+        if (flux_step_latent_callback)
+            flux_step_latent_callback(step + 1, num_steps, t_next, z_curr, cur_h, cur_w);
+
         if (flux_step_image_callback && flux_step_image_vae && step + 1 < num_steps) {
             flux_image *img = flux_vae_decode((flux_vae_t *)flux_step_image_vae,
-                                              z_curr, 1, h, w);
+                                              z_curr, 1, cur_h, cur_w);
             if (img) {
                 flux_step_image_callback(step + 1, num_steps, img);
                 flux_image_free(img);
@@ -688,16 +1286,28 @@ float *flux_sample_euler_cfg_with_multi_refs(void *transformer, void *text_encod
         }
     }
 
-    if (flux_verbose) {
+    /* The schedule ended before the last switch point: finish at full size */
+    if (z_curr && (cur_h != h || cur_w != w)) {
+        float *up = flux_vae_resize_latent((flux_vae_t *)vae, z_curr, cur_h, cur_w, h, w);
+        free(z_curr);
+        z_curr = up;
+    }
+
+    flux_mem_phase_end("denoising");
+    FLUX_TRACE_SPAN("denoising", "phase", get_time_ms() - total_denoising_start);
+
+    if (flux_verbose && z_curr) {
         double total_denoising = get_time_ms() - total_denoising_start;
-        fprintf(stderr, "\nDenoising timing breakdown (CFG multi-ref, %d refs, guidance=%.1f):\n",
-                num_refs, guidance_scale);
+        fprintf(stderr, "\nDenoising timing breakdown (progressive, %d levels):\n", levels_used);
         for (int step = 0; step < num_steps; step++) {
             fprintf(stderr, "  Step %d: %.1f ms\n", step + 1, step_times[step]);
         }
         fprintf(stderr, "  Total denoising: %.1f ms (%.2f s)\n", total_denoising, total_denoising / 1000.0);
     }
 
+    if (out_nfe) *out_nfe = model.nfe;
+    free(model.v_uncond);
+    free(x0);
     flux_transformer_free_mmap_cache(tf);
     return z_curr;
 }
@@ -725,9 +1335,21 @@ float *flux_sample_euler_ancestral(void *transformer,
         float t_next = schedule[step + 1];
         float dt = t_next - t_curr;
 
+        /* Abandoned through flux_abort_callback */
+        if (flux_aborted()) {
+            free(z_curr);
+            z_curr = NULL;
+            break;
+        }
+
         /* Predict velocity */
         float *v = flux_transformer_forward(tf, z_curr, h, w,
                                             text_emb, text_seq, t_curr);
+        if (!v) {
+            free(z_curr);
+            z_curr = NULL;
+            break;
+        }
 
         /* Euler step */
         flux_axpy(z_curr, dt, v, latent_size);
@@ -745,6 +1367,9 @@ float *flux_sample_euler_ancestral(void *transformer,
             progress_callback(step + 1, num_steps);
         }
 
+        if (flux_step_latent_callback)
+            flux_step_latent_callback(step + 1, num_steps, t_next, z_curr, h, w);
+
         /* Step image callback - decode and display intermediate result */
         if (flux_step_image_callback && flux_step_image_vae && step + 1 < num_steps) {
             flux_image *img = flux_vae_decode((flux_vae_t *)flux_step_image_vae,
@@ -788,9 +1413,21 @@ float *flux_sample_heun(void *transformer,
         float t_next = schedule[step + 1];
         float dt = t_next - t_curr;
 
+        /* Abandoned through flux_abort_callback */
+        if (flux_aborted()) {
+            free(z_curr);
+            z_curr = NULL;
+            break;
+        }
+
         /* First velocity estimate */
         float *v1 = flux_transformer_forward(tf, z_curr, h, w,
                                              text_emb, text_seq, t_curr);
+        if (!v1) {
+            free(z_curr);
+            z_curr = NULL;
+            break;
+        }
 
         /* Predict next state */
         flux_copy(z_pred, z_curr, latent_size);
@@ -800,6 +1437,12 @@ float *flux_sample_heun(void *transformer,
         if (step < num_steps - 1) {
             float *v2 = flux_transformer_forward(tf, z_pred, h, w,
                                                  text_emb, text_seq, t_next);
+            if (!v2) {
+                free(v1);
+                free(z_curr);
+                z_curr = NULL;
+                break;
+            }
 
             /* Heun correction: z_next = z_curr + dt/2 * (v1 + v2) */
             for (int i = 0; i < latent_size; i++) {
@@ -818,6 +1461,9 @@ float *flux_sample_heun(void *transformer,
             progress_callback(step + 1, num_steps);
         }
 
+        if (flux_step_latent_callback)
+            flux_step_latent_callback(step + 1, num_steps, t_next, z_curr, h, w);
+
         /* Step image callback - decode and display intermediate result */
         if (flux_step_image_callback && flux_step_image_vae && step + 1 < num_steps) {
             flux_image *img = flux_vae_decode((flux_vae_t *)flux_step_image_vae,
@@ -890,6 +1536,51 @@ float *flux_init_noise(int batch, int channels, int h, int w, int64_t seed) {
     return noise;
 }
 
+/*
+ * Same size-independent layout from a counter-based generator: position
+ * (b, c, sy, sx) of the master grid is Philox counter
+ * ((b * channels + c) * max_h + sy) * max_w + sx under key = seed, so only
+ * the subsampled positions are generated, rows are filled in parallel and
+ * nothing is shared between concurrent calls. Targets at or above the
+ * master size index their own grid, as flux_init_noise() does.
+ */
+typedef struct {
+    float *out;
+    int channels, h, w;
+    int src_h, src_w;
+    uint64_t key;
+} philox_noise_args;
+
+static void philox_noise_rows(void *arg, int start, int end) {
+    philox_noise_args *a = (philox_noise_args *)arg;
+    uint64_t *index = (uint64_t *)malloc(a->w * sizeof(uint64_t));
+
+    for (int row = start; row < end; row++) {
+        int bc = row / a->h;            /* batch * channels + channel */
+        int ty = row % a->h;
+        int sy = ty * a->src_h / a->h;
+        uint64_t row_base = ((uint64_t)bc * a->src_h + sy) * a->src_w;
+        for (int tx = 0; tx < a->w; tx++)
+            index[tx] = row_base + (uint64_t)tx * a->src_w / a->w;
+        flux_philox_randn(a->out + (size_t)row * a->w, index, a->w, a->key);
+    }
+    free(index);
+}
+
+float *flux_init_noise_philox(int batch, int channels, int h, int w, int64_t seed) {
+    float *noise = (float *)malloc((size_t)batch * channels * h * w * sizeof(float));
+    int direct = h >= NOISE_MAX_LATENT_DIM && w >= NOISE_MAX_LATENT_DIM;
+
+    philox_noise_args args = {
+        noise, channels, h, w,
+        direct ? h : NOISE_MAX_LATENT_DIM,
+        direct ? w : NOISE_MAX_LATENT_DIM,
+        (uint64_t)seed
+    };
+    flux_parallel_for(batch * channels * h, philox_noise_rows, &args);
+    return noise;
+}
+
 /* ========================================================================
  * Full Generation Pipeline
  * ======================================================================== */
@@ -937,7 +1628,7 @@ float *flux_generate_latent(void *ctx_ptr,
  * ======================================================================== */
 
 /* Legacy callback for step-level progress (called from sampling loop) */
-void (*flux_progress_callback)(int, int) = NULL;
+FLUX_THREAD_LOCAL void (*flux_progress_callback)(int, int) = NULL;
 
 void flux_set_progress_callback(void (*callback)(int, int)) {
     flux_progress_callback = callback;
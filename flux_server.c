@@ -0,0 +1,1174 @@
+/*
+ * FLUX Generation Server
+ *
+ * Keeps the models resident and serves generation requests over a local
+ * Unix socket, so scripted jobs skip process startup, model loading and
+ * text encoder reloads.
+ *
+ * Usage: flux -d model/ --serve /tmp/flux.sock
+ *
+ * Protocol: the client sends one JSON object on one line; the server
+ * answers with one JSON event per line and closes the connection.
+ *
+ *   -> {"prompt": "a cat", "width": 512, "height": 512, "steps": 4,
+ *       "seed": 42, "refs": ["in.png"], "output": "/tmp/cat.png"}
+ *   <- {"event": "queued", "id": 7, "position": 0}
+ *   <- {"event": "phase", "id": 7, "phase": "encoding text", "done": 0}
+ *   <- {"event": "progress", "id": 7, "step": 1, "total": 4}
+ *   <- {"event": "done", "id": 7, "seed": 42, "width": 512, "height": 512,
+ *       "seconds": 3.10, "path": "/tmp/cat.png"}
+ *
+ * Only "prompt" is required; "guidance" and "sampler" are also accepted.
+ * Without "output" the done event carries "png_bytes": N instead of
+ * "path" and is followed by N bytes of PNG data. Failures are reported as
+ * {"event": "error", "message": "..."}. {"shutdown": true} stops accepting
+ * connections; queued requests still complete.
+ *
+ * Text-to-image Euler requests are batched by the engine on the thread
+ * that called flux_server_run(). The others (references, resume, other
+ * samplers) run one at a time, in arrival order, on a second thread with
+ * a fork of the context, so they do not stall the batch. The accept
+ * thread and the per-connection threads only read, parse and queue.
+ *
+ * With --workers N (flux_server_run_prefork) a supervisor process loads
+ * the weights once and forks N worker processes that accept on the same
+ * socket. The weights are never written after loading, so the workers
+ * share their pages copy-on-write; each worker allocates only its own
+ * work buffers. Crashed workers are forked again from the supervisor
+ * without reloading anything. A shutdown request shuts the listening
+ * socket down for every worker; each drains its own queue and exits.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <limits.h>
+#include <float.h>
+#include <ctype.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "flux.h"
+#include "flux_kernels.h"
+#include "flux_server.h"
+
+/* ======================================================================
+ * Constants
+ * ====================================================================== */
+
+#define SERVER_MAX_REQUEST  65536   /* Longest request line in bytes */
+#define SERVER_MAX_QUEUE    64      /* Requests waiting to run */
+#define SERVER_MAX_REFS     16      /* Reference images per request */
+#define SERVER_MAX_BATCH    8       /* Requests denoised together (work budget permitting) */
+#define SERVER_BACKLOG      16
+#define SERVER_MAX_EVENT    8192
+#define SERVER_MAX_WORKERS  64
+#define SERVER_EMB_CACHE    ((size_t)256 << 20)  /* Bytes of cached prompt embeddings */
+
+/* ======================================================================
+ * Requests and Queue
+ * ====================================================================== */
+
+typedef struct {
+    char *prompt;
+    char *output;               /* NULL: return PNG bytes on the socket */
+    char *refs[SERVER_MAX_REFS];
+    int num_refs;
+    int width, height;          /* 0 = server default (or first ref size) */
+    int steps;                  /* 0 = server default */
+    int64_t seed;               /* -1 = time-based */
+    float guidance;             /* 0 = server default */
+    int sampler;                /* -1 = server default */
+    char *resume;               /* Checkpoint file to continue from */
+    int shutdown;
+} server_request;
+
+typedef struct server_job {
+    int fd;
+    int fd_ok;                  /* Cleared once the client went away */
+    int id;
+    server_request req;
+    int64_t seed;               /* Resolved seed */
+    struct timespec start;      /* When the job left the queue */
+    int engine_id;              /* Engine request id (batched jobs) */
+    int last_step;              /* Last progress step reported */
+    /* Event order: a line is numbered when formatted (possibly under
+     * srv_mutex) and written once every earlier line has been */
+    pthread_mutex_t ev_lock;
+    pthread_cond_t ev_cond;
+    unsigned ev_next, ev_sent;
+    struct server_job *next;
+} server_job;
+
+/* One formatted event line, numbered in its job's order */
+typedef struct {
+    char buf[SERVER_MAX_EVENT];
+    int len;
+    unsigned seq;
+} server_event;
+
+static pthread_mutex_t srv_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t srv_cond = PTHREAD_COND_INITIALIZER;
+static server_job *srv_head = NULL, *srv_tail = NULL;
+static int srv_queued = 0;
+static int srv_next_id = 1;
+static int srv_stopping = 0;
+static int srv_listen_fd = -1;
+
+/* Job whose progress the library callbacks report, per generating thread */
+static FLUX_THREAD_LOCAL server_job *srv_current = NULL;
+
+/* Jobs that cannot join the engine run on a worker thread of their own,
+ * on a fork of the context, so they do not hold up the engine's steps */
+static pthread_cond_t srv_solo_cond = PTHREAD_COND_INITIALIZER;
+static server_job *srv_solo_head = NULL, *srv_solo_tail = NULL;
+static int srv_solo_stopping = 0;
+
+static void request_free(server_request *req) {
+    free(req->prompt);
+    free(req->output);
+    free(req->resume);
+    for (int i = 0; i < req->num_refs; i++) free(req->refs[i]);
+}
+
+static server_job *server_job_new(int fd) {
+    server_job *job = (server_job *)calloc(1, sizeof(server_job));
+    if (!job) return NULL;
+    job->fd = fd;
+    job->fd_ok = 1;
+    pthread_mutex_init(&job->ev_lock, NULL);
+    pthread_cond_init(&job->ev_cond, NULL);
+    return job;
+}
+
+/* Close the client connection and free the job, once the events numbered
+ * for it (a queued line still on its way, say) have been written */
+static void server_job_free(server_job *job) {
+    pthread_mutex_lock(&job->ev_lock);
+    while (job->ev_sent != job->ev_next)
+        pthread_cond_wait(&job->ev_cond, &job->ev_lock);
+    pthread_mutex_unlock(&job->ev_lock);
+    request_free(&job->req);
+    close(job->fd);
+    pthread_cond_destroy(&job->ev_cond);
+    pthread_mutex_destroy(&job->ev_lock);
+    free(job);
+}
+
+/* ======================================================================
+ * Minimal JSON
+ * ====================================================================== */
+
+static void json_ws(const char **p) {
+    while (isspace((unsigned char)**p)) (*p)++;
+}
+
+static int json_hex4(const char *s, unsigned *out) {
+    unsigned v = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = s[i];
+        v <<= 4;
+        if (c >= '0' && c <= '9') v |= c - '0';
+        else if (c >= 'a' && c <= 'f') v |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') v |= c - 'A' + 10;
+        else return -1;
+    }
+    *out = v;
+    return 0;
+}
+
+/* Parse a string literal at *p. Returns a malloc'd UTF-8 string or NULL. */
+static char *json_string(const char **p) {
+    const char *s = *p;
+    if (*s != '"') return NULL;
+    s++;
+
+    /* Decoded output is never longer than the escaped input */
+    const char *end = s;
+    while (*end && *end != '"') end += (*end == '\\' && end[1]) ? 2 : 1;
+    if (*end != '"') return NULL;
+    char *out = (char *)malloc(end - s + 1);
+    char *o = out;
+
+    while (*s != '"') {
+        if (*s != '\\') {
+            *o++ = *s++;
+            continue;
+        }
+        s++;
+        switch (*s++) {
+            case '"': *o++ = '"'; break;
+            case '\\': *o++ = '\\'; break;
+            case '/': *o++ = '/'; break;
+            case 'b': *o++ = '\b'; break;
+            case 'f': *o++ = '\f'; break;
+            case 'n': *o++ = '\n'; break;
+            case 'r': *o++ = '\r'; break;
+            case 't': *o++ = '\t'; break;
+            case 'u': {
+                unsigned cp, lo;
+                if (json_hex4(s, &cp) < 0) { free(out); return NULL; }
+                s += 4;
+                if (cp >= 0xD800 && cp < 0xDC00 && s[0] == '\\' && s[1] == 'u' &&
+                    json_hex4(s + 2, &lo) == 0 && lo >= 0xDC00 && lo < 0xE000) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                    s += 6;
+                }
+                if (cp < 0x80) {
+                    *o++ = (char)cp;
+                } else if (cp < 0x800) {
+                    *o++ = (char)(0xC0 | (cp >> 6));
+                    *o++ = (char)(0x80 | (cp & 0x3F));
+                } else if (cp < 0x10000) {
+                    *o++ = (char)(0xE0 | (cp >> 12));
+                    *o++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    *o++ = (char)(0x80 | (cp & 0x3F));
+                } else {
+                    *o++ = (char)(0xF0 | (cp >> 18));
+                    *o++ = (char)(0x80 | ((cp >> 12) & 0x3F));
+                    *o++ = (char)(0x80 | ((cp >> 6) & 0x3F));
+                    *o++ = (char)(0x80 | (cp & 0x3F));
+                }
+                break;
+            }
+            default:
+                free(out);
+                return NULL;
+        }
+    }
+    *o = '\0';
+    *p = s + 1;
+    return out;
+}
+
+/* JSON numbers only: strtod alone would also take nan, inf and hex, and
+ * overflow to inf. Checked on the text and errno, not with isfinite(),
+ * which -ffast-math may fold away. */
+static int json_number(const char **p, double *out) {
+    const char *s = *p;
+    if (*s == '-') s++;
+    if (!isdigit((unsigned char)*s)) return -1;
+    char *end;
+    errno = 0;
+    *out = strtod(*p, &end);
+    if (end == *p || errno == ERANGE) return -1;
+    *p = end;
+    return 0;
+}
+
+static int json_literal(const char **p, const char *word) {
+    size_t n = strlen(word);
+    if (strncmp(*p, word, n) != 0) return -1;
+    *p += n;
+    return 0;
+}
+
+/* Skip any value (for keys the server does not know) */
+static int json_skip(const char **p, int depth) {
+    double d;
+    json_ws(p);
+    if (depth > 32) return -1;
+    switch (**p) {
+        case '"': {
+            char *s = json_string(p);
+            if (!s) return -1;
+            free(s);
+            return 0;
+        }
+        case '{': case '[': {
+            char close = (**p == '{') ? '}' : ']';
+            int object = (close == '}');
+            (*p)++;
+            json_ws(p);
+            if (**p == close) { (*p)++; return 0; }
+            for (;;) {
+                if (object) {
+                    if (json_skip(p, depth + 1) < 0) return -1;
+                    json_ws(p);
+                    if (**p != ':') return -1;
+                    (*p)++;
+                }
+                if (json_skip(p, depth + 1) < 0) return -1;
+                json_ws(p);
+                if (**p == ',') { (*p)++; continue; }
+                if (**p == close) { (*p)++; return 0; }
+                return -1;
+            }
+        }
+        case 't': return json_literal(p, "true");
+        case 'f': return json_literal(p, "false");
+        case 'n': return json_literal(p, "null");
+        default: return json_number(p, &d);
+    }
+}
+
+/* Escape src for use inside a JSON string literal */
+static void json_escape(char *dst, size_t cap, const char *src) {
+    size_t o = 0;
+    for (; *src && o + 7 < cap; src++) {
+        unsigned char c = (unsigned char)*src;
+        if (c == '"' || c == '\\') {
+            dst[o++] = '\\';
+            dst[o++] = c;
+        } else if (c < 0x20) {
+            o += snprintf(dst + o, cap - o, "\\u%04x", c);
+        } else {
+            dst[o++] = c;
+        }
+    }
+    dst[o] = '\0';
+}
+
+/* Values a numeric field's type cannot hold; converting them would be
+ * undefined. Finer limits (image size, steps) are checked afterwards. */
+static const char *number_range_error(const char *key, double num) {
+    if (!strcmp(key, "seed"))
+        return (num >= -0x1p63 && num < 0x1p63) ? NULL : "seed out of range";
+    if (!strcmp(key, "guidance"))
+        return (num >= 0 && num <= FLT_MAX) ? NULL : "guidance out of range";
+    return (num >= INT_MIN && num <= INT_MAX) ? NULL : "number out of range";
+}
+
+/* Parse one request line. On error returns -1 with *err set. */
+static int parse_request(const char *line, server_request *req, const char **err) {
+    const char *p = line;
+    double num;
+
+    memset(req, 0, sizeof(*req));
+    req->seed = -1;
+    req->sampler = -1;
+
+    json_ws(&p);
+    if (*p != '{') { *err = "request must be a JSON object"; return -1; }
+    p++;
+    json_ws(&p);
+    if (*p == '}') p++;
+    else for (;;) {
+        char *key = json_string(&p);
+        if (!key) { *err = "malformed key"; return -1; }
+        json_ws(&p);
+        if (*p != ':') { free(key); *err = "expected ':'"; return -1; }
+        p++;
+        json_ws(&p);
+
+        int ok = 0;
+        if (!strcmp(key, "prompt") || !strcmp(key, "output") || !strcmp(key, "sampler") ||
+            !strcmp(key, "resume")) {
+            char *s = json_string(&p);
+            ok = (s != NULL);
+            if (!strcmp(key, "prompt")) { free(req->prompt); req->prompt = s; }
+            else if (!strcmp(key, "output")) { free(req->output); req->output = s; }
+            else if (!strcmp(key, "resume")) { free(req->resume); req->resume = s; }
+            else if (s) {
+                req->sampler = flux_sampler_from_name(s);
+                free(s);
+                if (req->sampler < 0) { free(key); *err = "unknown sampler"; return -1; }
+            }
+        } else if (!strcmp(key, "refs")) {
+            ok = (*p == '[');
+            if (ok) {
+                p++;
+                json_ws(&p);
+                if (*p == ']') p++;
+                else for (;;) {
+                    char *s = json_string(&p);
+                    if (!s || req->num_refs == SERVER_MAX_REFS) {
+                        free(s);
+                        ok = 0;
+                        break;
+                    }
+                    req->refs[req->num_refs++] = s;
+                    json_ws(&p);
+                    if (*p == ',') { p++; json_ws(&p); continue; }
+                    ok = (*p == ']');
+                    if (ok) p++;
+                    break;
+                }
+            }
+        } else if (!strcmp(key, "shutdown")) {
+            if (json_literal(&p, "true") == 0) { req->shutdown = 1; ok = 1; }
+            else ok = (json_literal(&p, "false") == 0);
+        } else if (!strcmp(key, "width") || !strcmp(key, "height") ||
+                   !strcmp(key, "steps") || !strcmp(key, "seed") ||
+                   !strcmp(key, "guidance")) {
+            ok = (json_number(&p, &num) == 0);
+            if (ok) {
+                const char *range = number_range_error(key, num);
+                if (range) { free(key); *err = range; return -1; }
+                if (!strcmp(key, "width")) req->width = (int)num;
+                else if (!strcmp(key, "height")) req->height = (int)num;
+                else if (!strcmp(key, "steps")) req->steps = (int)num;
+                else if (!strcmp(key, "seed")) req->seed = (int64_t)num;
+                else req->guidance = (float)num;
+            }
+        } else {
+            ok = (json_skip(&p, 0) == 0);
+        }
+        free(key);
+        if (!ok) { *err = "malformed value"; return -1; }
+
+        json_ws(&p);
+        if (*p == ',') { p++; json_ws(&p); continue; }
+        if (*p == '}') { p++; break; }
+        *err = "expected ',' or '}'";
+        return -1;
+    }
+
+    if (req->shutdown) return 0;
+    if (!req->prompt) { *err = "missing prompt"; return -1; }
+    if ((req->width && (req->width < 64 || req->width > FLUX_VAE_MAX_DIM)) ||
+        (req->height && (req->height < 64 || req->height > FLUX_VAE_MAX_DIM))) {
+        *err = "width and height must be between 64 and 1792";
+        return -1;
+    }
+    if (req->steps < 0 || req->steps > FLUX_MAX_STEPS) {
+        *err = "steps out of range";
+        return -1;
+    }
+    if (req->resume && req->num_refs > 0) {
+        *err = "resume does not take reference images";
+        return -1;
+    }
+    return 0;
+}
+
+/* ======================================================================
+ * Socket I/O
+ * ====================================================================== */
+
+static int send_all(int fd, const void *buf, size_t len) {
+    const char *p = (const char *)buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* Format one event line and number it in the job's order. Never blocks,
+ * so it may run under srv_mutex; event_send() writes the line. */
+static void event_vformat(server_job *job, server_event *ev, const char *fmt, va_list ap) {
+    int n = vsnprintf(ev->buf, sizeof(ev->buf) - 1, fmt, ap);
+    if (n < 0) n = 0;
+    if (n > (int)sizeof(ev->buf) - 2) n = sizeof(ev->buf) - 2;
+    ev->buf[n++] = '\n';
+    ev->len = n;
+    pthread_mutex_lock(&job->ev_lock);
+    ev->seq = job->ev_next++;
+    pthread_mutex_unlock(&job->ev_lock);
+}
+
+static void event_format(server_job *job, server_event *ev, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    event_vformat(job, ev, fmt, ap);
+    va_end(ap);
+}
+
+/* Write ev after every line numbered before it. Call without srv_mutex:
+ * the write blocks for as long as the client does not read. A failed
+ * write marks the client gone; the job still runs to completion (and
+ * still writes its output file). */
+static void event_send(server_job *job, const server_event *ev) {
+    pthread_mutex_lock(&job->ev_lock);
+    while (job->ev_sent != ev->seq)
+        pthread_cond_wait(&job->ev_cond, &job->ev_lock);
+    pthread_mutex_unlock(&job->ev_lock);
+
+    if (job->fd_ok && send_all(job->fd, ev->buf, ev->len) < 0) job->fd_ok = 0;
+
+    pthread_mutex_lock(&job->ev_lock);
+    job->ev_sent++;
+    pthread_cond_broadcast(&job->ev_cond);
+    pthread_mutex_unlock(&job->ev_lock);
+}
+
+/* Send one event line, in order after any already formatted */
+static void send_event(server_job *job, const char *fmt, ...) {
+    server_event ev;
+    va_list ap;
+    va_start(ap, fmt);
+    event_vformat(job, &ev, fmt, ap);
+    va_end(ap);
+    event_send(job, &ev);
+}
+
+static void send_error(server_job *job, const char *message) {
+    char esc[1024];
+    json_escape(esc, sizeof(esc), message);
+    send_event(job, "{\"event\": \"error\", \"id\": %d, \"message\": \"%s\"}", job->id, esc);
+}
+
+/* Read one newline-terminated line. Returns malloc'd string or NULL. */
+static char *read_line(int fd) {
+    size_t cap = 1024, len = 0;
+    char *buf = (char *)malloc(cap);
+    for (;;) {
+        if (len + 1 == cap) {
+            if (cap >= SERVER_MAX_REQUEST) break;
+            cap *= 2;
+            buf = (char *)realloc(buf, cap);
+        }
+        ssize_t n = read(fd, buf + len, cap - len - 1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        char *nl = memchr(buf + len, '\n', n);
+        len += n;
+        if (nl) {
+            len = nl - buf;
+            break;
+        }
+    }
+    buf[len] = '\0';
+    if (len == 0) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+/* ======================================================================
+ * Connection Handling
+ * ====================================================================== */
+
+static void *server_conn_thread(void *arg) {
+    server_job *job = (server_job *)arg;
+    char *line = read_line(job->fd);
+    const char *err = NULL;
+
+    if (!line) {
+        server_job_free(job);
+        return NULL;
+    }
+    int rc = parse_request(line, &job->req, &err);
+    free(line);
+    if (rc < 0) {
+        send_error(job, err);
+        server_job_free(job);
+        return NULL;
+    }
+
+    server_event ev;
+    pthread_mutex_lock(&srv_mutex);
+    if (job->req.shutdown) {
+        srv_stopping = 1;
+        event_format(job, &ev, "{\"event\": \"shutdown\", \"pending\": %d}", srv_queued);
+        pthread_cond_signal(&srv_cond);
+        pthread_mutex_unlock(&srv_mutex);
+        event_send(job, &ev);
+        /* Wake the accept thread */
+        shutdown(srv_listen_fd, SHUT_RDWR);
+        server_job_free(job);
+        return NULL;
+    }
+    if (srv_stopping || srv_queued >= SERVER_MAX_QUEUE) {
+        pthread_mutex_unlock(&srv_mutex);
+        send_error(job, srv_stopping ? "server is shutting down" : "queue full");
+        server_job_free(job);
+        return NULL;
+    }
+    job->id = srv_next_id++;
+    /* Numbered under the lock so it precedes any progress from the worker,
+     * which waits for it; written after unlocking */
+    event_format(job, &ev, "{\"event\": \"queued\", \"id\": %d, \"position\": %d}",
+                 job->id, srv_queued);
+    if (srv_tail) srv_tail->next = job;
+    else srv_head = job;
+    srv_tail = job;
+    srv_queued++;
+    pthread_cond_signal(&srv_cond);
+    pthread_mutex_unlock(&srv_mutex);
+    event_send(job, &ev);
+    return NULL;
+}
+
+static void *server_accept_thread(void *arg) {
+    (void)arg;
+    for (;;) {
+        int fd = accept(srv_listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            break;
+        }
+        server_job *job = server_job_new(fd);
+        pthread_t tid;
+        if (!job) {
+            close(fd);
+            continue;
+        }
+        if (pthread_create(&tid, NULL, server_conn_thread, job) != 0) {
+            server_job_free(job);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+    /* The socket was shut down, possibly by a shutdown request that
+     * reached another worker process: drain the queue and stop */
+    pthread_mutex_lock(&srv_mutex);
+    srv_stopping = 1;
+    pthread_cond_signal(&srv_cond);
+    pthread_mutex_unlock(&srv_mutex);
+    return NULL;
+}
+
+/* ======================================================================
+ * Generation
+ *
+ * Text-to-image requests with the Euler sampler go through the
+ * continuous batching engine: requests arriving while others denoise
+ * join at the next step and share its transformer forward. Requests with
+ * reference images, a checkpoint to resume, another sampler, cfg_reuse or
+ * progressive resolution run alone on the solo worker thread, beside the
+ * engine (between engine steps on Metal, which has one GPU backend).
+ * ====================================================================== */
+
+static void server_step_callback(int step, int total) {
+    if (!srv_current) return;
+    send_event(srv_current, "{\"event\": \"progress\", \"id\": %d, \"step\": %d, \"total\": %d}",
+               srv_current->id, step, total);
+}
+
+static void server_phase_callback(const char *phase, int done) {
+    if (!srv_current) return;
+    char esc[256];
+    json_escape(esc, sizeof(esc), phase);
+    send_event(srv_current, "{\"event\": \"phase\", \"id\": %d, \"phase\": \"%s\", \"done\": %d}",
+               srv_current->id, esc, done);
+}
+
+/* Request parameters on top of the server defaults. Starts the job clock. */
+static flux_params server_job_params(const flux_params *defaults, server_job *job) {
+    const server_request *r = &job->req;
+    flux_params params = *defaults;
+
+    if (r->width) params.width = r->width;
+    if (r->height) params.height = r->height;
+    if (r->steps) params.num_steps = r->steps;
+    if (r->guidance > 0) params.guidance = r->guidance;
+    if (r->sampler >= 0) params.sampler = r->sampler;
+    params.seed = (r->seed >= 0) ? r->seed : (int64_t)time(NULL);
+    job->seed = params.seed;
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    return params;
+}
+
+static double server_job_elapsed(const server_job *job) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - job->start.tv_sec) + (now.tv_nsec - job->start.tv_nsec) / 1e9;
+}
+
+/* Report the finished image (or the failure if img is NULL) and free it */
+static void server_send_result(server_job *job, flux_image *img) {
+    const server_request *r = &job->req;
+    double elapsed = server_job_elapsed(job);
+
+    if (!img) {
+        send_error(job, flux_get_error());
+        fprintf(stderr, "[serve] #%d failed: %s\n", job->id, flux_get_error());
+        return;
+    }
+
+    if (r->output) {
+        if (flux_image_save_with_seed(img, r->output, job->seed) != 0) {
+            send_error(job, "failed to save image");
+        } else {
+            char esc[4096];
+            json_escape(esc, sizeof(esc), r->output);
+            send_event(job, "{\"event\": \"done\", \"id\": %d, \"seed\": %lld, "
+                       "\"width\": %d, \"height\": %d, \"seconds\": %.2f, \"path\": \"%s\"}",
+                       job->id, (long long)job->seed, img->width, img->height,
+                       elapsed, esc);
+        }
+    } else {
+        size_t len = 0;
+        uint8_t *png = flux_image_encode_png(img, job->seed, &len);
+        if (!png) {
+            send_error(job, "failed to encode image");
+        } else {
+            send_event(job, "{\"event\": \"done\", \"id\": %d, \"seed\": %lld, "
+                       "\"width\": %d, \"height\": %d, \"seconds\": %.2f, \"png_bytes\": %zu}",
+                       job->id, (long long)job->seed, img->width, img->height,
+                       elapsed, len);
+            if (job->fd_ok && send_all(job->fd, png, len) < 0) job->fd_ok = 0;
+            flux_free_buffer(png);
+        }
+    }
+    fprintf(stderr, "[serve] #%d %dx%d seed %lld (%.1fs)\n", job->id,
+            img->width, img->height, (long long)job->seed, elapsed);
+    flux_image_free(img);
+}
+
+/* Run one request on its own (reference images, non-Euler samplers) */
+static void server_run_job(flux_ctx *ctx, const flux_params *job_params, server_job *job) {
+    const server_request *r = &job->req;
+    flux_params params = *job_params;
+    flux_image *refs[SERVER_MAX_REFS];
+    flux_image *img = NULL;
+    flux_checkpoint *ck = NULL;
+
+    if (r->resume) {
+        ck = flux_checkpoint_load(r->resume);
+        if (!ck) {
+            char msg[1024];
+            snprintf(msg, sizeof(msg), "failed to load checkpoint: %s", r->resume);
+            send_error(job, msg);
+            return;
+        }
+        job->seed = ck->seed;
+    }
+    for (int i = 0; i < r->num_refs; i++) {
+        refs[i] = flux_image_load(r->refs[i]);
+        if (!refs[i]) {
+            char msg[1024];
+            snprintf(msg, sizeof(msg), "failed to load reference image: %s", r->refs[i]);
+            send_error(job, msg);
+            for (int j = 0; j < i; j++) flux_image_free(refs[j]);
+            return;
+        }
+    }
+
+    srv_current = job;
+    flux_step_callback = server_step_callback;
+
+    if (ck) {
+        /* The checkpoint fixes size and seed; steps 0 keeps its schedule */
+        params.num_steps = r->steps;
+        img = flux_generate_resume(ctx, r->prompt, ck, &params);
+        flux_checkpoint_free(ck);
+    } else if (r->num_refs > 0) {
+        /* Same sizing rule as the CLI: default to the first reference */
+        if (!r->width) params.width = refs[0]->width;
+        if (!r->height) params.height = refs[0]->height;
+        img = flux_multiref(ctx, r->prompt, (const flux_image **)refs, r->num_refs, &params);
+        for (int i = 0; i < r->num_refs; i++) flux_image_free(refs[i]);
+    } else {
+        img = flux_generate(ctx, r->prompt, &params);
+    }
+
+    flux_step_callback = NULL;
+    srv_current = NULL;
+    server_send_result(job, img);
+}
+
+/* ======================================================================
+ * Embedding Cache
+ *
+ * Repeated prompts skip the text encoder. Entries are the exact float
+ * embeddings, not the CLI's 4-bit quantized ones, so repeating a request
+ * with its seed reproduces its image. The least recently used entries go
+ * beyond SERVER_EMB_CACHE bytes. Only the generation thread uses it.
+ * ====================================================================== */
+
+typedef struct server_emb {
+    char *prompt;
+    float *emb;
+    int seq_len;
+    size_t bytes;
+    struct server_emb *next;        /* Most recently used first */
+} server_emb;
+
+static server_emb *srv_embs = NULL;
+static size_t srv_emb_bytes = 0;
+
+static void server_emb_free(server_emb *e) {
+    free(e->prompt);
+    free(e->emb);
+    free(e);
+}
+
+static void server_emb_clear(void) {
+    while (srv_embs) {
+        server_emb *e = srv_embs;
+        srv_embs = e->next;
+        server_emb_free(e);
+    }
+    srv_emb_bytes = 0;
+}
+
+/* Embeddings of prompt (caller frees), cached or freshly encoded */
+static float *server_encode(flux_ctx *ctx, const char *prompt, int *seq_len) {
+    for (server_emb **link = &srv_embs; *link; link = &(*link)->next) {
+        server_emb *e = *link;
+        if (strcmp(e->prompt, prompt) != 0) continue;
+        *link = e->next;
+        e->next = srv_embs;
+        srv_embs = e;
+        float *copy = (float *)malloc(e->bytes);
+        if (copy) memcpy(copy, e->emb, e->bytes);
+        *seq_len = e->seq_len;
+        return copy;
+    }
+
+    float *emb = flux_encode_text(ctx, prompt, seq_len);
+    if (!emb) return NULL;
+    size_t bytes = (size_t)*seq_len * flux_text_dim(ctx) * sizeof(float);
+    if (bytes > SERVER_EMB_CACHE) return emb;
+
+    server_emb *e = (server_emb *)calloc(1, sizeof(server_emb));
+    if (!e) return emb;
+    e->prompt = strdup(prompt);
+    e->emb = (float *)malloc(bytes);
+    if (!e->prompt || !e->emb) {
+        server_emb_free(e);
+        return emb;
+    }
+    memcpy(e->emb, emb, bytes);
+    e->seq_len = *seq_len;
+    e->bytes = bytes;
+    e->next = srv_embs;
+    srv_embs = e;
+    srv_emb_bytes += bytes;
+
+    /* Evict from the tail; the new entry fits on its own */
+    while (srv_emb_bytes > SERVER_EMB_CACHE) {
+        server_emb **link = &srv_embs;
+        while ((*link)->next) link = &(*link)->next;
+        srv_emb_bytes -= (*link)->bytes;
+        server_emb_free(*link);
+        *link = NULL;
+    }
+    return emb;
+}
+
+/* Encode the prompt and queue the job in the engine. Returns -1 on error. */
+static int server_submit(flux_ctx *ctx, flux_engine *eng, const flux_params *params,
+                         server_job *job) {
+    srv_current = job;
+    int seq_len = 0;
+    float *embeddings = server_encode(ctx, job->req.prompt, &seq_len);
+    job->engine_id = embeddings ?
+        flux_engine_submit_embeddings(eng, embeddings, seq_len, params) : -1;
+    flux_free_buffer(embeddings);
+    srv_current = NULL;
+    return job->engine_id > 0 ? 0 : -1;
+}
+
+/* Worker for the jobs that run alone (srv_solo_*) */
+typedef struct {
+    flux_ctx *ctx;                  /* A fork of the server's context */
+    const flux_params *defaults;
+} server_solo;
+
+static void *server_solo_thread(void *arg) {
+    const server_solo *solo = (const server_solo *)arg;
+    flux_phase_callback = server_phase_callback;
+    for (;;) {
+        pthread_mutex_lock(&srv_mutex);
+        while (!srv_solo_head && !srv_solo_stopping)
+            pthread_cond_wait(&srv_solo_cond, &srv_mutex);
+        server_job *job = srv_solo_head;
+        if (job) {
+            srv_solo_head = job->next;
+            if (!srv_solo_head) srv_solo_tail = NULL;
+        }
+        pthread_mutex_unlock(&srv_mutex);
+        if (!job) break;    /* Stopping, and nothing left */
+
+        flux_params params = server_job_params(solo->defaults, job);
+        server_run_job(solo->ctx, &params, job);
+        server_job_free(job);
+    }
+    flux_phase_callback = NULL;
+    return NULL;
+}
+
+static void server_solo_queue(server_job *job) {
+    job->next = NULL;
+    pthread_mutex_lock(&srv_mutex);
+    if (srv_solo_tail) srv_solo_tail->next = job;
+    else srv_solo_head = job;
+    srv_solo_tail = job;
+    pthread_cond_signal(&srv_solo_cond);
+    pthread_mutex_unlock(&srv_mutex);
+}
+
+/* ======================================================================
+ * Server Loop
+ * ====================================================================== */
+
+static int server_listen(const char *path) {
+    struct sockaddr_un addr;
+    struct stat st;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path too long: %s\n", path);
+        return -1;
+    }
+    /* Replace a stale socket from a previous run, but nothing else */
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "Error: %s exists and is not a socket\n", path);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+    chmod(path, 0600);
+    if (listen(fd, SERVER_BACKLOG) < 0) {
+        perror("listen");
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    return fd;
+}
+
+/* Serve requests accepted on srv_listen_fd until shutdown. Returns 0 on
+ * clean shutdown, non-zero on error. */
+static int server_serve(flux_ctx *ctx, const flux_params *defaults) {
+    flux_set_keep_text_encoder(ctx, 1);
+
+    pthread_t accept_tid;
+    if (pthread_create(&accept_tid, NULL, server_accept_thread, NULL) != 0)
+        return 1;
+    pthread_detach(accept_tid);
+
+    flux_engine *eng = flux_engine_new(ctx, SERVER_MAX_BATCH);
+    server_job *running = NULL;     /* Jobs inside the engine */
+    server_solo solo = {NULL, defaults};
+    pthread_t solo_tid;
+    srv_solo_stopping = 0;
+    flux_phase_callback = server_phase_callback;
+
+    for (;;) {
+        pthread_mutex_lock(&srv_mutex);
+        while (!srv_head && !srv_stopping && !running)
+            pthread_cond_wait(&srv_cond, &srv_mutex);
+        server_job *jobs = srv_head;
+        srv_head = srv_tail = NULL;
+        srv_queued = 0;
+        pthread_mutex_unlock(&srv_mutex);
+        if (!jobs && !running) break;   /* Stopping, and nothing left */
+
+        /* Admit everything that arrived since the last step */
+        while (jobs) {
+            server_job *job = jobs;
+            jobs = job->next;
+            flux_params params = server_job_params(defaults, job);
+            if (job->req.num_refs > 0 || job->req.resume ||
+                params.sampler != FLUX_SAMPLER_EULER ||
+                params.cfg_reuse > 0 || params.prog_levels > 0) {
+#ifndef USE_METAL
+                /* Forked here, between engine steps, on the first such job */
+                if (!solo.ctx && (solo.ctx = flux_fork(ctx)) != NULL) {
+                    flux_set_keep_text_encoder(solo.ctx, 1);
+                    if (pthread_create(&solo_tid, NULL, server_solo_thread, &solo) != 0) {
+                        flux_free(solo.ctx);
+                        solo.ctx = NULL;
+                    }
+                }
+#endif
+                if (solo.ctx) {
+                    server_solo_queue(job);
+                } else {
+                    /* Metal (one GPU backend), or no fork: run it in between */
+                    server_run_job(ctx, &params, job);
+                    server_job_free(job);
+                }
+            } else if (server_submit(ctx, eng, &params, job) < 0) {
+                send_error(job, flux_get_error());
+                server_job_free(job);
+            } else {
+                job->next = running;
+                running = job;
+            }
+        }
+        if (!running) continue;
+
+        if (flux_engine_step(eng) < 0) {
+            while (running) {
+                server_job *job = running;
+                running = job->next;
+                send_error(job, flux_get_error());
+                server_job_free(job);
+            }
+            flux_engine_free(eng);
+            eng = flux_engine_new(ctx, SERVER_MAX_BATCH);
+            continue;
+        }
+
+        for (server_job *job = running; job; job = job->next) {
+            int step, total;
+            if (flux_engine_progress(eng, job->engine_id, &step, &total) == 0 &&
+                step != job->last_step) {
+                job->last_step = step;
+                send_event(job, "{\"event\": \"progress\", \"id\": %d, \"step\": %d, \"total\": %d}",
+                           job->id, step, total);
+            }
+        }
+
+        int id;
+        flux_image *img;
+        while ((img = flux_engine_poll(eng, &id)) != NULL || id != 0) {
+            server_job **link = &running;
+            while (*link && (*link)->engine_id != id) link = &(*link)->next;
+            if (!*link) {
+                flux_image_free(img);
+                continue;
+            }
+            server_job *job = *link;
+            *link = job->next;
+            server_send_result(job, img);
+            server_job_free(job);
+        }
+    }
+
+    /* Let the solo worker finish its queue */
+    if (solo.ctx) {
+        pthread_mutex_lock(&srv_mutex);
+        srv_solo_stopping = 1;
+        pthread_cond_signal(&srv_solo_cond);
+        pthread_mutex_unlock(&srv_mutex);
+        pthread_join(solo_tid, NULL);
+        flux_free(solo.ctx);
+    }
+
+    flux_phase_callback = NULL;
+    flux_engine_free(eng);
+    server_emb_clear();
+    flux_set_keep_text_encoder(ctx, 0);
+    flux_release_text_encoder(ctx);
+    return 0;
+}
+
+int flux_server_run(flux_ctx *ctx, const char *socket_path, const flux_params *defaults) {
+    /* Clients that disconnect early must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    srv_listen_fd = server_listen(socket_path);
+    if (srv_listen_fd < 0) return 1;
+    fprintf(stderr, "Serving on %s\n", socket_path);
+
+    int rc = server_serve(ctx, defaults);
+    close(srv_listen_fd);
+    unlink(socket_path);
+    if (rc == 0) fprintf(stderr, "Server stopped\n");
+    return rc;
+}
+
+/* ======================================================================
+ * Prefork Workers
+ * ====================================================================== */
+
+/* Fork a worker serving on srv_listen_fd. Returns its pid, or -1. */
+static pid_t server_spawn_worker(flux_weights *w, const flux_params *defaults, int index) {
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    /* Worker: only the work buffers allocated from here on are private.
+     * It exits without freeing anything, so the shared pages stay shared. */
+    flux_ctx *ctx = flux_new(w);
+    if (!ctx) {
+        fprintf(stderr, "[serve] worker %d: %s\n", index, flux_get_error());
+        _exit(2);
+    }
+    fprintf(stderr, "[serve] worker %d ready (pid %d)\n", index, (int)getpid());
+    _exit(server_serve(ctx, defaults));
+}
+
+int flux_server_run_prefork(flux_weights *w, const char *socket_path,
+                            const flux_params *defaults, int workers) {
+#ifdef USE_METAL
+    (void)w; (void)socket_path; (void)defaults; (void)workers;
+    fprintf(stderr, "Error: --workers is not supported with Metal (GPU state cannot be forked)\n");
+    return 1;
+#else
+    pid_t pids[SERVER_MAX_WORKERS];
+    int live = 0, stopping = 0;
+
+    if (workers < 1 || workers > SERVER_MAX_WORKERS) {
+        fprintf(stderr, "Error: --workers must be between 1 and %d\n", SERVER_MAX_WORKERS);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    srv_listen_fd = server_listen(socket_path);
+    if (srv_listen_fd < 0) return 1;
+    fprintf(stderr, "Serving on %s with %d workers\n", socket_path, workers);
+
+    /* Anything buffered now would be flushed again by every child */
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < workers; i++) {
+        pids[i] = server_spawn_worker(w, defaults, i);
+        if (pids[i] < 0) {
+            perror("fork");
+            stopping = 1;
+            shutdown(srv_listen_fd, SHUT_RDWR);
+            break;
+        }
+        live++;
+    }
+
+    /* Supervise: a worker exiting cleanly means a shutdown request
+     * reached it; anything else is a crash, and the slot is refilled. */
+    while (live > 0) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        int slot = -1;
+        for (int i = 0; i < workers; i++)
+            if (pids[i] == pid) slot = i;
+        if (slot < 0) continue;
+        pids[slot] = -1;
+        live--;
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            stopping = 1;
+            continue;
+        }
+        if (WIFSIGNALED(status))
+            fprintf(stderr, "[serve] worker %d (pid %d) killed by signal %d\n",
+                    slot, (int)pid, WTERMSIG(status));
+        else
+            fprintf(stderr, "[serve] worker %d (pid %d) exited with status %d\n",
+                    slot, (int)pid, WEXITSTATUS(status));
+        if (stopping) continue;
+
+        sleep(1);   /* Don't spin if workers die on startup */
+        fflush(stderr);
+        pids[slot] = server_spawn_worker(w, defaults, slot);
+        if (pids[slot] < 0) {
+            perror("fork");
+            continue;
+        }
+        live++;
+    }
+
+    close(srv_listen_fd);
+    unlink(socket_path);
+    fprintf(stderr, "Server stopped\n");
+    return 0;
+#endif
+}
@@ -0,0 +1,27 @@
+/*
+ * FLUX Generation Server
+ */
+
+#ifndef FLUX_SERVER_H
+#define FLUX_SERVER_H
+
+#include "flux.h"
+
+/*
+ * Serve generation requests on a Unix socket at socket_path until a client
+ * sends a shutdown request. Models stay loaded between requests. defaults
+ * supplies every parameter a request leaves out.
+ * Returns 0 on clean shutdown, non-zero on error.
+ */
+int flux_server_run(flux_ctx *ctx, const char *socket_path, const flux_params *defaults);
+
+/*
+ * Like flux_server_run(), but with workers processes forked from this one,
+ * all sharing the weights in w copy-on-write and accepting on the same
+ * socket. Workers that crash are restarted without reloading the model.
+ * Not available on Metal builds.
+ */
+int flux_server_run_prefork(flux_weights *w, const char *socket_path,
+                            const flux_params *defaults, int workers);
+
+#endif /* FLUX_SERVER_H */
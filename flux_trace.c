@@ -0,0 +1,247 @@
+/*
+ * FLUX Timeline Tracing
+ *
+ * Each thread that records claims a ring buffer from a shared pool and
+ * returns it when the thread exits, so the short-lived workers of
+ * flux_parallel_for() reuse a few buffers instead of allocating one each.
+ * A buffer is one row ("tid") in the trace. Open events live on a small
+ * per-buffer stack; an event is written to the ring only when it ends,
+ * as a complete ("X") event, so overwriting old events never leaves a
+ * begin without its end.
+ */
+
+#include "flux_trace.h"
+#include "flux_kernels.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef FLUX_TRACE
+
+#define TRACE_MAX_DEPTH   32
+#define TRACE_MAX_BUFFERS 256
+
+typedef struct {
+    const char *name, *cat, *keys;
+    uint64_t ts, dur;           /* Nanoseconds since flux_trace_start() */
+    int32_t args[3];
+} trace_event;
+
+typedef struct trace_buffer {
+    trace_event *events;        /* FLUX_TRACE_RING entries */
+    uint64_t count;             /* Events ever written; ring index = count % RING */
+    int depth;
+    trace_event open[TRACE_MAX_DEPTH];
+    int tid;
+    int main_thread;            /* Claimed by the thread that started tracing */
+    struct trace_buffer *next_free;
+} trace_buffer;
+
+volatile int flux_trace_on = 0;
+
+static uint64_t g_origin;
+static pthread_t g_main_thread;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_key;
+static trace_buffer *g_buffers[TRACE_MAX_BUFFERS];
+static int g_num_buffers = 0;
+static trace_buffer *g_free = NULL;
+static FLUX_THREAD_LOCAL trace_buffer *t_buf = NULL;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Thread exit: hand the buffer (and its events) to the next thread */
+static void release_buffer(void *p) {
+    trace_buffer *b = (trace_buffer *)p;
+    pthread_mutex_lock(&g_lock);
+    b->depth = 0;
+    b->next_free = g_free;
+    g_free = b;
+    pthread_mutex_unlock(&g_lock);
+}
+
+static void make_key(void) {
+    pthread_key_create(&g_key, release_buffer);
+}
+
+static trace_buffer *claim_buffer(void) {
+    pthread_once(&g_key_once, make_key);
+    trace_buffer *b = NULL;
+    int is_main = pthread_equal(pthread_self(), g_main_thread);
+
+    pthread_mutex_lock(&g_lock);
+    /* The main thread keeps its own row; workers share the rest */
+    for (trace_buffer **pp = &g_free; *pp; pp = &(*pp)->next_free) {
+        if ((*pp)->main_thread == is_main) {
+            b = *pp;
+            *pp = b->next_free;
+            break;
+        }
+    }
+    if (!b && g_num_buffers < TRACE_MAX_BUFFERS) {
+        b = (trace_buffer *)calloc(1, sizeof(trace_buffer));
+        if (b) b->events = (trace_event *)malloc(FLUX_TRACE_RING * sizeof(trace_event));
+        if (b && !b->events) {
+            free(b);
+            b = NULL;
+        }
+        if (b) {
+            b->tid = g_num_buffers + 1;
+            b->main_thread = is_main;
+            g_buffers[g_num_buffers++] = b;
+        }
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    if (b) pthread_setspecific(g_key, b);
+    return b;
+}
+
+void flux_trace_begin(const char *name, const char *cat, const char *keys,
+                      int a, int b, int c) {
+    trace_buffer *buf = t_buf ? t_buf : (t_buf = claim_buffer());
+    if (!buf) return;
+    if (buf->depth < TRACE_MAX_DEPTH) {
+        trace_event *e = &buf->open[buf->depth];
+        e->name = name;
+        e->cat = cat;
+        e->keys = keys;
+        e->args[0] = a;
+        e->args[1] = b;
+        e->args[2] = c;
+        e->ts = now_ns();
+    }
+    buf->depth++;
+}
+
+void flux_trace_end(void) {
+    trace_buffer *buf = t_buf;
+    if (!buf || buf->depth == 0) return;     /* Began before tracing started */
+    if (--buf->depth >= TRACE_MAX_DEPTH) return;
+    trace_event *e = &buf->events[buf->count++ % FLUX_TRACE_RING];
+    *e = buf->open[buf->depth];
+    e->dur = now_ns() - e->ts;
+    e->ts -= g_origin;
+}
+
+void flux_trace_span(const char *name, const char *cat, double dur_ms,
+                     const char *keys, int a, int b, int c) {
+    trace_buffer *buf = t_buf ? t_buf : (t_buf = claim_buffer());
+    if (!buf) return;
+    uint64_t end = now_ns() - g_origin;
+    uint64_t dur = dur_ms > 0 ? (uint64_t)(dur_ms * 1e6) : 0;
+    if (dur > end) dur = end;
+    trace_event *e = &buf->events[buf->count++ % FLUX_TRACE_RING];
+    e->name = name;
+    e->cat = cat;
+    e->keys = keys;
+    e->args[0] = a;
+    e->args[1] = b;
+    e->args[2] = c;
+    e->ts = end - dur;
+    e->dur = dur;
+}
+
+int flux_trace_start(void) {
+    pthread_mutex_lock(&g_lock);
+    for (int i = 0; i < g_num_buffers; i++) {
+        g_buffers[i]->count = 0;
+        g_buffers[i]->depth = 0;
+    }
+    g_main_thread = pthread_self();
+    g_origin = now_ns();
+    pthread_mutex_unlock(&g_lock);
+    flux_trace_on = 1;
+    return 0;
+}
+
+void flux_trace_stop(void) {
+    flux_trace_on = 0;
+}
+
+static void write_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; s && *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+/* "args": {"m": 1, "k": 2} from the comma-separated keys */
+static void write_args(FILE *f, const trace_event *e) {
+    if (!e->keys) return;
+    fprintf(f, ",\"args\":{");
+    const char *k = e->keys;
+    for (int i = 0; i < 3 && *k; i++) {
+        const char *comma = strchr(k, ',');
+        int len = comma ? (int)(comma - k) : (int)strlen(k);
+        fprintf(f, "%s\"%.*s\":%d", i ? "," : "", len, k, e->args[i]);
+        k += len + (comma != NULL);
+    }
+    fputc('}', f);
+}
+
+int flux_trace_write(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) return -1;
+
+    pthread_mutex_lock(&g_lock);
+    uint64_t dropped = 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"flux\"}}");
+    for (int i = 0; i < g_num_buffers; i++) {
+        const trace_buffer *b = g_buffers[i];
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                   "\"args\":{\"name\":\"%s %d\"}}",
+                b->tid, b->main_thread ? "main" : "worker", b->tid);
+        fprintf(f, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                   "\"args\":{\"sort_index\":%d}}", b->tid, b->main_thread ? 0 : b->tid);
+
+        uint64_t n = b->count < FLUX_TRACE_RING ? b->count : FLUX_TRACE_RING;
+        dropped += b->count - n;
+        for (uint64_t j = b->count - n; j < b->count; j++) {
+            const trace_event *e = &b->events[j % FLUX_TRACE_RING];
+            fprintf(f, ",\n{\"name\":");
+            write_string(f, e->name);
+            fprintf(f, ",\"cat\":");
+            write_string(f, e->cat);
+            fprintf(f, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d",
+                    e->ts / 1000.0, e->dur / 1000.0, b->tid);
+            write_args(f, e);
+            fputc('}', f);
+        }
+    }
+    fprintf(f, "\n],\"otherData\":{\"dropped_events\":%llu}}\n", (unsigned long long)dropped);
+    pthread_mutex_unlock(&g_lock);
+
+    int err = ferror(f);
+    if (fclose(f) != 0 || err) return -1;
+    return 0;
+}
+
+#else
+
+int flux_trace_start(void) {
+    return -1;
+}
+
+void flux_trace_stop(void) {
+}
+
+int flux_trace_write(const char *path) {
+    (void)path;
+    errno = ENOSYS;
+    return -1;
+}
+
+#endif /* FLUX_TRACE */
@@ -0,0 +1,72 @@
+/*
+ * FLUX Timeline Tracing - Header
+ *
+ * Scoped events (phases, steps, blocks, GEMMs, attention, convolutions,
+ * I/O) recorded into per-thread ring buffers and written as Chrome trace
+ * JSON, which chrome://tracing and ui.perfetto.dev open directly.
+ *
+ * Instrumentation compiles to nothing unless the build defines FLUX_TRACE
+ * (make ... TRACE=1). When compiled in, an event costs one branch until
+ * flux_trace_start() is called.
+ */
+
+#ifndef FLUX_TRACE_H
+#define FLUX_TRACE_H
+
+/*
+ * Start recording. Returns 0, or -1 if tracing was not compiled in.
+ * Threads record into their own ring buffer (FLUX_TRACE_RING events);
+ * when one fills up, its oldest events are overwritten.
+ */
+int flux_trace_start(void);
+
+/* Stop recording; recorded events are kept until the next start */
+void flux_trace_stop(void);
+
+/*
+ * Write the recorded events as Chrome trace JSON. Call when no generation
+ * is running. Returns 0 on success, -1 on error.
+ */
+int flux_trace_write(const char *path);
+
+#ifdef FLUX_TRACE
+
+#define FLUX_TRACE_RING  (1 << 16)
+
+extern volatile int flux_trace_on;
+
+/*
+ * name, cat and keys must be string literals (only the pointer is kept).
+ * keys names the integer arguments, comma separated: "m,k,n" takes a, b, c;
+ * NULL for none.
+ */
+void flux_trace_begin(const char *name, const char *cat, const char *keys,
+                      int a, int b, int c);
+void flux_trace_end(void);
+
+/* An event of dur_ms that ends now, for code that already times itself */
+void flux_trace_span(const char *name, const char *cat, double dur_ms,
+                     const char *keys, int a, int b, int c);
+
+#define FLUX_TRACE_BEGIN(name, cat) \
+    do { if (flux_trace_on) flux_trace_begin((name), (cat), NULL, 0, 0, 0); } while (0)
+#define FLUX_TRACE_BEGIN_ARGS(name, cat, keys, a, b, c) \
+    do { if (flux_trace_on) flux_trace_begin((name), (cat), (keys), (a), (b), (c)); } while (0)
+#define FLUX_TRACE_END() \
+    do { if (flux_trace_on) flux_trace_end(); } while (0)
+#define FLUX_TRACE_SPAN(name, cat, dur_ms) \
+    do { if (flux_trace_on) flux_trace_span((name), (cat), (dur_ms), NULL, 0, 0, 0); } while (0)
+#define FLUX_TRACE_SPAN_ARG(name, cat, dur_ms, key, a) \
+    do { if (flux_trace_on) flux_trace_span((name), (cat), (dur_ms), (key), (a), 0, 0); } while (0)
+
+#else
+
+#define FLUX_TRACE_BEGIN(name, cat) ((void)0)
+#define FLUX_TRACE_BEGIN_ARGS(name, cat, keys, a, b, c) ((void)0)
+#define FLUX_TRACE_END() ((void)0)
+#define FLUX_TRACE_SPAN(name, cat, dur_ms) ((void)0)
+#define FLUX_TRACE_SPAN_ARG(name, cat, dur_ms, key, a) ((void)0)
+
+#endif /* FLUX_TRACE */
+
+#endif /* FLUX_TRACE_H */
@@ -15,29 +15,32 @@
 
 #include "flux.h"
 #include "flux_kernels.h"
+#include "flux_transformer.h"
+#include "flux_roofline.h"
 #include "flux_safetensors.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <math.h>
 #include <time.h>
 #include <sys/time.h>
 
 /* External timing counters from flux_sample.c */
-extern double flux_timing_transformer_total;
-extern double flux_timing_transformer_double;
-extern double flux_timing_transformer_single;
-extern double flux_timing_transformer_final;
+extern FLUX_THREAD_LOCAL double flux_timing_transformer_total;
+extern FLUX_THREAD_LOCAL double flux_timing_transformer_double;
+extern FLUX_THREAD_LOCAL double flux_timing_transformer_single;
+extern FLUX_THREAD_LOCAL double flux_timing_transformer_final;
 
 /* Fine-grained profiling for BLAS optimization */
-static double prof_single_adaln = 0;
-static double prof_single_fused_matmul = 0;
-static double prof_single_split = 0;
-static double prof_single_qknorm_rope = 0;
-static double prof_single_attention = 0;
-static double prof_single_swiglu = 0;
-static double prof_single_proj_matmul = 0;
-static double prof_single_gated_add = 0;
+static FLUX_THREAD_LOCAL double prof_single_adaln = 0;
+static FLUX_THREAD_LOCAL double prof_single_fused_matmul = 0;
+static FLUX_THREAD_LOCAL double prof_single_split = 0;
+static FLUX_THREAD_LOCAL double prof_single_qknorm_rope = 0;
+static FLUX_THREAD_LOCAL double prof_single_attention = 0;
+static FLUX_THREAD_LOCAL double prof_single_swiglu = 0;
+static FLUX_THREAD_LOCAL double prof_single_proj_matmul = 0;
+static FLUX_THREAD_LOCAL double prof_single_gated_add = 0;
 
 static double prof_get_time(void) {
     struct timeval tv;
@@ -91,6 +94,9 @@ static double tf_get_time_ms(void) {
 #include "flux_metal.h"
 #endif
 
+#define FLUX_MEM_DEFAULT FLUX_MEM_WORK
+#include "flux_mem.h"
+
 /* Enable BF16 pipeline debug logging when FLUX_BF16_DEBUG is set. */
 #ifdef USE_METAL
 static int bf16_debug_enabled(void) {
@@ -325,6 +331,8 @@ typedef struct flux_transformer {
     #define MAX_TF_SHARDS 4
     safetensors_file_t *sf_files[MAX_TF_SHARDS];
     int num_sf_files;
+
+    int is_fork;                    /* Weights belong to the transformer it was forked from */
 } flux_transformer_t;
 
 /* ========================================================================
@@ -395,6 +403,21 @@ static int parse_transformer_config(const char *model_dir, flux_transformer_t *t
     return 0;
 }
 
+/* Set default 4B architecture values. */
+static void transformer_set_defaults(flux_transformer_t *tf) {
+    tf->hidden_size = 3072;
+    tf->num_heads = 24;
+    tf->head_dim = 128;
+    tf->mlp_hidden = 9216;
+    tf->num_double_layers = 5;
+    tf->num_single_layers = 20;
+    tf->text_dim = 7680;
+    tf->latent_channels = 128;
+    tf->rope_theta = 2000.0f;
+    tf->rope_dim = 128;
+    tf->axis_dim = 32;
+}
+
 /* Open transformer safetensors shards.
  * Reads diffusion_pytorch_model.safetensors.index.json for shard filenames,
  * falls back to single diffusion_pytorch_model.safetensors.
@@ -521,6 +544,7 @@ static uint16_t *mmap_get_bf16(safetensors_file_t **files, int num_files, const
 static int load_double_block_weights(double_block_t *b, safetensors_file_t **files,
                                      int num_files, int idx, int h, int mlp, int use_bf16) {
     char name[256];
+    int prev_mem = flux_mem_enter(FLUX_MEM_TRANSFORMER_WEIGHTS);
 
     /* Image attention - QK norm weights (always f32) */
     snprintf(name, sizeof(name), "transformer_blocks.%d.attn.norm_q.weight", idx);
@@ -612,6 +636,7 @@ static int load_double_block_weights(double_block_t *b, safetensors_file_t **fil
     if (use_bf16) b->txt_mlp_down_weight_bf16 = mmap_get_bf16(files, num_files, name);
     if (!use_bf16) b->txt_mlp_down_weight = mmap_get_f32(files, num_files, name);
 
+    flux_mem_leave(prev_mem);
     return 0;
 }
 
@@ -663,6 +688,7 @@ static void free_double_block_weights(double_block_t *b) {
 static int load_single_block_weights(single_block_t *b, safetensors_file_t **files,
                                      int num_files, int idx, int h, int mlp, int use_bf16) {
     char name[256];
+    int prev_mem = flux_mem_enter(FLUX_MEM_TRANSFORMER_WEIGHTS);
     (void)h; (void)mlp;  /* Unused in single block */
 
     /* QK norm weights (always f32, small) */
@@ -681,6 +707,7 @@ static int load_single_block_weights(single_block_t *b, safetensors_file_t **fil
     if (use_bf16) b->proj_mlp_weight_bf16 = mmap_get_bf16(files, num_files, name);
     if (!use_bf16) b->proj_mlp_weight = mmap_get_f32(files, num_files, name);
 
+    flux_mem_leave(prev_mem);
     return 0;
 }
 
@@ -1200,6 +1227,8 @@ static void time_embed_forward(float *out, const float *t_sincos,
 static void apply_adaln(float *out, const float *x,
                         const float *shift, const float *scale,
                         int seq, int hidden, float eps) {
+    FLUX_OP_BEGIN(op, FLUX_OP_NORM, 8.0 * seq * hidden,
+                  4.0 * (2.0 * seq * hidden + 2.0 * hidden));
     /* Layer Norm (subtract mean, divide by std) + AdaLN modulation
      * Note: Flux2 uses LayerNorm with elementwise_affine=False (no learned weights)
      * Vectorized using Accelerate framework on Apple platforms.
@@ -1266,6 +1295,7 @@ static void apply_adaln(float *out, const float *x,
         }
     }
 #endif
+    FLUX_OP_END(op);
 }
 
 /* Apply QK normalization (RMSNorm per head)
@@ -1273,6 +1303,8 @@ static void apply_adaln(float *out, const float *x,
 static void apply_qk_norm(float *q, float *k,
                           const float *q_weight, const float *k_weight,
                           int seq, int heads, int head_dim, float eps) {
+    FLUX_OP_BEGIN(op, FLUX_OP_NORM, 2 * 4.0 * seq * heads * head_dim,
+                  2 * 4.0 * (2.0 * seq * heads * head_dim + head_dim));
 #if defined(__APPLE__) && defined(USE_BLAS)
     /* Vectorized implementation using vDSP */
     for (int s = 0; s < seq; s++) {
@@ -1324,6 +1356,7 @@ static void apply_qk_norm(float *q, float *k,
         }
     }
 #endif
+    FLUX_OP_END(op);
 }
 
 /* ========================================================================
@@ -1372,7 +1405,9 @@ static int ensure_attn_scores(flux_transformer_t *tf, int img_seq, int txt_seq)
 
     if (tf->attn_scores_alloc < needed) {
         free(tf->attn_scores);
+        int prev_mem = flux_mem_enter(FLUX_MEM_ATTENTION);
         tf->attn_scores = (float *)malloc(needed);
+        flux_mem_leave(prev_mem);
         if (!tf->attn_scores) {
             tf->attn_scores_alloc = 0;
             return -1;
@@ -1386,19 +1421,8 @@ static int ensure_attn_scores(flux_transformer_t *tf, int img_seq, int txt_seq)
 #endif
 }
 
-/* Ensure all work buffers are allocated for the given sequence length.
- * Buffers are only reallocated if the current allocation is too small.
- * Returns 0 on success, -1 on allocation failure.
- */
-static int ensure_work_buffers(flux_transformer_t *tf, int total_seq) {
-    if (tf->work_seq_alloc >= total_seq) {
-        return 0;  /* Already have enough space */
-    }
-
-    int hidden = tf->hidden_size;
-    int mlp = tf->mlp_hidden;
-
-    /* Free old buffers */
+/* Free the buffers ensure_work_buffers() sizes by sequence length */
+static void free_work_buffers(flux_transformer_t *tf) {
     free(tf->img_hidden);
     free(tf->txt_hidden);
     free(tf->work1);
@@ -1420,6 +1444,21 @@ static int ensure_work_buffers(flux_transformer_t *tf, int total_seq) {
     free(tf->ffn_up);
     free(tf->double_img_attn_out);
     free(tf->double_txt_attn_out);
+}
+
+/* Ensure all work buffers are allocated for the given sequence length.
+ * Buffers are only reallocated if the current allocation is too small.
+ * Returns 0 on success, -1 on allocation failure.
+ */
+static int ensure_work_buffers(flux_transformer_t *tf, int total_seq) {
+    if (tf->work_seq_alloc >= total_seq) {
+        return 0;  /* Already have enough space */
+    }
+
+    int hidden = tf->hidden_size;
+    int mlp = tf->mlp_hidden;
+
+    free_work_buffers(tf);
 
     /* Allocate new buffers */
     tf->img_hidden = (float *)malloc((size_t)total_seq * hidden * sizeof(float));
@@ -1430,12 +1469,14 @@ static int ensure_work_buffers(flux_transformer_t *tf, int total_seq) {
     tf->work_size = (size_t)total_seq * fused_dim * sizeof(float) + (size_t)hidden * 3 * sizeof(float);
     tf->work1 = (float *)malloc((size_t)total_seq * hidden * sizeof(float));
     tf->work2 = (float *)malloc(tf->work_size);
+    int prev_mem = flux_mem_enter(FLUX_MEM_ATTENTION);
     tf->attn_q_t = (float *)malloc((size_t)total_seq * hidden * sizeof(float));
     tf->attn_k_t = (float *)malloc((size_t)total_seq * hidden * sizeof(float));
     tf->attn_v_t = (float *)malloc((size_t)total_seq * hidden * sizeof(float));
     tf->attn_out_t = (float *)malloc((size_t)total_seq * hidden * sizeof(float));
     tf->attn_cat_k = (float *)malloc((size_t)total_seq * hidden * sizeof(float));
     tf->attn_cat_v = (float *)malloc((size_t)total_seq * hidden * sizeof(float));
+    flux_mem_leave(prev_mem);
     tf->single_q = (float *)malloc((size_t)total_seq * hidden * sizeof(float));
     tf->single_k = (float *)malloc((size_t)total_seq * hidden * sizeof(float));
     tf->single_v = (float *)malloc((size_t)total_seq * hidden * sizeof(float));
@@ -1464,6 +1505,57 @@ static int ensure_work_buffers(flux_transformer_t *tf, int total_seq) {
     return 0;
 }
 
+/* Memory the transformer of model_dir needs, without loading it.
+ * weights: resident weight bytes in anonymous memory. Without mmap that is
+ * every weight, as f32 (or bf16 for the Metal path); with mmap only the
+ * non-block weights plus the one block being converted at a time.
+ * mapped: file-backed bf16 pages of mmap mode (reclaimable page cache).
+ * work: ensure_work_buffers() for total_seq tokens.
+ * scores: ensure_attn_scores(), which flash attention does not need. */
+void flux_transformer_estimate_memory(const char *model_dir, int use_mmap,
+                                      int total_seq, size_t *weights,
+                                      size_t *mapped, size_t *work,
+                                      size_t *scores) {
+    flux_transformer_t tf;
+    memset(&tf, 0, sizeof(tf));
+    if (parse_transformer_config(model_dir, &tf) != 0)
+        transformer_set_defaults(&tf);
+
+    size_t h = tf.hidden_size, mlp = tf.mlp_hidden;
+    size_t double_block = 2 * (4 * h * h + 3 * mlp * h);
+    size_t single_block = (3 * h + 2 * mlp) * h + (h + mlp) * h;
+    size_t blocks = double_block * tf.num_double_layers +
+                    single_block * tf.num_single_layers;
+    size_t global = h * tf.latent_channels + h * tf.text_dim +  /* img_in, txt_in */
+                    256 * h + h * h +                            /* time_embed */
+                    15 * h * h +                                 /* adaLN modulation */
+                    2 * h * h + tf.latent_channels * h +         /* final layer */
+                    (size_t)52000 * tf.head_dim;                 /* rope_freqs */
+
+    int bf16 = 0;
+#ifdef USE_METAL
+    bf16 = flux_metal_available();
+#endif
+    if (use_mmap) {
+        *weights = global * sizeof(float);
+        if (!bf16) *weights += double_block * sizeof(float);
+        *mapped = (blocks + global) * sizeof(uint16_t);
+    } else {
+        *weights = global * sizeof(float) +
+                   blocks * (bf16 ? sizeof(uint16_t) : sizeof(float));
+        *mapped = 0;
+    }
+
+    size_t per_token = 19 * h + 7 * mlp;  /* Sum of the per-token buffer widths */
+    *work = ((size_t)total_seq * per_token + 3 * h) * sizeof(float);
+
+#if defined(USE_METAL) || defined(USE_BLAS)
+    *scores = (size_t)tf.num_heads * total_seq * total_seq * sizeof(float);
+#else
+    *scores = 0;
+#endif
+}
+
 /* ========================================================================
  * Thread-parallel attention for BLAS path.
  * Per-head sgemm is too small for BLAS internal threading, so we
@@ -1549,17 +1641,14 @@ static void *joint_attn_thread_worker(void *arg) {
 }
 
 /* Get number of threads for head-parallel attention.
- * Uses CPU core count, capped to divide num_heads evenly. */
+ * Uses the calling thread's CPU count, capped to divide num_heads evenly. */
 static int get_attn_num_threads(int heads) {
-    static int cached = 0;
-    if (cached) return cached;
-    int ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
-    if (ncpu < 2) { cached = 1; return 1; }
+    int ncpu = flux_num_threads();
+    if (ncpu < 2) return 1;
     if (ncpu > heads) ncpu = heads;
     /* Round down to divide heads evenly */
     while (heads % ncpu != 0) ncpu--;
-    cached = ncpu;
-    return cached;
+    return ncpu;
 }
 #endif /* USE_BLAS */
 
@@ -2119,6 +2208,9 @@ static void double_block_forward(float *img_hidden, float *txt_hidden,
                                  const float *txt_rope_cos, const float *txt_rope_sin,
                                  int img_seq, int txt_seq,
                                  flux_transformer_t *tf) {
+    FLUX_TRACE_BEGIN_ARGS("double_block", "block", "index,img_seq,txt_seq",
+                          (int)(block - tf->double_blocks), img_seq, txt_seq);
+    int prev_block = flux_op_enter_block(FLUX_BLOCK_DOUBLE);
     int hidden = tf->hidden_size;
     int heads = tf->num_heads;
     int head_dim = tf->head_dim;
@@ -2224,10 +2316,17 @@ static void double_block_forward(float *img_hidden, float *txt_hidden,
     float *img_attn_out = tf->double_img_attn_out;
     float *txt_attn_out = tf->double_txt_attn_out;
 
+    FLUX_TRACE_BEGIN_ARGS("attention", "attention", "img_seq,txt_seq,heads",
+                          img_seq, txt_seq, heads);
+    int total_seq = img_seq + txt_seq;
+    FLUX_OP_BEGIN(attn_op, FLUX_OP_ATTENTION, 4.0 * heads * total_seq * total_seq * head_dim,
+                  16.0 * heads * head_dim * total_seq);
     joint_attention(img_attn_out, txt_attn_out,
                     img_q, img_k, img_v,
                     txt_q, txt_k, txt_v,
                     img_seq, txt_seq, heads, head_dim, tf);
+    FLUX_OP_END(attn_op);
+    FLUX_TRACE_END();
 
 #ifdef DEBUG_DOUBLE_BLOCK
     if (block_idx == 0) {
@@ -2324,6 +2423,8 @@ static void double_block_forward(float *img_hidden, float *txt_hidden,
 #ifdef DEBUG_DOUBLE_BLOCK
     block_idx++;
 #endif
+    flux_op_leave_block(prev_block);
+    FLUX_TRACE_END();
 }
 
 /* ========================================================================
@@ -3288,6 +3389,7 @@ static float *flux_transformer_forward_bf16(flux_transformer_t *tf,
     }
     step_time = tf_get_time_ms() - step_start;
     flux_timing_transformer_total += step_time;
+    FLUX_TRACE_SPAN("transformer", "transformer", step_time);
     if (flux_substep_callback)
         flux_substep_callback(FLUX_SUBSTEP_FINAL_LAYER, 0, 1);
 
@@ -3335,6 +3437,9 @@ static void single_block_forward(float *hidden, const single_block_t *block,
                                  const float *img_rope_cos, const float *img_rope_sin,
                                  const float *txt_rope_cos, const float *txt_rope_sin,
                                  int seq, int img_offset, flux_transformer_t *tf) {
+    FLUX_TRACE_BEGIN_ARGS("single_block", "block", "index,seq",
+                          (int)(block - tf->single_blocks), seq, 0);
+    int prev_block = flux_op_enter_block(FLUX_BLOCK_SINGLE);
     /* seq = total_seq (txt + img)
      * img_offset = txt_seq (where image starts in the [txt, img] concatenation)
      */
@@ -3374,6 +3479,7 @@ static void single_block_forward(float *hidden, const single_block_t *block,
     apply_adaln(norm, hidden, shift, scale, seq, h_size, eps);
     double _t1 = prof_get_time();
     prof_single_adaln += _t1 - _t0;
+    FLUX_TRACE_SPAN("adaln", "single_block", _t1 - _t0);
 
     /* Fused QKV + FFN input projection
      * Output: [seq, fused_dim] where fused_dim = [Q, K, V, gate, up]
@@ -3384,6 +3490,7 @@ static void single_block_forward(float *hidden, const single_block_t *block,
                        seq, h_size, fused_dim);
     double _t2 = prof_get_time();
     prof_single_fused_matmul += _t2 - _t1;
+    FLUX_TRACE_SPAN("qkv_mlp_proj", "single_block", _t2 - _t1);
 
     /* Split outputs: use pre-allocated buffers
      * Each position has [Q, K, V, gate, up] concatenated
@@ -3405,6 +3512,7 @@ static void single_block_forward(float *hidden, const single_block_t *block,
 
     double _t3 = prof_get_time();
     prof_single_split += _t3 - _t2;
+    FLUX_TRACE_SPAN("split", "single_block", _t3 - _t2);
 
     /* Apply QK normalization */
     apply_qk_norm(q, k, block->norm_q_weight, block->norm_k_weight,
@@ -3429,18 +3537,24 @@ static void single_block_forward(float *hidden, const single_block_t *block,
 
     double _t4 = prof_get_time();
     prof_single_qknorm_rope += _t4 - _t3;
+    FLUX_TRACE_SPAN("qk_norm_rope", "single_block", _t4 - _t3);
 
     /* Self-attention - use pre-allocated buffer */
     float *attn_out = tf->single_attn_out;
+    FLUX_OP_BEGIN(attn_op, FLUX_OP_ATTENTION, 4.0 * heads * seq * seq * head_dim,
+                  16.0 * heads * head_dim * seq);
     mha_forward(attn_out, q, k, v, seq, heads, head_dim, tf);
+    FLUX_OP_END(attn_op);
     double _t5 = prof_get_time();
     prof_single_attention += _t5 - _t4;
+    FLUX_TRACE_SPAN("attention", "attention", _t5 - _t4);
 
     /* SwiGLU: silu(gate) * up - fused for better performance */
     flux_silu_mul(mlp_gate, mlp_up, seq * mlp_hidden);
 
     double _t6 = prof_get_time();
     prof_single_swiglu += _t6 - _t5;
+    FLUX_TRACE_SPAN("swiglu", "single_block", _t6 - _t5);
 
     /* Fused output projection: [attn_out, mlp_out] -> hidden
      * proj_mlp_weight: [hidden, hidden + mlp_hidden]
@@ -3460,13 +3574,17 @@ static void single_block_forward(float *hidden, const single_block_t *block,
 
     double _t7 = prof_get_time();
     prof_single_proj_matmul += _t7 - _t6;
+    FLUX_TRACE_SPAN("out_proj", "single_block", _t7 - _t6);
 
     /* Apply gate and add residual - use vectorized helper */
     gated_add(hidden, gate, proj_out, seq, h_size);
     double _t8 = prof_get_time();
     prof_single_gated_add += _t8 - _t7;
+    FLUX_TRACE_SPAN("gated_add", "single_block", _t8 - _t7);
 
     /* No free - using pre-allocated buffers */
+    flux_op_leave_block(prev_block);
+    FLUX_TRACE_END();
 }
 
 /* ========================================================================
@@ -3594,6 +3712,7 @@ float *flux_transformer_forward(flux_transformer_t *tf,
     flux_linear_nobias(tf->double_mod_txt, tf->t_emb_silu, tf->adaln_double_txt_weight,
                        1, hidden, double_mod_size);
 
+    int aborted = 0;
     for (int i = 0; i < tf->num_double_layers; i++) {
         /* In mmap mode, load block weights on-demand and free after use */
         if (tf->use_mmap && tf->double_blocks[i].img_q_weight == NULL
@@ -3610,6 +3729,10 @@ float *flux_transformer_forward(flux_transformer_t *tf,
         if (tf->use_mmap) free_double_block_weights(&tf->double_blocks[i]);
         if (flux_substep_callback)
             flux_substep_callback(FLUX_SUBSTEP_DOUBLE_BLOCK, i, tf->num_double_layers);
+        if (flux_aborted()) {
+            aborted = 1;
+            break;
+        }
 #ifdef DEBUG_TRANSFORMER
         if (i == 0) {
             fprintf(stderr, "\n[DEBUG] After double block 0:\n");
@@ -3628,8 +3751,15 @@ float *flux_transformer_forward(flux_transformer_t *tf,
 #endif
     }
 
+    if (aborted) {
+        free(t_emb);
+        return NULL;
+    }
+
     double double_time = tf_get_time_ms() - double_start;
 
+    FLUX_TRACE_SPAN("double_blocks", "transformer", double_time);
+
     /* Concatenate text and image for single-stream blocks
      * Python uses [txt, img] order for concatenation
      */
@@ -3842,6 +3972,10 @@ float *flux_transformer_forward(flux_transformer_t *tf,
             if (tf->use_mmap) free_single_block_weights(&tf->single_blocks[i]);
             if (flux_substep_callback)
                 flux_substep_callback(FLUX_SUBSTEP_SINGLE_BLOCK, i, tf->num_single_layers);
+            if (flux_aborted()) {
+                aborted = 1;
+                break;
+            }
 
 #ifdef DEBUG_SINGLE_BLOCK
             if (i == 0 || i == 9 || i == 19) {
@@ -3857,8 +3991,16 @@ float *flux_transformer_forward(flux_transformer_t *tf,
     }
 #endif
 
+    if (aborted) {
+        free(concat_hidden);
+        free(t_emb);
+        return NULL;
+    }
+
     double single_time = tf_get_time_ms() - single_start;
 
+    FLUX_TRACE_SPAN("single_blocks", "transformer", single_time);
+
     /* Extract image hidden states (image is after text) */
     memcpy(img_hidden, concat_hidden + txt_seq * hidden, img_seq * hidden * sizeof(float));
     free(concat_hidden);
@@ -3912,6 +4054,8 @@ float *flux_transformer_forward(flux_transformer_t *tf,
 
     double final_time = tf_get_time_ms() - final_start;
 
+    FLUX_TRACE_SPAN("final_layer", "transformer", final_time);
+
     /* Update global timing counters */
     flux_timing_transformer_double += double_time;
     flux_timing_transformer_single += single_time;
@@ -4062,6 +4206,7 @@ float *flux_transformer_forward_with_refs(flux_transformer_t *tf,
                        1, hidden, double_mod_size);
 
     /* Double blocks - process combined image with text */
+    int aborted = 0;
     for (int i = 0; i < tf->num_double_layers; i++) {
         if (tf->use_mmap) {
             load_double_block_weights(&tf->double_blocks[i], tf->sf_files, tf->num_sf_files, i,
@@ -4079,6 +4224,16 @@ float *flux_transformer_forward_with_refs(flux_transformer_t *tf,
         }
         if (flux_substep_callback)
             flux_substep_callback(FLUX_SUBSTEP_DOUBLE_BLOCK, i, tf->num_double_layers);
+        if (flux_aborted()) {
+            aborted = 1;
+            break;
+        }
+    }
+
+    if (aborted) {
+        free(combined_hidden);
+        free(t_emb);
+        return NULL;
     }
 
     /* Concatenate for single blocks: [txt, combined_img] */
@@ -4104,6 +4259,16 @@ float *flux_transformer_forward_with_refs(flux_transformer_t *tf,
         }
         if (flux_substep_callback)
             flux_substep_callback(FLUX_SUBSTEP_SINGLE_BLOCK, i, tf->num_single_layers);
+        if (flux_aborted()) {
+            aborted = 1;
+            break;
+        }
+    }
+
+    if (aborted) {
+        free(concat_hidden);
+        free(t_emb);
+        return NULL;
     }
 
     /* Extract ONLY target image hidden states (first img_seq tokens after txt) */
@@ -4306,6 +4471,7 @@ float *flux_transformer_forward_with_multi_refs(flux_transformer_t *tf,
                        1, hidden, double_mod_size);
 
     /* Double blocks */
+    int aborted = 0;
     for (int i = 0; i < tf->num_double_layers; i++) {
         if (tf->use_mmap) {
             load_double_block_weights(&tf->double_blocks[i], tf->sf_files, tf->num_sf_files, i,
@@ -4322,6 +4488,18 @@ float *flux_transformer_forward_with_multi_refs(flux_transformer_t *tf,
         }
         if (flux_substep_callback)
             flux_substep_callback(FLUX_SUBSTEP_DOUBLE_BLOCK, i, tf->num_double_layers);
+        if (flux_aborted()) {
+            aborted = 1;
+            break;
+        }
+    }
+
+    if (aborted) {
+        free(combined_hidden);
+        free(t_emb);
+        free(combined_rope_cos);
+        free(combined_rope_sin);
+        return NULL;
     }
 
     /* Concatenate for single blocks */
@@ -4346,6 +4524,18 @@ float *flux_transformer_forward_with_multi_refs(flux_transformer_t *tf,
         }
         if (flux_substep_callback)
             flux_substep_callback(FLUX_SUBSTEP_SINGLE_BLOCK, i, tf->num_single_layers);
+        if (flux_aborted()) {
+            aborted = 1;
+            break;
+        }
+    }
+
+    if (aborted) {
+        free(concat_hidden);
+        free(t_emb);
+        free(combined_rope_cos);
+        free(combined_rope_sin);
+        return NULL;
     }
 
     /* Extract ONLY target image hidden states */
@@ -4397,6 +4587,510 @@ float *flux_transformer_forward_with_multi_refs(flux_transformer_t *tf,
     return output;
 }
 
+/* ========================================================================
+ * Packed Multi-Request Forward
+ *
+ * Several independent requests (different sizes, prompts and timesteps)
+ * run through one forward pass. Their tokens are stacked so every linear
+ * layer - most of the FLOPs - sees one tall matrix, while everything that
+ * is per request stays per segment:
+ *   - RoPE tables are built per segment and stacked in token order
+ *   - AdaLN modulation comes from each segment's own timestep
+ *   - attention runs per segment (a block-diagonal mask over the stack)
+ *
+ * Stream layouts (seg = segment):
+ *   double blocks:  image [img_0, img_1, ...]   text [txt_0, txt_1, ...]
+ *   single blocks:  [txt_0, img_0, txt_1, img_1, ...]
+ * ======================================================================== */
+
+/* Per-segment offsets and modulation for the packed blocks */
+typedef struct {
+    int img_off, img_seq;       /* Rows in the packed image stream */
+    int txt_off, txt_seq;       /* Rows in the packed text stream */
+    float *t_emb;               /* [hidden] */
+    float *mod_img, *mod_txt;   /* Double blocks [hidden * 6] */
+    float *mod_single;          /* Single blocks [hidden * 3] */
+    float *mod_final;           /* Final layer [hidden * 2] (scale, shift) */
+} packed_seg_t;
+
+static void double_block_forward_packed(float *img_hidden, float *txt_hidden,
+                                        const double_block_t *block,
+                                        const packed_seg_t *segs, int num_segs,
+                                        const float *img_rope_cos, const float *img_rope_sin,
+                                        const float *txt_rope_cos, const float *txt_rope_sin,
+                                        int img_seq, int txt_seq,
+                                        flux_transformer_t *tf) {
+    FLUX_TRACE_BEGIN_ARGS("double_block", "block", "index,img_seq,txt_seq",
+                          (int)(block - tf->double_blocks), img_seq, txt_seq);
+    int prev_block = flux_op_enter_block(FLUX_BLOCK_DOUBLE);
+    int hidden = tf->hidden_size;
+    int heads = tf->num_heads;
+    int head_dim = tf->head_dim;
+    int mlp_hidden = tf->mlp_hidden;
+    int axis_dim = 32;
+    float eps = 1e-6f;
+
+    float *img_norm = tf->work1;
+    float *txt_norm = img_norm + img_seq * hidden;
+    for (int s = 0; s < num_segs; s++) {
+        const packed_seg_t *g = &segs[s];
+        apply_adaln(img_norm + g->img_off * hidden, img_hidden + g->img_off * hidden,
+                    g->mod_img, g->mod_img + hidden, g->img_seq, hidden, eps);
+        apply_adaln(txt_norm + g->txt_off * hidden, txt_hidden + g->txt_off * hidden,
+                    g->mod_txt, g->mod_txt + hidden, g->txt_seq, hidden, eps);
+    }
+
+    float *img_q = tf->work2;
+    float *img_k = img_q + img_seq * hidden;
+    float *img_v = img_k + img_seq * hidden;
+    float *txt_q = img_v + img_seq * hidden;
+    float *txt_k = txt_q + txt_seq * hidden;
+    float *txt_v = txt_k + txt_seq * hidden;
+
+    flux_gpu_begin_batch();
+    LINEAR_BF16_OR_F32(img_q, img_norm, block->img_q_weight, block->img_q_weight_bf16,
+                       img_seq, hidden, hidden);
+    LINEAR_BF16_OR_F32(img_k, img_norm, block->img_k_weight, block->img_k_weight_bf16,
+                       img_seq, hidden, hidden);
+    LINEAR_BF16_OR_F32(img_v, img_norm, block->img_v_weight, block->img_v_weight_bf16,
+                       img_seq, hidden, hidden);
+    LINEAR_BF16_OR_F32(txt_q, txt_norm, block->txt_q_weight, block->txt_q_weight_bf16,
+                       txt_seq, hidden, hidden);
+    LINEAR_BF16_OR_F32(txt_k, txt_norm, block->txt_k_weight, block->txt_k_weight_bf16,
+                       txt_seq, hidden, hidden);
+    LINEAR_BF16_OR_F32(txt_v, txt_norm, block->txt_v_weight, block->txt_v_weight_bf16,
+                       txt_seq, hidden, hidden);
+    flux_gpu_end_batch();
+
+    apply_qk_norm(img_q, img_k, block->img_norm_q_weight, block->img_norm_k_weight,
+                  img_seq, heads, head_dim, eps);
+    apply_qk_norm(txt_q, txt_k, block->txt_norm_q_weight, block->txt_norm_k_weight,
+                  txt_seq, heads, head_dim, eps);
+
+    /* The stacked tables already hold each segment's own positions */
+    apply_rope_2d(img_q, img_rope_cos, img_rope_sin, img_seq, heads, head_dim, axis_dim);
+    apply_rope_2d(img_k, img_rope_cos, img_rope_sin, img_seq, heads, head_dim, axis_dim);
+    apply_rope_2d(txt_q, txt_rope_cos, txt_rope_sin, txt_seq, heads, head_dim, axis_dim);
+    apply_rope_2d(txt_k, txt_rope_cos, txt_rope_sin, txt_seq, heads, head_dim, axis_dim);
+
+    /* Block-diagonal joint attention: each segment only sees itself */
+    float *img_attn_out = tf->double_img_attn_out;
+    float *txt_attn_out = tf->double_txt_attn_out;
+    for (int s = 0; s < num_segs; s++) {
+        int io = segs[s].img_off * hidden, to = segs[s].txt_off * hidden;
+        FLUX_TRACE_BEGIN_ARGS("attention", "attention", "img_seq,txt_seq,heads",
+                              segs[s].img_seq, segs[s].txt_seq, heads);
+        int total_seq = segs[s].img_seq + segs[s].txt_seq;
+        FLUX_OP_BEGIN(attn_op, FLUX_OP_ATTENTION, 4.0 * heads * total_seq * total_seq * head_dim,
+                      16.0 * heads * head_dim * total_seq);
+        joint_attention(img_attn_out + io, txt_attn_out + to,
+                        img_q + io, img_k + io, img_v + io,
+                        txt_q + to, txt_k + to, txt_v + to,
+                        segs[s].img_seq, segs[s].txt_seq, heads, head_dim, tf);
+        FLUX_OP_END(attn_op);
+        FLUX_TRACE_END();
+    }
+
+    float *img_proj = tf->work1;
+    float *txt_proj = img_proj + img_seq * hidden;
+
+    flux_gpu_begin_batch();
+    LINEAR_BF16_OR_F32(img_proj, img_attn_out, block->img_proj_weight, block->img_proj_weight_bf16,
+                       img_seq, hidden, hidden);
+    LINEAR_BF16_OR_F32(txt_proj, txt_attn_out, block->txt_proj_weight, block->txt_proj_weight_bf16,
+                       txt_seq, hidden, hidden);
+    flux_gpu_end_batch();
+
+    for (int s = 0; s < num_segs; s++) {
+        const packed_seg_t *g = &segs[s];
+        gated_add(img_hidden + g->img_off * hidden, g->mod_img + hidden * 2,
+                  img_proj + g->img_off * hidden, g->img_seq, hidden);
+        gated_add(txt_hidden + g->txt_off * hidden, g->mod_txt + hidden * 2,
+                  txt_proj + g->txt_off * hidden, g->txt_seq, hidden);
+    }
+
+    /* FFN for image */
+    for (int s = 0; s < num_segs; s++) {
+        const packed_seg_t *g = &segs[s];
+        apply_adaln(img_norm + g->img_off * hidden, img_hidden + g->img_off * hidden,
+                    g->mod_img + hidden * 3, g->mod_img + hidden * 4, g->img_seq, hidden, eps);
+    }
+    swiglu_ffn_bf16(img_proj, img_norm,
+                    block->img_mlp_gate_weight, block->img_mlp_up_weight,
+                    block->img_mlp_down_weight,
+                    block->img_mlp_gate_weight_bf16, block->img_mlp_up_weight_bf16,
+                    block->img_mlp_down_weight_bf16,
+                    img_seq, hidden, mlp_hidden, tf);
+    for (int s = 0; s < num_segs; s++) {
+        const packed_seg_t *g = &segs[s];
+        gated_add(img_hidden + g->img_off * hidden, g->mod_img + hidden * 5,
+                  img_proj + g->img_off * hidden, g->img_seq, hidden);
+    }
+
+    /* FFN for text */
+    for (int s = 0; s < num_segs; s++) {
+        const packed_seg_t *g = &segs[s];
+        apply_adaln(txt_norm + g->txt_off * hidden, txt_hidden + g->txt_off * hidden,
+                    g->mod_txt + hidden * 3, g->mod_txt + hidden * 4, g->txt_seq, hidden, eps);
+    }
+    swiglu_ffn_bf16(txt_proj, txt_norm,
+                    block->txt_mlp_gate_weight, block->txt_mlp_up_weight,
+                    block->txt_mlp_down_weight,
+                    block->txt_mlp_gate_weight_bf16, block->txt_mlp_up_weight_bf16,
+                    block->txt_mlp_down_weight_bf16,
+                    txt_seq, hidden, mlp_hidden, tf);
+    for (int s = 0; s < num_segs; s++) {
+        const packed_seg_t *g = &segs[s];
+        gated_add(txt_hidden + g->txt_off * hidden, g->mod_txt + hidden * 5,
+                  txt_proj + g->txt_off * hidden, g->txt_seq, hidden);
+    }
+    flux_op_leave_block(prev_block);
+    FLUX_TRACE_END();
+}
+
+/* Single block over the [txt_0, img_0, txt_1, img_1, ...] stack.
+ * Segment s starts at row txt_off + img_off. */
+static void single_block_forward_packed(float *hidden, const single_block_t *block,
+                                        const packed_seg_t *segs, int num_segs,
+                                        const float *rope_cos, const float *rope_sin,
+                                        int seq, flux_transformer_t *tf) {
+    FLUX_TRACE_BEGIN_ARGS("single_block", "block", "index,seq",
+                          (int)(block - tf->single_blocks), seq, 0);
+    int prev_block = flux_op_enter_block(FLUX_BLOCK_SINGLE);
+    int h_size = tf->hidden_size;
+    int heads = tf->num_heads;
+    int head_dim = tf->head_dim;
+    int mlp_hidden = tf->mlp_hidden;
+    int fused_dim = h_size * 3 + mlp_hidden * 2;
+    int axis_dim = 32;
+    float eps = 1e-6f;
+
+    float *norm = tf->work1;
+    for (int s = 0; s < num_segs; s++) {
+        const packed_seg_t *g = &segs[s];
+        int off = (g->txt_off + g->img_off) * h_size;
+        apply_adaln(norm + off, hidden + off, g->mod_single, g->mod_single + h_size,
+                    g->txt_seq + g->img_seq, h_size, eps);
+    }
+
+    float *fused_out = tf->work2;
+    LINEAR_BF16_OR_F32(fused_out, norm, block->qkv_mlp_weight, block->qkv_mlp_weight_bf16,
+                       seq, h_size, fused_dim);
+
+    float *q = tf->single_q;
+    float *k = tf->single_k;
+    float *v = tf->single_v;
+    float *mlp_gate = tf->single_mlp_gate;
+    float *mlp_up = tf->single_mlp_up;
+    for (int s = 0; s < seq; s++) {
+        float *row = fused_out + s * fused_dim;
+        memcpy(q + s * h_size, row, h_size * sizeof(float));
+        memcpy(k + s * h_size, row + h_size, h_size * sizeof(float));
+        memcpy(v + s * h_size, row + h_size * 2, h_size * sizeof(float));
+        memcpy(mlp_gate + s * mlp_hidden, row + h_size * 3, mlp_hidden * sizeof(float));
+        memcpy(mlp_up + s * mlp_hidden, row + h_size * 3 + mlp_hidden, mlp_hidden * sizeof(float));
+    }
+
+    apply_qk_norm(q, k, block->norm_q_weight, block->norm_k_weight,
+                  seq, heads, head_dim, eps);
+    apply_rope_2d(q, rope_cos, rope_sin, seq, heads, head_dim, axis_dim);
+    apply_rope_2d(k, rope_cos, rope_sin, seq, heads, head_dim, axis_dim);
+
+    float *attn_out = tf->single_attn_out;
+    for (int s = 0; s < num_segs; s++) {
+        int off = (segs[s].txt_off + segs[s].img_off) * h_size;
+        int seg_seq = segs[s].txt_seq + segs[s].img_seq;
+        FLUX_TRACE_BEGIN_ARGS("attention", "attention", "seq,heads", seg_seq, heads, 0);
+        FLUX_OP_BEGIN(attn_op, FLUX_OP_ATTENTION, 4.0 * heads * seg_seq * seg_seq * head_dim,
+                      16.0 * heads * head_dim * seg_seq);
+        mha_forward(attn_out + off, q + off, k + off, v + off, seg_seq, heads, head_dim, tf);
+        FLUX_OP_END(attn_op);
+        FLUX_TRACE_END();
+    }
+
+    flux_silu_mul(mlp_gate, mlp_up, seq * mlp_hidden);
+
+    float *concat = tf->single_concat;
+    for (int s = 0; s < seq; s++) {
+        memcpy(concat + s * (h_size + mlp_hidden),
+               attn_out + s * h_size, h_size * sizeof(float));
+        memcpy(concat + s * (h_size + mlp_hidden) + h_size,
+               mlp_gate + s * mlp_hidden, mlp_hidden * sizeof(float));
+    }
+
+    float *proj_out = tf->work1;
+    LINEAR_BF16_OR_F32(proj_out, concat, block->proj_mlp_weight, block->proj_mlp_weight_bf16,
+                       seq, h_size + mlp_hidden, h_size);
+
+    for (int s = 0; s < num_segs; s++) {
+        const packed_seg_t *g = &segs[s];
+        int off = (g->txt_off + g->img_off) * h_size;
+        gated_add(hidden + off, g->mod_single + h_size * 2, proj_out + off,
+                  g->txt_seq + g->img_seq, h_size);
+    }
+    flux_op_leave_block(prev_block);
+    FLUX_TRACE_END();
+}
+
+/* Declared in flux_transformer.h */
+int flux_transformer_forward_packed(flux_transformer_t *tf,
+                                    const flux_packed_seg_t *in, int num_segs,
+                                    float **out) {
+    int hidden = tf->hidden_size;
+    int channels = tf->latent_channels;
+    int head_dim = tf->head_dim;
+    int axis_dim = tf->axis_dim;
+
+    if (num_segs == 1) {
+        out[0] = flux_transformer_forward(tf, in[0].img_latent, in[0].img_h, in[0].img_w,
+                                          in[0].txt_emb, in[0].txt_seq, in[0].timestep);
+        return out[0] ? 0 : -1;
+    }
+
+    /* Everything below is freed at fail: on error or abort */
+    float *mods = NULL, *img_tokens = NULL, *txt_tokens = NULL;
+    float *img_rope_cos = NULL, *img_rope_sin = NULL;
+    float *txt_rope_cos = NULL, *txt_rope_sin = NULL;
+    float *cat_rope_cos = NULL, *cat_rope_sin = NULL;
+    float *concat_hidden = NULL, *output_nlc = NULL;
+    for (int s = 0; s < num_segs; s++) out[s] = NULL;
+
+    /* Segment layout and the largest single attention problem */
+    packed_seg_t *segs = (packed_seg_t *)calloc(num_segs, sizeof(packed_seg_t));
+    if (!segs) return -1;
+    int img_seq = 0, txt_seq = 0;
+    int max_seg = 0, max_img = 0, max_txt = 0;
+    for (int s = 0; s < num_segs; s++) {
+        segs[s].img_off = img_seq;
+        segs[s].img_seq = in[s].img_h * in[s].img_w;
+        segs[s].txt_off = txt_seq;
+        segs[s].txt_seq = in[s].txt_seq;
+        img_seq += segs[s].img_seq;
+        txt_seq += segs[s].txt_seq;
+        if (segs[s].img_seq + segs[s].txt_seq > max_seg) {
+            max_seg = segs[s].img_seq + segs[s].txt_seq;
+            max_img = segs[s].img_seq;
+            max_txt = segs[s].txt_seq;
+        }
+    }
+    int total_seq = img_seq + txt_seq;
+
+    if (ensure_work_buffers(tf, total_seq) < 0 ||
+        ensure_attn_scores(tf, max_img, max_txt) < 0) {
+        fprintf(stderr, "Failed to allocate work buffers for packed seq_len=%d\n", total_seq);
+        goto fail;
+    }
+
+    /* Per-segment timestep embedding and modulation: 18 * hidden each
+     * (t_emb 1, double img 6, double txt 6, single 3, final 2) */
+    mods = (float *)malloc((size_t)num_segs * hidden * 18 * sizeof(float));
+    if (!mods) goto fail;
+    for (int s = 0; s < num_segs; s++) {
+        packed_seg_t *g = &segs[s];
+        g->t_emb = mods + (size_t)s * hidden * 18;
+        g->mod_img = g->t_emb + hidden;
+        g->mod_txt = g->mod_img + hidden * 6;
+        g->mod_single = g->mod_txt + hidden * 6;
+        g->mod_final = g->mod_single + hidden * 3;
+
+        float t_sincos[256];
+        get_timestep_embedding(t_sincos, in[s].timestep * 1000.0f,
+                               tf->time_embed.sincos_dim, 10000.0f);
+        time_embed_forward(g->t_emb, t_sincos, &tf->time_embed, hidden, tf->t_emb_silu);
+        for (int j = 0; j < hidden; j++) {
+            float x = g->t_emb[j];
+            tf->t_emb_silu[j] = x / (1.0f + expf(-x));
+        }
+        flux_linear_nobias(g->mod_img, tf->t_emb_silu, tf->adaln_double_img_weight,
+                           1, hidden, hidden * 6);
+        flux_linear_nobias(g->mod_txt, tf->t_emb_silu, tf->adaln_double_txt_weight,
+                           1, hidden, hidden * 6);
+        flux_linear_nobias(g->mod_single, tf->t_emb_silu, tf->adaln_single_weight,
+                           1, hidden, hidden * 3);
+        flux_linear_nobias(g->mod_final, tf->t_emb_silu, tf->final_norm_weight,
+                           1, hidden, hidden * 2);
+    }
+
+    /* Stacked RoPE tables: per stream, and in single-block order */
+    size_t rope_row = (size_t)head_dim;
+    img_rope_cos = (float *)malloc(img_seq * rope_row * sizeof(float));
+    img_rope_sin = (float *)malloc(img_seq * rope_row * sizeof(float));
+    txt_rope_cos = (float *)malloc(txt_seq * rope_row * sizeof(float));
+    txt_rope_sin = (float *)malloc(txt_seq * rope_row * sizeof(float));
+    cat_rope_cos = (float *)malloc(total_seq * rope_row * sizeof(float));
+    cat_rope_sin = (float *)malloc(total_seq * rope_row * sizeof(float));
+    if (!img_rope_cos || !img_rope_sin || !txt_rope_cos || !txt_rope_sin ||
+        !cat_rope_cos || !cat_rope_sin)
+        goto fail;
+    for (int s = 0; s < num_segs; s++) {
+        const packed_seg_t *g = &segs[s];
+        size_t io = g->img_off * rope_row, to = g->txt_off * rope_row;
+        size_t co = (size_t)(g->img_off + g->txt_off) * rope_row;
+        compute_rope_2d(img_rope_cos + io, img_rope_sin + io,
+                        in[s].img_h, in[s].img_w, axis_dim, tf->rope_theta);
+        compute_rope_text(txt_rope_cos + to, txt_rope_sin + to,
+                          g->txt_seq, axis_dim, tf->rope_theta);
+        memcpy(cat_rope_cos + co, txt_rope_cos + to, g->txt_seq * rope_row * sizeof(float));
+        memcpy(cat_rope_sin + co, txt_rope_sin + to, g->txt_seq * rope_row * sizeof(float));
+        co += g->txt_seq * rope_row;
+        memcpy(cat_rope_cos + co, img_rope_cos + io, g->img_seq * rope_row * sizeof(float));
+        memcpy(cat_rope_sin + co, img_rope_sin + io, g->img_seq * rope_row * sizeof(float));
+    }
+
+    /* Input projections over the whole stack */
+    img_tokens = (float *)malloc((size_t)img_seq * channels * sizeof(float));
+    txt_tokens = (float *)malloc((size_t)txt_seq * tf->text_dim * sizeof(float));
+    if (!img_tokens || !txt_tokens) goto fail;
+    for (int s = 0; s < num_segs; s++) {
+        const packed_seg_t *g = &segs[s];
+        float *dst = img_tokens + (size_t)g->img_off * channels;
+        for (int pos = 0; pos < g->img_seq; pos++)
+            for (int c = 0; c < channels; c++)
+                dst[pos * channels + c] = in[s].img_latent[c * g->img_seq + pos];
+        memcpy(txt_tokens + (size_t)g->txt_off * tf->text_dim, in[s].txt_emb,
+               (size_t)g->txt_seq * tf->text_dim * sizeof(float));
+    }
+
+    double double_start = tf_get_time_ms();
+
+    float *img_hidden = tf->img_hidden;
+    float *txt_hidden = tf->txt_hidden;
+    LINEAR_BF16_OR_F32(img_hidden, img_tokens, tf->img_in_weight, tf->img_in_weight_bf16,
+                       img_seq, channels, hidden);
+    LINEAR_BF16_OR_F32(txt_hidden, txt_tokens, tf->txt_in_weight, tf->txt_in_weight_bf16,
+                       txt_seq, tf->text_dim, hidden);
+    free(img_tokens);
+    free(txt_tokens);
+    img_tokens = txt_tokens = NULL;
+
+    for (int i = 0; i < tf->num_double_layers; i++) {
+        if (tf->use_mmap && tf->double_blocks[i].img_q_weight == NULL
+                         && tf->double_blocks[i].img_q_weight_bf16 == NULL) {
+            load_double_block_weights(&tf->double_blocks[i], tf->sf_files, tf->num_sf_files, i,
+                                      tf->hidden_size, tf->mlp_hidden, tf->use_bf16);
+        }
+        double_block_forward_packed(img_hidden, txt_hidden, &tf->double_blocks[i],
+                                    segs, num_segs,
+                                    img_rope_cos, img_rope_sin,
+                                    txt_rope_cos, txt_rope_sin,
+                                    img_seq, txt_seq, tf);
+        if (tf->use_mmap) free_double_block_weights(&tf->double_blocks[i]);
+        if (flux_substep_callback)
+            flux_substep_callback(FLUX_SUBSTEP_DOUBLE_BLOCK, i, tf->num_double_layers);
+        if (flux_aborted()) goto fail;
+    }
+
+    double double_time = tf_get_time_ms() - double_start;
+
+    FLUX_TRACE_SPAN("double_blocks", "transformer", double_time);
+    double single_start = tf_get_time_ms();
+
+    /* Interleave into [txt_0, img_0, txt_1, img_1, ...] */
+    concat_hidden = (float *)malloc((size_t)total_seq * hidden * sizeof(float));
+    if (!concat_hidden) goto fail;
+    for (int s = 0; s < num_segs; s++) {
+        const packed_seg_t *g = &segs[s];
+        float *dst = concat_hidden + (size_t)(g->txt_off + g->img_off) * hidden;
+        memcpy(dst, txt_hidden + (size_t)g->txt_off * hidden,
+               (size_t)g->txt_seq * hidden * sizeof(float));
+        memcpy(dst + (size_t)g->txt_seq * hidden, img_hidden + (size_t)g->img_off * hidden,
+               (size_t)g->img_seq * hidden * sizeof(float));
+    }
+
+    for (int i = 0; i < tf->num_single_layers; i++) {
+        if (tf->use_mmap && tf->single_blocks[i].qkv_mlp_weight == NULL
+                         && tf->single_blocks[i].qkv_mlp_weight_bf16 == NULL) {
+            load_single_block_weights(&tf->single_blocks[i], tf->sf_files, tf->num_sf_files, i,
+                                      tf->hidden_size, tf->mlp_hidden, tf->use_bf16);
+        }
+        single_block_forward_packed(concat_hidden, &tf->single_blocks[i],
+                                    segs, num_segs, cat_rope_cos, cat_rope_sin,
+                                    total_seq, tf);
+        if (tf->use_mmap) free_single_block_weights(&tf->single_blocks[i]);
+        if (flux_substep_callback)
+            flux_substep_callback(FLUX_SUBSTEP_SINGLE_BLOCK, i, tf->num_single_layers);
+        if (flux_aborted()) goto fail;
+    }
+
+    double single_time = tf_get_time_ms() - single_start;
+
+    FLUX_TRACE_SPAN("single_blocks", "transformer", single_time);
+    double final_start = tf_get_time_ms();
+
+    /* Final layer: per-segment AdaLN, one projection over all image tokens */
+    float *final_norm = tf->work1;
+    for (int s = 0; s < num_segs; s++) {
+        const packed_seg_t *g = &segs[s];
+        const float *img_part = concat_hidden +
+                                (size_t)(g->txt_off + g->img_off + g->txt_seq) * hidden;
+        apply_adaln(final_norm + (size_t)g->img_off * hidden, img_part,
+                    g->mod_final + hidden, g->mod_final, g->img_seq, hidden, 1e-6f);
+    }
+    free(concat_hidden);
+    concat_hidden = NULL;
+
+    output_nlc = (float *)malloc((size_t)img_seq * channels * sizeof(float));
+    if (!output_nlc) goto fail;
+    LINEAR_BF16_OR_F32(output_nlc, final_norm, tf->final_proj_weight, tf->final_proj_weight_bf16,
+                       img_seq, hidden, channels);
+
+    for (int s = 0; s < num_segs; s++) {
+        const packed_seg_t *g = &segs[s];
+        const float *src = output_nlc + (size_t)g->img_off * channels;
+        out[s] = (float *)malloc((size_t)g->img_seq * channels * sizeof(float));
+        if (!out[s]) goto fail;
+        for (int pos = 0; pos < g->img_seq; pos++)
+            for (int c = 0; c < channels; c++)
+                out[s][c * g->img_seq + pos] = src[pos * channels + c];
+    }
+    free(output_nlc);
+
+    free(img_rope_cos);
+    free(img_rope_sin);
+    free(txt_rope_cos);
+    free(txt_rope_sin);
+    free(cat_rope_cos);
+    free(cat_rope_sin);
+    free(mods);
+    free(segs);
+
+    double final_time = tf_get_time_ms() - final_start;
+
+    FLUX_TRACE_SPAN("final_layer", "transformer", final_time);
+    flux_timing_transformer_double += double_time;
+    flux_timing_transformer_single += single_time;
+    flux_timing_transformer_final += final_time;
+    flux_timing_transformer_total += double_time + single_time + final_time;
+
+    if (flux_substep_callback)
+        flux_substep_callback(FLUX_SUBSTEP_FINAL_LAYER, 0, 1);
+
+#ifdef USE_METAL
+    flux_gpu_sync();
+#endif
+
+    return 0;
+
+fail:
+    for (int s = 0; s < num_segs; s++) {
+        free(out[s]);
+        out[s] = NULL;
+    }
+    free(output_nlc);
+    free(concat_hidden);
+    free(img_tokens);
+    free(txt_tokens);
+    free(img_rope_cos);
+    free(img_rope_sin);
+    free(txt_rope_cos);
+    free(txt_rope_sin);
+    free(cat_rope_cos);
+    free(cat_rope_sin);
+    free(mods);
+    free(segs);
+    return -1;
+}
+
 /* ========================================================================
  * Transformer Loading
  * ======================================================================== */
@@ -4541,9 +5235,136 @@ error:
     return NULL;
 }
 
+/* Work buffers and RoPE caches: everything a forward pass writes */
+static void free_workspace(flux_transformer_t *tf) {
+    free(tf->img_hidden);
+    free(tf->txt_hidden);
+    free(tf->work1);
+    free(tf->work2);
+
+    /* Free attention workspace buffers */
+    free(tf->attn_q_t);
+    free(tf->attn_k_t);
+    free(tf->attn_v_t);
+    free(tf->attn_out_t);
+    free(tf->attn_scores);
+    free(tf->attn_cat_k);
+    free(tf->attn_cat_v);
+
+    /* Free single-block work buffers */
+    free(tf->single_q);
+    free(tf->single_k);
+    free(tf->single_v);
+    free(tf->single_mlp_gate);
+    free(tf->single_mlp_up);
+    free(tf->single_attn_out);
+    free(tf->single_concat);
+
+    /* Free FFN work buffers */
+    free(tf->ffn_gate);
+    free(tf->ffn_up);
+
+    /* Free double-block work buffers */
+    free(tf->t_emb_silu);
+    free(tf->double_mod_img);
+    free(tf->double_mod_txt);
+    free(tf->double_img_attn_out);
+    free(tf->double_txt_attn_out);
+
+    /* Free cached RoPE buffers */
+    free(tf->cached_img_rope_cos);
+    free(tf->cached_img_rope_sin);
+    free(tf->cached_ref_rope_cos);
+    free(tf->cached_ref_rope_sin);
+    free(tf->cached_txt_rope_cos);
+    free(tf->cached_txt_rope_sin);
+    free(tf->cached_combined_rope_cos);
+    free(tf->cached_combined_rope_sin);
+}
+
+/* Free tf's work buffers, RoPE caches and any blocks loaded in mmap mode,
+ * for a transformer that from now on only serves as the weight source of
+ * its forks and runs no forward passes itself. */
+void flux_transformer_release_workspace(flux_transformer_t *tf) {
+    if (!tf) return;
+    flux_transformer_free_mmap_cache(tf);
+    free_workspace(tf);
+    size_t ws_start = offsetof(flux_transformer_t, img_hidden);
+    memset((char *)tf + ws_start, 0, offsetof(flux_transformer_t, use_mmap) - ws_start);
+}
+
+/* Free the sequence-sized work buffers and attention scores. Packed
+ * batches grow them to the whole batch's token count and they never
+ * shrink on their own; the next forward pass allocates what it needs. */
+void flux_transformer_release_work(flux_transformer_t *tf) {
+    if (!tf || tf->work_seq_alloc == 0) return;
+    free_work_buffers(tf);
+    free(tf->attn_scores);
+    tf->img_hidden = tf->txt_hidden = tf->work1 = tf->work2 = NULL;
+    tf->attn_q_t = tf->attn_k_t = tf->attn_v_t = tf->attn_out_t = NULL;
+    tf->attn_cat_k = tf->attn_cat_v = tf->attn_scores = NULL;
+    tf->single_q = tf->single_k = tf->single_v = NULL;
+    tf->single_mlp_gate = tf->single_mlp_up = NULL;
+    tf->single_attn_out = tf->single_concat = NULL;
+    tf->ffn_gate = tf->ffn_up = NULL;
+    tf->double_img_attn_out = tf->double_txt_attn_out = NULL;
+    tf->work_seq_alloc = 0;
+    tf->work_size = 0;
+    tf->attn_scores_alloc = 0;
+}
+
+/* A transformer sharing tf's weights, with its own work buffers and RoPE
+ * caches, so both can run forward passes on different threads. In mmap
+ * mode the block structs are copied too, since blocks are loaded into them
+ * on use. Free it before tf. */
+flux_transformer_t *flux_transformer_fork(flux_transformer_t *tf) {
+    if (!tf) return NULL;
+    flux_transformer_t *fork = (flux_transformer_t *)malloc(sizeof(flux_transformer_t));
+    if (!fork) return NULL;
+    *fork = *tf;
+    fork->is_fork = 1;
+
+    /* Working memory through the RoPE caches is per instance */
+    size_t ws_start = offsetof(flux_transformer_t, img_hidden);
+    memset((char *)fork + ws_start, 0, offsetof(flux_transformer_t, use_mmap) - ws_start);
+
+    int hidden = tf->hidden_size;
+    fork->t_emb_silu = (float *)malloc(hidden * sizeof(float));
+    fork->double_mod_img = (float *)malloc(hidden * 6 * sizeof(float));
+    fork->double_mod_txt = (float *)malloc(hidden * 6 * sizeof(float));
+    if (tf->use_mmap) {
+        fork->double_blocks = (double_block_t *)malloc(tf->num_double_layers * sizeof(double_block_t));
+        fork->single_blocks = (single_block_t *)malloc(tf->num_single_layers * sizeof(single_block_t));
+        if (fork->double_blocks)
+            memcpy(fork->double_blocks, tf->double_blocks,
+                   tf->num_double_layers * sizeof(double_block_t));
+        if (fork->single_blocks)
+            memcpy(fork->single_blocks, tf->single_blocks,
+                   tf->num_single_layers * sizeof(single_block_t));
+    }
+    if (!fork->t_emb_silu || !fork->double_mod_img || !fork->double_mod_txt ||
+        !fork->double_blocks || !fork->single_blocks) {
+        flux_transformer_free(fork);
+        return NULL;
+    }
+    return fork;
+}
+
 void flux_transformer_free(flux_transformer_t *tf) {
     if (!tf) return;
 
+    if (tf->is_fork) {
+        if (tf->use_mmap) {
+            if (tf->double_blocks && tf->single_blocks)
+                flux_transformer_free_mmap_cache(tf);
+            free(tf->double_blocks);
+            free(tf->single_blocks);
+        }
+        free_workspace(tf);
+        free(tf);
+        return;
+    }
+
     /* In mmap mode, bf16 pointers point into the mmap'd file region and must
      * NOT be freed. Clean up any cached block weights first, then only NULL
      * the bf16 pointers (don't free them). */
@@ -4618,10 +5439,6 @@ void flux_transformer_free(flux_transformer_t *tf) {
     free(tf->final_proj_weight);
     free(tf->final_proj_weight_bf16);
     free(tf->rope_freqs);
-    free(tf->img_hidden);
-    free(tf->txt_hidden);
-    free(tf->work1);
-    free(tf->work2);
     free(tf->adaln_double_img_weight);
     free(tf->adaln_double_txt_weight);
     free(tf->adaln_single_weight);
@@ -4629,44 +5446,7 @@ void flux_transformer_free(flux_transformer_t *tf) {
     free(tf->adaln_double_txt_weight_bf16);
     free(tf->adaln_single_weight_bf16);
 
-    /* Free attention workspace buffers */
-    free(tf->attn_q_t);
-    free(tf->attn_k_t);
-    free(tf->attn_v_t);
-    free(tf->attn_out_t);
-    free(tf->attn_scores);
-    free(tf->attn_cat_k);
-    free(tf->attn_cat_v);
-
-    /* Free single-block work buffers */
-    free(tf->single_q);
-    free(tf->single_k);
-    free(tf->single_v);
-    free(tf->single_mlp_gate);
-    free(tf->single_mlp_up);
-    free(tf->single_attn_out);
-    free(tf->single_concat);
-
-    /* Free FFN work buffers */
-    free(tf->ffn_gate);
-    free(tf->ffn_up);
-
-    /* Free double-block work buffers */
-    free(tf->t_emb_silu);
-    free(tf->double_mod_img);
-    free(tf->double_mod_txt);
-    free(tf->double_img_attn_out);
-    free(tf->double_txt_attn_out);
-
-    /* Free cached RoPE buffers */
-    free(tf->cached_img_rope_cos);
-    free(tf->cached_img_rope_sin);
-    free(tf->cached_ref_rope_cos);
-    free(tf->cached_ref_rope_sin);
-    free(tf->cached_txt_rope_cos);
-    free(tf->cached_txt_rope_sin);
-    free(tf->cached_combined_rope_cos);
-    free(tf->cached_combined_rope_sin);
+    free_workspace(tf);
 
     /* Close safetensors files if in mmap mode */
     if (tf->use_mmap) {
@@ -4776,6 +5556,32 @@ static void warmup_bf16_weights(flux_transformer_t *tf) {
 }
 #endif /* USE_METAL */
 
+/* Spread the f32 block weights over NUMA nodes (flux_numa_place); the
+ * loader thread first-touched them all on its own node. */
+static void place_weights_numa(flux_transformer_t *tf) {
+    size_t h = tf->hidden_size, mlp = tf->mlp_hidden;
+    size_t row = h * sizeof(float);
+    for (int i = 0; i < tf->num_double_layers; i++) {
+        double_block_t *b = &tf->double_blocks[i];
+        float *square[] = { b->img_q_weight, b->img_k_weight, b->img_v_weight,
+                            b->img_proj_weight, b->txt_q_weight, b->txt_k_weight,
+                            b->txt_v_weight, b->txt_proj_weight };
+        for (size_t j = 0; j < sizeof(square) / sizeof(square[0]); j++)
+            flux_numa_place(square[j], h, row);
+        flux_numa_place(b->img_mlp_gate_weight, mlp, row);
+        flux_numa_place(b->img_mlp_up_weight, mlp, row);
+        flux_numa_place(b->img_mlp_down_weight, h, mlp * sizeof(float));
+        flux_numa_place(b->txt_mlp_gate_weight, mlp, row);
+        flux_numa_place(b->txt_mlp_up_weight, mlp, row);
+        flux_numa_place(b->txt_mlp_down_weight, h, mlp * sizeof(float));
+    }
+    for (int i = 0; i < tf->num_single_layers; i++) {
+        single_block_t *b = &tf->single_blocks[i];
+        flux_numa_place(b->qkv_mlp_weight, 3 * h + 2 * mlp, row);
+        flux_numa_place(b->proj_mlp_weight, h, (h + mlp) * sizeof(float));
+    }
+}
+
 flux_transformer_t *flux_transformer_load_safetensors(const char *model_dir) {
     flux_transformer_t *tf = calloc(1, sizeof(flux_transformer_t));
     if (!tf) return NULL;
@@ -4783,19 +5589,8 @@ flux_transformer_t *flux_transformer_load_safetensors(const char *model_dir) {
     char name[256];
 
     /* Parse config from transformer/config.json, fall back to 4B defaults */
-    if (parse_transformer_config(model_dir, tf) != 0) {
-        tf->hidden_size = 3072;
-        tf->num_heads = 24;
-        tf->head_dim = 128;
-        tf->mlp_hidden = 9216;
-        tf->num_double_layers = 5;
-        tf->num_single_layers = 20;
-        tf->text_dim = 7680;
-        tf->latent_channels = 128;
-        tf->rope_theta = 2000.0f;
-        tf->rope_dim = 128;
-        tf->axis_dim = 32;
-    }
+    if (parse_transformer_config(model_dir, tf) != 0)
+        transformer_set_defaults(tf);
     tf->max_seq_len = 52000;
 
     /* Open safetensors shards */
@@ -5021,6 +5816,8 @@ flux_transformer_t *flux_transformer_load_safetensors(const char *model_dir) {
         return NULL;
     }
 
+    place_weights_numa(tf);
+
 #ifdef USE_METAL
     /* Pre-warm bf16→f16 cache to avoid conversion overhead on first inference step */
     warmup_bf16_weights(tf);
@@ -5035,19 +5832,8 @@ flux_transformer_t *flux_transformer_load_safetensors_mmap(const char *model_dir
     if (!tf) return NULL;
 
     /* Parse config from transformer/config.json, fall back to 4B defaults */
-    if (parse_transformer_config(model_dir, tf) != 0) {
-        tf->hidden_size = 3072;
-        tf->num_heads = 24;
-        tf->head_dim = 128;
-        tf->mlp_hidden = 9216;
-        tf->num_double_layers = 5;
-        tf->num_single_layers = 20;
-        tf->text_dim = 7680;
-        tf->latent_channels = 128;
-        tf->rope_theta = 2000.0f;
-        tf->rope_dim = 128;
-        tf->axis_dim = 32;
-    }
+    if (parse_transformer_config(model_dir, tf) != 0)
+        transformer_set_defaults(tf);
     tf->max_seq_len = 52000;  /* Support up to 1792x1792 */
 
     /* Open safetensors shards and keep them open for on-demand loading */
@@ -0,0 +1,42 @@
+/*
+ * FLUX Transformer - Packed Forward
+ *
+ * Interface between the request engine in flux.c and the packed forward
+ * pass in flux_transformer.c, which runs several independent requests
+ * through one stacked pass of the transformer.
+ */
+
+#ifndef FLUX_TRANSFORMER_H
+#define FLUX_TRANSFORMER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct flux_transformer flux_transformer_t;
+
+/* One request in a packed forward pass */
+typedef struct {
+    const float *img_latent;    /* [latent_channels, img_h, img_w] */
+    int img_h, img_w;
+    const float *txt_emb;       /* [txt_seq, text_dim] */
+    int txt_seq;
+    float timestep;
+} flux_packed_seg_t;
+
+/*
+ * Forward num_segs independent requests in one pass. out[s] receives the
+ * velocity of segment s in NCHW [channels, img_h, img_w] (caller frees).
+ * Text-to-image only (no reference tokens). Always takes the per-block
+ * path; the Metal bf16 / chained single-block pipelines are single-request.
+ * Returns 0 on success, -1 on failure (out[] is then left NULL).
+ */
+int flux_transformer_forward_packed(flux_transformer_t *tf,
+                                    const flux_packed_seg_t *segs, int num_segs,
+                                    float **out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FLUX_TRANSFORMER_H */
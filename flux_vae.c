@@ -13,6 +13,7 @@
 
 #include "flux.h"
 #include "flux_kernels.h"
+#include "flux_roofline.h"
 #include "flux_safetensors.h"
 #ifdef USE_METAL
 #include "flux_metal.h"
@@ -22,6 +23,9 @@
 #include <string.h>
 #include <math.h>
 
+#define FLUX_MEM_DEFAULT FLUX_MEM_VAE
+#include "flux_mem.h"
+
 /* ========================================================================
  * VAE Data Structures
  * ======================================================================== */
@@ -115,6 +119,8 @@ typedef struct flux_vae {
     int max_h, max_w;
     float *work1, *work2, *work3;
     size_t work_size;
+
+    int is_fork;            /* Weights belong to the VAE it was forked from */
 } flux_vae_t;
 
 /* Forward declarations */
@@ -327,8 +333,10 @@ float *flux_vae_encode(flux_vae_t *vae, const float *img,
      * -> patchify 2x2 -> [B, 128, H/16, W/16]
      * -> batch_norm
      */
+    int prev_block = flux_op_enter_block(FLUX_BLOCK_VAE);
+    int prev_mem = flux_mem_enter(FLUX_MEM_VAE);
 
-    int ch_mult[4] = {1, 2, 4, 4};
+    const int *ch_mult = vae->ch_mult;
     float *x = vae->work1;
     float *work = vae->work2;
 
@@ -384,6 +392,8 @@ float *flux_vae_encode(flux_vae_t *vae, const float *img,
         flux_vae_progress_callback(progress++, total_blocks);
     if (attnblock_forward(x, work, &vae->enc_mid_attn, vae->work3,
                           batch, cur_h, cur_w, vae->num_groups, vae->eps) < 0) {
+        flux_op_leave_block(prev_block);
+        flux_mem_leave(prev_mem);
         return NULL;  /* OOM in attention */
     }
     if (flux_vae_progress_callback)
@@ -434,6 +444,9 @@ float *flux_vae_encode(flux_vae_t *vae, const float *img,
                     batch, FLUX_LATENT_CHANNELS, patch_h, patch_w, vae->eps);
     flux_copy(latent, work, batch * FLUX_LATENT_CHANNELS * patch_h * patch_w);
 
+    flux_op_leave_block(prev_block);
+    flux_mem_leave(prev_mem);
+
     *out_h = patch_h;
     *out_w = patch_w;
     return latent;
@@ -506,7 +519,7 @@ static flux_image *vae_decode_gpu(flux_vae_t *vae, const float *latent,
                                    int batch, int latent_h, int latent_w) {
     if (!flux_metal_available()) return NULL;
 
-    int ch_mult[4] = {1, 2, 4, 4};
+    const int *ch_mult = vae->ch_mult;
 
     /* Batch denormalize + unpatchify on CPU (small data, fast) */
     float *cpu_x = vae->work1;
@@ -605,6 +618,13 @@ static flux_image *vae_decode_gpu(flux_vae_t *vae, const float *latent,
     for (int level = 3; level >= 0; level--) {
         int ch_out = vae->base_channels * ch_mult[level];
 
+        /* Abandoned: the CPU path sees the flag too and returns NULL */
+        if (flux_aborted()) {
+            flux_gpu_tensor_free(x);
+            flux_gpu_batch_end();
+            return NULL;
+        }
+
         for (int r = 0; r < vae->num_res_blocks + 1; r++) {
             vae_resblock_t *block = &vae->dec_up_blocks[block_idx++];
             t = resblock_forward_gpu(x, block, batch, cur_h, cur_w, vae->num_groups, vae->eps);
@@ -698,6 +718,9 @@ flux_image *flux_vae_decode(flux_vae_t *vae, const float *latent,
     }
 #endif
 
+    /* Also covers a GPU decode abandoned part way */
+    if (flux_aborted()) return NULL;
+
     /*
      * Decoder path:
      * [B, 128, H/16, W/16]
@@ -706,8 +729,10 @@ flux_image *flux_vae_decode(flux_vae_t *vae, const float *latent,
      * -> conv_in -> mid_block -> up_blocks -> norm -> conv_out
      * -> [B, 3, H, W]
      */
+    int prev_block = flux_op_enter_block(FLUX_BLOCK_VAE);
+    int prev_mem = flux_mem_enter(FLUX_MEM_VAE);
 
-    int ch_mult[4] = {1, 2, 4, 4};
+    const int *ch_mult = vae->ch_mult;
     float *x = vae->work1;
     float *work = vae->work2;
 
@@ -756,6 +781,8 @@ flux_image *flux_vae_decode(flux_vae_t *vae, const float *latent,
         flux_vae_progress_callback(progress++, total_blocks);
     if (attnblock_forward(x, work, &vae->dec_mid_attn, vae->work3,
                           batch, cur_h, cur_w, vae->num_groups, vae->eps) < 0) {
+        flux_op_leave_block(prev_block);
+        flux_mem_leave(prev_mem);
         return NULL;  /* OOM in attention */
     }
     if (flux_vae_progress_callback)
@@ -773,6 +800,13 @@ flux_image *flux_vae_decode(flux_vae_t *vae, const float *latent,
     for (int level = 3; level >= 0; level--) {
         int ch_out = vae->base_channels * ch_mult[level];
 
+        /* Abandoned through flux_abort_callback */
+        if (flux_aborted()) {
+            flux_op_leave_block(prev_block);
+            flux_mem_leave(prev_mem);
+            return NULL;
+        }
+
         /* num_res_blocks + 1 resblocks per level */
         for (int r = 0; r < vae->num_res_blocks + 1; r++) {
             vae_resblock_t *block = &vae->dec_up_blocks[block_idx++];
@@ -811,6 +845,8 @@ flux_image *flux_vae_decode(flux_vae_t *vae, const float *latent,
     /* Conv out: 128 -> 3 */
     vae_conv2d(x, work, vae->dec_conv_out_weight, vae->dec_conv_out_bias,
                 batch, out_ch, 3, cur_h, cur_w, 3, 3, 1, 1);
+    flux_op_leave_block(prev_block);
+    flux_mem_leave(prev_mem);
 
     /* Convert to image */
     int H = cur_h;
@@ -1034,6 +1070,14 @@ error:
 void flux_vae_free(flux_vae_t *vae) {
     if (!vae) return;
 
+    if (vae->is_fork) {
+        free(vae->work1);
+        free(vae->work2);
+        free(vae->work3);
+        free(vae);
+        return;
+    }
+
     free(vae->enc_conv_in_weight);
     free(vae->enc_conv_in_bias);
 
@@ -1102,6 +1146,133 @@ void flux_vae_free(flux_vae_t *vae) {
     free(vae);
 }
 
+/* Bytes of work memory an encode or decode of a width x height image
+ * touches. The work buffers are sized for FLUX_VAE_MAX_DIM but only their
+ * first pages are written: at most 256 channels at full resolution (the
+ * decoder's last upsample). The mid-block attention at 1/8 scale adds its
+ * q/k/v/out copies and a full score matrix. */
+size_t flux_vae_work_bytes(int width, int height) {
+    size_t spatial = (size_t)width * height;
+    size_t attn_spatial = spatial / 64;
+    size_t floats = 3 * 256 * spatial +                 /* work1..3 */
+                    4 * 512 * attn_spatial +            /* attention q, k, v, out */
+                    attn_spatial * attn_spatial +       /* attention scores */
+                    3 * spatial;                        /* RGB tensor */
+    return floats * sizeof(float);
+}
+
+/* A VAE that shares vae's weights and has its own work buffers, so the
+ * two can encode/decode on different threads. Free it before vae. */
+flux_vae_t *flux_vae_fork(const flux_vae_t *vae) {
+    if (!vae) return NULL;
+    flux_vae_t *fork = (flux_vae_t *)malloc(sizeof(flux_vae_t));
+    if (!fork) return NULL;
+    *fork = *vae;
+    fork->is_fork = 1;
+    fork->work1 = (float *)malloc(fork->work_size);
+    fork->work2 = (float *)malloc(fork->work_size);
+    fork->work3 = (float *)malloc(fork->work_size);
+    if (!fork->work1 || !fork->work2 || !fork->work3) {
+        flux_vae_free(fork);
+        return NULL;
+    }
+    return fork;
+}
+
+/* Free the work buffers of a VAE that from now on only serves as the
+ * weight source of its forks */
+void flux_vae_release_workspace(flux_vae_t *vae) {
+    if (!vae) return;
+    free(vae->work1);
+    free(vae->work2);
+    free(vae->work3);
+    vae->work1 = vae->work2 = vae->work3 = NULL;
+}
+
+/* ========================================================================
+ * Latent Resampling
+ * ======================================================================== */
+
+/* Bilinear resize of [C, H, W] planes (half-pixel centers, clamped edges) */
+static void resize_bilinear_planes(float *out, const float *in, int channels,
+                                   int H, int W, int out_h, int out_w) {
+    float sy = (float)H / out_h;
+    float sx = (float)W / out_w;
+    for (int y = 0; y < out_h; y++) {
+        float fy = (y + 0.5f) * sy - 0.5f;
+        if (fy < 0) fy = 0;
+        int y0 = (int)fy;
+        int y1 = (y0 + 1 < H) ? y0 + 1 : H - 1;
+        float wy = fy - y0;
+        for (int x = 0; x < out_w; x++) {
+            float fx = (x + 0.5f) * sx - 0.5f;
+            if (fx < 0) fx = 0;
+            int x0 = (int)fx;
+            int x1 = (x0 + 1 < W) ? x0 + 1 : W - 1;
+            float wx = fx - x0;
+            for (int c = 0; c < channels; c++) {
+                const float *p = in + (size_t)c * H * W;
+                float top = p[y0 * W + x0] * (1 - wx) + p[y0 * W + x1] * wx;
+                float bot = p[y1 * W + x0] * (1 - wx) + p[y1 * W + x1] * wx;
+                out[(size_t)c * out_h * out_w + y * out_w + x] = top * (1 - wy) + bot * wy;
+            }
+        }
+    }
+}
+
+/*
+ * Resize a normalized [128, H, W] transformer latent to [128, out_h, out_w].
+ * Interpolation happens in the VAE's own [32, 2H, 2W] space (batch-norm
+ * undone and 2x2 patches unpacked), since the packed channels of one token
+ * are neighbouring pixels rather than independent features.
+ */
+float *flux_vae_resize_latent(flux_vae_t *vae, const float *latent,
+                              int latent_h, int latent_w, int out_h, int out_w) {
+    int zc = FLUX_VAE_Z_CHANNELS;
+    size_t in_n = (size_t)FLUX_LATENT_CHANNELS * latent_h * latent_w;
+    size_t out_n = (size_t)FLUX_LATENT_CHANNELS * out_h * out_w;
+    float *packed = (float *)malloc(in_n * sizeof(float));
+    float *unpacked = (float *)malloc(in_n * sizeof(float));
+    float *resized = (float *)malloc(out_n * sizeof(float));
+    float *out = (float *)malloc(out_n * sizeof(float));
+    if (!packed || !unpacked || !resized || !out) {
+        free(packed);
+        free(unpacked);
+        free(resized);
+        free(out);
+        return NULL;
+    }
+
+    int in_spatial = latent_h * latent_w;
+    int out_spatial = out_h * out_w;
+
+    /* Denormalize: x = x * sqrt(var + eps) + mean */
+    for (int c = 0; c < FLUX_LATENT_CHANNELS; c++) {
+        float mean = vae ? vae->bn_mean[c] : 0.0f;
+        float std = vae ? sqrtf(vae->bn_var[c] + vae->eps) : 1.0f;
+        for (int i = 0; i < in_spatial; i++)
+            packed[c * in_spatial + i] = latent[c * in_spatial + i] * std + mean;
+    }
+
+    flux_unpatchify(unpacked, packed, 1, zc, latent_h, latent_w, 2);
+    resize_bilinear_planes(resized, unpacked, zc, latent_h * 2, latent_w * 2,
+                           out_h * 2, out_w * 2);
+    flux_patchify(out, resized, 1, zc, out_h * 2, out_w * 2, 2);
+
+    /* Normalize back: x = (x - mean) / sqrt(var + eps) */
+    for (int c = 0; c < FLUX_LATENT_CHANNELS; c++) {
+        float mean = vae ? vae->bn_mean[c] : 0.0f;
+        float std = vae ? sqrtf(vae->bn_var[c] + vae->eps) : 1.0f;
+        for (int i = 0; i < out_spatial; i++)
+            out[c * out_spatial + i] = (out[c * out_spatial + i] - mean) / std;
+    }
+
+    free(packed);
+    free(unpacked);
+    free(resized);
+    return out;
+}
+
 /* ========================================================================
  * Image Preprocessing
  * ======================================================================== */
@@ -1245,6 +1416,15 @@ flux_vae_t *flux_vae_load_safetensors(safetensors_file_t *sf) {
     vae->max_w = FLUX_VAE_MAX_DIM;
     vae->eps = 1e-4f;  /* batch_norm_eps from config */
 
+    /* Channel widths follow the weights, so narrower test VAEs load too */
+    const safetensor_t *conv_in = safetensors_find(sf, "encoder.conv_in.weight");
+    if (conv_in && conv_in->ndim == 4) vae->base_channels = (int)conv_in->shape[0];
+    for (int level = 0; level < 4; level++) {
+        snprintf(name, sizeof(name), "encoder.down_blocks.%d.resnets.0.conv1.weight", level);
+        const safetensor_t *t = safetensors_find(sf, name);
+        if (t && t->ndim == 4) ch_mult[level] = (int)t->shape[0] / vae->base_channels;
+    }
+
     vae->ch_mult[0] = ch_mult[0];
     vae->ch_mult[1] = ch_mult[1];
     vae->ch_mult[2] = ch_mult[2];
@@ -23,11 +23,18 @@
 #include "flux.h"
 #include "flux_kernels.h"
 #include "flux_cli.h"
+#include "flux_server.h"
+#include "flux_pipeline.h"
+#include "flux_perf.h"
+#include "flux_trace.h"
+#include "flux_roofline.h"
+#include "flux_mem.h"
 #include "terminals.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <errno.h>
 #include <time.h>
 #include <sys/time.h>
 #include <unistd.h>
@@ -205,6 +212,22 @@ static double timer_end(void) {
 /* Print only in verbose mode */
 #define LOG_VERBOSE(...) do { if (output_level >= OUTPUT_VERBOSE) fprintf(stderr, __VA_ARGS__); } while(0)
 
+/* ========================================================================
+ * Timeline Trace
+ * ======================================================================== */
+
+static const char *trace_path = NULL;
+
+/* Every mode returns from main on its own path; write the trace on exit */
+static void write_trace_at_exit(void) {
+    flux_trace_stop();
+    if (flux_trace_write(trace_path) != 0) {
+        fprintf(stderr, "Error: cannot write trace %s: %s\n", trace_path, strerror(errno));
+        return;
+    }
+    LOG_NORMAL("Trace: %s\n", trace_path);
+}
+
 /* ========================================================================
  * Usage and Help
  * ======================================================================== */
@@ -230,7 +253,28 @@ static void print_usage(const char *prog) {
     fprintf(stderr, "  -S, --seed N          Random seed (-1 for random)\n");
     fprintf(stderr, "      --linear          Use linear timestep schedule (default: shifted sigmoid)\n");
     fprintf(stderr, "      --power           Use power curve timestep schedule (default alpha: 2.0)\n");
-    fprintf(stderr, "      --power-alpha N   Set power schedule exponent (default: 2.0)\n\n");
+    fprintf(stderr, "      --power-alpha N   Set power schedule exponent (default: 2.0)\n");
+    fprintf(stderr, "      --sampler NAME    ODE solver: euler, dpm++2m, unipc, adaptive (default: euler)\n");
+    fprintf(stderr, "      --rng NAME        Initial noise generator: xoshiro, philox (default: xoshiro)\n");
+    fprintf(stderr, "      --tolerance N     Local error tolerance for adaptive sampler (default: %.2f)\n",
+            FLUX_DEFAULT_TOLERANCE);
+    fprintf(stderr, "      --cfg-min T       Base model: apply CFG only at timesteps t >= T (default: 0)\n");
+    fprintf(stderr, "      --cfg-max T       Base model: apply CFG only at timesteps t <= T (default: 1)\n");
+    fprintf(stderr, "      --cfg-reuse N     Base model: reuse the uncond prediction for N steps\n");
+    fprintf(stderr, "      --hires           Two-pass: generate small, upscale latent, refine at full size\n");
+    fprintf(stderr, "      --hires-scale F   First pass size relative to output (default: 0.5)\n");
+    fprintf(stderr, "      --hires-denoise T Re-noise timestep for the refine pass (default: 0.6)\n");
+    fprintf(stderr, "      --hires-steps N   Refine pass steps (default: steps * denoise)\n");
+    fprintf(stderr, "      --progressive N   Start denoising at 1/2^N resolution, Euler steps (default: off)\n");
+    fprintf(stderr, "      --progressive-t T Timestep of the switch to full resolution (default: %.1f)\n",
+            FLUX_DEFAULT_PROG_T_END);
+    fprintf(stderr, "      --variations N    Generate N variations sharing their first steps (out-2.png, ...)\n");
+    fprintf(stderr, "      --variation-steps K  Shared steps before branching (default: steps / 4)\n");
+    fprintf(stderr, "      --variation-strength S  Fraction of noise replaced per branch (default: 0.5)\n");
+    fprintf(stderr, "      --save-checkpoint FILE  Save the latent after --checkpoint-step steps (default: last)\n");
+    fprintf(stderr, "      --checkpoint-step K  Step to checkpoint for --save-checkpoint\n");
+    fprintf(stderr, "      --resume FILE     Continue from a checkpoint (same prompt; -s for a new step count,\n");
+    fprintf(stderr, "                        not with the dpm++2m or unipc samplers)\n\n");
     fprintf(stderr, "Model options:\n");
     fprintf(stderr, "      --base            Force base model mode (undistilled, CFG enabled)\n\n");
     fprintf(stderr, "Reference images (img2img / multi-reference):\n");
@@ -247,7 +291,27 @@ static void print_usage(const char *prog) {
     fprintf(stderr, "  -m, --mmap            Use memory-mapped weights (default, fastest on MPS)\n");
     fprintf(stderr, "      --no-mmap         Disable mmap, load all weights upfront\n");
     fprintf(stderr, "      --no-license-info Suppress non-commercial license warning\n");
-    fprintf(stderr, "      --blas-threads N  Set number of BLAS threads (OpenBLAS only)\n");
+    fprintf(stderr, "      --blas-threads N  Set number of BLAS threads (OpenBLAS only, default: usable CPUs)\n");
+    fprintf(stderr, "      --numa POLICY     Weight placement on multi-socket hosts: auto, off,\n");
+    fprintf(stderr, "                        interleave, partition (node-local GEMM slices);\n");
+    fprintf(stderr, "                        places --no-mmap weights only\n");
+    fprintf(stderr, "      --serve SOCKET    Keep models loaded and serve JSON requests on a Unix socket\n");
+    fprintf(stderr, "      --workers N       Serve from N worker processes sharing one copy of the weights\n");
+    fprintf(stderr, "      --batch FILE      Generate one image per prompt line, pipelining the stages\n");
+    fprintf(stderr, "                        (-o out.png names them out-1.png, out-2.png, ...)\n");
+    fprintf(stderr, "      --batch-depth N   Jobs buffered between pipeline stages (default: 2)\n");
+    fprintf(stderr, "      --batch-writers N PNG writer threads for --batch (default: 2)\n");
+    fprintf(stderr, "      --batch-threads E,D,V Compute threads of the encode, denoise and decode\n");
+    fprintf(stderr, "                        stages (default: 1/8, 3/4, 1/8 of the CPUs)\n");
+    fprintf(stderr, "      --bench           Time generation end to end (-p, -W/-H, -s, -S are the defaults)\n");
+    fprintf(stderr, "      --bench-sizes L   Sizes to benchmark, e.g. 256,512x768\n");
+    fprintf(stderr, "      --bench-steps L   Step counts, e.g. 4,8\n");
+    fprintf(stderr, "      --bench-refs L    Reference images per run, e.g. 0,1,2\n");
+    fprintf(stderr, "      --bench-batch L   Concurrent requests per run, e.g. 1,4\n");
+    fprintf(stderr, "      --bench-mode M    warm (one loaded model), cold (load per run) or both\n");
+    fprintf(stderr, "      --bench-iters N   Timed runs per configuration (default: 3)\n");
+    fprintf(stderr, "      --bench-json FILE Also write the results as JSON\n");
+    fprintf(stderr, "      --trace FILE      Write a Chrome/Perfetto timeline of the run (build with TRACE=1)\n");
     fprintf(stderr, "  -h, --help            Show this help\n\n");
     fprintf(stderr, "Examples:\n");
     fprintf(stderr, "  %s -d model/ -p \"a cat on a rainbow\" -o cat.png\n", prog);
@@ -293,6 +357,40 @@ int main(int argc, char *argv[]) {
         {"debug-py",   no_argument,       0, 'D'},
         {"no-license-info", no_argument, 0, 258},
         {"blas-threads",required_argument, 0, 259},
+        {"sampler",    required_argument, 0, 260},
+        {"tolerance",  required_argument, 0, 261},
+        {"cfg-min",    required_argument, 0, 262},
+        {"cfg-max",    required_argument, 0, 263},
+        {"cfg-reuse",  required_argument, 0, 264},
+        {"hires",      no_argument,       0, 265},
+        {"hires-scale",required_argument, 0, 266},
+        {"hires-denoise",required_argument, 0, 267},
+        {"hires-steps",required_argument, 0, 268},
+        {"progressive",required_argument, 0, 269},
+        {"progressive-t",required_argument, 0, 270},
+        {"variations", required_argument, 0, 271},
+        {"variation-steps",required_argument, 0, 272},
+        {"variation-strength",required_argument, 0, 273},
+        {"save-checkpoint",required_argument, 0, 274},
+        {"checkpoint-step",required_argument, 0, 275},
+        {"resume",     required_argument, 0, 276},
+        {"rng",        required_argument, 0, 277},
+        {"serve",      required_argument, 0, 278},
+        {"batch",      required_argument, 0, 279},
+        {"batch-depth",required_argument, 0, 280},
+        {"batch-writers",required_argument, 0, 281},
+        {"workers",    required_argument, 0, 282},
+        {"numa",       required_argument, 0, 283},
+        {"bench",      no_argument,       0, 284},
+        {"bench-sizes",required_argument, 0, 285},
+        {"bench-steps",required_argument, 0, 286},
+        {"bench-refs", required_argument, 0, 287},
+        {"bench-batch",required_argument, 0, 288},
+        {"bench-mode", required_argument, 0, 289},
+        {"bench-iters",required_argument, 0, 290},
+        {"bench-json", required_argument, 0, 291},
+        {"trace",      required_argument, 0, 292},
+        {"batch-threads",required_argument, 0, 293},
         {0, 0, 0, 0}
     };
 
@@ -322,6 +420,18 @@ int main(int argc, char *argv[]) {
     int force_base = 0;
     int no_license_info = 0;
     int blas_threads = 0; (void)blas_threads;
+    int hires = 0, hires_steps = 0;
+    float hires_scale = 0.0f, hires_denoise = 0.0f;
+    int variations = 0, variation_steps = 0;
+    float variation_strength = 0.0f;
+    const char *checkpoint_path = NULL, *resume_path = NULL;
+    const char *serve_path = NULL;
+    int serve_workers = 0;
+    const char *batch_path = NULL;
+    flux_pipeline_opts batch_opts = {0};
+    int bench = 0;
+    flux_perf_opts bench_opts = {0};
+    int checkpoint_step = 0;
     term_graphics_proto graphics_proto = detect_terminal_graphics();
 
     int opt;
@@ -363,15 +473,120 @@ int main(int argc, char *argv[]) {
             case 258: no_license_info = 1; break;
             case 'D': debug_py = 1; break;
             case 259: blas_threads = atoi(optarg); break;
+            case 260:
+                params.sampler = flux_sampler_from_name(optarg);
+                if (params.sampler < 0) {
+                    fprintf(stderr, "Error: Unknown sampler '%s' (euler, dpm++2m, unipc, adaptive)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 261:
+                params.tolerance = atof(optarg);
+                if (!(params.tolerance > 0)) {
+                    fprintf(stderr, "Error: --tolerance must be greater than 0\n");
+                    return 1;
+                }
+                break;
+            case 262: params.cfg_t_min = atof(optarg); break;
+            case 263: params.cfg_t_max = atof(optarg); break;
+            case 264: params.cfg_reuse = atoi(optarg); break;
+            case 265: hires = 1; break;
+            case 266: hires_scale = atof(optarg); hires = 1; break;
+            case 267: hires_denoise = atof(optarg); hires = 1; break;
+            case 268: hires_steps = atoi(optarg); hires = 1; break;
+            case 269: params.prog_levels = atoi(optarg); break;
+            case 270: params.prog_t_end = atof(optarg); break;
+            case 271: variations = atoi(optarg); break;
+            case 272: variation_steps = atoi(optarg); break;
+            case 273: variation_strength = atof(optarg); break;
+            case 274: checkpoint_path = optarg; break;
+            case 275: checkpoint_step = atoi(optarg); break;
+            case 276: resume_path = optarg; break;
+            case 277:
+                if (strcmp(optarg, "philox") == 0) {
+                    params.noise = FLUX_NOISE_PHILOX;
+                } else if (strcmp(optarg, "xoshiro") == 0) {
+                    params.noise = FLUX_NOISE_XOSHIRO;
+                } else {
+                    fprintf(stderr, "Error: Unknown noise generator '%s' (xoshiro, philox)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 278: serve_path = optarg; break;
+            case 279: batch_path = optarg; break;
+            case 280: batch_opts.queue_depth = atoi(optarg); break;
+            case 281: batch_opts.writers = atoi(optarg); break;
+            case 282: serve_workers = atoi(optarg); break;
+            case 283:
+                if (strcmp(optarg, "auto") == 0) {
+                    flux_set_numa_policy(FLUX_NUMA_AUTO);
+                } else if (strcmp(optarg, "off") == 0) {
+                    flux_set_numa_policy(FLUX_NUMA_OFF);
+                } else if (strcmp(optarg, "interleave") == 0) {
+                    flux_set_numa_policy(FLUX_NUMA_INTERLEAVE);
+                } else if (strcmp(optarg, "partition") == 0) {
+                    flux_set_numa_policy(FLUX_NUMA_PARTITION);
+                } else {
+                    fprintf(stderr, "Error: Unknown NUMA policy '%s' (auto, off, interleave, partition)\n", optarg);
+                    return 1;
+                }
+                break;
+            case 284: bench = 1; break;
+            case 285: bench_opts.sizes = optarg; bench = 1; break;
+            case 286: bench_opts.steps = optarg; bench = 1; break;
+            case 287: bench_opts.refs = optarg; bench = 1; break;
+            case 288: bench_opts.batches = optarg; bench = 1; break;
+            case 289:
+                if (strcmp(optarg, "warm") == 0) {
+                    bench_opts.warm = 1;
+                } else if (strcmp(optarg, "cold") == 0) {
+                    bench_opts.cold = 1;
+                } else if (strcmp(optarg, "both") == 0) {
+                    bench_opts.warm = bench_opts.cold = 1;
+                } else {
+                    fprintf(stderr, "Error: Unknown bench mode '%s' (warm, cold, both)\n", optarg);
+                    return 1;
+                }
+                bench = 1;
+                break;
+            case 290: bench_opts.iterations = atoi(optarg); bench = 1; break;
+            case 291: bench_opts.json_path = optarg; bench = 1; break;
+            case 292: trace_path = optarg; break;
+            case 293:
+                if (sscanf(optarg, "%d,%d,%d", &batch_opts.encode_threads,
+                           &batch_opts.denoise_threads, &batch_opts.decode_threads) != 3) {
+                    fprintf(stderr, "Error: --batch-threads takes ENCODE,DENOISE,DECODE\n");
+                    return 1;
+                }
+                break;
             default:
                 print_usage(argv[0]);
                 return 1;
         }
     }
 
-    /* BLAS: apply thread setting regardless of quiet mode */
+    if (trace_path) {
+        if (flux_trace_start() != 0) {
+            fprintf(stderr, "Error: --trace needs a build with tracing (e.g. make blas TRACE=1)\n");
+            return 1;
+        }
+        atexit(write_trace_at_exit);
+    }
+
+    /* BLAS: apply thread setting regardless of quiet mode. Without one,
+     * OpenBLAS would use every host core; keep it to the CPUs a container
+     * may use unless the environment says otherwise. */
+    const flux_host_resources *host = flux_get_host_resources();
 #if defined(USE_BLAS) && !defined(USE_METAL) && !defined(__APPLE__)
-    if (blas_threads > 0) openblas_set_num_threads(blas_threads);
+    if (blas_threads > 0) {
+        openblas_set_num_threads(blas_threads);
+    } else if (flux_numa_policy() == FLUX_NUMA_PARTITION) {
+        /* Each node-bound worker runs its own single-threaded GEMM slice */
+        openblas_set_num_threads(1);
+    } else if (!getenv("OPENBLAS_NUM_THREADS") && !getenv("OMP_NUM_THREADS") &&
+               host->cpus < openblas_get_num_threads()) {
+        openblas_set_num_threads(host->cpus);
+    }
 #endif
 
     /* Backend banner (suppressed by --quiet) */
@@ -406,6 +621,22 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Generic: Pure C backend (no acceleration)\n");
 #endif
     }
+    LOG_VERBOSE("Host: %d of %d CPUs usable", host->cpus, host->online_cpus);
+    if (host->affinity_cpus < host->online_cpus)
+        LOG_VERBOSE(", cpuset %d", host->affinity_cpus);
+    if (host->cpu_quota > 0)
+        LOG_VERBOSE(", cgroup v%d quota %.2f", host->cgroup_version, host->cpu_quota);
+    LOG_VERBOSE(" | memory %.1f GB", host->memory_limit / 1e9);
+    if (host->cgroup_memory_limit > 0)
+        LOG_VERBOSE(" (cgroup v%d limit, host %.1f GB)", host->cgroup_version,
+                    host->physical_memory / 1e9);
+    LOG_VERBOSE(" | %d compute threads", flux_num_threads());
+    if (host->numa_nodes > 1) {
+        static const char *numa_names[] = {"auto", "off", "interleave", "partition"};
+        LOG_VERBOSE(" | %d NUMA nodes, %s", host->numa_nodes,
+                    numa_names[flux_numa_policy()]);
+    }
+    LOG_VERBOSE("\n");
 
     /* Validate required arguments */
     if (!model_dir) {
@@ -414,11 +645,12 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    /* Interactive mode: -d provided but no -p, -e, -o, or --debug-py */
-    int interactive_mode = (!prompt && !embeddings_path && !output_path && !debug_py);
+    /* Interactive mode: -d provided but no -p, -e, -o, --debug-py, --serve, --batch or --bench */
+    int interactive_mode = (!prompt && !embeddings_path && !output_path && !debug_py &&
+                            !serve_path && !batch_path && !bench);
 
-    if (!interactive_mode) {
-        if (!prompt && !embeddings_path && !debug_py) {
+    if (!interactive_mode && !serve_path && !batch_path && !bench) {
+        if (!prompt && !embeddings_path && !debug_py && !resume_path) {
             fprintf(stderr, "Error: Prompt (-p) or embeddings file (-e) is required\n\n");
             print_usage(argv[0]);
             return 1;
@@ -444,6 +676,47 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    if (hires && (num_inputs > 0 || embeddings_path)) {
+        fprintf(stderr, "Warning: --hires only applies to text-to-image, ignoring\n");
+    }
+    if (params.prog_levels > 0 && params.sampler != FLUX_SAMPLER_EULER) {
+        fprintf(stderr, "Error: --progressive requires the Euler sampler\n");
+        return 1;
+    }
+    if (params.prog_levels > 0 && (num_inputs > 0 || embeddings_path || hires)) {
+        fprintf(stderr, "Warning: --progressive only applies to single-pass text-to-image, ignoring\n");
+    }
+    if (variations > 1 && params.prog_levels > 0 &&
+        !(num_inputs > 0 || embeddings_path || hires)) {
+        fprintf(stderr, "Error: --variations cannot be combined with --progressive\n");
+        return 1;
+    }
+    if (variations > 1 && (num_inputs > 0 || embeddings_path || hires)) {
+        fprintf(stderr, "Warning: --variations only applies to single-pass text-to-image, ignoring\n");
+    }
+
+    /* Benchmark mode loads its own contexts */
+    if (bench) {
+        bench_opts.use_mmap = use_mmap;
+        bench_opts.force_base = force_base;
+        bench_opts.quiet = (output_level == OUTPUT_QUIET);
+        if (!steps_set) params.num_steps = 0;
+        return flux_perf_run(model_dir, prompt, &params, &bench_opts);
+    }
+
+    /* A resumed run keeps the checkpoint's seed and size */
+    flux_checkpoint *resume_ck = NULL;
+    if (resume_path) {
+        resume_ck = flux_checkpoint_load(resume_path);
+        if (!resume_ck) {
+            fprintf(stderr, "Error: %s: %s\n", resume_path, flux_get_error());
+            return 1;
+        }
+        params.seed = resume_ck->seed;
+        params.width = resume_ck->latent_w * 16;
+        params.height = resume_ck->latent_h * 16;
+    }
+
     /* Set seed */
     int64_t actual_seed;
     if (params.seed >= 0) {
@@ -470,6 +743,9 @@ int main(int argc, char *argv[]) {
     }
     LOG_VERBOSE("\n");
 
+    /* The -v memory report counts the library's heap from the first load */
+    if (output_level >= OUTPUT_VERBOSE) flux_mem_enable(1);
+
     /* Load model (VAE only at startup, other components loaded on-demand) */
     LOG_NORMAL("Loading VAE...");
     if (output_level >= OUTPUT_NORMAL) fflush(stderr);
@@ -481,10 +757,23 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    /* Loading every weight must fit in the memory limit, else fall back to mmap */
+    if (!use_mmap && host->memory_limit > 0) {
+        flux_memory_estimate est;
+        if (flux_estimate_memory(ctx, &params, NULL, 0, &est) == 0 &&
+            est.peak > host->memory_limit) {
+            fprintf(stderr, "\nNote: --no-mmap needs ~%.1f GB, over the %.1f GB memory limit; using mmap\n",
+                    est.peak / 1e9, host->memory_limit / 1e9);
+            use_mmap = 1;
+        }
+    }
+
     /* Enable mmap mode if requested (reduces memory, slower inference) */
     if (use_mmap) {
         flux_set_mmap(ctx, 1);
         LOG_VERBOSE("  Using mmap mode for text encoder (lower memory)\n");
+        if (flux_numa_policy() != FLUX_NUMA_OFF)
+            LOG_VERBOSE("  NUMA: mmap'd weights are not placed (--no-mmap, or run under numactl --interleave=all)\n");
     }
 
     /* Override model type if --base was specified */
@@ -493,7 +782,9 @@ int main(int argc, char *argv[]) {
     }
 
     /* Resolve auto-parameters now that we know the model type */
-    if (!steps_set || params.num_steps <= 0) {
+    if (resume_ck && !steps_set) {
+        params.num_steps = 0;   /* Keep the checkpoint's schedule */
+    } else if (!steps_set || params.num_steps <= 0) {
         params.num_steps = flux_is_distilled(ctx) ? 4 : 50;
     }
     if (params.guidance <= 0) {
@@ -522,6 +813,36 @@ int main(int argc, char *argv[]) {
         return rc;
     }
 
+    /* Server mode: command line options become the request defaults */
+    if (serve_path) {
+        params.seed = -1;
+        if (serve_workers > 0) {
+            /* Load everything once; the workers share it copy-on-write */
+            flux_weights *w = flux_get_weights(ctx);
+            flux_free(ctx);
+            if (!w) {
+                fprintf(stderr, "Error: Failed to load model: %s\n", flux_get_error());
+                return 1;
+            }
+            int rc = flux_server_run_prefork(w, serve_path, &params, serve_workers);
+            flux_weights_release(w);
+            return rc;
+        }
+        int rc = flux_server_run(ctx, serve_path, &params);
+        if (output_level >= OUTPUT_VERBOSE) flux_mem_print();
+        flux_free(ctx);
+        return rc;
+    }
+
+    /* Batch mode: the prompts in the file replace -p, -o names the outputs */
+    if (batch_path) {
+        batch_opts.quiet = (output_level == OUTPUT_QUIET);
+        int rc = flux_pipeline_run(ctx, batch_path, output_path, &params, &batch_opts);
+        if (output_level >= OUTPUT_VERBOSE) flux_mem_print();
+        flux_free(ctx);
+        return rc;
+    }
+
     /* Set up progress callbacks (for normal and verbose modes) */
     if (output_level >= OUTPUT_NORMAL) {
         cli_setup_progress();
@@ -537,8 +858,20 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    /* Verbose: measure this machine's peaks and account every kernel
+     * against them, for the roofline table after generation */
+    if (output_level >= OUTPUT_VERBOSE) {
+        flux_peak peak;
+        if (flux_roofline_probe(&peak) == 0)
+            LOG_VERBOSE("Peak: %.1f GFLOP/s (linear), %.1f GB/s (triad)\n",
+                        peak.gflops, peak.gbps);
+        flux_roofline_enable(1);
+    }
+
     /* Generate image */
     flux_image *output = NULL;
+    flux_image **variation_images = NULL;
+    int num_variations = 0, saved_evals = 0;
     struct timeval total_start_tv;
     gettimeofday(&total_start_tv, NULL);
 
@@ -661,12 +994,46 @@ int main(int argc, char *argv[]) {
         /* Note: flux_generate handles text encoding internally.
          * We can't easily time it separately without modifying the library.
          * The progress callbacks will show denoising progress. */
-        output = flux_generate(ctx, prompt, &params);
+        if (checkpoint_path) {
+            flux_set_checkpoint_interval(ctx, checkpoint_step > 0 ? checkpoint_step
+                                                                  : FLUX_MAX_STEPS);
+        }
+        if (resume_ck) {
+            output = flux_generate_resume(ctx, prompt, resume_ck, &params);
+            flux_checkpoint_free(resume_ck);
+        } else if (hires) {
+            output = flux_generate_hires(ctx, prompt, &params,
+                                         hires_scale, hires_denoise, hires_steps);
+        } else if (variations > 1) {
+            variation_images = (flux_image **)calloc(variations, sizeof(flux_image *));
+            num_variations = flux_generate_variations(ctx, prompt, &params, variations,
+                                                      variation_steps, variation_strength,
+                                                      variation_images, &saved_evals);
+            if (num_variations > 0) output = variation_images[0];
+        } else {
+            output = flux_generate(ctx, prompt, &params);
+        }
     }
 
     /* Finish progress display */
     cli_finish_progress();
 
+    if (checkpoint_path && output) {
+        const flux_checkpoint *ck = NULL;
+        for (int i = 0; i < flux_checkpoint_count(ctx); i++) {
+            ck = flux_get_checkpoint(ctx, i);
+            if (ck->step == checkpoint_step) break;
+        }
+        if (!ck) {
+            fprintf(stderr, "Warning: no checkpoint recorded (only text-to-image runs are checkpointed)\n");
+        } else if (flux_checkpoint_save(ck, checkpoint_path) != 0) {
+            fprintf(stderr, "Error: Failed to save checkpoint: %s\n", checkpoint_path);
+        } else {
+            LOG_NORMAL("Checkpoint: %s (step %d/%d, t=%.3f)\n",
+                       checkpoint_path, ck->step, ck->num_steps, ck->t);
+        }
+    }
+
     /* Clear step image callback if it was set */
     if (show_steps) {
         flux_set_step_image_callback(ctx, NULL);
@@ -682,6 +1049,11 @@ int main(int argc, char *argv[]) {
     gettimeofday(&total_end_tv, NULL);
     double total_time = (total_end_tv.tv_sec - total_start_tv.tv_sec) +
                         (total_end_tv.tv_usec - total_start_tv.tv_usec) / 1000000.0;
+    if (params.sampler == FLUX_SAMPLER_ADAPTIVE) {
+        int steps, evals;
+        flux_last_step_count(ctx, &steps, &evals);
+        LOG_NORMAL("Adaptive sampler: %d steps, %d transformer evaluations\n", steps, evals);
+    }
     LOG_VERBOSE("Generated in %.1fs total\n", total_time);
     LOG_VERBOSE("  Output: %dx%d, %d channels\n",
                 output->width, output->height, output->channels);
@@ -700,6 +1072,26 @@ int main(int argc, char *argv[]) {
 
     LOG_NORMAL(" %s %dx%d (%.1fs)\n", output_path, output->width, output->height, timer_end());
 
+    /* Remaining variations go to out-2.png, out-3.png, ... */
+    for (int i = 1; i < num_variations; i++) {
+        char path[1024];
+        const char *dot = strrchr(output_path, '.');
+        const char *slash = strrchr(output_path, '/');
+        if (!dot || (slash && dot < slash)) dot = output_path + strlen(output_path);
+        snprintf(path, sizeof(path), "%.*s-%d%s",
+                 (int)(dot - output_path), output_path, i + 1, dot);
+        if (flux_image_save_with_seed(variation_images[i], path, actual_seed) != 0)
+            fprintf(stderr, "Error: Failed to save image: %s\n", path);
+        else
+            LOG_NORMAL("Saved %s\n", path);
+        flux_image_free(variation_images[i]);
+    }
+    if (num_variations > 1) {
+        LOG_NORMAL("Variations: %d images, %d transformer evaluations saved\n",
+                   num_variations, saved_evals);
+    }
+    free(variation_images);
+
     /* Display image in terminal if requested */
     if (show_image) {
         terminal_display_png(output_path, graphics_proto);
@@ -711,6 +1103,10 @@ int main(int argc, char *argv[]) {
     double total_time_final = (final_tv.tv_sec - total_start_tv.tv_sec) +
                               (final_tv.tv_usec - total_start_tv.tv_usec) / 1000000.0;
     LOG_NORMAL("Total generation time: %.1f seconds\n", load_time + total_time_final);
+    if (output_level >= OUTPUT_VERBOSE) {
+        flux_roofline_print();
+        flux_mem_print();
+    }
 
     /* Cleanup */
     flux_image_free(output);
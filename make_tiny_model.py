@@ -0,0 +1,320 @@
+#!/usr/bin/env python3
+"""
+Write a tiny FLUX.2-klein model with random weights.
+
+Usage:
+    python3 make_tiny_model.py [OUTPUT_DIR]
+
+The model has the layout and tensor names of the real checkpoint (VAE,
+transformer, Qwen3 text encoder and tokenizer, all bf16) with a fraction
+of the width and depth, so the whole pipeline runs in seconds on any
+machine. Images are noise: it is meant for `flux --bench` and for testing
+code paths without downloading the 16 GB model. Only the standard library
+is needed.
+"""
+
+import json
+import os
+import random
+import struct
+import sys
+from array import array
+
+# Transformer: heads * 128 hidden (RoPE uses 4 axes of 32 dims)
+TF_HEADS = 2
+TF_HEAD_DIM = 128
+TF_HIDDEN = TF_HEADS * TF_HEAD_DIM
+TF_MLP = 3 * TF_HIDDEN
+TF_DOUBLE = 2
+TF_SINGLE = 4
+LATENT_CHANNELS = 128               # 32 VAE channels, patchified 2x2
+
+# Qwen3: layers 9, 18 and 27 are read out, so at least 27 layers; the
+# special token ids are fixed, so the vocabulary keeps its real size
+QWEN_HIDDEN = 64
+QWEN_HEADS = 2
+QWEN_KV_HEADS = 1
+QWEN_HEAD_DIM = 32
+QWEN_MLP = 128
+QWEN_LAYERS = 28
+QWEN_VOCAB = 151936
+
+# VAE: real topology (4 levels, 2 resblocks, 32 groups), narrower
+VAE_BASE = 32
+VAE_MULT = [1, 2, 4, 4]
+VAE_Z = 32
+
+_noise = None
+
+
+def bf16(values):
+    """Pack floats as bf16 (upper half of each f32)."""
+    raw = array("f", values).tobytes()
+    if sys.byteorder != "little":
+        raise SystemExit("make_tiny_model.py: little-endian host required")
+    out = bytearray(len(raw) // 2)
+    out[0::2] = raw[2::4]
+    out[1::2] = raw[3::4]
+    return bytes(out)
+
+
+def random_bf16(n, scale):
+    """n gaussian values: one block of noise, rotated, keeps this fast."""
+    global _noise
+    if _noise is None:
+        rng = random.Random(1)
+        _noise = [rng.gauss(0.0, 1.0) for _ in range(65521)]
+    block = bf16([v * scale for v in _noise])
+    k = len(_noise)
+    parts = []
+    offset = n % k
+    while n > 0:
+        take = min(n, k - offset)
+        parts.append(block[2 * offset:2 * (offset + take)])
+        n -= take
+        offset = (offset + 7919) % k
+    return b"".join(parts)
+
+
+class Writer:
+    def __init__(self):
+        self.tensors = {}
+
+    def add(self, name, shape, scale=0.02):
+        n = 1
+        for s in shape:
+            n *= s
+        self.tensors[name] = (shape, random_bf16(n, scale))
+
+    def const(self, name, shape, value):
+        n = 1
+        for s in shape:
+            n *= s
+        self.tensors[name] = (shape, bf16([value]) * n)
+
+    def save(self, path):
+        header, offset = {}, 0
+        for name, (shape, data) in self.tensors.items():
+            header[name] = {"dtype": "BF16", "shape": shape,
+                            "data_offsets": [offset, offset + len(data)]}
+            offset += len(data)
+        blob = json.dumps(header).encode()
+        blob += b" " * ((8 - len(blob) % 8) % 8)
+        with open(path, "wb") as f:
+            f.write(struct.pack("<Q", len(blob)))
+            f.write(blob)
+            for _, data in self.tensors.values():
+                f.write(data)
+
+
+def write_json(path, obj):
+    with open(path, "w") as f:
+        json.dump(obj, f, indent=2)
+
+
+def make_transformer(out):
+    h, mlp, hd = TF_HIDDEN, TF_MLP, TF_HEAD_DIM
+    w = Writer()
+    w.add("x_embedder.weight", [h, LATENT_CHANNELS])
+    w.add("context_embedder.weight", [h, 3 * QWEN_HIDDEN])
+    w.add("time_guidance_embed.timestep_embedder.linear_1.weight", [h, 256])
+    w.add("time_guidance_embed.timestep_embedder.linear_2.weight", [h, h])
+    w.add("double_stream_modulation_img.linear.weight", [6 * h, h])
+    w.add("double_stream_modulation_txt.linear.weight", [6 * h, h])
+    w.add("single_stream_modulation.linear.weight", [3 * h, h])
+    for i in range(TF_DOUBLE):
+        p = "transformer_blocks.%d." % i
+        for n in ["norm_q", "norm_k", "norm_added_q", "norm_added_k"]:
+            w.const(p + "attn." + n + ".weight", [hd], 1.0)
+        for n in ["to_q", "to_k", "to_v", "to_out.0",
+                  "add_q_proj", "add_k_proj", "add_v_proj", "to_add_out"]:
+            w.add(p + "attn." + n + ".weight", [h, h])
+        for ff in ["ff", "ff_context"]:
+            w.add(p + ff + ".linear_in.weight", [2 * mlp, h])
+            w.add(p + ff + ".linear_out.weight", [h, mlp])
+    for i in range(TF_SINGLE):
+        p = "single_transformer_blocks.%d." % i
+        w.const(p + "attn.norm_q.weight", [hd], 1.0)
+        w.const(p + "attn.norm_k.weight", [hd], 1.0)
+        w.add(p + "attn.to_qkv_mlp_proj.weight", [3 * h + 2 * mlp, h])
+        w.add(p + "attn.to_out.weight", [h, h + mlp])
+    w.add("norm_out.linear.weight", [2 * h, h])
+    w.add("proj_out.weight", [LATENT_CHANNELS, h])
+
+    os.makedirs(out, exist_ok=True)
+    w.save(os.path.join(out, "diffusion_pytorch_model.safetensors"))
+    write_json(os.path.join(out, "config.json"), {
+        "num_attention_heads": TF_HEADS,
+        "attention_head_dim": TF_HEAD_DIM,
+        "num_layers": TF_DOUBLE,
+        "num_single_layers": TF_SINGLE,
+        "joint_attention_dim": 3 * QWEN_HIDDEN,
+        "in_channels": LATENT_CHANNELS,
+        "mlp_ratio": 3.0,
+        "rope_theta": 2000,
+    })
+
+
+def make_text_encoder(out):
+    h, hd = QWEN_HIDDEN, QWEN_HEAD_DIM
+    w = Writer()
+    w.add("model.embed_tokens.weight", [QWEN_VOCAB, h], 1.0)
+    for i in range(QWEN_LAYERS):
+        p = "model.layers.%d." % i
+        w.const(p + "input_layernorm.weight", [h], 1.0)
+        w.const(p + "post_attention_layernorm.weight", [h], 1.0)
+        w.add(p + "self_attn.q_proj.weight", [QWEN_HEADS * hd, h])
+        w.add(p + "self_attn.k_proj.weight", [QWEN_KV_HEADS * hd, h])
+        w.add(p + "self_attn.v_proj.weight", [QWEN_KV_HEADS * hd, h])
+        w.add(p + "self_attn.o_proj.weight", [h, QWEN_HEADS * hd])
+        w.const(p + "self_attn.q_norm.weight", [hd], 1.0)
+        w.const(p + "self_attn.k_norm.weight", [hd], 1.0)
+        w.add(p + "mlp.gate_proj.weight", [QWEN_MLP, h])
+        w.add(p + "mlp.up_proj.weight", [QWEN_MLP, h])
+        w.add(p + "mlp.down_proj.weight", [h, QWEN_MLP])
+    w.const("model.norm.weight", [h], 1.0)
+
+    os.makedirs(out, exist_ok=True)
+    shard = "model-00001-of-00001.safetensors"
+    w.save(os.path.join(out, shard))
+    write_json(os.path.join(out, "model.safetensors.index.json"),
+               {"weight_map": {name: shard for name in w.tensors}})
+    write_json(os.path.join(out, "config.json"), {
+        "hidden_size": h,
+        "intermediate_size": QWEN_MLP,
+        "num_attention_heads": QWEN_HEADS,
+        "num_key_value_heads": QWEN_KV_HEADS,
+        "head_dim": hd,
+        "vocab_size": QWEN_VOCAB,
+        "num_hidden_layers": QWEN_LAYERS,
+        "rope_theta": 1000000,
+    })
+
+
+def byte_level_alphabet():
+    """GPT-2 byte-to-unicode table used by the Qwen3 tokenizer."""
+    bs = (list(range(ord("!"), ord("~") + 1)) +
+          list(range(ord("¡"), ord("¬") + 1)) +
+          list(range(ord("®"), ord("ÿ") + 1)))
+    cs = bs[:]
+    n = 0
+    for b in range(256):
+        if b not in bs:
+            bs.append(b)
+            cs.append(256 + n)
+            n += 1
+    return [chr(c) for _, c in sorted(zip(bs, cs))]
+
+
+def make_tokenizer(out):
+    # Byte tokens and no merges: every prompt byte becomes one token. The
+    # filler entries keep the special tokens at their real ids.
+    vocab = {ch: i for i, ch in enumerate(byte_level_alphabet())}
+    for i in range(256, 151643):
+        vocab["<|tiny_%d|>" % i] = i
+    specials = {151643: "<|endoftext|>", 151644: "<|im_start|>",
+                151645: "<|im_end|>", 151667: "<think>", 151668: "</think>"}
+    os.makedirs(out, exist_ok=True)
+    write_json(os.path.join(out, "tokenizer.json"), {
+        "added_tokens": [{"id": i, "content": c, "special": True}
+                         for i, c in sorted(specials.items())],
+        "model": {"type": "BPE", "vocab": vocab, "merges": []},
+    })
+
+
+def make_vae(out):
+    w = Writer()
+
+    def resblock(p, cin, cout):
+        w.const(p + ".norm1.weight", [cin], 1.0)
+        w.const(p + ".norm1.bias", [cin], 0.0)
+        w.add(p + ".conv1.weight", [cout, cin, 3, 3])
+        w.const(p + ".conv1.bias", [cout], 0.0)
+        w.const(p + ".norm2.weight", [cout], 1.0)
+        w.const(p + ".norm2.bias", [cout], 0.0)
+        w.add(p + ".conv2.weight", [cout, cout, 3, 3])
+        w.const(p + ".conv2.bias", [cout], 0.0)
+        if cin != cout:
+            w.add(p + ".conv_shortcut.weight", [cout, cin, 1, 1])
+            w.const(p + ".conv_shortcut.bias", [cout], 0.0)
+
+    def attention(p, ch):
+        w.const(p + ".group_norm.weight", [ch], 1.0)
+        w.const(p + ".group_norm.bias", [ch], 0.0)
+        for n in ["to_q", "to_k", "to_v", "to_out.0"]:
+            w.add(p + "." + n + ".weight", [ch, ch])
+            w.const(p + "." + n + ".bias", [ch], 0.0)
+
+    chans = [VAE_BASE * m for m in VAE_MULT]
+    mid = chans[-1]
+
+    w.add("encoder.conv_in.weight", [VAE_BASE, 3, 3, 3])
+    w.const("encoder.conv_in.bias", [VAE_BASE], 0.0)
+    prev = VAE_BASE
+    for level, ch in enumerate(chans):
+        for r in range(2):
+            resblock("encoder.down_blocks.%d.resnets.%d" % (level, r),
+                     prev if r == 0 else ch, ch)
+        prev = ch
+        if level < 3:
+            w.add("encoder.down_blocks.%d.downsamplers.0.conv.weight" % level, [ch, ch, 3, 3])
+            w.const("encoder.down_blocks.%d.downsamplers.0.conv.bias" % level, [ch], 0.0)
+    resblock("encoder.mid_block.resnets.0", mid, mid)
+    attention("encoder.mid_block.attentions.0", mid)
+    resblock("encoder.mid_block.resnets.1", mid, mid)
+    w.const("encoder.conv_norm_out.weight", [mid], 1.0)
+    w.const("encoder.conv_norm_out.bias", [mid], 0.0)
+    w.add("encoder.conv_out.weight", [2 * VAE_Z, mid, 3, 3])
+    w.const("encoder.conv_out.bias", [2 * VAE_Z], 0.0)
+    w.add("quant_conv.weight", [2 * VAE_Z, 2 * VAE_Z, 1, 1])
+    w.const("quant_conv.bias", [2 * VAE_Z], 0.0)
+
+    w.add("post_quant_conv.weight", [VAE_Z, VAE_Z, 1, 1])
+    w.const("post_quant_conv.bias", [VAE_Z], 0.0)
+    w.add("decoder.conv_in.weight", [mid, VAE_Z, 3, 3])
+    w.const("decoder.conv_in.bias", [mid], 0.0)
+    resblock("decoder.mid_block.resnets.0", mid, mid)
+    attention("decoder.mid_block.attentions.0", mid)
+    resblock("decoder.mid_block.resnets.1", mid, mid)
+    prev = mid
+    for up in range(4):
+        ch = chans[3 - up]
+        for r in range(3):
+            resblock("decoder.up_blocks.%d.resnets.%d" % (up, r),
+                     prev if r == 0 else ch, ch)
+        prev = ch
+        if up < 3:
+            w.add("decoder.up_blocks.%d.upsamplers.0.conv.weight" % up, [ch, ch, 3, 3])
+            w.const("decoder.up_blocks.%d.upsamplers.0.conv.bias" % up, [ch], 0.0)
+    w.const("decoder.conv_norm_out.weight", [VAE_BASE], 1.0)
+    w.const("decoder.conv_norm_out.bias", [VAE_BASE], 0.0)
+    w.add("decoder.conv_out.weight", [3, VAE_BASE, 3, 3])
+    w.const("decoder.conv_out.bias", [3], 0.0)
+
+    w.const("bn.running_mean", [LATENT_CHANNELS], 0.0)
+    w.const("bn.running_var", [LATENT_CHANNELS], 1.0)
+
+    os.makedirs(out, exist_ok=True)
+    w.save(os.path.join(out, "diffusion_pytorch_model.safetensors"))
+
+
+def main():
+    if len(sys.argv) > 2 or (len(sys.argv) == 2 and sys.argv[1] in ("-h", "--help")):
+        print(__doc__.strip())
+        return 1
+    out = sys.argv[1] if len(sys.argv) == 2 else "./flux-tiny"
+
+    make_transformer(os.path.join(out, "transformer"))
+    make_text_encoder(os.path.join(out, "text_encoder"))
+    make_tokenizer(os.path.join(out, "tokenizer"))
+    make_vae(os.path.join(out, "vae"))
+    write_json(os.path.join(out, "model_index.json"),
+               {"_class_name": "Flux2KleinPipeline", "is_distilled": True})
+
+    print("Tiny random-weight model written to %s" % out)
+    print("Try: ./flux -d %s --bench" % out)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())